@@ -5,27 +5,29 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 #include "SimFramework/Framework.h"
+#include "SimFramework/MultiDeviceFramework.h"
 #include "HostComm/Ipc/MessageClient.hpp"
 
 using namespace boost::program_options;
 
-bool parseCommandLine(int argc, const char* argv[], std::string& hardwarespecFilename, bool& interactive)
+bool parseCommandLine(int argc, const char* argv[], std::vector<std::string>& hardwarespecFilenames, bool& interactive)
 {
     try
     {
         options_description generalOptions{ "General" };
         generalOptions.add_options()
             ("help,h", "Help")
-            ("hardwarespec", value<std::string>(), "Hardware specifications")
+            ("hardwarespec", value<std::vector<std::string>>()->multitoken(), "Hardware specifications, one per simulated drive")
             ("interactive", "Interactive actions");
 
         variables_map vm;
         store(parse_command_line(argc, argv, generalOptions), vm);
         if (vm.count("hardwarespec"))
         {
-            hardwarespecFilename = vm["hardwarespec"].as<std::string>();
+            hardwarespecFilenames = vm["hardwarespec"].as<std::vector<std::string>>();
         }
         else
         {
@@ -60,7 +62,7 @@ void printInteractiveMenu()
     std::cout << sstr.str();
 }
 
-void handleInteractiveCmd()
+void handleInteractiveCmd(const std::vector<std::string>& simServerNames)
 {
     bool exit = false;
     while (!exit)
@@ -74,12 +76,14 @@ void handleInteractiveCmd()
 
         if (0 == userSelectedCmd)
         {
-            // send command exit
-			//TODO: implement way to retrieve message server name
-            std::shared_ptr<MessageClient<SimFrameworkCommand>> client = std::make_shared<MessageClient<SimFrameworkCommand>>("SsdSimMainMessageServer");
-            Message<SimFrameworkCommand> *message = client->AllocateMessage(sizeof(SimFrameworkCommand), false);
-            message->Data.Code = SimFrameworkCommand::Code::Exit;
-            client->Push(message);
+            // send command exit to every drive
+            for (const auto& simServerName : simServerNames)
+            {
+                std::shared_ptr<MessageClient<SimFrameworkCommand>> client = std::make_shared<MessageClient<SimFrameworkCommand>>(simServerName.c_str());
+                Message<SimFrameworkCommand> *message = client->AllocateMessage(sizeof(SimFrameworkCommand), false);
+                message->Data.Code = SimFrameworkCommand::Code::Exit;
+                client->Push(message);
+            }
 
             // exit app
             exit = true;
@@ -94,17 +98,17 @@ void handleInteractiveCmd()
 
 int main(int argc, const char* argv[])
 {
-    std::string hardwarespecFilename = "";
+    std::vector<std::string> hardwarespecFilenames;
     bool interactive = false;
 
-    if (parseCommandLine(argc, argv, hardwarespecFilename, interactive))
+    if (parseCommandLine(argc, argv, hardwarespecFilenames, interactive))
     {
-        if (!hardwarespecFilename.empty())
+        if (hardwarespecFilenames.size() == 1)
         {
             try
             {
                 Framework framework;
-                framework.Init(hardwarespecFilename);
+                framework.Init(hardwarespecFilenames[0]);
 
                 // start framework async if interative option enabled
                 if (true == interactive)
@@ -112,7 +116,7 @@ int main(int argc, const char* argv[])
                     auto fwFuture = std::async(std::launch::async, &Framework::operator(), &framework);
 
                     // handle interactive commands
-                    handleInteractiveCmd();
+                    handleInteractiveCmd({ framework.GetSimServerName() });
                 }
                 else // run framework in sync if no interactive option
                 {
@@ -126,6 +130,37 @@ int main(int argc, const char* argv[])
                 return -1;
             }
         }
+        else if (hardwarespecFilenames.size() > 1)
+        {
+            try
+            {
+                // one drive per hardware spec, all served by a shared worker pool
+                MultiDeviceFramework framework;
+                framework.Init(hardwarespecFilenames);
+
+                if (true == interactive)
+                {
+                    std::vector<std::string> simServerNames;
+                    for (U32 i = 0; i < framework.GetDriveCount(); ++i)
+                    {
+                        simServerNames.push_back(framework.GetDrive(i).GetSimServerName());
+                    }
+
+                    auto fwFuture = std::async(std::launch::async, &MultiDeviceFramework::operator(), &framework);
+                    handleInteractiveCmd(simServerNames);
+                }
+                else
+                {
+                    framework.operator()();
+                }
+            }
+            catch (const Framework::Exception &err)
+            {
+                std::cout << "Error";
+                std::cout << err.what();
+                return -1;
+            }
+        }
     }
 
     return 0;
@@ -0,0 +1,7 @@
+// Firmware linked into this build, found by FirmwareCore under the file names below instead of being loaded as libraries
+
+#include "SimFrameworkBase/FirmwareRegistry.h"
+
+FIRMWARE_STATIC_REGISTER(PageMappingFtlFirmware, "PageMappingFtl.dll")
+FIRMWARE_STATIC_REGISTER(RomCodeFirmware, "RomCode.dll")
+FIRMWARE_STATIC_REGISTER(SimpleFtlFirmware, "SimpleFtl.dll")
\ No newline at end of file
@@ -11,12 +11,61 @@ BufferHal::BufferHal() : _CurrentBufferHandle(0), _SectorInfo(DefaultSectorInfo)
     SetImplicitAllocationSectorCount(1);
 }
 
+BufferHal::~BufferHal()
+{
+    if (_ControllerMemoryBufferShm)
+    {
+        shared_memory_object::remove(_ControllerMemoryBufferName.c_str());
+    }
+}
+
 void BufferHal::PreInit(const U32 &maxBufferSizeInKB)
 {
     _MaxBufferSizeInSector = maxBufferSizeInKB * 2;
     _CurrentFreeSizeInSector = _MaxBufferSizeInSector;
 }
 
+void BufferHal::InitControllerMemoryBuffer(const std::string &name, const U32 &sizeInKB)
+{
+    shared_memory_object::remove(name.c_str());
+
+    _ControllerMemoryBufferName = name;
+    _ControllerMemoryBufferShm = std::make_unique<shared_memory_object>(create_only, name.c_str(), read_write);
+    _ControllerMemoryBufferShm->truncate(sizeInKB * 1024);
+    _ControllerMemoryBufferRegion = std::make_unique<mapped_region>(*_ControllerMemoryBufferShm, read_write);
+}
+
+U8* BufferHal::GetControllerMemoryBuffer() const
+{
+    return _ControllerMemoryBufferRegion ? static_cast<U8*>(_ControllerMemoryBufferRegion->get_address()) : nullptr;
+}
+
+U32 BufferHal::GetControllerMemoryBufferSize() const
+{
+    return _ControllerMemoryBufferRegion ? static_cast<U32>(_ControllerMemoryBufferRegion->get_size()) : 0;
+}
+
+bool BufferHal::MapControllerMemoryBuffer(BufferType type, const U32 &byteOffset, const U32 &sectorCount, Buffer &buffer)
+{
+    scoped_lock<interprocess_mutex> lock(_Mutex);
+    U32 sizeInByte = ToByteIndexInTransfer(type, sectorCount);
+    if (!_ControllerMemoryBufferRegion || (byteOffset + sizeInByte) > _ControllerMemoryBufferRegion->get_size())
+    {
+        return false;
+    }
+
+    buffer.Handle = _CurrentBufferHandle;
+    buffer.Type = type;
+    buffer.SizeInSector = sectorCount;
+    buffer.SizeInByte = sizeInByte;
+
+    _ControllerMemoryBuffers.insert(std::make_pair(_CurrentBufferHandle,
+        static_cast<U8*>(_ControllerMemoryBufferRegion->get_address()) + byteOffset));
+    ++_CurrentBufferHandle;
+
+    return true;
+}
+
 void BufferHal::SetImplicitAllocationSectorCount(const U32& sectorCount)
 {
     _ImplicitAllocationSectorCount = sectorCount;
@@ -53,6 +102,13 @@ void BufferHal::DeallocateBuffer(const Buffer &buffer)
 {
     scoped_lock<interprocess_mutex> lock(_Mutex);
 
+    auto controllerMemoryBuffer = _ControllerMemoryBuffers.find(buffer.Handle);
+    if (_ControllerMemoryBuffers.end() != controllerMemoryBuffer)
+    {
+        _ControllerMemoryBuffers.erase(controllerMemoryBuffer);
+        return;
+    }
+
     assert(buffer.SizeInSector + _CurrentFreeSizeInSector <= _MaxBufferSizeInSector);
 
     auto temp = _AllocatedBuffers->find(buffer.Handle);
@@ -61,6 +117,11 @@ void BufferHal::DeallocateBuffer(const Buffer &buffer)
     _CurrentFreeSizeInSector += buffer.SizeInSector;
 }
 
+U32 BufferHal::GetMaxBufferSizeInSector() const
+{
+    return _MaxBufferSizeInSector;
+}
+
 U8* BufferHal::ToPointer(const Buffer &buffer)
 {
     scoped_lock<interprocess_mutex> lock(_Mutex);
@@ -70,6 +131,12 @@ U8* BufferHal::ToPointer(const Buffer &buffer)
     {
         return temp->second.get();
     }
+
+    auto controllerMemoryBuffer = _ControllerMemoryBuffers.find(buffer.Handle);
+    if (controllerMemoryBuffer != _ControllerMemoryBuffers.end())
+    {
+        return controllerMemoryBuffer->second;
+    }
     return nullptr;
 }
 
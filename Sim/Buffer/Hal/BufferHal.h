@@ -2,6 +2,10 @@
 #define __BufferHal_h__
 
 #include <map>
+#include <memory>
+#include <string>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 
 #include "BasicTypes.h"
@@ -14,9 +18,17 @@ class BufferHal
 public:
 public:
     BufferHal();
+    ~BufferHal();
 
     void PreInit(const U32 &maxBufferSizeInKB);
 
+    //! Controller memory buffer (CMB), a shared-memory region the host can place payloads in directly.
+    //! Buffers mapped onto it alias the host data so no copy is needed, and don't count against the buffer pool.
+    void InitControllerMemoryBuffer(const std::string &name, const U32 &sizeInKB);
+    U8* GetControllerMemoryBuffer() const;
+    U32 GetControllerMemoryBufferSize() const;
+    bool MapControllerMemoryBuffer(BufferType type, const U32 &byteOffset, const U32 &sectorCount, Buffer &buffer);
+
 public:
     void SetImplicitAllocationSectorCount(const U32& sectorCount);
 
@@ -24,6 +36,7 @@ public:
     bool AllocateBuffer(BufferType type, const U32 &sectorCount, Buffer &buffer);
     bool AllocateBuffer(BufferType type, Buffer& buffer);
     void DeallocateBuffer(const Buffer &buffer);
+    U32 GetMaxBufferSizeInSector() const;
 
     U8* ToPointer(const Buffer &buffer);
     void CopyFromBuffer(U8* const dest, const Buffer& buffer, const tSectorOffset& bufferOffset, const tSectorCount& sectorCount);
@@ -39,10 +52,15 @@ private:
     U32 _CurrentFreeSizeInSector;
     U32 _CurrentBufferHandle;
     std::unique_ptr<std::map<U32, std::unique_ptr<U8[]>>> _AllocatedBuffers;
+    std::map<U32, U8*> _ControllerMemoryBuffers;
     SectorInfo _SectorInfo;
     U32 _ImplicitAllocationSectorCount;
 
     boost::interprocess::interprocess_mutex _Mutex;
+
+    std::string _ControllerMemoryBufferName;
+    std::unique_ptr<boost::interprocess::shared_memory_object> _ControllerMemoryBufferShm;
+    std::unique_ptr<boost::interprocess::mapped_region> _ControllerMemoryBufferRegion;
 };
 
 #endif
\ No newline at end of file
@@ -38,6 +38,84 @@ struct SectorInfoPayload
     SectorInfo SectorInfo;
 };
 
+//! Garbage collection settings of FTLs that have one, free block counts are for the whole drive
+struct GarbageCollectionPayload
+{
+    enum class Policy
+    {
+        Greedy,
+        CostBenefit,
+    };
+
+    Policy VictimPolicy;
+    U32 StartFreeBlocks;        //!< collection starts at this many free blocks
+    U32 ThrottleFreeBlocks;     //!< host writes are paced by the collection at this many free blocks
+    U32 PipelineDepth;          //!< NAND commands in flight at once
+};
+
+struct StatisticsPayload
+{
+    std::uint64_t HostSectorsWritten;
+    std::uint64_t NandSectorsWritten;   //!< whole pages, write amplification is NandSectorsWritten / HostSectorsWritten
+    std::uint64_t RelocatedSectors;
+    U32 ErasedBlocks;
+    U32 FreeBlocks;
+    std::uint64_t ReadCacheHits;
+    std::uint64_t ReadCacheMisses;
+    std::uint64_t ReadAheadPages;       //!< read ahead and taken into the read cache
+    std::uint64_t CopybackPages;        //!< copied by NAND copyback, without going through a buffer
+    std::uint64_t MountSpareReads;      //!< spare areas read to rebuild the mapping on mount
+    std::uint64_t MountTimeUs;          //!< from the start of the mount until commands are taken
+};
+
+//! Pages the read cache of FTLs that have one can hold, the FTL returns the count it applied
+struct ReadCachePayload
+{
+    U32 PageCount;
+};
+
+//! Every sector of the range is filled with Pattern repeated, without any data transfer
+struct WritePatternPayload
+{
+    U32 Lba;
+    U32 SectorCount;
+    U32 Pattern;
+};
+
+//! LBA ranges of Trim and of the vectored commands, whose data is laid out in the payload in range order
+struct RangeListPayload
+{
+    enum : U32 { MaxRangeCount = 64 };
+
+    U32 RangeCount;
+    SimpleFtlPayload Ranges[MaxRangeCount];
+};
+
+//! The source ranges are copied one after the other from DestinationLba on, none may overlap the destination
+struct CopyPayload
+{
+    U32 DestinationLba;
+    RangeListPayload SourceRanges;
+};
+
+//! The range is compared with the expected data inside the drive, only the result comes back
+struct ComparePayload
+{
+    enum class Expected
+    {
+        Payload,        //!< the command data, laid out like the data of a Write
+        Pattern,        //!< Pattern repeated, as WritePattern writes it
+    };
+
+    enum : std::uint64_t { NoMismatch = ~std::uint64_t(0) };
+
+    U32 Lba;
+    U32 SectorCount;
+    Expected ExpectedData;
+    U32 Pattern;
+    std::uint64_t MismatchOffset;   //!< of the first byte that differs in the command data, NoMismatch if none
+};
+
 union CustomProtocolCommandDescriptor
 {
     DownloadAndExecutePayload DownloadAndExecute;
@@ -45,6 +123,13 @@ union CustomProtocolCommandDescriptor
     SimpleFtlPayload SimpleFtlPayload;
     DeviceInfoPayload DeviceInfoPayload;
     SectorInfoPayload SectorInfoPayload;
+    GarbageCollectionPayload GarbageCollectionPayload;
+    StatisticsPayload StatisticsPayload;
+    ReadCachePayload ReadCachePayload;
+    RangeListPayload RangeListPayload;
+    WritePatternPayload WritePatternPayload;
+    CopyPayload CopyPayload;
+    ComparePayload ComparePayload;
 };
 
 typedef U32 CommandId;
@@ -62,7 +147,19 @@ struct CustomProtocolCommand
 		LoopbackRead,
         GetDeviceInfo,
         SetSectorSize,
-        Nop
+        Nop,
+        SetGarbageCollection,
+        GetStatistics,
+        Flush,                  //!< responds once the data written before it is programmed
+        SetReadCache,
+        Trim,                   //!< FTLs with a mapping unmap the ranges, they read back as never written
+        WriteZeroes,            //!< SimpleFtlPayload, no data transfer
+        WritePattern,
+        ReadVectored,           //!< RangeListPayload
+        WriteVectored,
+        Copy,                   //!< CopyPayload, the data stays in the drive
+        Compare,                //!< ComparePayload
+        Verify,                 //!< SimpleFtlPayload, only checks the range reads back without errors
     };
 
     enum class Status
@@ -71,15 +168,30 @@ struct CustomProtocolCommand
         ReadError,
         WriteError,
         Failed,
+        Miscompare,             //!< Compare found data that differs
 	};
 
+    //! How the command data is carried in the message payload
+    enum class TransferMode
+    {
+        Payload,        //!< The whole data fits in the payload
+        Streaming,      //!< The payload is a StreamingTransferHeader followed by a ring of windows
+        ControllerMemoryBuffer, //!< The data is placed by the host in the controller memory buffer at ControllerMemoryBufferOffset
+    };
+
 public:
     Code Command;
 	Status CommandStatus;
     CustomProtocolCommandDescriptor Descriptor;
+    TransferMode PayloadMode;
+    U32 ControllerMemoryBufferOffset;
+
+    //! Set by CustomProtocolHal, unique among the commands in flight and below its queue depth
+    inline U32 GetContextIndex() const { return ContextIndex; }
 
 private:
     CommandId CommandId;
+    U32 ContextIndex;
     friend class CustomProtocolHal;
 };
 
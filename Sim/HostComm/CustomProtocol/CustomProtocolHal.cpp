@@ -1,8 +1,12 @@
+#include <algorithm>
+
 #include "CustomProtocolHal.h"
 
-CustomProtocolHal::CustomProtocolHal()
+CustomProtocolHal::CustomProtocolHal() : _BufferHal(nullptr), _ListenerThread(nullptr), _StalledTransferCount{ 0 }, _QueueDepth(0)
 {
-    _TransferCommandQueue = std::unique_ptr<boost::lockfree::spsc_queue<TransferCommandDesc>>(new boost::lockfree::spsc_queue<TransferCommandDesc>{ 1024 });
+    _TransferCommandQueue = std::unique_ptr<boost::lockfree::spsc_queue<TransferCommandDesc>>(new boost::lockfree::spsc_queue<TransferCommandDesc>{ TransferQueueSize });
+
+    SetQueueDepth(MaxInFlightCommands);
 }
 
 void CustomProtocolHal::Init(const char *protocolIpcName, BufferHal *bufferHal)
@@ -11,17 +15,51 @@ void CustomProtocolHal::Init(const char *protocolIpcName, BufferHal *bufferHal)
     _BufferHal = bufferHal;
 }
 
+void CustomProtocolHal::SetResponseCoalescing(const U32 &threshold, const std::chrono::microseconds &timeLimit)
+{
+    _MessageServer->SetResponseCoalescing(threshold, timeLimit, [this]() { return Now(); });
+}
+
+void CustomProtocolHal::SetQueueDepth(const U32 &queueDepth)
+{
+    assert(queueDepth > 0 && queueDepth <= MaxInFlightCommands);
+    assert(_FreeCommandContexts.size() == _QueueDepth);   // none in use
+
+    _QueueDepth = queueDepth;
+    _FreeCommandContexts.clear();
+    for (U32 i = _QueueDepth; i > 0; --i)
+    {
+        _FreeCommandContexts.push_back(i - 1);
+    }
+}
+
 bool CustomProtocolHal::HasCommand()
 {
-    return _MessageServer->HasMessage();
+    // Leave commands in the queue while every context is in use
+    return !_FreeCommandContexts.empty() && _MessageServer->HasMessage();
 }
 
 CustomProtocolCommand* CustomProtocolHal::GetCommand()
 {
+    if (_FreeCommandContexts.empty())
+    {
+        return nullptr;
+    }
+
     Message<CustomProtocolCommand>* msg = _MessageServer->Pop();
     if (msg)
     {
+        U32 contextIndex = _FreeCommandContexts.back();
+        _FreeCommandContexts.pop_back();
+
+        CommandContext &context = _CommandContexts[contextIndex];
+        context.Message = msg;
+        context.Payload = static_cast<U8*>(msg->Payload);
+        context.PayloadSize = msg->PayloadSize;
+        context.Streaming.Started = false;
+
         msg->Data.CommandId = msg->Id();
+        msg->Data.ContextIndex = contextIndex;
         return &msg->Data;
     }
 
@@ -30,10 +68,20 @@ CustomProtocolCommand* CustomProtocolHal::GetCommand()
 
 void CustomProtocolHal::SubmitResponse(CustomProtocolCommand *command)
 {
-    Message<CustomProtocolCommand> *message = _MessageServer->GetMessage(command->CommandId);
+    assert(command->ContextIndex < MaxInFlightCommands);
+    CommandContext &context = _CommandContexts[command->ContextIndex];
+    Message<CustomProtocolCommand> *message = context.Message;
+    assert(&message->Data == command);
+
+    context.Message = nullptr;
+    _FreeCommandContexts.push_back(command->ContextIndex);
+
     if (message->ExpectsResponse())
     {
         _MessageServer->PushResponse(message);
+
+        // Coalesced responses are flushed on deadline by this HAL's thread
+        Wakeup();
     }
     else
     {
@@ -43,44 +91,199 @@ void CustomProtocolHal::SubmitResponse(CustomProtocolCommand *command)
 
 void CustomProtocolHal::QueueCommand(const TransferCommandDesc& command)
 {
-    _TransferCommandQueue->push(command);
+    {
+        std::lock_guard<std::mutex> lock(_QueueMutex);
+        bool queued = _TransferCommandQueue->push(command);
+        assert(queued);
+    }
+    Wakeup();
+}
+
+void CustomProtocolHal::SetListenerThread(FrameworkThread *listenerThread)
+{
+    _ListenerThread = listenerThread;
+}
+
+bool CustomProtocolHal::IsTransferQueueEmpty() const
+{
+    return _TransferCommandQueue->empty() && (_StalledTransferCount == 0);
 }
 
 U8* CustomProtocolHal::GetBuffer(CustomProtocolCommand *command, const tSectorOffset& offset)
 {
-    Message<CustomProtocolCommand>* msg = _MessageServer->GetMessage(command->CommandId);
-    if (msg)
+    if (command->PayloadMode == CustomProtocolCommand::TransferMode::ControllerMemoryBuffer)
     {
-        U32 bufferIndex = _BufferHal->ToByteIndexInTransfer(BufferType::User, offset);
-        assert(msg->PayloadSize > bufferIndex);
-        return ((U8*)msg->Payload) + bufferIndex;
+        U32 byteIndex = command->ControllerMemoryBufferOffset + _BufferHal->ToByteIndexInTransfer(BufferType::User, offset);
+        assert(_BufferHal->GetControllerMemoryBufferSize() > byteIndex);
+        return _BufferHal->GetControllerMemoryBuffer() + byteIndex;
     }
 
-    return nullptr;
+    const CommandContext &context = _CommandContexts[command->ContextIndex];
+    U32 bufferIndex = _BufferHal->ToByteIndexInTransfer(BufferType::User, offset);
+    assert(context.Message != nullptr);
+    assert(context.PayloadSize > bufferIndex);
+    return context.Payload + bufferIndex;
 }
 
-void CustomProtocolHal::Run()
+bool CustomProtocolHal::Run()
 {
+    bool busy = RetryStalledTransfers();
+
     while (_TransferCommandQueue->empty() == false)
     {
         ProcessTransferCommand();
+        busy = true;
+    }
+
+    // Held back responses have a deadline, a free running thread keeps polling until they are flushed
+    if (_MessageServer->ProcessResponseCoalescing() && !WakeupAt(_MessageServer->GetResponseDeadline()))
+    {
+        busy = true;
     }
+
+    return busy;
 }
 
 void CustomProtocolHal::ProcessTransferCommand()
 {
     TransferCommandDesc& command = _TransferCommandQueue->front();
-    U8 *buffer = GetBuffer(command.Command, command.CommandOffset);
-    if (command.Direction == TransferCommandDesc::Direction::In)
+    if (!Transfer(command))
     {
-        _BufferHal->CopyToBuffer(buffer, command.Buffer, command.BufferOffset, command.SectorCount);
+        _StalledTransfers.push_back(command);
+        ++_StalledTransferCount;
+    }
+    _TransferCommandQueue->pop();
+}
+
+bool CustomProtocolHal::RetryStalledTransfers()
+{
+    bool progress = false;
+    for (auto it = _StalledTransfers.begin(); it != _StalledTransfers.end();)
+    {
+        if (Transfer(*it))
+        {
+            it = _StalledTransfers.erase(it);
+            --_StalledTransferCount;
+            progress = true;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    return progress;
+}
+
+bool CustomProtocolHal::Transfer(const TransferCommandDesc &command)
+{
+    if (command.Command->PayloadMode == CustomProtocolCommand::TransferMode::Streaming)
+    {
+        if (!TransferStreaming(command))
+        {
+            return false;
+        }
     }
     else
     {
-        _BufferHal->CopyFromBuffer(buffer, command.Buffer, command.BufferOffset, command.SectorCount);
+        U8 *buffer = GetBuffer(command.Command, command.CommandOffset);
+        U8 *bufferData = _BufferHal->ToPointer(command.Buffer) + _BufferHal->ToByteIndexInTransfer(command.Buffer.Type, command.BufferOffset);
+        if (buffer == bufferData)
+        {
+            // The buffer is mapped onto the host data in the controller memory buffer, nothing to copy
+        }
+        else if (command.Direction == TransferCommandDesc::Direction::In)
+        {
+            _BufferHal->CopyToBuffer(buffer, command.Buffer, command.BufferOffset, command.SectorCount);
+        }
+        else
+        {
+            _BufferHal->CopyFromBuffer(buffer, command.Buffer, command.BufferOffset, command.SectorCount);
+        }
     }
 
     assert(command.Listener != nullptr);
     command.Listener->HandleCommandCompleted(command);
-    _TransferCommandQueue->pop();
+    if (_ListenerThread)
+    {
+        _ListenerThread->Wakeup();
+    }
+    return true;
+}
+
+bool CustomProtocolHal::TransferStreaming(const TransferCommandDesc &command)
+{
+    CommandContext &commandContext = _CommandContexts[command.Command->ContextIndex];
+    assert(commandContext.Message != nullptr);
+    assert(commandContext.PayloadSize >= StreamingTransfer::HeaderSize());
+    auto header = reinterpret_cast<StreamingTransferHeader*>(commandContext.Payload);
+    const U32 windowSizeInSector = header->WindowSizeInSector;
+    const U32 windowSizeInByte = _BufferHal->ToByteIndexInTransfer(BufferType::User, windowSizeInSector);
+    const bool in = (command.Direction == TransferCommandDesc::Direction::In);
+
+    // All the windows touched by this transfer must be available, the host is on the other side of the ring
+    U32 lastWindow = (command.CommandOffset + command.SectorCount - 1) / windowSizeInSector;
+    if (in ? !StreamingTransfer::CanConsume(header, lastWindow) : !StreamingTransfer::CanProduce(header, lastWindow))
+    {
+        return false;
+    }
+
+    StreamingContext &context = commandContext.Streaming;
+    if (!context.Started)
+    {
+        context.Started = true;
+        context.NextWindow = 0;
+        context.TransferredSectors.assign(header->WindowCount, 0);
+    }
+
+    U32 commandOffset = command.CommandOffset;
+    U32 bufferOffset = command.BufferOffset;
+    U32 remaining = command.SectorCount;
+    while (remaining > 0)
+    {
+        U32 window = commandOffset / windowSizeInSector;
+        U32 offsetInWindow = commandOffset % windowSizeInSector;
+        U32 sectorCount = std::min(remaining, windowSizeInSector - offsetInWindow);
+        U8 *data = StreamingTransfer::GetWindow(header, window, windowSizeInByte)
+            + _BufferHal->ToByteIndexInTransfer(BufferType::User, offsetInWindow);
+        assert(data + _BufferHal->ToByteIndexInTransfer(BufferType::User, sectorCount) <= commandContext.Payload + commandContext.PayloadSize);
+
+        if (in)
+        {
+            _BufferHal->CopyToBuffer(data, command.Buffer, tSectorOffset{ bufferOffset }, tSectorCount{ sectorCount });
+        }
+        else
+        {
+            _BufferHal->CopyFromBuffer(data, command.Buffer, tSectorOffset{ bufferOffset }, tSectorCount{ sectorCount });
+        }
+        context.TransferredSectors[window % header->WindowCount] += sectorCount;
+
+        commandOffset += sectorCount;
+        bufferOffset += sectorCount;
+        remaining -= sectorCount;
+    }
+
+    // Hand completed windows over to the host in order
+    U32 windowTotal = StreamingTransfer::WindowTotal(header);
+    while (context.NextWindow < windowTotal)
+    {
+        U32 &transferred = context.TransferredSectors[context.NextWindow % header->WindowCount];
+        if (transferred < StreamingTransfer::WindowSectorCount(header, context.NextWindow))
+        {
+            break;
+        }
+        transferred = 0;
+        ++context.NextWindow;
+    }
+
+    if (in)
+    {
+        header->ConsumedWindowCount = context.NextWindow;
+    }
+    else
+    {
+        header->ProducedWindowCount = context.NextWindow;
+    }
+
+    return true;
 }
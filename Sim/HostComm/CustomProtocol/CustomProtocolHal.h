@@ -1,12 +1,19 @@
 #ifndef __CustomProtocolHal_h__
 #define __CustomProtocolHal_h__
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
 #include "boost/lockfree/spsc_queue.hpp"
 
 #include "SimFrameworkBase/FrameworkThread.h"
 
 #include "BasicTypes.h"
 #include "CustomProtocolCommand.h"
+#include "StreamingTransfer.h"
 #include "HostComm/Ipc/MessageServer.hpp"
 #include "Buffer/Hal/BufferHal.h"
 #include "Nand/Hal/NandHal.h"
@@ -17,6 +24,11 @@ public:
     CustomProtocolHal();
     
     void Init(const char *protocolIpcName = nullptr, BufferHal *bufferHal = nullptr);
+    void SetResponseCoalescing(const U32 &threshold, const std::chrono::microseconds &timeLimit);
+
+    //! Commands handed out at once, up to MaxInFlightCommands. Context indexes stay below it
+    void SetQueueDepth(const U32 &queueDepth);
+    inline U32 GetQueueDepth() const { return _QueueDepth; }
 
     bool HasCommand();
     CustomProtocolCommand* GetCommand();
@@ -50,20 +62,61 @@ public:
     };
 
 public:
+    //! Safe from several threads, sharded firmware queues transfers from each of its shards
     void QueueCommand(const TransferCommandDesc &command);
 
+    //! Thread running the transfer listeners, woken up on each completion
+    void SetListenerThread(FrameworkThread *listenerThread);
+
+    //! True once every queued transfer, stalled ones included, has completed and its listener returned
+    bool IsTransferQueueEmpty() const;
+
 protected:
-    virtual void Run() override;
+    virtual bool Run() override;
 
 private:
     U8* GetBuffer(CustomProtocolCommand *command, const tSectorOffset& offset);
     void ProcessTransferCommand();
+    bool Transfer(const TransferCommandDesc &command);
+    bool TransferStreaming(const TransferCommandDesc &command);
+    bool RetryStalledTransfers();
+
+public:
+    static constexpr U32 MaxInFlightCommands = 256;
+    static constexpr U32 TransferQueueSize = 1024;     //!< transfers queued at once, the firmware keeps below it
+
+private:
+    struct StreamingContext
+    {
+        bool Started;
+        U32 NextWindow;
+        std::vector<U32> TransferredSectors;    //!< per window slot
+    };
+
+    //! Filled once when the command is popped so transfers don't have to look the message up again
+    struct CommandContext
+    {
+        Message<CustomProtocolCommand> *Message;
+        U8 *Payload;
+        U32 PayloadSize;
+        StreamingContext Streaming;
+    };
 
 private:
     std::unique_ptr<MessageServer<CustomProtocolCommand>> _MessageServer;
     BufferHal *_BufferHal;
+    FrameworkThread *_ListenerThread;
 
     std::unique_ptr<boost::lockfree::spsc_queue<TransferCommandDesc>> _TransferCommandQueue;
+    std::mutex _QueueMutex;                 //!< the queue has a single producer at a time
+
+    //! Streaming transfers waiting for a window, kept aside so they don't block other transfers
+    std::deque<TransferCommandDesc> _StalledTransfers;
+    std::atomic<U32> _StalledTransferCount;
+
+    std::array<CommandContext, MaxInFlightCommands> _CommandContexts;
+    std::vector<U32> _FreeCommandContexts;
+    U32 _QueueDepth;
 };
 
 #endif
\ No newline at end of file
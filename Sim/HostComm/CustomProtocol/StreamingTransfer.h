@@ -0,0 +1,78 @@
+#ifndef __StreamingTransfer_h__
+#define __StreamingTransfer_h__
+
+#include <atomic>
+
+#include "BasicTypes.h"
+
+//! Payload layout of a command sent with CustomProtocolCommand::TransferMode::Streaming.
+//! The payload holds a ring of WindowCount fixed-size windows behind this header so a large Read/Write
+//! only needs a few windows of shared memory. The side producing the data (host for Write, device for Read)
+//! publishes a window by advancing ProducedWindowCount, the other side hands it back by advancing
+//! ConsumedWindowCount. Window n lives in slot n % WindowCount.
+struct StreamingTransferHeader
+{
+    U32 WindowCount;
+    U32 WindowSizeInSector;
+    U32 SectorCount;
+
+    std::atomic<U32> ProducedWindowCount;
+    std::atomic<U32> ConsumedWindowCount;
+};
+
+namespace StreamingTransfer
+{
+    constexpr U32 WindowAlignment = 64;
+
+    inline U32 HeaderSize()
+    {
+        return (sizeof(StreamingTransferHeader) + WindowAlignment - 1) & ~(WindowAlignment - 1);
+    }
+
+    inline U32 PayloadSize(const U32 &windowCount, const U32 &windowSizeInByte)
+    {
+        return HeaderSize() + windowCount * windowSizeInByte;
+    }
+
+    inline U32 WindowTotal(const StreamingTransferHeader *header)
+    {
+        return (header->SectorCount + header->WindowSizeInSector - 1) / header->WindowSizeInSector;
+    }
+
+    inline U32 WindowSectorCount(const StreamingTransferHeader *header, const U32 &window)
+    {
+        U32 windowOffset = window * header->WindowSizeInSector;
+        U32 remaining = header->SectorCount - windowOffset;
+        return (remaining < header->WindowSizeInSector) ? remaining : header->WindowSizeInSector;
+    }
+
+    inline StreamingTransferHeader* Init(void *payload, const U32 &windowCount, const U32 &windowSizeInSector, const U32 &sectorCount)
+    {
+        auto header = static_cast<StreamingTransferHeader*>(payload);
+        header->WindowCount = windowCount;
+        header->WindowSizeInSector = windowSizeInSector;
+        header->SectorCount = sectorCount;
+        header->ProducedWindowCount = 0;
+        header->ConsumedWindowCount = 0;
+        return header;
+    }
+
+    inline U8* GetWindow(StreamingTransferHeader *header, const U32 &window, const U32 &windowSizeInByte)
+    {
+        return reinterpret_cast<U8*>(header) + HeaderSize() + (window % header->WindowCount) * windowSizeInByte;
+    }
+
+    //! Producer side: true when window can be filled
+    inline bool CanProduce(const StreamingTransferHeader *header, const U32 &window)
+    {
+        return window < header->ConsumedWindowCount + header->WindowCount;
+    }
+
+    //! Consumer side: true when window holds data
+    inline bool CanConsume(const StreamingTransferHeader *header, const U32 &window)
+    {
+        return window < header->ProducedWindowCount;
+    }
+};
+
+#endif
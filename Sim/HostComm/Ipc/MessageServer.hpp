@@ -4,6 +4,10 @@
 
 #include <memory>
 #include <iostream>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
 #include <boost/interprocess/managed_shared_memory.hpp>
 #include <boost/interprocess/containers/deque.hpp>
 
@@ -74,8 +78,25 @@ public:
             throw "This message doesn't need respond";
         }
 
-        message->_ResponseTime = std::chrono::high_resolution_clock::now();
-        MessageBaseService<TData>::DoPush(MessageBaseService<TData>::_ResponseQueue, message);
+        if (_CoalescingThreshold <= 1)
+        {
+            message->_ResponseTime = std::chrono::high_resolution_clock::now();
+            MessageBaseService<TData>::DoPush(MessageBaseService<TData>::_ResponseQueue, message);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_PendingResponsesMutex);
+        if (_PendingResponses.empty())
+        {
+            _FirstPendingResponseTime = _CoalescingClock();
+        }
+        _PendingResponses.push_back(message);
+        _HasPendingResponses = true;
+
+        if (_PendingResponses.size() >= _CoalescingThreshold)
+        {
+            DoFlushResponses();
+        }
     }
 
     void PushResponse(const MessageId &id)
@@ -104,6 +125,83 @@ public:
     {
         return MessageBaseService<TData>::GetMessage(id);
     }
+
+public:
+    //! Completion coalescing, analogous to NVMe interrupt coalescing.
+    //! Responses are held back until threshold responses are pending or the oldest pending one
+    //! has waited for timeLimit, then published to the host in one batch. A threshold of 0 or 1 disables it.
+    //! The time limit is measured with clock, which a simulation stepped in virtual time replaces.
+    void SetResponseCoalescing(const U32 &threshold, const std::chrono::microseconds &timeLimit,
+        const std::function<std::chrono::high_resolution_clock::time_point()> &clock = &std::chrono::high_resolution_clock::now)
+    {
+        FlushResponses();
+        _CoalescingThreshold = threshold;
+        _CoalescingTimeLimit = timeLimit;
+        _CoalescingClock = clock;
+    }
+
+    //! Must be polled by the server to honor the coalescing time limit
+    //! Returns true while responses are still held back
+    bool ProcessResponseCoalescing()
+    {
+        if (!_HasPendingResponses)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(_PendingResponsesMutex);
+        if (!_PendingResponses.empty()
+            && (_CoalescingClock() - _FirstPendingResponseTime) >= _CoalescingTimeLimit)
+        {
+            DoFlushResponses();
+        }
+        return !_PendingResponses.empty();
+    }
+
+    //! When ProcessResponseCoalescing() has to run next to flush the responses held back
+    std::chrono::high_resolution_clock::time_point GetResponseDeadline()
+    {
+        std::lock_guard<std::mutex> lock(_PendingResponsesMutex);
+        return _FirstPendingResponseTime + _CoalescingTimeLimit;
+    }
+
+    void FlushResponses()
+    {
+        std::lock_guard<std::mutex> lock(_PendingResponsesMutex);
+        DoFlushResponses();
+    }
+
+private:
+    void DoFlushResponses()
+    {
+        if (_PendingResponses.empty())
+        {
+            return;
+        }
+
+        auto responseTime = std::chrono::high_resolution_clock::now();
+        _PendingResponseIds.clear();
+        for (auto message : _PendingResponses)
+        {
+            message->_ResponseTime = responseTime;
+            _PendingResponseIds.push_back(message->_Id);
+        }
+
+        // Single doorbell update for the whole batch
+        MessageBaseService<TData>::_ResponseQueue->push(_PendingResponseIds.begin(), _PendingResponseIds.end());
+        _PendingResponses.clear();
+        _HasPendingResponses = false;
+    }
+
+private:
+    U32 _CoalescingThreshold = 0;
+    std::chrono::microseconds _CoalescingTimeLimit = std::chrono::microseconds::zero();
+    std::function<std::chrono::high_resolution_clock::time_point()> _CoalescingClock = &std::chrono::high_resolution_clock::now;
+    std::vector<Message<TData>*> _PendingResponses;
+    std::vector<MessageId> _PendingResponseIds;
+    std::chrono::high_resolution_clock::time_point _FirstPendingResponseTime;
+    std::atomic<bool> _HasPendingResponses{ false };
+    std::mutex _PendingResponsesMutex;
 };
 
 #endif
\ No newline at end of file
@@ -54,6 +54,18 @@ public:
         _Queue.push_back(element);
         _WaitCondition.notify_one();
     }
+
+    // Publish a batch of elements with a single notification
+    template <class InputIt> void push(InputIt first, InputIt last)
+    {
+        lock lock(_IoMutex);
+        for (; first != last; ++first)
+        {
+            _Queue.push_back(*first);
+        }
+        _WaitCondition.notify_one();
+    }
+
     bool empty() const
     {
         lock lock(_IoMutex);
@@ -1,6 +1,6 @@
 #include "Nand/Hal/NandHal.h"
 
-NandHal::NandHal()
+NandHal::NandHal() : _ListenerThread(nullptr)
 {
 	_CommandQueue = std::unique_ptr<boost::lockfree::spsc_queue<CommandDesc>>(new boost::lockfree::spsc_queue<CommandDesc>{ 1024 });
 }
@@ -19,7 +19,8 @@ void NandHal::Init()
 	for (U8 i(0); i < _Geometry.ChannelCount; ++i)
 	{
 		NandChannel nandChannel;
-		nandChannel.Init(_BufferHal.get(), _Geometry.DevicesPerChannel, _Geometry.BlocksPerDevice, _Geometry.PagesPerBlock, _Geometry.BytesPerPage);
+		nandChannel.Init(_BufferHal.get(), _Geometry.DevicesPerChannel, _Geometry.BlocksPerDevice, _Geometry.PagesPerBlock, _Geometry.BytesPerPage,
+			GetSpareBytesPerPage(_Geometry));
 		_NandChannels.push_back(std::move(nandChannel));
 	}
 }
@@ -31,7 +32,12 @@ void NandHal::SetSectorInfo(const SectorInfo &sectorInfo)
 
 void NandHal::QueueCommand(const CommandDesc& command)
 {
-	_CommandQueue->push(command);
+	{
+		std::lock_guard<std::mutex> lock(_QueueMutex);
+		bool queued = _CommandQueue->push(command);
+		assert(queued);
+	}
+	Wakeup();
 }
 
 bool NandHal::IsCommandQueueEmpty() const
@@ -39,6 +45,11 @@ bool NandHal::IsCommandQueueEmpty() const
 	return _CommandQueue->empty();
 }
 
+void NandHal::SetListenerThread(FrameworkThread *listenerThread)
+{
+	_ListenerThread = listenerThread;
+}
+
 bool NandHal::ReadPage(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, const Buffer &outBuffer)
 {
 	return (_NandChannels[channel][device].ReadPage(block, page, outBuffer));
@@ -73,17 +84,35 @@ void NandHal::WritePage(const tChannel& channel,
 	_NandChannels[channel][device].WritePage(block, page, sector, sectorCount, inBuffer, bufferOffset);
 }
 
+bool NandHal::CopybackPage(tChannel channel, tDeviceInChannel device, tBlockInDevice sourceBlock, tPageInBlock sourcePage, tBlockInDevice block, tPageInBlock page)
+{
+	return (_NandChannels[channel][device].CopybackPage(sourceBlock, sourcePage, block, page));
+}
+
+bool NandHal::ReadSpare(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, U8 *spare)
+{
+	return (_NandChannels[channel][device].ReadSpare(block, page, spare));
+}
+
+void NandHal::WriteSpare(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, const U8 *spare)
+{
+	_NandChannels[channel][device].WriteSpare(block, page, spare);
+}
+
 void NandHal::EraseBlock(tChannel channel, tDeviceInChannel device, tBlockInDevice block)
 {
 	_NandChannels[channel][device].EraseBlock(block);
 }
 
-void NandHal::Run()
+bool NandHal::Run()
 {
 	if (_CommandQueue->empty() == false)
 	{
         ProcessNandOperation();
+        return true;
 	}
+
+	return false;
 }
 
 void NandHal::ProcessNandOperation()
@@ -125,10 +154,52 @@ void NandHal::ProcessNandOperation()
         // TODO: Update command status
         WritePage(address.Channel, address.Device, address.Block, address.Page, address.Sector, address.SectorCount, command.Buffer, command.BufferOffset);
     }break;
+    case CommandDesc::Op::Copyback:
+    {
+        assert(command.SourceAddress.Channel == address.Channel && command.SourceAddress.Device == address.Device);
+        if (false == CopybackPage(address.Channel, address.Device, command.SourceAddress.Block, command.SourceAddress.Page, address.Block, address.Page))
+        {
+            command.CommandStatus = CommandDesc::Status::Uecc;
+        }
+    }break;
+    case CommandDesc::Op::ReadSpare:
+    {
+        if (false == ReadSpare(address.Channel, address.Device, address.Block, address.Page, command.Spare))
+        {
+            command.CommandStatus = CommandDesc::Status::Uecc;
+        }
+    }break;
+    case CommandDesc::Op::WriteWithSpare:
+    {
+        WritePage(address.Channel, address.Device, address.Block, address.Page, command.Buffer);
+        WriteSpare(address.Channel, address.Device, address.Block, address.Page, command.Spare);
+    }break;
+    case CommandDesc::Op::WritePartialWithSpare:
+    {
+        WritePage(address.Channel, address.Device, address.Block, address.Page, address.Sector, address.SectorCount, command.Buffer, command.BufferOffset);
+        WriteSpare(address.Channel, address.Device, address.Block, address.Page, command.Spare);
+    }break;
+    case CommandDesc::Op::CopybackWithSpare:
+    {
+        // The spare area of the source is replaced, the data lands at other LBAs
+        assert(command.SourceAddress.Channel == address.Channel && command.SourceAddress.Device == address.Device);
+        if (false == CopybackPage(address.Channel, address.Device, command.SourceAddress.Block, command.SourceAddress.Page, address.Block, address.Page))
+        {
+            command.CommandStatus = CommandDesc::Status::Uecc;
+        }
+        else
+        {
+            WriteSpare(address.Channel, address.Device, address.Block, address.Page, command.Spare);
+        }
+    }break;
     }
 
     assert(command.Listener != nullptr);
     command.Listener->HandleCommandCompleted(command);
+    if (_ListenerThread)
+    {
+        _ListenerThread->Wakeup();
+    }
 
     _CommandQueue->pop();
 }
\ No newline at end of file
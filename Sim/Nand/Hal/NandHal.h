@@ -4,6 +4,7 @@
 #include <vector>
 #include <queue>
 #include <memory>
+#include <mutex>
 
 #include "boost/lockfree/spsc_queue.hpp"
 
@@ -37,6 +38,9 @@ public:
 public:
     inline Geometry GetGeometry() const { return _Geometry; }
 
+    //! Out of band bytes of each page, a 32nd of its data like most parts
+    static inline U32 GetSpareBytesPerPage(const Geometry &geometry) { return geometry.BytesPerPage / 32; }
+
 public:
     struct NandAddress
     {
@@ -64,6 +68,11 @@ public:
 			Erase,
 			ReadPartial,
 			WritePartial,
+			Copyback,       //!< SourceAddress to Address, a page of the same device without going through a buffer
+			ReadSpare,      //!< only the spare area of the page, into Spare
+			WriteWithSpare,             //!< the ops above, also programming Spare into the spare area of the page
+			WritePartialWithSpare,
+			CopybackWithSpare,
 		};
 
 		enum class Status
@@ -75,6 +84,7 @@ public:
 		};
 
 		NandAddress Address;
+		NandAddress SourceAddress;
 		Op Operation;
 		Status CommandStatus;
 		Buffer Buffer;
@@ -82,11 +92,16 @@ public:
 
         tSectorOffset DescSectorIndex;
         CommandListener *Listener;
+        U8 *Spare;                  //!< GetSpareBytesPerPage() bytes, only the spare ops use it. Kept by the caller until completion
 	};
 
+	//! Safe from several threads, sharded firmware queues commands from each of its shards
 	void QueueCommand(const CommandDesc& command);
 	bool IsCommandQueueEmpty() const;
 
+	//! Thread running the command listeners, woken up on each completion
+	void SetListenerThread(FrameworkThread *listenerThread);
+
 public:
 	bool ReadPage(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, const Buffer &outBuffer);
 	bool ReadPage(
@@ -110,10 +125,15 @@ public:
         const Buffer &inBuffer,
         const tSectorOffset& bufferOffset);
 
+	bool CopybackPage(tChannel channel, tDeviceInChannel device, tBlockInDevice sourceBlock, tPageInBlock sourcePage, tBlockInDevice block, tPageInBlock page);
+
+	bool ReadSpare(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, U8 *spare);
+	void WriteSpare(tChannel channel, tDeviceInChannel device, tBlockInDevice block, tPageInBlock page, const U8 *spare);
+
 	void EraseBlock(tChannel channel, tDeviceInChannel chip, tBlockInDevice block);
 
 protected:
-	virtual void Run() override;
+	virtual bool Run() override;
 
 private:
     void ProcessNandOperation();
@@ -124,9 +144,12 @@ private:
 	std::vector<NandChannel> _NandChannels;
 
 	std::unique_ptr<boost::lockfree::spsc_queue<CommandDesc>> _CommandQueue;
+	std::mutex _QueueMutex;                 //!< the queue has a single producer at a time
 
     Geometry _Geometry;
     SectorInfo _SectorInfo;
+
+    FrameworkThread *_ListenerThread;
 };
 
 #endif
@@ -3,10 +3,11 @@
 
 #include "Nand/Sim/NandBlock.h"
 
-NandBlock::NandBlock(BufferHal *bufferHal, U32 pagesPerBlock, U32 totalBytesPerPage) : _NandBlockTracker(pagesPerBlock)
+NandBlock::NandBlock(BufferHal *bufferHal, U32 pagesPerBlock, U32 totalBytesPerPage, U32 spareBytesPerPage) : _NandBlockTracker(pagesPerBlock)
 {
 	_PagesPerBlock = pagesPerBlock;
 	_TotalBytesPerPage = totalBytesPerPage;
+	_SpareBytesPerPage = spareBytesPerPage;
     _BufferHal = bufferHal;
 
 	_ErasedBuffer = std::unique_ptr<U8[]>(new U8[_TotalBytesPerPage]);
@@ -16,6 +17,7 @@ NandBlock::NandBlock(BufferHal *bufferHal, U32 pagesPerBlock, U32 totalBytesPerP
 void NandBlock::Erase()
 {
 	_Buffer.reset();
+	_Spare.reset();
 	_NandBlockTracker.Reset();
 }
 
@@ -83,4 +85,56 @@ bool NandBlock::ReadPage(const tPageInBlock& page, const tSectorInPage& sector,
 
     _BufferHal->CopyToBuffer(data, outBuffer, bufferOffset, sectorCount);
 	return (true);
+}
+
+bool NandBlock::ReadPage(const tPageInBlock& page, U8 *pageRegister)
+{
+    if (true == _NandBlockTracker.IsPageCorrupted(page))
+    {
+        return (false);
+    }
+
+	auto data = (nullptr == _Buffer) ? &_ErasedBuffer[0] : &_Buffer[page * _TotalBytesPerPage];
+	std::memcpy(pageRegister, data, _TotalBytesPerPage);
+	return (true);
+}
+
+void NandBlock::WritePage(const tPageInBlock& page, const U8 *pageRegister)
+{
+	if (nullptr == _Buffer)
+	{
+		_Buffer = std::unique_ptr<U8[]>(new U8[_PagesPerBlock * _TotalBytesPerPage]);
+	}
+
+	std::memcpy(&_Buffer[page * _TotalBytesPerPage], pageRegister, _TotalBytesPerPage);
+	_NandBlockTracker.WritePage(page);
+}
+
+bool NandBlock::ReadSpare(const tPageInBlock& page, U8 *spare)
+{
+	if (true == _NandBlockTracker.IsPageCorrupted(page))
+	{
+		return (false);
+	}
+
+	if (nullptr == _Spare)
+	{
+		std::memset(spare, ERASED_PATTERN, _SpareBytesPerPage);
+	}
+	else
+	{
+		std::memcpy(spare, &_Spare[page * _SpareBytesPerPage], _SpareBytesPerPage);
+	}
+	return (true);
+}
+
+void NandBlock::WriteSpare(const tPageInBlock& page, const U8 *spare)
+{
+	if (nullptr == _Spare)
+	{
+		_Spare = std::unique_ptr<U8[]>(new U8[_PagesPerBlock * _SpareBytesPerPage]);
+		std::memset(_Spare.get(), ERASED_PATTERN, _PagesPerBlock * _SpareBytesPerPage);
+	}
+
+	std::memcpy(&_Spare[page * _SpareBytesPerPage], spare, _SpareBytesPerPage);
 }
\ No newline at end of file
@@ -13,7 +13,7 @@
 class NandBlock
 {
 public:
-	NandBlock(BufferHal *bufferHal, U32 pagesPerBlock, U32 totalBytesPerPage);
+	NandBlock(BufferHal *bufferHal, U32 pagesPerBlock, U32 totalBytesPerPage, U32 spareBytesPerPage);
 	NandBlock(NandBlock&& rhs) = default;
 
 public:
@@ -25,6 +25,14 @@ public:
 	bool ReadPage(tPageInBlock page, const Buffer &outBuffer);
 	bool ReadPage(const tPageInBlock& page, const tSectorInPage& sector, const tSectorCount& sectorCount, const Buffer &outBuffer, const tSectorOffset& bufferOffset);
 
+	//! Whole page to or from the device's page register, for copyback
+	bool ReadPage(const tPageInBlock& page, U8 *pageRegister);
+	void WritePage(const tPageInBlock& page, const U8 *pageRegister);
+
+	//! Spare area of the page, programmed along with it. It reads as ERASED_PATTERN until then
+	bool ReadSpare(const tPageInBlock& page, U8 *spare);
+	void WriteSpare(const tPageInBlock& page, const U8 *spare);
+
 public:
 	static const U8 ERASED_PATTERN = 0xff;
 
@@ -34,8 +42,10 @@ private:
     BufferHal *_BufferHal;
 	U32 _PagesPerBlock;
 	U32 _TotalBytesPerPage;
+	U32 _SpareBytesPerPage;
 
 	std::unique_ptr<U8[]> _Buffer;
+	std::unique_ptr<U8[]> _Spare;
 	std::unique_ptr<U8[]> _ErasedBuffer;
 };
 
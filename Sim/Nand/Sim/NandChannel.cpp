@@ -1,10 +1,10 @@
 #include "Nand/Sim/NandChannel.h"
 
-void NandChannel::Init(BufferHal *bufferHal, U8 deviceCount, U32 blocksPerDevice, U32 pagesPerBlock, U32 bytesPerPage)
+void NandChannel::Init(BufferHal *bufferHal, U8 deviceCount, U32 blocksPerDevice, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage)
 {
 	for (U8 i(0); i < deviceCount; ++i)
 	{
-		_Devices.push_back(std::move(NandDevice(bufferHal, blocksPerDevice, pagesPerBlock, bytesPerPage)));
+		_Devices.push_back(std::move(NandDevice(bufferHal, blocksPerDevice, pagesPerBlock, bytesPerPage, spareBytesPerPage)));
 	}
 }
 
@@ -11,7 +11,7 @@
 class NandChannel
 {
 public:
-	void Init(BufferHal *bufferHal, U8 deviceCount, U32 blocksPerDevice, U32 pagesPerBlock, U32 bytesPerPage);
+	void Init(BufferHal *bufferHal, U8 deviceCount, U32 blocksPerDevice, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage);
 
 public:
 	NandDevice& operator[](const int index);
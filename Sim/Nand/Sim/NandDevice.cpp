@@ -1,12 +1,14 @@
 #include "Nand/Sim/NandDevice.h"
 
-NandDevice::NandDevice(BufferHal *bufferHal, U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage)
+NandDevice::NandDevice(BufferHal *bufferHal, U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage)
 {
-	_Desc = std::unique_ptr<NandDeviceDesc>(new NandDeviceDesc(blockCount, pagesPerBlock, bytesPerPage));
+	_Desc = std::unique_ptr<NandDeviceDesc>(new NandDeviceDesc(blockCount, pagesPerBlock, bytesPerPage, spareBytesPerPage));
 	for (U32 i = 0; i < blockCount; ++i)
 	{
-		_Blocks.push_back(std::move(NandBlock(bufferHal, _Desc->GetPagesPerBlock(), _Desc->GetBytesPerPage())));
+		_Blocks.push_back(std::move(NandBlock(bufferHal, _Desc->GetPagesPerBlock(), _Desc->GetBytesPerPage(), _Desc->GetSpareBytesPerPage())));
 	}
+	_PageRegister = std::unique_ptr<U8[]>(new U8[_Desc->GetBytesPerPage()]);
+	_SpareRegister = std::unique_ptr<U8[]>(new U8[_Desc->GetSpareBytesPerPage()]);
 }
 
 bool NandDevice::ReadPage(tBlockInDevice block, tPageInBlock page, const Buffer &outBuffer)
@@ -29,6 +31,28 @@ void NandDevice::WritePage(const tBlockInDevice& block, const tPageInBlock& page
 	_Blocks[block].WritePage(page, sector, sectorCount, inBuffer, bufferOffset);
 }
 
+bool NandDevice::CopybackPage(const tBlockInDevice& sourceBlock, const tPageInBlock& sourcePage, const tBlockInDevice& block, const tPageInBlock& page)
+{
+	if (false == _Blocks[sourceBlock].ReadPage(sourcePage, _PageRegister.get())
+		|| false == _Blocks[sourceBlock].ReadSpare(sourcePage, _SpareRegister.get()))
+	{
+		return (false);
+	}
+	_Blocks[block].WritePage(page, _PageRegister.get());
+	_Blocks[block].WriteSpare(page, _SpareRegister.get());
+	return (true);
+}
+
+bool NandDevice::ReadSpare(const tBlockInDevice& block, const tPageInBlock& page, U8 *spare)
+{
+	return (_Blocks[block].ReadSpare(page, spare));
+}
+
+void NandDevice::WriteSpare(const tBlockInDevice& block, const tPageInBlock& page, const U8 *spare)
+{
+	_Blocks[block].WriteSpare(page, spare);
+}
+
 void NandDevice::EraseBlock(tBlockInDevice block)
 {
 	_Blocks[block].Erase();
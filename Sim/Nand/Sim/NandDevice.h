@@ -13,7 +13,7 @@
 class NandDevice
 {
 public:
-	NandDevice(BufferHal *bufferHal, U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage);
+	NandDevice(BufferHal *bufferHal, U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage);
 	NandDevice(NandDevice&& rhs) = default;
 
 public:
@@ -25,11 +25,19 @@ public:
 	void WritePage(const tBlockInDevice& block, const tPageInBlock& page, const tSectorInPage& sector, const tSectorCount& sectorCount, 
         const Buffer &inBuffer, const tSectorOffset& bufferOffset);
 
+	//! The page goes through the page register, its data never leaves the device. Its spare area goes along
+	bool CopybackPage(const tBlockInDevice& sourceBlock, const tPageInBlock& sourcePage, const tBlockInDevice& block, const tPageInBlock& page);
+
+	bool ReadSpare(const tBlockInDevice& block, const tPageInBlock& page, U8 *spare);
+	void WriteSpare(const tBlockInDevice& block, const tPageInBlock& page, const U8 *spare);
+
 	void EraseBlock(tBlockInDevice block);
 
 private:
 	std::unique_ptr<NandDeviceDesc> _Desc;
 	std::vector<NandBlock> _Blocks;
+	std::unique_ptr<U8[]> _PageRegister;
+	std::unique_ptr<U8[]> _SpareRegister;
 };
 
 #endif
\ No newline at end of file
@@ -1,7 +1,7 @@
 #include "Nand/Sim/NandDeviceDesc.h"
 
-NandDeviceDesc::NandDeviceDesc(U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage) :
-	_BlockCount(blockCount), _PagesPerBlock(pagesPerBlock), _BytesPerPage(bytesPerPage)
+NandDeviceDesc::NandDeviceDesc(U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage) :
+	_BlockCount(blockCount), _PagesPerBlock(pagesPerBlock), _BytesPerPage(bytesPerPage), _SpareBytesPerPage(spareBytesPerPage)
 {
 
 }
\ No newline at end of file
@@ -6,17 +6,19 @@
 class NandDeviceDesc
 {
 public:
-	NandDeviceDesc(U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage);
+	NandDeviceDesc(U32 blockCount, U32 pagesPerBlock, U32 bytesPerPage, U32 spareBytesPerPage);
 
 public:
 	inline U32 GetBlockCount() const { return _BlockCount; }
 	inline U32 GetPagesPerBlock() const { return _PagesPerBlock; }
 	inline U32 GetBytesPerPage() const { return _BytesPerPage; }
+	inline U32 GetSpareBytesPerPage() const { return _SpareBytesPerPage; }
 
 private:
 	U32	_BlockCount;
 	U32 _PagesPerBlock;
 	U32 _BytesPerPage;
+	U32 _SpareBytesPerPage;
 };
 
 #endif
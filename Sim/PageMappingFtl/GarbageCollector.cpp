@@ -0,0 +1,425 @@
+#include "GarbageCollector.h"
+
+GarbageCollector::GarbageCollector() :
+    _NandHal(nullptr),
+    _BufferHal(nullptr),
+    _Mapping(nullptr),
+    _Config{ PageMapping::VictimPolicy::Greedy, 0, 0, 1 },
+    _Victim(PageMapping::NoBlock),
+    _NextPage(0),
+    _VictimProgrammedPages(0),
+    _InFlightCount(0),
+    _DiscardCount(0),
+    _ReadPageCursor(0),
+    _CurrentPackedPage(NoPackedPage),
+    _HostCredits(0),
+    _OwnedBufferCount(0),
+    _Statistics{}
+{
+    _CompletedCommands = std::unique_ptr<boost::lockfree::queue<NandHal::CommandDesc>>(new boost::lockfree::queue<NandHal::CommandDesc>{ 64 });
+}
+
+void GarbageCollector::Init(NandHal *nandHal, BufferHal *bufferHal, PageMapping *mapping)
+{
+    _NandHal = nandHal;
+    _BufferHal = bufferHal;
+    _Mapping = mapping;
+}
+
+void GarbageCollector::SetConfig(const Config &config)
+{
+    _Config = config;
+    if (_Config.PipelineDepth == 0)
+    {
+        _Config.PipelineDepth = 1;
+    }
+
+    while (_OwnedBufferCount > GetBufferPoolSize() && !_SpareBuffers.empty())
+    {
+        DropBuffer(_SpareBuffers.back());
+        _SpareBuffers.pop_back();
+    }
+    FillBufferPool();
+}
+
+void GarbageCollector::Reset()
+{
+    // Whatever is still in flight belongs to the old mapping, it completes first and is dropped.
+    // Buffers are reallocated as the sector size may have changed
+    for (auto &buffer : _SpareBuffers)
+    {
+        DropBuffer(buffer);
+    }
+    _SpareBuffers.clear();
+    for (auto &command : _ReadPages)
+    {
+        DropBuffer(command.Buffer);
+    }
+    _ReadPages.clear();
+    _ReadPageCursor = 0;
+
+    if (_CurrentPackedPage != NoPackedPage)
+    {
+        _FullPackedPages.push_back(_CurrentPackedPage);
+        _CurrentPackedPage = NoPackedPage;
+    }
+    for (auto &packedPage : _FullPackedPages)
+    {
+        DropBuffer(_PackedPages[packedPage].Buffer);
+    }
+    _FullPackedPages.clear();
+    _FreePackedPages.clear();
+    _PackedPages.clear();
+
+    _DiscardCount += _InFlightCount;
+    _InFlightCount = 0;
+
+    _Victim = PageMapping::NoBlock;
+    _HostCredits = 0;
+    _Statistics = Statistics{};
+    FillBufferPool();
+}
+
+void GarbageCollector::operator()()
+{
+    NandHal::CommandDesc command;
+    while (_CompletedCommands->pop(command))
+    {
+        if (_DiscardCount > 0)
+        {
+            if (NandHal::CommandDesc::Op::Erase != command.Operation)
+            {
+                DropBuffer(command.Buffer);
+            }
+            --_DiscardCount;
+            continue;
+        }
+
+        if (NandHal::CommandDesc::Op::Read == command.Operation)
+        {
+            --_InFlightCount;
+            _ReadPages.push_back(command);
+        }
+        else
+        {
+            OnWriteCompleted(command);
+        }
+    }
+
+    while (!_ReadPages.empty() && PackReadPage(_ReadPages.front()))
+    {
+        ReturnBuffer(_ReadPages.front().Buffer);
+        _ReadPages.pop_front();
+    }
+
+    // The last sectors of a victim don't wait for a full page
+    if (_CurrentPackedPage != NoPackedPage && _Victim != PageMapping::NoBlock
+        && _NextPage == _Mapping->GetPagesPerBlock() && _ReadPages.empty() && _InFlightCount == 0)
+    {
+        _FullPackedPages.push_back(_CurrentPackedPage);
+        _CurrentPackedPage = NoPackedPage;
+    }
+
+    while (!_FullPackedPages.empty() && WritePage(_FullPackedPages.front()))
+    {
+        _FullPackedPages.pop_front();
+    }
+
+    if (_Victim != PageMapping::NoBlock && IsVictimMoved())
+    {
+        ReleaseVictim();
+    }
+
+    if (_Victim == PageMapping::NoBlock && _Mapping->GetFreeBlockCount() <= _Config.StartFreeBlocks)
+    {
+        SelectVictim();
+    }
+
+    if (_Victim != PageMapping::NoBlock)
+    {
+        ReadNextPages();
+    }
+}
+
+bool GarbageCollector::IsThrottling() const
+{
+    return _Mapping->GetFreeBlockCount() <= _Config.ThrottleFreeBlocks;
+}
+
+bool GarbageCollector::HasHostCredit() const
+{
+    // Without a victim in progress there is nothing to wait for
+    return !IsThrottling() || _HostCredits > 0 || _Victim == PageMapping::NoBlock;
+}
+
+void GarbageCollector::SpendHostCredit()
+{
+    // Credits only pace the host once throttling, they aren't saved up before
+    if (!IsThrottling())
+    {
+        _HostCredits = 0;
+    }
+    else if (_HostCredits > 0)
+    {
+        --_HostCredits;
+    }
+}
+
+bool GarbageCollector::CanFreeSpace()
+{
+    if (_Victim == PageMapping::NoBlock)
+    {
+        SelectVictim();
+    }
+    return (_Victim != PageMapping::NoBlock);
+}
+
+bool GarbageCollector::IsIdle()
+{
+    return (_InFlightCount == 0) && (_DiscardCount == 0) && _CompletedCommands->empty();
+}
+
+bool GarbageCollector::TakeBuffer(Buffer &buffer)
+{
+    if (!_SpareBuffers.empty())
+    {
+        buffer = _SpareBuffers.back();
+        _SpareBuffers.pop_back();
+        return true;
+    }
+
+    if (_OwnedBufferCount < GetBufferPoolSize() && _BufferHal->AllocateBuffer(BufferType::User, buffer))
+    {
+        ++_OwnedBufferCount;
+        return true;
+    }
+    return false;
+}
+
+void GarbageCollector::ReturnBuffer(const Buffer &buffer)
+{
+    if (_OwnedBufferCount > GetBufferPoolSize())
+    {
+        DropBuffer(buffer);
+        return;
+    }
+    _SpareBuffers.push_back(buffer);
+}
+
+void GarbageCollector::DropBuffer(const Buffer &buffer)
+{
+    _BufferHal->DeallocateBuffer(buffer);
+    --_OwnedBufferCount;
+}
+
+void GarbageCollector::FillBufferPool()
+{
+    // Best effort, what can't be allocated now is on first use
+    Buffer buffer;
+    while (_BufferHal != nullptr && _OwnedBufferCount < GetBufferPoolSize() && _BufferHal->AllocateBuffer(BufferType::User, buffer))
+    {
+        _SpareBuffers.push_back(buffer);
+        ++_OwnedBufferCount;
+    }
+}
+
+U32 GarbageCollector::GetBufferPoolSize() const
+{
+    // Reads in flight and waiting to be packed are bounded by PipelineDepth, the extra one is for packing
+    return _Config.PipelineDepth + 1;
+}
+
+void GarbageCollector::SelectVictim()
+{
+    _Victim = _Mapping->SelectVictim(_Config.Policy);
+    _NextPage = 0;
+    _VictimProgrammedPages = 0;
+}
+
+void GarbageCollector::ReadNextPages()
+{
+    // Pages read but not packed yet hold a buffer as well, they count against the pipeline
+    Buffer buffer;
+    while (_InFlightCount + _ReadPages.size() < _Config.PipelineDepth && _NextPage < _Mapping->GetPagesPerBlock())
+    {
+        if (!HasValidSector(_NextPage))
+        {
+            ++_NextPage;
+            continue;
+        }
+
+        if (!TakeBuffer(buffer))
+        {
+            break;
+        }
+
+        NandHal::CommandDesc commandDesc;
+        _Mapping->ToNandAddress(_Victim, _NextPage, commandDesc.Address);
+        commandDesc.Operation = NandHal::CommandDesc::Op::Read;
+        commandDesc.Buffer = buffer;
+        commandDesc.BufferOffset = 0;
+        commandDesc.DescSectorIndex = 0;
+        commandDesc.Listener = this;
+        _NandHal->QueueCommand(commandDesc);
+
+        ++_NextPage;
+        ++_InFlightCount;
+    }
+}
+
+bool GarbageCollector::HasValidSector(const U32 &page)
+{
+    NandHal::NandAddress nandAddress;
+    _Mapping->ToNandAddress(_Victim, page, nandAddress);
+    U32 physicalSector = _Mapping->ToPhysicalSector(nandAddress);
+    for (U32 sector = 0; sector < _Mapping->GetSectorsPerPage(); ++sector)
+    {
+        if (_Mapping->GetLogicalSector(physicalSector + sector) != PageMapping::Unmapped)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GarbageCollector::PackReadPage(const NandHal::CommandDesc &readCommand)
+{
+    // Returns false when out of buffers, packing resumes from _ReadPageCursor
+    U32 sectorsPerPage = _Mapping->GetSectorsPerPage();
+    U32 source = _Mapping->ToPhysicalSector(readCommand.Address);
+    for (; _ReadPageCursor < sectorsPerPage; ++_ReadPageCursor)
+    {
+        U32 sector = _ReadPageCursor;
+        if (_Mapping->GetLogicalSector(source + sector) == PageMapping::Unmapped)
+        {
+            continue;
+        }
+
+        if (_CurrentPackedPage == NoPackedPage)
+        {
+            Buffer buffer;
+            if (!TakeBuffer(buffer))
+            {
+                return false;
+            }
+
+            if (_FreePackedPages.empty())
+            {
+                _FreePackedPages.push_back(static_cast<U32>(_PackedPages.size()));
+                _PackedPages.push_back(PackedPage{});
+            }
+            _CurrentPackedPage = _FreePackedPages.front();
+            _FreePackedPages.pop_front();
+
+            PackedPage &packedPage = _PackedPages[_CurrentPackedPage];
+            packedPage.Buffer = buffer;
+            packedPage.SectorCount = 0;
+            packedPage.Sources.assign(sectorsPerPage, PageMapping::Unmapped);
+        }
+
+        PackedPage &packedPage = _PackedPages[_CurrentPackedPage];
+        U8 *dest = _BufferHal->ToPointer(packedPage.Buffer) + _BufferHal->ToByteIndexInTransfer(packedPage.Buffer.Type, packedPage.SectorCount);
+        _BufferHal->CopyFromBuffer(dest, readCommand.Buffer, tSectorOffset{ sector }, tSectorCount{ 1 });
+        packedPage.Sources[packedPage.SectorCount++] = source + sector;
+
+        if (packedPage.SectorCount == sectorsPerPage)
+        {
+            _FullPackedPages.push_back(_CurrentPackedPage);
+            _CurrentPackedPage = NoPackedPage;
+        }
+    }
+
+    _ReadPageCursor = 0;
+    return true;
+}
+
+bool GarbageCollector::WritePage(const U32 &packedPage)
+{
+    NandHal::NandAddress nandAddress;
+    bool openedBlock;
+    if (!_Mapping->AllocatePage(nandAddress, openedBlock))
+    {
+        return false;
+    }
+
+    NandHal::CommandDesc commandDesc;
+    if (openedBlock)
+    {
+        commandDesc.Address = nandAddress;
+        commandDesc.Operation = NandHal::CommandDesc::Op::Erase;
+        commandDesc.Listener = this;
+        _NandHal->QueueCommand(commandDesc);
+        ++_InFlightCount;
+    }
+
+    commandDesc.Address = nandAddress;
+    commandDesc.Operation = NandHal::CommandDesc::Op::WriteWithSpare;
+    commandDesc.Spare = _Mapping->SetSpare(nandAddress, _PackedPages[packedPage].Sources, _PackedPages[packedPage].SectorCount);
+    commandDesc.Buffer = _PackedPages[packedPage].Buffer;
+    commandDesc.BufferOffset = 0;
+    commandDesc.DescSectorIndex = packedPage;
+    commandDesc.Listener = this;
+    _NandHal->QueueCommand(commandDesc);
+    ++_InFlightCount;
+    return true;
+}
+
+void GarbageCollector::OnWriteCompleted(const NandHal::CommandDesc &command)
+{
+    --_InFlightCount;
+    if (NandHal::CommandDesc::Op::Erase == command.Operation)
+    {
+        return;
+    }
+
+    _Mapping->ProgramCompleted(command.Address);
+
+    U32 packedPageIndex = command.DescSectorIndex;
+    PackedPage &packedPage = _PackedPages[packedPageIndex];
+    if (NandHal::CommandDesc::Status::Success == command.CommandStatus)
+    {
+        NandHal::NandAddress nandAddress = command.Address;
+        for (U32 sector = 0; sector < packedPage.SectorCount; ++sector)
+        {
+            // Skip what the host has rewritten since the page was read
+            U32 lba = _Mapping->GetLogicalSector(packedPage.Sources[sector]);
+            if (lba != PageMapping::Unmapped)
+            {
+                nandAddress.Sector._ = sector;
+                _Mapping->Update(lba, 1, nandAddress);
+                ++_Statistics.RelocatedSectors;
+            }
+        }
+    }
+
+    ReturnBuffer(packedPage.Buffer);
+    _FreePackedPages.push_back(packedPageIndex);
+    ++_VictimProgrammedPages;
+    ++_Statistics.RelocatedPages;
+}
+
+bool GarbageCollector::IsVictimMoved() const
+{
+    return _NextPage == _Mapping->GetPagesPerBlock() && _InFlightCount == 0 && _ReadPages.empty()
+        && _CurrentPackedPage == NoPackedPage && _FullPackedPages.empty();
+}
+
+void GarbageCollector::ReleaseVictim()
+{
+    // A failed program leaves its sectors behind, the block can't be reused while they're mapped
+    if (_Mapping->GetValidSectorCount(_Victim) != 0)
+    {
+        _NextPage = 0;
+        return;
+    }
+
+    _Mapping->ReleaseBlock(_Victim);
+    _HostCredits += _Mapping->GetPagesPerBlock() - std::min(_VictimProgrammedPages, _Mapping->GetPagesPerBlock());
+    ++_Statistics.CollectedBlocks;
+    _Victim = PageMapping::NoBlock;
+}
+
+void GarbageCollector::HandleCommandCompleted(const NandHal::CommandDesc &command)
+{
+    _CompletedCommands->push(command);
+}
\ No newline at end of file
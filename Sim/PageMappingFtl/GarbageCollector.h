@@ -0,0 +1,127 @@
+#ifndef __GarbageCollector_h__
+#define __GarbageCollector_h__
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "boost/lockfree/queue.hpp"
+
+#include "Buffer/Hal/BufferHal.h"
+#include "Nand/Hal/NandHal.h"
+#include "PageMapping.h"
+
+//! Reclaims blocks of a PageMapping by moving their valid sectors to the open blocks
+/*!
+    Collection starts when the free blocks drop to StartFreeBlocks. Up to PipelineDepth NAND commands
+    are in flight at once. Victim pages are read and their valid sectors packed into full pages,
+    so a victim takes as many pages as it has valid sectors rather than one per partly valid page.
+    Sectors rewritten by the host meanwhile are left behind.
+    The GC keeps PipelineDepth + 1 buffers of its own so that host pages waiting on it can't starve it.
+
+    At ThrottleFreeBlocks and below, host pages need a credit to be programmed.
+    Releasing a victim earns as many credits as it had pages that didn't need moving,
+    so host writes proceed at the rate the GC makes space.
+*/
+class GarbageCollector : public NandHal::CommandListener
+{
+public:
+    struct Config
+    {
+        PageMapping::VictimPolicy Policy;
+        U32 StartFreeBlocks;
+        U32 ThrottleFreeBlocks;
+        U32 PipelineDepth;
+    };
+
+    struct Statistics
+    {
+        std::uint64_t RelocatedPages;
+        std::uint64_t RelocatedSectors;
+        U32 CollectedBlocks;
+    };
+
+public:
+    GarbageCollector();
+
+    void Init(NandHal *nandHal, BufferHal *bufferHal, PageMapping *mapping);
+    void SetConfig(const Config &config);
+    inline const Config& GetConfig() const { return _Config; }
+
+    //! Forgets the victim being collected, for when the mapping is formatted
+    void Reset();
+
+    void operator()();
+
+    bool HasHostCredit() const;
+    void SpendHostCredit();
+
+    //! Free blocks host writes must leave to the GC, so that a victim can always be moved
+    inline U32 GetReservedBlockCount() const { return _Mapping->GetDieCount(); }
+
+    //! True while a victim is being collected or one is available, i.e. space is on its way
+    bool CanFreeSpace();
+
+    //! No NAND command in flight
+    bool IsIdle();
+
+    inline const Statistics& GetStatistics() const { return _Statistics; }
+
+    virtual void HandleCommandCompleted(const NandHal::CommandDesc &command);
+
+private:
+    bool IsThrottling() const;
+    bool TakeBuffer(Buffer &buffer);
+    void ReturnBuffer(const Buffer &buffer);
+    void DropBuffer(const Buffer &buffer);
+    void FillBufferPool();
+    U32 GetBufferPoolSize() const;
+
+    void SelectVictim();
+    void ReadNextPages();
+    bool HasValidSector(const U32 &page);
+    bool PackReadPage(const NandHal::CommandDesc &readCommand);
+    bool WritePage(const U32 &packedPage);
+    void OnWriteCompleted(const NandHal::CommandDesc &command);
+    bool IsVictimMoved() const;
+    void ReleaseVictim();
+
+private:
+    NandHal *_NandHal;
+    BufferHal *_BufferHal;
+    PageMapping *_Mapping;
+    Config _Config;
+
+    enum : U32 { NoPackedPage = 0xFFFFFFFF };
+
+    //! Destination page being filled, the slot index is the DescSectorIndex of its program
+    struct PackedPage
+    {
+        Buffer Buffer;
+        U32 SectorCount;
+        std::vector<U32> Sources;   //!< physical sector each packed sector was read from
+    };
+
+    U32 _Victim;
+    U32 _NextPage;
+    U32 _VictimProgrammedPages;
+    U32 _InFlightCount;
+    U32 _DiscardCount;                                //!< completions left from before Reset()
+    std::deque<NandHal::CommandDesc> _ReadPages;     //!< waiting to be packed
+    U32 _ReadPageCursor;                              //!< next sector of the front read page to pack
+
+    std::vector<PackedPage> _PackedPages;
+    std::deque<U32> _FreePackedPages;
+    std::deque<U32> _FullPackedPages;                 //!< waiting for a page to be programmed to
+    U32 _CurrentPackedPage;
+    std::uint64_t _HostCredits;
+
+    std::vector<Buffer> _SpareBuffers;
+    U32 _OwnedBufferCount;
+
+    Statistics _Statistics;
+
+    std::unique_ptr<boost::lockfree::queue<NandHal::CommandDesc>> _CompletedCommands;
+};
+
+#endif
\ No newline at end of file
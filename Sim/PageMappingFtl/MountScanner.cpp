@@ -0,0 +1,113 @@
+#include "MountScanner.h"
+
+MountScanner::MountScanner() :
+    _NandHal(nullptr),
+    _Mapping(nullptr),
+    _Geometry{},
+    _QueueDepth(1),
+    _InFlightCount(0),
+    _Done(true),
+    _Statistics{}
+{
+    _CompletedCommands = std::unique_ptr<boost::lockfree::queue<NandHal::CommandDesc>>(new boost::lockfree::queue<NandHal::CommandDesc>{ 64 });
+}
+
+void MountScanner::Init(NandHal *nandHal, PageMapping *mapping)
+{
+    _NandHal = nandHal;
+    _Mapping = mapping;
+}
+
+void MountScanner::Start(const U32 &queueDepth)
+{
+    assert(_InFlightCount == 0);
+
+    _Geometry = _NandHal->GetGeometry();
+    _QueueDepth = std::max<U32>(queueDepth, 1);
+    U32 dieCount = _Geometry.ChannelCount * _Geometry.DevicesPerChannel;
+    _Dies.assign(dieCount, DieScan{ 0, 0, 0 });
+    _ProgrammedPages.assign(dieCount * _Geometry.BlocksPerDevice, _Geometry.PagesPerBlock);
+    _Done = false;
+    _Statistics = Statistics{};
+
+    for (U32 die = 0; die < dieCount; ++die)
+    {
+        ReadNextSpares(die);
+    }
+}
+
+void MountScanner::operator()()
+{
+    if (_Done)
+    {
+        return;
+    }
+
+    NandHal::CommandDesc command;
+    while (_CompletedCommands->pop(command))
+    {
+        OnSpareRead(command);
+    }
+
+    bool scanned = true;
+    for (U32 die = 0; die < _Dies.size(); ++die)
+    {
+        ReadNextSpares(die);
+        scanned = scanned && _Dies[die].Block == _Geometry.BlocksPerDevice;
+    }
+    _Done = scanned && _InFlightCount == 0;
+}
+
+void MountScanner::ReadNextSpares(const U32 &die)
+{
+    DieScan &scan = _Dies[die];
+    while (scan.InFlightCount < _QueueDepth && scan.Block < _Geometry.BlocksPerDevice)
+    {
+        U32 blockIndex = scan.Block * static_cast<U32>(_Dies.size()) + die;
+
+        NandHal::CommandDesc commandDesc;
+        _Mapping->ToNandAddress(blockIndex, scan.Page, commandDesc.Address);
+        commandDesc.Operation = NandHal::CommandDesc::Op::ReadSpare;
+        commandDesc.Spare = _Mapping->GetSpare(blockIndex, scan.Page);
+        commandDesc.Listener = this;
+        _NandHal->QueueCommand(commandDesc);
+
+        ++scan.InFlightCount;
+        ++_InFlightCount;
+        ++_Statistics.SpareReads;
+        if (++scan.Page == _Geometry.PagesPerBlock)
+        {
+            scan.Block++;
+            scan.Page = 0;
+        }
+    }
+}
+
+void MountScanner::OnSpareRead(const NandHal::CommandDesc &command)
+{
+    U32 blockIndex = command.Address.Block._ * static_cast<U32>(_Dies.size()) + _Mapping->ToDie(command.Address);
+    U32 page = command.Address.Page._;
+    DieScan &scan = _Dies[_Mapping->ToDie(command.Address)];
+    --scan.InFlightCount;
+    --_InFlightCount;
+
+    if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
+    {
+        _Mapping->SetSpareUnreadable(blockIndex, page);
+    }
+    else if (_Mapping->IsSpareErased(blockIndex, page) && page < _ProgrammedPages[blockIndex])
+    {
+        // The rest of the block is erased as well, reads already queued past it are ignored
+        _ProgrammedPages[blockIndex] = page;
+        if (scan.Block == command.Address.Block._ && scan.Page > page)
+        {
+            scan.Block++;
+            scan.Page = 0;
+        }
+    }
+}
+
+void MountScanner::HandleCommandCompleted(const NandHal::CommandDesc &command)
+{
+    _CompletedCommands->push(command);
+}
\ No newline at end of file
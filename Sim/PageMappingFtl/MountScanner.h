@@ -0,0 +1,72 @@
+#ifndef __MountScanner_h__
+#define __MountScanner_h__
+
+#include <memory>
+#include <vector>
+
+#include "boost/lockfree/queue.hpp"
+
+#include "Nand/Hal/NandHal.h"
+#include "PageMapping.h"
+
+//! Reads the spare area of every programmed page into a PageMapping, for it to rebuild the mapping of a drive written before
+/*!
+    Only spare areas are read, never page data. Every die is scanned at once with up to QueueDepth reads in flight each,
+    its blocks one after the other. Pages of a block are programmed in order, so the scan of a block stops at its
+    first erased page and a block whose first page is erased is free.
+*/
+class MountScanner : public NandHal::CommandListener
+{
+public:
+    struct Statistics
+    {
+        std::uint64_t SpareReads;
+    };
+
+public:
+    MountScanner();
+
+    void Init(NandHal *nandHal, PageMapping *mapping);
+
+    //! The mapping must be formatted for the geometry
+    void Start(const U32 &queueDepth);
+
+    void operator()();
+
+    //! Pages found programmed in each block, for PageMapping::Rebuild()
+    inline const std::vector<U32>& GetProgrammedPages() const { return _ProgrammedPages; }
+
+    //! Every spare area is read and no read is in flight
+    inline bool IsDone() const { return _Done; }
+
+    inline const Statistics& GetStatistics() const { return _Statistics; }
+
+    virtual void HandleCommandCompleted(const NandHal::CommandDesc &command);
+
+private:
+    void ReadNextSpares(const U32 &die);
+    void OnSpareRead(const NandHal::CommandDesc &command);
+
+private:
+    NandHal *_NandHal;
+    PageMapping *_Mapping;
+    NandHal::Geometry _Geometry;
+    U32 _QueueDepth;
+
+    struct DieScan
+    {
+        U32 Block;
+        U32 Page;
+        U32 InFlightCount;
+    };
+    std::vector<DieScan> _Dies;
+    std::vector<U32> _ProgrammedPages;      //!< per block, indexed by block * dies + die. PagesPerBlock until an erased page is read
+    U32 _InFlightCount;
+    bool _Done;
+
+    Statistics _Statistics;
+
+    std::unique_ptr<boost::lockfree::queue<NandHal::CommandDesc>> _CompletedCommands;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,721 @@
+#ifndef __PageMapping_h__
+#define __PageMapping_h__
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "Nand/Hal/NandHal.h"
+
+//! Logical to physical sector table of a log structured FTL
+/*!
+    A rewritten LBA goes to a new physical sector and its previous one is invalidated.
+    Pages are handed out from one open block per die, in die order with the channel changing first,
+    so consecutive pages are programmed on different channels then on different devices.
+    Physical sectors are numbered ((block * dies + die) * pagesPerBlock + page) * sectorsPerPage + sector.
+
+    Fully programmed blocks are indexed by valid sector count, one list per count,
+    so that a greedy victim is the head of the lowest non empty list.
+
+    An LBA can also point to a 32 bit pattern instead of a physical sector, its sector reads as the pattern repeated.
+    Such LBAs take no NAND space, the patterns in use are kept in a small table whose entries are the top logical values.
+
+    Each page is programmed with a SpareEntry per sector in its spare area, the LBA and the sequence number of the write
+    that brought the data in, so that a mount can rebuild the mapping from them. The latest write of an LBA wins.
+    Trims and patterns are only in the mapping, a mount brings back what their LBAs held on NAND before them.
+*/
+class PageMapping
+{
+public:
+    enum : U32 { Unmapped = 0xFFFFFFFF, NoBlock = 0xFFFFFFFF, PatternCount = 256, FirstPattern = Unmapped - PatternCount };
+
+    //! Entry 0 of the spare area of a page is a header, Lba holding the sectors per page and Sequence the format it was programmed in
+    struct SpareEntry
+    {
+        std::uint32_t Lba;          //!< ErasedSpare when the sector holds nothing
+        std::uint32_t Sequence;
+    };
+    enum : std::uint32_t { ErasedSpare = 0xFFFFFFFF };
+
+    enum class VictimPolicy
+    {
+        Greedy,         //!< fewest valid sectors
+        CostBenefit,    //!< best (1 - u) * age / (1 + u) among the emptiest blocks, u being the valid ratio
+    };
+
+public:
+    PageMapping() : _SectorsPerPage(0), _DieCount(0), _LbaCount(0), _SpareEntriesPerPage(0), _NextSequence(0), _FormatSequence(0),
+        _NextDie(0), _FreeBlockCount(0), _MinBucket(0), _ProgrammedPageCount(0), _OpenedBlockCount(0)
+    {
+    }
+
+    //! Sectors of a page that leave room in its spare area for their entries and the header
+    static inline U32 GetMaxSectorsPerPage(const NandHal::Geometry &geometry)
+    {
+        return NandHal::GetSpareBytesPerPage(geometry) / sizeof(SpareEntry) - 1;
+    }
+
+    //! Forgets every mapping, reservedBlocksPerDie are kept out of the user capacity
+    void Format(const NandHal::Geometry &geometry, U8 sectorsPerPage, U32 reservedBlocksPerDie)
+    {
+        assert(sectorsPerPage <= GetMaxSectorsPerPage(geometry));
+        _Geometry = geometry;
+        _SectorsPerPage = sectorsPerPage;
+        _DieCount = geometry.ChannelCount * geometry.DevicesPerChannel;
+        U32 blockCount = geometry.BlocksPerDevice * _DieCount;
+
+        reservedBlocksPerDie = std::min(reservedBlocksPerDie, geometry.BlocksPerDevice - 1);
+        _LbaCount = (geometry.BlocksPerDevice - reservedBlocksPerDie) * _DieCount * geometry.PagesPerBlock * _SectorsPerPage;
+        _LogicalToPhysical.assign(_LbaCount, Unmapped);
+        _MappedSectorCounts.assign((_LbaCount + MappedChunkSectors - 1) / MappedChunkSectors, 0);
+        _PhysicalToLogical.assign(blockCount * geometry.PagesPerBlock * _SectorsPerPage, Unmapped);
+        assert(_PhysicalToLogical.size() <= FirstPattern);
+        _Patterns.assign(PatternCount, 0);
+        _PatternLbaCounts.assign(PatternCount, 0);
+        _ValidSectorCount.assign(blockCount, 0);
+        _BlockStates.assign(blockCount, BlockState::Free);
+        _PendingProgramCount.assign(blockCount, 0);
+        _ClosedTime.assign(blockCount, 0);
+        _BucketNext.assign(blockCount, NoBlock);
+        _BucketPrevious.assign(blockCount, NoBlock);
+        _BucketHeads.assign(geometry.PagesPerBlock * _SectorsPerPage + 1, NoBlock);
+        _MinBucket = static_cast<U32>(_BucketHeads.size());
+
+        // Sized by the geometry only, so that programs still in flight from before keep their spare area
+        _SpareEntriesPerPage = NandHal::GetSpareBytesPerPage(geometry) / sizeof(SpareEntry);
+        size_t spareEntryCount = static_cast<size_t>(blockCount) * geometry.PagesPerBlock * _SpareEntriesPerPage;
+        if (_Spares.size() != spareEntryCount)
+        {
+            _Spares.assign(spareEntryCount, SpareEntry{ ErasedSpare, ErasedSpare });
+        }
+        _FormatSequence = _NextSequence;
+
+        _FreeBlocks.assign(_DieCount, std::deque<U32>());
+        for (U32 die = 0; die < _DieCount; ++die)
+        {
+            for (U32 block = 0; block < geometry.BlocksPerDevice; ++block)
+            {
+                _FreeBlocks[die].push_back(block);
+            }
+        }
+        _OpenBlocks.assign(_DieCount, OpenBlock{ 0, geometry.PagesPerBlock });
+        _NextDie = 0;
+        _FreeBlockCount = blockCount;
+        _ProgrammedPageCount = 0;
+        _OpenedBlockCount = 0;
+    }
+
+    inline U32 GetLbaCount() const { return _LbaCount; }
+    inline U8 GetSectorsPerPage() const { return _SectorsPerPage; }
+    inline U32 GetPagesPerBlock() const { return _Geometry.PagesPerBlock; }
+
+    //! Same contract as SimpleFtlTranslation::LbaToNandAddress, the run stops where the next LBA isn't in the same physical page
+    /*!
+        Unmapped LBAs are gathered into runs of up to a page with mapped set to false, nandAddress then only carries the SectorCount.
+    */
+    void LbaToNandAddress(const U32 &lba, const U32 &sectorCount,
+        NandHal::NandAddress &nandAddress, U32 &nextLba, U32 &remainSectorCount, bool &mapped) const
+    {
+        U32 pattern;
+        LbaToNandAddress(lba, sectorCount, nandAddress, nextLba, remainSectorCount, mapped, pattern);
+    }
+
+    //! Also gives the pattern of a run that isn't mapped to NAND, 0 for never written LBAs
+    void LbaToNandAddress(const U32 &lba, const U32 &sectorCount,
+        NandHal::NandAddress &nandAddress, U32 &nextLba, U32 &remainSectorCount, bool &mapped, U32 &pattern) const
+    {
+        assert(lba + sectorCount <= _LbaCount);
+
+        U32 physicalSector = _LogicalToPhysical[lba];
+        mapped = (physicalSector < FirstPattern);
+        pattern = (mapped || physicalSector == Unmapped) ? 0 : _Patterns[physicalSector - FirstPattern];
+
+        U32 count = 1;
+        if (mapped)
+        {
+            ToNandAddress(physicalSector, nandAddress);
+            while (count < sectorCount
+                && nandAddress.Sector._ + count < _SectorsPerPage
+                && _LogicalToPhysical[lba + count] == physicalSector + count)
+            {
+                ++count;
+            }
+        }
+        else
+        {
+            nandAddress.Sector._ = 0;
+            while (count < sectorCount && count < _SectorsPerPage && _LogicalToPhysical[lba + count] == physicalSector)
+            {
+                ++count;
+            }
+        }
+
+        nandAddress.SectorCount._ = count;
+        nextLba = lba + count;
+        remainSectorCount = sectorCount - count;
+    }
+
+    //! Next page to program, in program order. Returns false once no die has a free page left
+    /*!
+        openedBlock is set when the page is the first of a block, which must be erased before it's programmed.
+        No block is opened while there are keptFreeBlocks or fewer left.
+    */
+    bool AllocatePage(NandHal::NandAddress &nandAddress, bool &openedBlock, U32 keptFreeBlocks = 0)
+    {
+        for (U32 attempt = 0; attempt < _DieCount; ++attempt)
+        {
+            U32 die = _NextDie;
+            _NextDie = (_NextDie + 1) % _DieCount;
+            if (AllocatePage(die, nandAddress, openedBlock, keptFreeBlocks))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! Same as above on the given die only, for data that can't leave it. The die order of the other pages is left as is
+    bool AllocatePage(const U32 &die, NandHal::NandAddress &nandAddress, bool &openedBlock, U32 keptFreeBlocks = 0)
+    {
+        OpenBlock &openBlock = _OpenBlocks[die];
+        openedBlock = (openBlock.NextPage == _Geometry.PagesPerBlock);
+        if (openedBlock)
+        {
+            if (_FreeBlocks[die].empty() || _FreeBlockCount <= keptFreeBlocks)
+            {
+                return false;
+            }
+            openBlock.Block = _FreeBlocks[die].front();
+            openBlock.NextPage = 0;
+            _FreeBlocks[die].pop_front();
+            _BlockStates[openBlock.Block * _DieCount + die] = BlockState::Open;
+            --_FreeBlockCount;
+            ++_OpenedBlockCount;
+        }
+
+        ++_PendingProgramCount[openBlock.Block * _DieCount + die];
+        ++_ProgrammedPageCount;
+
+        nandAddress.Channel._ = die % _Geometry.ChannelCount;
+        nandAddress.Device._ = die / _Geometry.ChannelCount;
+        nandAddress.Block._ = openBlock.Block;
+        nandAddress.Page._ = openBlock.NextPage++;
+        nandAddress.Sector._ = 0;
+        nandAddress.SectorCount._ = _SectorsPerPage;
+        return true;
+    }
+
+    //! Points [lba, lba + sectorCount) to the sectors of nandAddress and invalidates their previous location
+    void Update(const U32 &lba, const U32 &sectorCount, const NandHal::NandAddress &nandAddress)
+    {
+        assert(lba + sectorCount <= _LbaCount);
+        assert(nandAddress.Sector._ + sectorCount <= _SectorsPerPage);
+
+        U32 physicalSector = ToPhysicalSector(nandAddress);
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            Invalidate(lba + i);
+            _LogicalToPhysical[lba + i] = physicalSector + i;
+            _PhysicalToLogical[physicalSector + i] = lba + i;
+            ++_MappedSectorCounts[(lba + i) / MappedChunkSectors];
+        }
+        U32 blockIndex = ToBlockIndex(physicalSector);
+        SetValidSectorCount(blockIndex, _ValidSectorCount[blockIndex] + sectorCount);
+    }
+
+    //! Unmaps [lba, lba + sectorCount), the GC leaves their sectors behind and reads get the unmapped data
+    /*!
+        Chunks of LBAs with nothing mapped are skipped whole, the cost follows what was written rather than the range size.
+    */
+    void Trim(const U32 &lba, const U32 &sectorCount)
+    {
+        assert(lba + sectorCount <= _LbaCount);
+
+        U32 endLba = lba + sectorCount;
+        for (U32 current = lba; current < endLba; )
+        {
+            U32 chunk = current / MappedChunkSectors;
+            U32 chunkEndLba = std::min<U32>(endLba, (chunk + 1) * MappedChunkSectors);
+            for (; _MappedSectorCounts[chunk] > 0 && current < chunkEndLba; ++current)
+            {
+                Invalidate(current);
+            }
+            current = chunkEndLba;
+        }
+    }
+
+    //! Points [lba, lba + sectorCount) to the pattern, false if the pattern table is full
+    /*!
+        A zero pattern unmaps the LBAs instead, they read back as zeroes all the same.
+    */
+    bool SetPattern(const U32 &lba, const U32 &sectorCount, const U32 &pattern)
+    {
+        assert(lba + sectorCount <= _LbaCount);
+
+        if (pattern == 0)
+        {
+            Trim(lba, sectorCount);
+            return true;
+        }
+
+        U32 entry = PatternCount;
+        for (U32 i = 0; i < PatternCount; ++i)
+        {
+            if (_PatternLbaCounts[i] > 0 && _Patterns[i] == pattern)
+            {
+                entry = i;
+                break;
+            }
+            if (_PatternLbaCounts[i] == 0 && entry == PatternCount)
+            {
+                entry = i;
+            }
+        }
+        if (entry == PatternCount)
+        {
+            return false;
+        }
+
+        // Taken before the LBAs are invalidated, so that a pattern they held already isn't released meanwhile
+        _Patterns[entry] = pattern;
+        _PatternLbaCounts[entry] += sectorCount;
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            Invalidate(lba + i);
+            _LogicalToPhysical[lba + i] = FirstPattern + entry;
+            ++_MappedSectorCounts[(lba + i) / MappedChunkSectors];
+        }
+        return true;
+    }
+
+    //! Must follow every page from AllocatePage() once its program has completed, successful or not
+    /*!
+        A block only becomes a GC candidate once all of its pages are programmed,
+        before that its valid count doesn't account for the data still on its way.
+    */
+    void ProgramCompleted(const NandHal::NandAddress &nandAddress)
+    {
+        U32 blockIndex = ToBlockIndex(ToPhysicalSector(nandAddress));
+        assert(_PendingProgramCount[blockIndex] > 0);
+        --_PendingProgramCount[blockIndex];
+
+        U32 die = blockIndex % _DieCount;
+        bool open = (_OpenBlocks[die].Block == blockIndex / _DieCount) && (_OpenBlocks[die].NextPage < _Geometry.PagesPerBlock);
+        if (_PendingProgramCount[blockIndex] == 0 && !open && _BlockStates[blockIndex] == BlockState::Open)
+        {
+            _BlockStates[blockIndex] = BlockState::Closed;
+            _ClosedTime[blockIndex] = _ProgrammedPageCount;
+            InsertInBucket(blockIndex);
+        }
+    }
+
+    //! Takes the block to collect out of the index, NoBlock when no block would free any space
+    U32 SelectVictim(VictimPolicy policy, U32 costBenefitCandidates = 32)
+    {
+        U32 fullBucket = static_cast<U32>(_BucketHeads.size()) - 1;
+        while (_MinBucket < fullBucket && _BucketHeads[_MinBucket] == NoBlock)
+        {
+            ++_MinBucket;
+        }
+        if (_MinBucket >= fullBucket)
+        {
+            return NoBlock;
+        }
+
+        U32 victim = _BucketHeads[_MinBucket];
+        if (policy == VictimPolicy::CostBenefit)
+        {
+            // Only the emptiest blocks are scored, which keeps the selection bounded
+            double bestScore = -1;
+            U32 candidates = 0;
+            for (U32 bucket = _MinBucket; bucket < fullBucket && candidates < costBenefitCandidates; ++bucket)
+            {
+                for (U32 block = _BucketHeads[bucket]; block != NoBlock && candidates < costBenefitCandidates; block = _BucketNext[block])
+                {
+                    double utilization = static_cast<double>(bucket) / fullBucket;
+                    double age = static_cast<double>(_ProgrammedPageCount - _ClosedTime[block]) + 1;
+                    double score = (1 - utilization) * age / (1 + utilization);
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        victim = block;
+                    }
+                    ++candidates;
+                }
+            }
+        }
+
+        RemoveFromBucket(victim);
+        _BlockStates[victim] = BlockState::Collecting;
+        return victim;
+    }
+
+    //! Returns a collected block to the free blocks of its die, it is erased when opened again
+    void ReleaseBlock(const U32 &blockIndex)
+    {
+        assert(_BlockStates[blockIndex] == BlockState::Collecting);
+        assert(_ValidSectorCount[blockIndex] == 0);
+
+        _BlockStates[blockIndex] = BlockState::Free;
+        _FreeBlocks[blockIndex % _DieCount].push_back(blockIndex / _DieCount);
+        ++_FreeBlockCount;
+    }
+
+    //! Spare area to program the page at nandAddress with, [lba, lba + sectorCount) from its sector are written now
+    U8* SetSpare(const NandHal::NandAddress &nandAddress, const U32 &lba, const U32 &sectorCount)
+    {
+        assert(nandAddress.Sector._ + sectorCount <= _SectorsPerPage);
+
+        SpareEntry *entries = ClearSpare(nandAddress);
+        std::uint32_t sequence = _NextSequence++;
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            entries[1 + nandAddress.Sector._ + i] = SpareEntry{ static_cast<std::uint32_t>(lba + i), sequence };
+        }
+        return reinterpret_cast<U8*>(entries);
+    }
+
+    //! Same for sectors moved from the physical sectors in sources, they keep the sequence number of their write
+    /*!
+        So an LBA the host writes again while its sector is being moved is still found at the new write on mount.
+        Sources no longer mapped are left out.
+    */
+    U8* SetSpare(const NandHal::NandAddress &nandAddress, const std::vector<U32> &sources, const U32 &sectorCount)
+    {
+        assert(sectorCount <= _SectorsPerPage && sectorCount <= sources.size());
+
+        SpareEntry *entries = ClearSpare(nandAddress);
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            U32 lba = _PhysicalToLogical[sources[i]];
+            if (lba != Unmapped)
+            {
+                entries[1 + i] = SpareEntry{ static_cast<std::uint32_t>(lba), _Spares[ToSpareIndex(sources[i])].Sequence };
+            }
+        }
+        return reinterpret_cast<U8*>(entries);
+    }
+
+    //! Spare area of a page of a block, for a mount to read into
+    inline U8* GetSpare(const U32 &blockIndex, const U32 &page)
+    {
+        return reinterpret_cast<U8*>(&_Spares[(blockIndex * _Geometry.PagesPerBlock + page) * _SpareEntriesPerPage]);
+    }
+
+    inline bool IsSpareErased(const U32 &blockIndex, const U32 &page) const
+    {
+        return _Spares[(blockIndex * _Geometry.PagesPerBlock + page) * _SpareEntriesPerPage].Lba == ErasedSpare;
+    }
+
+    //! For a page whose spare area couldn't be read, it's programmed but none of its sectors are found
+    inline void SetSpareUnreadable(const U32 &blockIndex, const U32 &page)
+    {
+        _Spares[(blockIndex * _Geometry.PagesPerBlock + page) * _SpareEntriesPerPage] = SpareEntry{ 0, 0 };
+    }
+
+    //! Sectors per page of the newest format the programmed pages hold, 0 if none of them has a readable spare area
+    /*!
+        programmedPages is per block, the pages of a block below it are the ones a mount has read the spare area of.
+    */
+    U32 GetMountedSectorsPerPage(const std::vector<U32> &programmedPages) const
+    {
+        U32 sectorsPerPage = 0;
+        std::uint32_t formatSequence = 0;
+        ForEachPageHeader(programmedPages, [&](const U32 &, const U32 &, const SpareEntry &header)
+        {
+            if (header.Lba > 0 && header.Lba <= GetMaxSectorsPerPage(_Geometry) && (sectorsPerPage == 0 || header.Sequence > formatSequence))
+            {
+                sectorsPerPage = header.Lba;
+                formatSequence = header.Sequence;
+            }
+        });
+        return sectorsPerPage;
+    }
+
+    //! Maps every LBA to the sector holding its latest write among the programmed pages, after a Format() with the sectors per page they were written in
+    /*!
+        Pages of older formats are left out. Blocks holding a mapped sector are closed, partly programmed ones included,
+        the others are free since opening a block erases it. Returns how many LBAs are mapped.
+    */
+    U32 Rebuild(const std::vector<U32> &programmedPages)
+    {
+        assert(programmedPages.size() == GetBlockCount());
+
+        std::uint32_t lastSequence = 0;
+        bool formatFound = false;
+        ForEachPageHeader(programmedPages, [&](const U32 &, const U32 &, const SpareEntry &header)
+        {
+            if (header.Lba == _SectorsPerPage && (!formatFound || header.Sequence > _FormatSequence))
+            {
+                _FormatSequence = header.Sequence;
+                formatFound = true;
+            }
+        });
+
+        U32 mappedCount = 0;
+        ForEachPageHeader(programmedPages, [&](const U32 &blockIndex, const U32 &page, const SpareEntry &header)
+        {
+            if (header.Lba != _SectorsPerPage || header.Sequence != _FormatSequence)
+            {
+                return;
+            }
+
+            U32 physicalSector = (blockIndex * _Geometry.PagesPerBlock + page) * _SectorsPerPage;
+            const SpareEntry *entries = &_Spares[(blockIndex * _Geometry.PagesPerBlock + page) * _SpareEntriesPerPage];
+            for (U32 sector = 0; sector < _SectorsPerPage; ++sector)
+            {
+                const SpareEntry &entry = entries[1 + sector];
+                if (entry.Lba >= _LbaCount)
+                {
+                    continue;
+                }
+
+                lastSequence = std::max(lastSequence, entry.Sequence);
+                U32 current = _LogicalToPhysical[entry.Lba];
+                if (current == Unmapped)
+                {
+                    ++mappedCount;
+                }
+                else if (_Spares[ToSpareIndex(current)].Sequence >= entry.Sequence)
+                {
+                    // Equal when it's the same write moved by the GC, either copy does
+                    continue;
+                }
+
+                Invalidate(entry.Lba);
+                _LogicalToPhysical[entry.Lba] = physicalSector + sector;
+                _PhysicalToLogical[physicalSector + sector] = entry.Lba;
+                ++_MappedSectorCounts[entry.Lba / MappedChunkSectors];
+                ++_ValidSectorCount[blockIndex];
+            }
+        });
+
+        // Writes carry on after the newest sequence number found
+        _NextSequence = formatFound ? std::max(lastSequence, _FormatSequence) + 1 : _NextSequence;
+
+        for (auto &freeBlocks : _FreeBlocks)
+        {
+            freeBlocks.clear();
+        }
+        _FreeBlockCount = 0;
+        for (U32 block = 0; block < _Geometry.BlocksPerDevice; ++block)
+        {
+            for (U32 die = 0; die < _DieCount; ++die)
+            {
+                U32 blockIndex = block * _DieCount + die;
+                if (_ValidSectorCount[blockIndex] == 0)
+                {
+                    _FreeBlocks[die].push_back(block);
+                    ++_FreeBlockCount;
+                }
+                else
+                {
+                    _BlockStates[blockIndex] = BlockState::Closed;
+                    InsertInBucket(blockIndex);
+                }
+            }
+        }
+        return mappedCount;
+    }
+
+    //! nandAddress of the first sector of a page of a block
+    void ToNandAddress(const U32 &blockIndex, const U32 &page, NandHal::NandAddress &nandAddress) const
+    {
+        ToNandAddress((blockIndex * _Geometry.PagesPerBlock + page) * _SectorsPerPage, nandAddress);
+        nandAddress.SectorCount._ = _SectorsPerPage;
+    }
+
+    //! FirstPattern and above when the LBA holds a pattern
+    inline U32 GetPhysicalSector(const U32 &lba) const { return _LogicalToPhysical[lba]; }
+
+    //! Unmapped unless the sector still holds the latest copy of an LBA
+    inline U32 GetLogicalSector(const U32 &physicalSector) const { return _PhysicalToLogical[physicalSector]; }
+
+    inline U32 GetBlockCount() const { return static_cast<U32>(_ValidSectorCount.size()); }
+    inline U32 GetValidSectorCount(const U32 &blockIndex) const { return _ValidSectorCount[blockIndex]; }
+
+    inline U32 GetFreeBlockCount() const { return _FreeBlockCount; }
+    inline U32 GetDieCount() const { return _DieCount; }
+
+    //! Pages handed out by AllocatePage() and blocks opened, hence erased, since the last Format()
+    inline std::uint64_t GetProgrammedPageCount() const { return _ProgrammedPageCount; }
+    inline U32 GetOpenedBlockCount() const { return _OpenedBlockCount; }
+
+    inline U32 ToDie(const NandHal::NandAddress &nandAddress) const
+    {
+        return nandAddress.Device._ * _Geometry.ChannelCount + nandAddress.Channel._;
+    }
+
+    U32 ToPhysicalSector(const NandHal::NandAddress &nandAddress) const
+    {
+        U32 die = ToDie(nandAddress);
+        U32 blockIndex = nandAddress.Block._ * _DieCount + die;
+        return ((blockIndex * _Geometry.PagesPerBlock) + nandAddress.Page._) * _SectorsPerPage + nandAddress.Sector._;
+    }
+
+    void ToNandAddress(const U32 &physicalSector, NandHal::NandAddress &nandAddress) const
+    {
+        U32 page = physicalSector / _SectorsPerPage;
+        U32 blockIndex = page / _Geometry.PagesPerBlock;
+        U32 die = blockIndex % _DieCount;
+        nandAddress.Channel._ = die % _Geometry.ChannelCount;
+        nandAddress.Device._ = die / _Geometry.ChannelCount;
+        nandAddress.Block._ = blockIndex / _DieCount;
+        nandAddress.Page._ = page % _Geometry.PagesPerBlock;
+        nandAddress.Sector._ = physicalSector % _SectorsPerPage;
+        nandAddress.SectorCount._ = 1;
+    }
+
+    inline U32 ToBlockIndex(const U32 &physicalSector) const
+    {
+        return physicalSector / (_Geometry.PagesPerBlock * _SectorsPerPage);
+    }
+
+private:
+    inline size_t ToSpareIndex(const U32 &physicalSector) const
+    {
+        return static_cast<size_t>(physicalSector / _SectorsPerPage) * _SpareEntriesPerPage + 1 + physicalSector % _SectorsPerPage;
+    }
+
+    SpareEntry* ClearSpare(const NandHal::NandAddress &nandAddress)
+    {
+        U32 page = ToPhysicalSector(nandAddress) / _SectorsPerPage;
+        SpareEntry *entries = &_Spares[static_cast<size_t>(page) * _SpareEntriesPerPage];
+        entries[0] = SpareEntry{ static_cast<std::uint32_t>(_SectorsPerPage), _FormatSequence };
+        std::fill(entries + 1, entries + _SpareEntriesPerPage, SpareEntry{ ErasedSpare, ErasedSpare });
+        return entries;
+    }
+
+    template<typename Function>
+    void ForEachPageHeader(const std::vector<U32> &programmedPages, Function function) const
+    {
+        for (U32 blockIndex = 0; blockIndex < GetBlockCount(); ++blockIndex)
+        {
+            for (U32 page = 0; page < programmedPages[blockIndex]; ++page)
+            {
+                function(blockIndex, page, _Spares[(blockIndex * _Geometry.PagesPerBlock + page) * _SpareEntriesPerPage]);
+            }
+        }
+    }
+
+    void Invalidate(const U32 &lba)
+    {
+        U32 physicalSector = _LogicalToPhysical[lba];
+        if (physicalSector == Unmapped)
+        {
+            return;
+        }
+
+        if (physicalSector >= FirstPattern)
+        {
+            --_PatternLbaCounts[physicalSector - FirstPattern];
+        }
+        else
+        {
+            _PhysicalToLogical[physicalSector] = Unmapped;
+            U32 blockIndex = ToBlockIndex(physicalSector);
+            SetValidSectorCount(blockIndex, _ValidSectorCount[blockIndex] - 1);
+        }
+        _LogicalToPhysical[lba] = Unmapped;
+        --_MappedSectorCounts[lba / MappedChunkSectors];
+    }
+
+    void SetValidSectorCount(const U32 &blockIndex, const U32 &count)
+    {
+        if (_BlockStates[blockIndex] != BlockState::Closed)
+        {
+            _ValidSectorCount[blockIndex] = count;
+            return;
+        }
+
+        RemoveFromBucket(blockIndex);
+        _ValidSectorCount[blockIndex] = count;
+        InsertInBucket(blockIndex);
+    }
+
+    void InsertInBucket(const U32 &blockIndex)
+    {
+        U32 bucket = _ValidSectorCount[blockIndex];
+        _BucketPrevious[blockIndex] = NoBlock;
+        _BucketNext[blockIndex] = _BucketHeads[bucket];
+        if (_BucketHeads[bucket] != NoBlock)
+        {
+            _BucketPrevious[_BucketHeads[bucket]] = blockIndex;
+        }
+        _BucketHeads[bucket] = blockIndex;
+        _MinBucket = std::min(_MinBucket, bucket);
+    }
+
+    void RemoveFromBucket(const U32 &blockIndex)
+    {
+        U32 next = _BucketNext[blockIndex];
+        U32 previous = _BucketPrevious[blockIndex];
+        if (previous != NoBlock)
+        {
+            _BucketNext[previous] = next;
+        }
+        else
+        {
+            _BucketHeads[_ValidSectorCount[blockIndex]] = next;
+        }
+        if (next != NoBlock)
+        {
+            _BucketPrevious[next] = previous;
+        }
+    }
+
+private:
+    enum class BlockState : U8
+    {
+        Free,
+        Open,           //!< being programmed
+        Closed,         //!< fully programmed, in the valid count index
+        Collecting,     //!< taken by the GC
+    };
+
+    enum : U32 { MappedChunkSectors = 1024 };
+
+    struct OpenBlock
+    {
+        U32 Block;
+        U32 NextPage;       //!< PagesPerBlock once full
+    };
+
+    NandHal::Geometry _Geometry;
+    U8 _SectorsPerPage;
+    U32 _DieCount;
+    U32 _LbaCount;
+
+    std::vector<SpareEntry> _Spares;        //!< _SpareEntriesPerPage per page, as last programmed or read by a mount
+    U32 _SpareEntriesPerPage;
+    std::uint32_t _NextSequence;            //!< 32 bits like on NAND, wrapping around isn't handled
+    std::uint32_t _FormatSequence;          //!< sequence number at the last Format()
+
+    std::vector<U32> _LogicalToPhysical;
+    std::vector<U32> _PhysicalToLogical;
+    std::vector<U32> _MappedSectorCounts;   //!< per MappedChunkSectors LBAs, lets a trim skip what was never written
+    std::vector<U32> _Patterns;             //!< LBAs at FirstPattern + i hold _Patterns[i]
+    std::vector<U32> _PatternLbaCounts;     //!< an entry is free again once no LBA holds it
+    std::vector<U32> _ValidSectorCount;     //!< per block, indexed by block * dies + die
+    std::vector<BlockState> _BlockStates;
+    std::vector<U32> _PendingProgramCount;
+    std::vector<std::uint64_t> _ClosedTime;      //!< in programmed pages
+
+    std::vector<U32> _BucketHeads;          //!< per valid sector count
+    std::vector<U32> _BucketNext;           //!< per block
+    std::vector<U32> _BucketPrevious;       //!< per block
+    U32 _MinBucket;                         //!< no closed block has fewer valid sectors
+
+    std::vector<std::deque<U32>> _FreeBlocks;   //!< per die, oldest released first
+    std::vector<OpenBlock> _OpenBlocks;         //!< per die
+    U32 _NextDie;
+    U32 _FreeBlockCount;
+
+    std::uint64_t _ProgrammedPageCount;
+    U32 _OpenedBlockCount;
+};
+
+#endif
\ No newline at end of file
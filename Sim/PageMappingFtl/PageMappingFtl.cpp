@@ -0,0 +1,937 @@
+#include <algorithm>
+#include <cstring>
+
+#include "PageMappingFtl.h"
+
+PageMappingFtl::PageMappingFtl() : _Mounted(false), _MountTimeUs(0), _HostSectorsWritten(0), _CopybackPageCount(0), _PatternDataValue(0), _ProcessingCommand(nullptr), _OpenCopyPage(NoCopyPage)
+{
+    _EventQueue = std::unique_ptr<boost::lockfree::queue<Event>>(new boost::lockfree::queue<Event>{ 1024 });
+}
+
+void PageMappingFtl::SetProtocol(CustomProtocolHal *customProtocolHal)
+{
+    _CustomProtocolHal = customProtocolHal;
+}
+
+void PageMappingFtl::SetNandHal(NandHal *nandHal)
+{
+    _NandHal = nandHal;
+    NandHal::Geometry geometry = _NandHal->GetGeometry();
+
+    _PatternData = std::unique_ptr<U8[]>(new U8[geometry.BytesPerPage]);
+    std::memset(_PatternData.get(), 0, geometry.BytesPerPage);
+    _PatternDataValue = 0;
+}
+
+void PageMappingFtl::SetBufferHal(BufferHal *bufferHal)
+{
+    _BufferHal = bufferHal;
+    _GarbageCollector.Init(_NandHal, _BufferHal, &_Mapping);
+    _MountScanner.Init(_NandHal, &_Mapping);
+    SetSectorInfo(DefaultSectorInfo);
+
+    // Collect from 4 free blocks per die and pace the host from 2, moving 2 pages at a time
+    U32 dieCount = _Mapping.GetDieCount();
+    _GarbageCollector.SetConfig(GarbageCollector::Config{ PageMapping::VictimPolicy::Greedy, 4 * dieCount, 2 * dieCount, 2 });
+}
+
+bool PageMappingFtl::SetSectorInfo(const SectorInfo &sectorInfo)
+{
+    // Each sector of a page takes an entry of its spare area
+    NandHal::Geometry geometry = _NandHal->GetGeometry();
+    U32 sectorsPerPage = geometry.BytesPerPage >> sectorInfo.SectorSizeInBit;
+    if (sectorsPerPage == 0 || sectorsPerPage > PageMapping::GetMaxSectorsPerPage(geometry) || _BufferHal->SetSectorInfo(sectorInfo) == false)
+    {
+        return false;
+    }
+
+    _SectorsPerPage = sectorsPerPage;
+    _BufferHal->SetImplicitAllocationSectorCount(_SectorsPerPage);
+
+    // The mapping is in sectors, changing their size formats the drive
+    // Part of each die is kept out of the user capacity so that there is always somewhere to write
+    U32 reservedBlocksPerDie = std::max<U32>(2, geometry.BlocksPerDevice / 16);
+    _Mapping.Format(geometry, _SectorsPerPage, reservedBlocksPerDie);
+    _GarbageCollector.Reset();
+    _HostSectorsWritten = 0;
+    _CopybackPageCount = 0;
+
+    return true;
+}
+
+bool PageMappingFtl::SetGarbageCollection(const GarbageCollectionPayload &payload)
+{
+    if (payload.ThrottleFreeBlocks > payload.StartFreeBlocks || payload.PipelineDepth == 0)
+    {
+        return false;
+    }
+
+    GarbageCollector::Config config;
+    config.Policy = (payload.VictimPolicy == GarbageCollectionPayload::Policy::CostBenefit)
+        ? PageMapping::VictimPolicy::CostBenefit : PageMapping::VictimPolicy::Greedy;
+    config.StartFreeBlocks = payload.StartFreeBlocks;
+    config.ThrottleFreeBlocks = payload.ThrottleFreeBlocks;
+    config.PipelineDepth = payload.PipelineDepth;
+    _GarbageCollector.SetConfig(config);
+    return true;
+}
+
+bool PageMappingFtl::Trim(const RangeListPayload &payload)
+{
+    // Every range is checked first so that a bad one leaves the mapping untouched
+    if (payload.RangeCount > RangeListPayload::MaxRangeCount)
+    {
+        return false;
+    }
+    for (U32 i = 0; i < payload.RangeCount; ++i)
+    {
+        const SimpleFtlPayload &range = payload.Ranges[i];
+        if (range.Lba >= _Mapping.GetLbaCount() || range.SectorCount > _Mapping.GetLbaCount() - range.Lba)
+        {
+            return false;
+        }
+    }
+
+    for (U32 i = 0; i < payload.RangeCount; ++i)
+    {
+        _Mapping.Trim(payload.Ranges[i].Lba, payload.Ranges[i].SectorCount);
+    }
+    return true;
+}
+
+bool PageMappingFtl::StartCopy(const CopyPayload &payload)
+{
+    const RangeListPayload &sources = payload.SourceRanges;
+    if (sources.RangeCount > RangeListPayload::MaxRangeCount)
+    {
+        return false;
+    }
+
+    std::uint64_t sectorCount = 0;
+    for (U32 i = 0; i < sources.RangeCount; ++i)
+    {
+        const SimpleFtlPayload &range = sources.Ranges[i];
+        if (range.Lba >= _Mapping.GetLbaCount() || range.SectorCount > _Mapping.GetLbaCount() - range.Lba)
+        {
+            return false;
+        }
+        sectorCount += range.SectorCount;
+    }
+    if (sectorCount > 0 && (payload.DestinationLba >= _Mapping.GetLbaCount() || sectorCount > _Mapping.GetLbaCount() - payload.DestinationLba))
+    {
+        return false;
+    }
+
+    // Sources are read as the copy goes, one in the destination could already be overwritten
+    U32 destinationEndLba = payload.DestinationLba + static_cast<U32>(sectorCount);
+    for (U32 i = 0; i < sources.RangeCount; ++i)
+    {
+        const SimpleFtlPayload &range = sources.Ranges[i];
+        if (range.SectorCount > 0 && range.Lba < destinationEndLba && payload.DestinationLba < range.Lba + range.SectorCount)
+        {
+            return false;
+        }
+    }
+
+    _RemainingSectorCount = static_cast<U32>(sectorCount);
+    _ProcessedSectorCount = 0;
+    _PendingCommandCount = 0;
+    _CopyRange = 0;
+    _CurrentLba = (sources.RangeCount > 0) ? sources.Ranges[0].Lba : 0;
+    _CopyRangeRemainingSectorCount = (sources.RangeCount > 0) ? sources.Ranges[0].SectorCount : 0;
+    _OpenCopyPage = NoCopyPage;
+    return true;
+}
+
+bool PageMappingFtl::WritePattern(const U32 &lba, const U32 &sectorCount, const U32 &pattern)
+{
+    // Only the mapping changes, nothing is programmed
+    if (lba >= _Mapping.GetLbaCount() || sectorCount > _Mapping.GetLbaCount() - lba)
+    {
+        return false;
+    }
+    return _Mapping.SetPattern(lba, sectorCount, pattern);
+}
+
+void PageMappingFtl::GetStatistics(StatisticsPayload &payload)
+{
+    payload.HostSectorsWritten = _HostSectorsWritten;
+    payload.NandSectorsWritten = _Mapping.GetProgrammedPageCount() * _SectorsPerPage;
+    payload.RelocatedSectors = _GarbageCollector.GetStatistics().RelocatedSectors;
+    payload.ErasedBlocks = _Mapping.GetOpenedBlockCount();
+    payload.FreeBlocks = _Mapping.GetFreeBlockCount();
+    payload.ReadCacheHits = 0;
+    payload.ReadCacheMisses = 0;
+    payload.ReadAheadPages = 0;
+    payload.CopybackPages = _CopybackPageCount;
+    payload.MountSpareReads = _MountScanner.GetStatistics().SpareReads;
+    payload.MountTimeUs = _MountTimeUs;
+}
+
+void PageMappingFtl::Mount()
+{
+    // Every die is scanned at once, as deep as a share of the NAND command queue allows
+    U32 queueDepth = std::min<U32>(MountQueueDepth, MaxInFlight / _Mapping.GetDieCount());
+    _Mounted = false;
+    _MountStartTime = std::chrono::high_resolution_clock::now();
+    _MountScanner.Start(queueDepth);
+}
+
+void PageMappingFtl::OnMountScanned()
+{
+    // A drive written in another sector size is formatted back to it, the compact mode is up to the host to set again
+    const std::vector<U32> &programmedPages = _MountScanner.GetProgrammedPages();
+    U32 sectorsPerPage = _Mapping.GetMountedSectorsPerPage(programmedPages);
+    if (sectorsPerPage != 0 && sectorsPerPage != _SectorsPerPage)
+    {
+        SectorInfo sectorInfo = DefaultSectorInfo;
+        sectorInfo.SectorSizeInBit = 0;
+        while ((_NandHal->GetGeometry().BytesPerPage >> sectorInfo.SectorSizeInBit) > sectorsPerPage)
+        {
+            ++sectorInfo.SectorSizeInBit;
+        }
+        bool formatted = SetSectorInfo(sectorInfo);
+        assert(formatted);
+    }
+
+    _Mapping.Rebuild(programmedPages);
+    _MountTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - _MountStartTime).count();
+    _Mounted = true;
+}
+
+void PageMappingFtl::operator()()
+{
+    if (!_Mounted)
+    {
+        _MountScanner();
+        if (_MountScanner.IsDone())
+        {
+            OnMountScanned();
+        }
+        return;
+    }
+
+    while (_EventQueue->empty() == false)
+    {
+        ProcessEvent();
+    }
+
+    _GarbageCollector();
+    if (!_WaitingPages.empty())
+    {
+        WriteWaitingPages();
+    }
+}
+
+void PageMappingFtl::ProcessEvent()
+{
+    Event event;
+    _EventQueue->pop(event);
+    switch (event.EventType)
+    {
+        case Event::Type::CustomProtocolCommand:
+        {
+            OnNewCustomProtocolCommand(event.EventParams.CustomProtocolCommand);
+        } break;
+
+        case Event::Type::TransferCompleted:
+        {
+            OnTransferCommandCompleted(event.EventParams.TransferCommand);
+        } break;
+
+        case Event::Type::NandCommandCompleted:
+        {
+            OnNandCommandCompleted(event.EventParams.NandCommand);
+        } break;
+
+        default:
+        {
+            assert(0);
+        }
+    }
+}
+
+void PageMappingFtl::OnNewCustomProtocolCommand(CustomProtocolCommand *command)
+{
+    // NOTE: only support for handling single command at a time
+    assert(_ProcessingCommand == nullptr);
+
+    _ProcessingCommand = command;
+    command->CommandStatus = CustomProtocolCommand::Status::Success;
+
+    switch (command->Command)
+    {
+    case CustomProtocolCommand::Code::Write:
+    case CustomProtocolCommand::Code::Read:
+    {
+        _RemainingSectorCount = command->Descriptor.SimpleFtlPayload.SectorCount;
+        _CurrentLba = command->Descriptor.SimpleFtlPayload.Lba;
+        _ProcessedSectorCount = 0;
+        _PendingCommandCount = 0;
+
+        if (_CurrentLba >= _Mapping.GetLbaCount() || _RemainingSectorCount > _Mapping.GetLbaCount() - _CurrentLba)
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+            SubmitResponse();
+        }
+        else if (_RemainingSectorCount == 0)
+        {
+            SubmitResponse();
+        }
+        else if (CustomProtocolCommand::Code::Write == command->Command)
+        {
+            WriteNextLbas();
+        }
+        else
+        {
+            ReadNextLbas();
+        }
+    } break;
+
+    case CustomProtocolCommand::Code::LoopbackWrite:
+    case CustomProtocolCommand::Code::LoopbackRead:
+    {
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::GetDeviceInfo:
+    {
+        command->Descriptor.DeviceInfoPayload.TotalSector = _Mapping.GetLbaCount();
+        command->Descriptor.DeviceInfoPayload.SectorInfo = _BufferHal->GetSectorInfo();
+        command->Descriptor.DeviceInfoPayload.SectorsPerPage = _SectorsPerPage;
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::SetSectorSize:
+    {
+        if (!SetSectorInfo(command->Descriptor.SectorInfoPayload.SectorInfo))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        }
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::SetGarbageCollection:
+    {
+        if (!SetGarbageCollection(command->Descriptor.GarbageCollectionPayload))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        }
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::GetStatistics:
+    {
+        GetStatistics(command->Descriptor.StatisticsPayload);
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::Trim:
+    {
+        if (!Trim(command->Descriptor.RangeListPayload))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        }
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::WriteZeroes:
+    {
+        if (!WritePattern(command->Descriptor.SimpleFtlPayload.Lba, command->Descriptor.SimpleFtlPayload.SectorCount, 0))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        }
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::WritePattern:
+    {
+        const WritePatternPayload &payload = command->Descriptor.WritePatternPayload;
+        if (!WritePattern(payload.Lba, payload.SectorCount, payload.Pattern))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        }
+        SubmitResponse();
+    } break;
+
+    case CustomProtocolCommand::Code::Copy:
+    {
+        if (!StartCopy(command->Descriptor.CopyPayload))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+            SubmitResponse();
+        }
+        else if (_RemainingSectorCount == 0)
+        {
+            SubmitResponse();
+        }
+        else
+        {
+            CopyNextLbas();
+        }
+    } break;
+
+    case CustomProtocolCommand::Code::Flush:
+    {
+        // Writes respond once programmed, nothing is held back
+        SubmitResponse();
+    } break;
+
+    default:
+    {
+        command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        SubmitResponse();
+    } break;
+    }
+}
+
+void PageMappingFtl::ReadNextLbas()
+{
+    Buffer buffer;
+    NandHal::NandAddress nandAddress;
+    U32 nextLba;
+    U32 remainingSectorCount;
+    bool mapped;
+    U32 pattern;
+    while (_RemainingSectorCount > 0)
+    {
+        _Mapping.LbaToNandAddress(_CurrentLba, _RemainingSectorCount, nandAddress, nextLba, remainingSectorCount, mapped, pattern);
+        if (!_BufferHal->AllocateBuffer(BufferType::User, buffer))
+        {
+            break;
+        }
+
+        tSectorOffset commandOffset{ _ProcessedSectorCount };
+        if (mapped)
+        {
+            ReadPage(nandAddress, buffer, commandOffset);
+        }
+        else
+        {
+            // Nothing to read from NAND, the data goes straight out
+            SetPatternData(pattern);
+            tSectorOffset bufferOffset{ 0 };
+            _BufferHal->CopyToBuffer(_PatternData.get(), buffer, bufferOffset, nandAddress.SectorCount);
+            TransferOut(buffer, nandAddress, commandOffset, nandAddress.SectorCount);
+        }
+
+        _ProcessedSectorCount += nandAddress.SectorCount;
+        _CurrentLba = nextLba;
+        _RemainingSectorCount = remainingSectorCount;
+        ++_PendingCommandCount;
+    }
+}
+
+void PageMappingFtl::TransferOut(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+{
+    CustomProtocolHal::TransferCommandDesc transferCommand;
+    transferCommand.Buffer = buffer;
+    transferCommand.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
+    transferCommand.Command = _ProcessingCommand;
+    transferCommand.Direction = CustomProtocolHal::TransferCommandDesc::Direction::Out;
+    transferCommand.CommandOffset = commandOffset;
+    transferCommand.SectorCount = sectorCount;
+    transferCommand.NandAddress = nandAddress;
+    transferCommand.Listener = this;
+    _CustomProtocolHal->QueueCommand(transferCommand);
+}
+
+void PageMappingFtl::ReadPage(const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex)
+{
+    assert((nandAddress.Sector + nandAddress.SectorCount) <= _SectorsPerPage);
+
+    NandHal::CommandDesc commandDesc;
+    commandDesc.Address = nandAddress;
+    commandDesc.Operation = (nandAddress.SectorCount == _SectorsPerPage)
+        ? NandHal::CommandDesc::Op::Read : NandHal::CommandDesc::Op::ReadPartial;
+    commandDesc.Buffer = outBuffer;
+    commandDesc.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
+    commandDesc.DescSectorIndex = descSectorIndex;
+    commandDesc.Listener = this;
+
+    _NandHal->QueueCommand(commandDesc);
+}
+
+void PageMappingFtl::SetPatternData(const U32 &pattern)
+{
+    if (pattern != _PatternDataValue)
+    {
+        // 32 bits whatever the width of U32
+        std::uint32_t value = static_cast<std::uint32_t>(pattern);
+        U32 byteCount = _NandHal->GetGeometry().BytesPerPage;
+        for (U32 offset = 0; offset < byteCount; offset += sizeof(value))
+        {
+            std::memcpy(&_PatternData[offset], &value, sizeof(value));
+        }
+        _PatternDataValue = pattern;
+    }
+}
+
+void PageMappingFtl::WriteNextLbas()
+{
+    // Data is packed from the start of the buffer, where it goes is only decided once it's in
+    Buffer buffer;
+    NandHal::NandAddress nandAddress;
+    while (_RemainingSectorCount > 0)
+    {
+        if (!_BufferHal->AllocateBuffer(BufferType::User, buffer))
+        {
+            break;
+        }
+
+        U32 sectorCount = std::min(_RemainingSectorCount, static_cast<U32>(_SectorsPerPage));
+        nandAddress.Sector._ = 0;
+        nandAddress.SectorCount._ = sectorCount;
+        tSectorOffset commandOffset{ _ProcessedSectorCount };
+        TransferIn(buffer, nandAddress, commandOffset, nandAddress.SectorCount);
+
+        _ProcessedSectorCount += sectorCount;
+        _CurrentLba += sectorCount;
+        _RemainingSectorCount -= sectorCount;
+        ++_PendingCommandCount;
+    }
+}
+
+void PageMappingFtl::TransferIn(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+{
+    CustomProtocolHal::TransferCommandDesc transferCommand;
+    transferCommand.Buffer = buffer;
+    transferCommand.BufferOffset = nandAddress.Sector;
+    transferCommand.Command = _ProcessingCommand;
+    transferCommand.Direction = CustomProtocolHal::TransferCommandDesc::Direction::In;
+    transferCommand.CommandOffset = commandOffset;
+    transferCommand.SectorCount = sectorCount;
+    transferCommand.NandAddress = nandAddress;
+    transferCommand.Listener = this;
+    _CustomProtocolHal->QueueCommand(transferCommand);
+}
+
+void PageMappingFtl::WriteWaitingPages()
+{
+    while (!_WaitingPages.empty() && _GarbageCollector.HasHostCredit())
+    {
+        WaitingPage &waitingPage = _WaitingPages.front();
+        if (WritePage(waitingPage.CommandOffset, waitingPage.SectorCount, waitingPage.Buffer))
+        {
+            _GarbageCollector.SpendHostCredit();
+        }
+        else if (_GarbageCollector.CanFreeSpace())
+        {
+            // Try again once the GC has released a block
+            break;
+        }
+        else
+        {
+            // Every block holds valid data
+            OnPageWritten(waitingPage.SectorCount, waitingPage.Buffer, false);
+        }
+        _WaitingPages.pop_front();
+    }
+}
+
+bool PageMappingFtl::WritePage(const tSectorOffset& commandOffset, const tSectorCount& sectorCount, const Buffer &inBuffer)
+{
+    // Pages are allocated in the order they are queued so that each block is programmed in page order
+    NandHal::NandAddress nandAddress;
+    bool openedBlock;
+    if (!_Mapping.AllocatePage(nandAddress, openedBlock, _GarbageCollector.GetReservedBlockCount()))
+    {
+        return false;
+    }
+
+    if (openedBlock)
+    {
+        EraseBlock(nandAddress);
+    }
+
+    // A partial page leaves the rest of it unused, it can't be programmed again before an erase
+    nandAddress.SectorCount = sectorCount;
+
+    NandHal::CommandDesc commandDesc;
+    commandDesc.Address = nandAddress;
+    commandDesc.Operation = (nandAddress.SectorCount == _SectorsPerPage)
+        ? NandHal::CommandDesc::Op::WriteWithSpare : NandHal::CommandDesc::Op::WritePartialWithSpare;
+    commandDesc.Spare = _Mapping.SetSpare(nandAddress, ToLba(commandOffset), sectorCount);
+    commandDesc.Buffer = inBuffer;
+    commandDesc.BufferOffset = nandAddress.Sector;
+    commandDesc.DescSectorIndex = commandOffset;
+    commandDesc.Listener = this;
+
+    _NandHal->QueueCommand(commandDesc);
+    return true;
+}
+
+void PageMappingFtl::EraseBlock(const NandHal::NandAddress &nandAddress)
+{
+    NandHal::CommandDesc commandDesc;
+    commandDesc.Address = nandAddress;
+    commandDesc.Operation = NandHal::CommandDesc::Op::Erase;
+    commandDesc.Listener = this;
+
+    _NandHal->QueueCommand(commandDesc);
+}
+
+void PageMappingFtl::CopyNextLbas()
+{
+    // Sources are packed into destination pages like host data is, a whole source page is copied back on its die instead
+    const CopyPayload &payload = _ProcessingCommand->Descriptor.CopyPayload;
+    NandHal::NandAddress nandAddress;
+    U32 nextLba;
+    U32 remainingSectorCount;
+    bool mapped;
+    U32 pattern;
+    while (_RemainingSectorCount > 0)
+    {
+        if (_CopyRangeRemainingSectorCount == 0)
+        {
+            const SimpleFtlPayload &range = payload.SourceRanges.Ranges[++_CopyRange];
+            _CurrentLba = range.Lba;
+            _CopyRangeRemainingSectorCount = range.SectorCount;
+            continue;
+        }
+
+        U32 pageSectorCount = (_OpenCopyPage == NoCopyPage) ? 0 : _CopyPages[_OpenCopyPage].SectorCount;
+        _Mapping.LbaToNandAddress(_CurrentLba, std::min<U32>(_CopyRangeRemainingSectorCount, _SectorsPerPage - pageSectorCount),
+            nandAddress, nextLba, remainingSectorCount, mapped, pattern);
+        U32 sectorCount = nandAddress.SectorCount;
+
+        bool copied = false;
+        if (!mapped)
+        {
+            // Nothing to read, the destination takes the pattern as well. The page being filled ends before it
+            copied = _Mapping.SetPattern(payload.DestinationLba + _ProcessedSectorCount, sectorCount, pattern);
+            if (copied)
+            {
+                CloseCopyPage();
+            }
+        }
+        else if (pageSectorCount == 0 && sectorCount == _SectorsPerPage)
+        {
+            // Copybacks take no buffer to hold them back, the next one waits for a completion to pick the copy up again
+            if (_PendingCommandCount >= MaxInFlight)
+            {
+                break;
+            }
+            copied = CopybackPage(nandAddress);
+        }
+
+        if (!copied)
+        {
+            if (_OpenCopyPage == NoCopyPage && !OpenCopyPage())
+            {
+                break;
+            }
+
+            CopyPage &copyPage = _CopyPages[_OpenCopyPage];
+            tSectorOffset bufferOffset{ copyPage.SectorCount };
+            if (mapped)
+            {
+                NandHal::CommandDesc commandDesc;
+                commandDesc.Address = nandAddress;
+                commandDesc.Operation = NandHal::CommandDesc::Op::ReadPartial;
+                commandDesc.Buffer = copyPage.Buffer;
+                commandDesc.BufferOffset = bufferOffset;
+                commandDesc.DescSectorIndex = _OpenCopyPage;
+                commandDesc.Listener = this;
+                _NandHal->QueueCommand(commandDesc);
+                ++copyPage.PendingReadCount;
+            }
+            else
+            {
+                // The pattern table is full, the pattern is programmed as data
+                SetPatternData(pattern);
+                _BufferHal->CopyToBuffer(_PatternData.get(), copyPage.Buffer, bufferOffset, nandAddress.SectorCount);
+            }
+
+            copyPage.SectorCount += sectorCount;
+            if (copyPage.SectorCount == _SectorsPerPage)
+            {
+                CloseCopyPage();
+            }
+        }
+
+        _ProcessedSectorCount += sectorCount;
+        _CurrentLba = nextLba;
+        _CopyRangeRemainingSectorCount -= sectorCount;
+        _RemainingSectorCount -= sectorCount;
+    }
+
+    // The last page doesn't wait to be filled. A page whose read failed may have been the last thing pending
+    if (_RemainingSectorCount == 0)
+    {
+        CloseCopyPage();
+        if (_PendingCommandCount == 0)
+        {
+            SubmitResponse();
+        }
+    }
+}
+
+bool PageMappingFtl::CopybackPage(const NandHal::NandAddress &sourceAddress)
+{
+    // Pages already waiting for space go first, this one doesn't jump ahead of them
+    if (!_WaitingPages.empty() || !_GarbageCollector.HasHostCredit())
+    {
+        return false;
+    }
+
+    NandHal::NandAddress nandAddress;
+    bool openedBlock;
+    if (!_Mapping.AllocatePage(_Mapping.ToDie(sourceAddress), nandAddress, openedBlock, _GarbageCollector.GetReservedBlockCount()))
+    {
+        return false;
+    }
+    _GarbageCollector.SpendHostCredit();
+
+    if (openedBlock)
+    {
+        EraseBlock(nandAddress);
+    }
+
+    NandHal::CommandDesc commandDesc;
+    commandDesc.Address = nandAddress;
+    commandDesc.SourceAddress = sourceAddress;
+    commandDesc.Operation = NandHal::CommandDesc::Op::CopybackWithSpare;
+    commandDesc.Spare = _Mapping.SetSpare(nandAddress, ToLba(_ProcessedSectorCount), _SectorsPerPage);
+    commandDesc.DescSectorIndex = _ProcessedSectorCount;
+    commandDesc.Listener = this;
+    _NandHal->QueueCommand(commandDesc);
+
+    ++_PendingCommandCount;
+    return true;
+}
+
+bool PageMappingFtl::OpenCopyPage()
+{
+    Buffer buffer;
+    if (!_BufferHal->AllocateBuffer(BufferType::User, buffer))
+    {
+        return false;
+    }
+
+    _OpenCopyPage = _ProcessedSectorCount;
+    _CopyPages[_OpenCopyPage] = CopyPage{ buffer, 0, 0, false, false };
+    ++_PendingCommandCount;
+    return true;
+}
+
+void PageMappingFtl::CloseCopyPage()
+{
+    if (_OpenCopyPage == NoCopyPage)
+    {
+        return;
+    }
+
+    U32 commandOffset = _OpenCopyPage;
+    _OpenCopyPage = NoCopyPage;
+    CopyPage &copyPage = _CopyPages[commandOffset];
+    copyPage.Closed = true;
+    if (copyPage.PendingReadCount == 0)
+    {
+        SubmitCopyPage(commandOffset);
+    }
+}
+
+void PageMappingFtl::SubmitCopyPage(const U32 &commandOffset)
+{
+    // Programmed from the main loop, like the host pages waiting for space
+    auto copyPage = _CopyPages.find(commandOffset);
+    assert(copyPage != _CopyPages.end());
+    if (copyPage->second.ReadFailed)
+    {
+        // The destination keeps what it held
+        _BufferHal->DeallocateBuffer(copyPage->second.Buffer);
+        --_PendingCommandCount;
+    }
+    else
+    {
+        _WaitingPages.push_back(WaitingPage{ tSectorOffset{ commandOffset }, tSectorCount{ copyPage->second.SectorCount }, copyPage->second.Buffer });
+    }
+    _CopyPages.erase(copyPage);
+}
+
+void PageMappingFtl::OnTransferCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command)
+{
+    if (CustomProtocolCommand::Code::Read == _ProcessingCommand->Command)
+    {
+        _BufferHal->DeallocateBuffer(command.Buffer);
+        --_PendingCommandCount;
+        OnDataCommandCompleted();
+    }
+    else
+    {
+        // Pages are taken in transfer order, behind any page still waiting
+        _WaitingPages.push_back(WaitingPage{ command.CommandOffset, command.SectorCount, command.Buffer });
+        WriteWaitingPages();
+    }
+}
+
+void PageMappingFtl::OnNandCommandCompleted(const NandHal::CommandDesc &command)
+{
+    if (NandHal::CommandDesc::Op::Erase == command.Operation)
+    {
+        if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
+        {
+            _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::WriteError;
+        }
+    }
+    else if (NandHal::CommandDesc::Op::CopybackWithSpare == command.Operation)
+    {
+        OnCopybackCompleted(command);
+    }
+    else if (CustomProtocolCommand::Code::Copy == _ProcessingCommand->Command && NandHal::CommandDesc::Op::ReadPartial == command.Operation)
+    {
+        OnCopyReadCompleted(command);
+    }
+    else if (CustomProtocolCommand::Code::Read == _ProcessingCommand->Command)
+    {
+        TransferOut(command.Buffer, command.Address, command.DescSectorIndex, command.Address.SectorCount);
+
+        if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
+        {
+            _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::ReadError;
+        }
+    }
+    else
+    {
+        bool success = (NandHal::CommandDesc::Status::Success == command.CommandStatus);
+        if (success)
+        {
+            _Mapping.Update(ToLba(command.DescSectorIndex), command.Address.SectorCount, command.Address);
+        }
+        _Mapping.ProgramCompleted(command.Address);
+
+        OnPageWritten(command.Address.SectorCount, command.Buffer, success);
+    }
+}
+
+void PageMappingFtl::OnCopyReadCompleted(const NandHal::CommandDesc &command)
+{
+    U32 commandOffset = command.DescSectorIndex;
+    CopyPage &copyPage = _CopyPages[commandOffset];
+    --copyPage.PendingReadCount;
+    if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
+    {
+        copyPage.ReadFailed = true;
+        _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::ReadError;
+    }
+
+    if (copyPage.Closed && copyPage.PendingReadCount == 0)
+    {
+        SubmitCopyPage(commandOffset);
+    }
+    OnDataCommandCompleted();
+}
+
+void PageMappingFtl::OnCopybackCompleted(const NandHal::CommandDesc &command)
+{
+    // Fails when the source page can't be read, nothing is programmed then
+    if (NandHal::CommandDesc::Status::Success == command.CommandStatus)
+    {
+        _Mapping.Update(ToLba(command.DescSectorIndex), _SectorsPerPage, command.Address);
+        _HostSectorsWritten += _SectorsPerPage;
+        ++_CopybackPageCount;
+    }
+    else
+    {
+        _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::ReadError;
+    }
+    _Mapping.ProgramCompleted(command.Address);
+
+    --_PendingCommandCount;
+    OnDataCommandCompleted();
+}
+
+void PageMappingFtl::OnPageWritten(const tSectorCount& sectorCount, const Buffer &buffer, bool success)
+{
+    if (success)
+    {
+        _HostSectorsWritten += sectorCount;
+    }
+    else
+    {
+        _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::WriteError;
+    }
+
+    _BufferHal->DeallocateBuffer(buffer);
+    --_PendingCommandCount;
+    OnDataCommandCompleted();
+}
+
+void PageMappingFtl::OnDataCommandCompleted()
+{
+    if (_RemainingSectorCount == 0 && _PendingCommandCount == 0)
+    {
+        SubmitResponse();
+    }
+    else if (CustomProtocolCommand::Code::Read == _ProcessingCommand->Command)
+    {
+        ReadNextLbas();
+    }
+    else if (CustomProtocolCommand::Code::Copy == _ProcessingCommand->Command)
+    {
+        CopyNextLbas();
+    }
+    else
+    {
+        WriteNextLbas();
+    }
+}
+
+void PageMappingFtl::SubmitCustomProtocolCommand(CustomProtocolCommand *command)
+{
+    Event event;
+    event.EventType = Event::Type::CustomProtocolCommand;
+    event.EventParams.CustomProtocolCommand = command;
+    _EventQueue->push(event);
+}
+
+void PageMappingFtl::HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command)
+{
+    Event event;
+    event.EventType = Event::Type::TransferCompleted;
+    event.EventParams.TransferCommand = command;
+    _EventQueue->push(event);
+}
+
+void PageMappingFtl::HandleCommandCompleted(const NandHal::CommandDesc &command)
+{
+    Event event;
+    event.EventType = Event::Type::NandCommandCompleted;
+    event.EventParams.NandCommand = command;
+    _EventQueue->push(event);
+}
+
+bool PageMappingFtl::IsProcessingCommand()
+{
+    return (nullptr != _ProcessingCommand);
+}
+
+bool PageMappingFtl::IsEventQueueEmpty()
+{
+    return _EventQueue->empty();
+}
+
+bool PageMappingFtl::IsGarbageCollectionIdle()
+{
+    return _GarbageCollector.IsIdle();
+}
+
+bool PageMappingFtl::IsMounted()
+{
+    return _Mounted;
+}
+
+U32 PageMappingFtl::ToLba(const U32 &commandOffset) const
+{
+    // A Copy writes to its destination range
+    return ((CustomProtocolCommand::Code::Copy == _ProcessingCommand->Command)
+        ? _ProcessingCommand->Descriptor.CopyPayload.DestinationLba : _ProcessingCommand->Descriptor.SimpleFtlPayload.Lba) + commandOffset;
+}
+
+void PageMappingFtl::SubmitResponse()
+{
+    assert(_ProcessingCommand != nullptr);
+    _CustomProtocolHal->SubmitResponse(_ProcessingCommand);
+    _ProcessingCommand = nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#ifndef __PageMappingFtl_h__
+#define __PageMappingFtl_h__
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "boost/lockfree/queue.hpp"
+
+#include "Buffer/Hal/BufferHal.h"
+#include "HostComm/CustomProtocol/CustomProtocolHal.h"
+#include "Nand/Hal/NandHal.h"
+#include "GarbageCollector.h"
+#include "MountScanner.h"
+#include "PageMapping.h"
+
+//! Log structured FTL, every write is appended to the open blocks and the previous copy is invalidated
+class PageMappingFtl : public CustomProtocolHal::TransferCommandListener, public NandHal::CommandListener
+{
+private:
+    struct Event
+    {
+        enum class Type
+        {
+            CustomProtocolCommand,
+            TransferCompleted,
+            NandCommandCompleted
+        };
+
+        union Params
+        {
+            CustomProtocolCommand *CustomProtocolCommand;
+            CustomProtocolHal::TransferCommandDesc TransferCommand;
+            NandHal::CommandDesc NandCommand;
+        };
+
+        Type EventType;
+        Params EventParams;
+    };
+
+public:
+    PageMappingFtl();
+
+    void SetProtocol(CustomProtocolHal *customProtocolHal);
+    void SetNandHal(NandHal *nandHal);
+    void SetBufferHal(BufferHal *bufferHal);
+
+    //! Rebuilds the mapping from the spare areas on NAND, in the sector size they were written in. Commands wait until IsMounted()
+    void Mount();
+    void operator()();
+
+    void SubmitCustomProtocolCommand(CustomProtocolCommand *command);
+    virtual void HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command);
+    virtual void HandleCommandCompleted(const NandHal::CommandDesc &command);
+
+    bool IsProcessingCommand();
+    bool IsEventQueueEmpty();
+    bool IsGarbageCollectionIdle();
+    bool IsMounted();
+
+private:
+    void ProcessEvent();
+    void ReadNextLbas();
+    void TransferOut(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+    void ReadPage(const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex);
+    void SetPatternData(const U32 &pattern);
+
+    void WriteNextLbas();
+    void TransferIn(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+    void WriteWaitingPages();
+    bool WritePage(const tSectorOffset& commandOffset, const tSectorCount& sectorCount, const Buffer &inBuffer);
+    void EraseBlock(const NandHal::NandAddress &nandAddress);
+
+    bool StartCopy(const CopyPayload &payload);
+    void CopyNextLbas();
+    bool CopybackPage(const NandHal::NandAddress &sourceAddress);
+    bool OpenCopyPage();
+    void CloseCopyPage();
+    void SubmitCopyPage(const U32 &commandOffset);
+
+    bool SetSectorInfo(const SectorInfo &sectorInfo);
+    void OnMountScanned();
+    bool SetGarbageCollection(const GarbageCollectionPayload &payload);
+    bool Trim(const RangeListPayload &payload);
+    bool WritePattern(const U32 &lba, const U32 &sectorCount, const U32 &pattern);
+    void GetStatistics(StatisticsPayload &payload);
+
+    void OnNewCustomProtocolCommand(CustomProtocolCommand *command);
+    void OnTransferCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command);
+    void OnNandCommandCompleted(const NandHal::CommandDesc &command);
+    void OnCopyReadCompleted(const NandHal::CommandDesc &command);
+    void OnCopybackCompleted(const NandHal::CommandDesc &command);
+    void OnDataCommandCompleted();
+    void OnPageWritten(const tSectorCount& sectorCount, const Buffer &buffer, bool success);
+    U32 ToLba(const U32 &commandOffset) const;
+
+    void SubmitResponse();
+
+private:
+    NandHal *_NandHal;
+    BufferHal *_BufferHal;
+    CustomProtocolHal *_CustomProtocolHal;
+    U8 _SectorsPerPage;
+
+    PageMapping _Mapping;
+    GarbageCollector _GarbageCollector;
+    MountScanner _MountScanner;
+    enum : U32
+    {
+        MountQueueDepth = 8,                    //!< spare reads in flight per die
+        MaxInFlight = 512,                      //!< NAND commands a mount or a Copy keeps queued, half the NAND command queue
+    };
+    bool _Mounted;
+    std::chrono::high_resolution_clock::time_point _MountStartTime;
+    std::uint64_t _MountTimeUs;             //!< from Mount() until the mapping is rebuilt
+    std::uint64_t _HostSectorsWritten;
+    std::uint64_t _CopybackPageCount;
+    std::unique_ptr<U8[]> _PatternData;      //!< a page of the pattern of LBAs that aren't on NAND, zeroes for never written ones
+    U32 _PatternDataValue;
+
+    CustomProtocolCommand *_ProcessingCommand;
+    U32 _RemainingSectorCount;
+    U32 _ProcessedSectorCount;
+    U32 _CurrentLba;
+    U32 _PendingCommandCount;
+
+    //! Host pages transferred in and waiting for a page, or for a GC credit
+    struct WaitingPage
+    {
+        tSectorOffset CommandOffset;
+        tSectorCount SectorCount;
+        Buffer Buffer;
+    };
+    std::deque<WaitingPage> _WaitingPages;
+
+    //! Destination page of a Copy being read into from its sources, keyed by its CommandOffset
+    struct CopyPage
+    {
+        Buffer Buffer;
+        U32 SectorCount;
+        U32 PendingReadCount;
+        bool Closed;            //!< no more sources are added, it's programmed once the reads are in
+        bool ReadFailed;
+    };
+    enum : U32 { NoCopyPage = 0xFFFFFFFF };
+    std::map<U32, CopyPage> _CopyPages;
+    U32 _OpenCopyPage;
+    U32 _CopyRange;                             //!< source range _CurrentLba is in
+    U32 _CopyRangeRemainingSectorCount;
+
+    std::unique_ptr<boost::lockfree::queue<Event>> _EventQueue;
+};
+
+#endif
\ No newline at end of file
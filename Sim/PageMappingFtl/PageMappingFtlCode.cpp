@@ -0,0 +1,54 @@
+#include <memory>
+#include <functional>
+
+#include "HostComm/CustomProtocol/CustomProtocolHal.h"
+#include "Nand/Hal/NandHal.h"
+#include "SimFrameworkBase/FirmwareRegistry.h"
+#include "PageMappingFtl.h"
+
+namespace
+{
+    CustomProtocolHal* _CustomProtocolHal = nullptr;
+    PageMappingFtl _PageMappingFtl;
+    bool _ShutdownRequested = false;
+}
+
+FIRMWARE_EXPORTS_BEGIN(PageMappingFtlFirmware)
+    FIRMWARE_EXPORT(void) Initialize(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
+    {
+        _ShutdownRequested = false;
+        _PageMappingFtl.SetNandHal(nandHal);
+        _PageMappingFtl.SetBufferHal(bufferHal);
+        _PageMappingFtl.SetProtocol(CustomProtocolHal);
+        _PageMappingFtl.Mount();
+        _CustomProtocolHal = CustomProtocolHal;
+    }
+
+    FIRMWARE_EXPORT(void) Execute()
+    {
+        if (_CustomProtocolHal == nullptr)
+        {
+            return;
+        }
+
+        // After Shutdown new commands are left queued for the next firmware, before the mount is done they wait
+        if (!_ShutdownRequested && _PageMappingFtl.IsMounted() && _CustomProtocolHal->HasCommand() && !_PageMappingFtl.IsProcessingCommand())
+        {
+            CustomProtocolCommand *command = _CustomProtocolHal->GetCommand();
+            _PageMappingFtl.SubmitCustomProtocolCommand(command);
+        }
+        _PageMappingFtl();
+    }
+
+    FIRMWARE_EXPORT(void) Shutdown()
+    {
+        _ShutdownRequested = true;
+    }
+
+    FIRMWARE_EXPORT(bool) IsQuiescent()
+    {
+        return _PageMappingFtl.IsMounted() && !_PageMappingFtl.IsProcessingCommand() && _PageMappingFtl.IsEventQueueEmpty() && _PageMappingFtl.IsGarbageCollectionIdle();
+    }
+FIRMWARE_EXPORTS_END
+
+FIRMWARE_ENTRY_POINTS(PageMappingFtlFirmware, &Initialize, &Execute, &Shutdown, &IsQuiescent, nullptr)
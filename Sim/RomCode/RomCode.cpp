@@ -6,22 +6,28 @@
 
 #include "HostComm/CustomProtocol/CustomProtocolHal.h"
 #include "Nand/Hal/NandHal.h"
+#include "SimFrameworkBase/FirmwareRegistry.h"
 
-std::function<bool(std::string)> _SetExecuteFunc;
-CustomProtocolHal* _CustomProtocolHal = nullptr;
-
-extern "C"
+namespace
 {
-    void __declspec(dllexport) __stdcall Initialize(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
+    std::function<bool(std::string)> _SetExecuteFunc;
+    CustomProtocolHal* _CustomProtocolHal = nullptr;
+    bool _ShutdownRequested = false;
+}
+
+FIRMWARE_EXPORTS_BEGIN(RomCodeFirmware)
+    FIRMWARE_EXPORT(void) Initialize(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
     {
+        _ShutdownRequested = false;
         _CustomProtocolHal = CustomProtocolHal;
     }
 
-    void __declspec(dllexport) __stdcall Execute()
+    FIRMWARE_EXPORT(void) Execute()
     {
         assert(_CustomProtocolHal != nullptr);
 
-        if (_CustomProtocolHal->HasCommand())
+        // After Shutdown new commands are left queued for the next firmware
+        if (!_ShutdownRequested && _CustomProtocolHal->HasCommand())
         {
             CustomProtocolCommand *command = _CustomProtocolHal->GetCommand();
 
@@ -46,8 +52,21 @@ extern "C"
         }
     }
 
-    void __declspec(dllexport) __stdcall SetExecuteCallback(std::function<bool(std::string)> setExecuteFunc)
+    FIRMWARE_EXPORT(void) Shutdown()
+    {
+        _ShutdownRequested = true;
+    }
+
+    FIRMWARE_EXPORT(bool) IsQuiescent()
+    {
+        // Commands are completed within Execute()
+        return true;
+    }
+
+    FIRMWARE_EXPORT(void) SetExecuteCallback(std::function<bool(std::string)> setExecuteFunc)
     {
         _SetExecuteFunc = setExecuteFunc;
     }
-};
+FIRMWARE_EXPORTS_END
+
+FIRMWARE_ENTRY_POINTS(RomCodeFirmware, &Initialize, &Execute, &Shutdown, &IsQuiescent, &SetExecuteCallback)
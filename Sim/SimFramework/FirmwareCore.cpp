@@ -1,107 +1,320 @@
 #include "FirmwareCore.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    //! With the trailing separator, empty if it can't be found
+    std::string GetExecutableDirectory()
+    {
+#ifdef _WIN32
+        char path[MAX_PATH];
+        DWORD length = GetModuleFileName(nullptr, path, MAX_PATH);
+        std::string executable(path, (length < MAX_PATH) ? length : 0);
+#else
+        char path[4096];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+        std::string executable(path, (length > 0 && static_cast<size_t>(length) < sizeof(path)) ? length : 0);
+#endif
+        auto separator = executable.find_last_of("\\/");
+        return (separator == std::string::npos) ? std::string() : executable.substr(0, separator + 1);
+    }
+
+    bool IsAbsolutePath(const std::string &path)
+    {
+#ifdef _WIN32
+        return (path.size() > 1 && path[1] == ':') || (!path.empty() && (path[0] == '\\' || path[0] == '/'));
+#else
+        return !path.empty() && path[0] == '/';
+#endif
+    }
+
+    //! Relative names are looked up next to the executable first, where the build puts the firmware, then in the working directory
+    /*!
+        Firmware names come from Windows configs. Off Windows backslashes become slashes, and names left relative get a "./"
+        since dlopen() searches the library path for names without a slash.
+    */
+    std::string ToModulePath(const std::string &filename)
+    {
+        std::string path = filename;
+#ifndef _WIN32
+        std::replace(path.begin(), path.end(), '\\', '/');
+#endif
+        if (path.empty() || IsAbsolutePath(path))
+        {
+            return path;
+        }
+
+        std::string executableDirectory = GetExecutableDirectory();
+        if (!executableDirectory.empty() && std::ifstream(executableDirectory + path).is_open())
+        {
+            return executableDirectory + path;
+        }
+#ifndef _WIN32
+        path = "./" + path;
+#endif
+        return path;
+    }
+
+    //! In the temp directory and named after the process, so neither the working directory nor other runs see it
+    std::string GetInstanceCopyPath(const std::string &path, U32 instanceId)
+    {
+        auto separator = path.find_last_of("\\/");
+        std::string name = (separator == std::string::npos) ? path : path.substr(separator + 1);
+        auto extension = name.find_last_of('.');
+        if (extension == std::string::npos)
+        {
+            extension = name.size();
+        }
+
+#ifdef _WIN32
+        char directory[MAX_PATH + 1];
+        DWORD length = GetTempPath(MAX_PATH + 1, directory);
+        std::string tempDirectory(directory, (length <= MAX_PATH) ? length : 0);
+        unsigned long processId = GetCurrentProcessId();
+#else
+        const char *directory = std::getenv("TMPDIR");
+        std::string tempDirectory = std::string(directory ? directory : "/tmp") + "/";
+        unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+        return tempDirectory + name.substr(0, extension) + "." + std::to_string(processId) + ".instance" + std::to_string(instanceId)
+            + name.substr(extension);
+    }
 
-// TODO: fix this declaration. Cannot add to header file because of causing JSON build error
-HMODULE _DllInstance;
-HMODULE _NewDllInstance;
+    void* OpenModule(const std::string &filename)
+    {
+#ifdef _WIN32
+        return LoadLibrary(filename.c_str());
+#else
+        return dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    }
+
+    void* GetSymbol(void *module, const char *name)
+    {
+#ifdef _WIN32
+        return GetProcAddress(static_cast<HMODULE>(module), name);
+#else
+        return dlsym(module, name);
+#endif
+    }
+
+    void CloseModule(void *module)
+    {
+#ifdef _WIN32
+        FreeLibrary(static_cast<HMODULE>(module));
+#else
+        dlclose(module);
+#endif
+    }
+
+    bool CopyModule(const std::string &source, const std::string &destination)
+    {
+        std::ifstream in(source, std::ios::binary);
+        std::ofstream out(destination, std::ios::binary | std::ios::trunc);
+        if (!in.is_open() || !out.is_open())
+        {
+            return false;
+        }
+
+        out << in.rdbuf();
+        return out.good();
+    }
+}
 
-typedef void(__stdcall *fInitialize)(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal);
-typedef void(__stdcall *fSetIpcName)(const std::string& ipcName);
-typedef void(__stdcall *fExecute)();
-typedef void(__stdcall *fExecuteCallback)(std::function<bool(std::string)> callback);
-typedef void(__stdcall *fShutdown)();
+// Firmware without IsQuiescent gets this long to finish its work after Shutdown
+constexpr auto DrainTimeLimit = std::chrono::milliseconds(1000);
 
-FirmwareCore::FirmwareCore() : _Execute(nullptr), _NewExecute(nullptr), _NandHal(nullptr), _BufferHal(nullptr), _CustomProtocolHal(nullptr)
+FirmwareCore::FirmwareCore() : _Firmware{}, _NewFirmware{}, _InstanceId(0),
+    _ShardCount(1), _ShardsThreaded(true), _Draining(false), _NandHal(nullptr), _BufferHal(nullptr), _CustomProtocolHal(nullptr)
 {
-    _DllInstance = NULL;
-    _NewDllInstance = NULL;
 }
 
 bool FirmwareCore::SetExecute(std::string Filename)
 {
-    _NewDllInstance = LoadLibrary(Filename.c_str());
-
-    if (!_NewDllInstance)
+    if (!Load(Filename, _NewFirmware))
     {
         return false;
     }
 
-    auto initialize = (fInitialize)GetProcAddress(_NewDllInstance, "Initialize");
-    if (initialize)
+    if (_ShardCount > 1 && _NewFirmware.EntryPoints.SetShards)
     {
-        initialize(_NandHal, _BufferHal, _CustomProtocolHal);
+        _NewFirmware.EntryPoints.SetShards(_ShardCount, _ShardsThreaded, _ShardPlacement, GetIdleStrategy(), GetSpinCount(), GetParkTimeout(), this);
     }
 
-    auto execute = (fExecute)GetProcAddress(_NewDllInstance, "Execute");
-    if (!execute)
+    if (_NewFirmware.EntryPoints.Initialize)
     {
-        FreeLibrary(_NewDllInstance);
-        return false;
+        _NewFirmware.EntryPoints.Initialize(_NandHal, _BufferHal, _CustomProtocolHal);
     }
 
-    auto setExecuteCallback = (fExecuteCallback)GetProcAddress(_NewDllInstance, "SetExecuteCallback");
-    if (setExecuteCallback)
+    if (_NewFirmware.EntryPoints.SetExecuteCallback)
     {
         std::function<bool(std::string)> func = std::bind(&FirmwareCore::SetExecute, this, std::placeholders::_1);
-        setExecuteCallback(func);
+        _NewFirmware.EntryPoints.SetExecuteCallback(func);
     }
 
-    _NewExecute = execute;
     return true;
 }
 
-void FirmwareCore::Run()
+bool FirmwareCore::Load(const std::string &filename, LoadedFirmware &firmware)
 {
-    if (_NewExecute)
+    // Statically linked firmware takes precedence over a library of the same name
+    const FirmwareEntryPoints *registered = FirmwareRegistry::Find(filename);
+    if (registered)
+    {
+        // There is a single copy of its globals, it can't serve more than one instance
+        if (_InstanceId != 0)
+        {
+            return false;
+        }
+
+        firmware.Module = nullptr;
+        firmware.EntryPoints = *registered;
+        return (firmware.EntryPoints.Execute != nullptr);
+    }
+
+    std::string path = ToModulePath(filename);
+    if (_InstanceId != 0)
     {
-        SwapExecute();
+        std::string source = path;
+        path = GetInstanceCopyPath(source, _InstanceId);
+        if (!CopyModule(source, path))
+        {
+            std::remove(path.c_str());
+            return false;
+        }
+        firmware.ModuleCopy = path;
     }
 
-    if (_Execute)
+    firmware.Module = OpenModule(path);
+    if (!firmware.Module)
     {
-        _Execute();
+        Free(firmware);
+        return false;
     }
+
+    FirmwareEntryPoints &entryPoints = firmware.EntryPoints;
+    entryPoints.Initialize = (FirmwareEntryPoints::fInitialize)GetSymbol(firmware.Module, "Initialize");
+    entryPoints.Execute = (FirmwareEntryPoints::fExecute)GetSymbol(firmware.Module, "Execute");
+    entryPoints.Shutdown = (FirmwareEntryPoints::fShutdown)GetSymbol(firmware.Module, "Shutdown");
+    entryPoints.IsQuiescent = (FirmwareEntryPoints::fIsQuiescent)GetSymbol(firmware.Module, "IsQuiescent");
+    entryPoints.SetExecuteCallback = (FirmwareEntryPoints::fSetExecuteCallback)GetSymbol(firmware.Module, "SetExecuteCallback");
+    entryPoints.SetShards = (FirmwareEntryPoints::fSetShards)GetSymbol(firmware.Module, "SetShards");
+    if (!entryPoints.Execute)
+    {
+        Free(firmware);
+        return false;
+    }
+
+    return true;
 }
 
-void FirmwareCore::Unload()
+void FirmwareCore::Free(LoadedFirmware &firmware)
 {
-    if (_DllInstance)
+    if (firmware.Module)
     {
-        auto shutdown = (fShutdown)GetProcAddress(_DllInstance, "Shutdown");
-        if (shutdown)
-        {
-            shutdown();
-        }
-        FreeLibrary(_DllInstance);
+        CloseModule(firmware.Module);
+    }
+    if (!firmware.ModuleCopy.empty())
+    {
+        std::remove(firmware.ModuleCopy.c_str());
+    }
+    firmware = LoadedFirmware{};
+}
+
+bool FirmwareCore::Run()
+{
+    // Execute() doesn't report whether it did anything, assume it did when a HAL completed something or a command is waiting
+    bool busy = ConsumeWakeup() || (_CustomProtocolHal && _CustomProtocolHal->HasCommand());
+
+    if (_NewFirmware.EntryPoints.Execute)
+    {
+        busy |= SwapExecute();
+    }
+
+    if (_Firmware.EntryPoints.Execute)
+    {
+        _Firmware.EntryPoints.Execute();
     }
 
-    if (_NewDllInstance)
+    return busy;
+}
+
+void FirmwareCore::Unload()
+{
+    if (_Firmware.EntryPoints.Shutdown)
     {
-        FreeLibrary(_NewDllInstance);
+        _Firmware.EntryPoints.Shutdown();
     }
+    Free(_Firmware);
+    Free(_NewFirmware);
 }
 
-void FirmwareCore::SwapExecute()
+bool FirmwareCore::SwapExecute()
 {
-    if (_DllInstance)
+    if (_Firmware.EntryPoints.Execute)
     {
-        auto shutdown = (fShutdown)GetProcAddress(_DllInstance, "Shutdown");
-        if (shutdown)
+        if (!_Draining)
         {
-            shutdown();
+            // The outgoing firmware stops taking new commands, they stay queued for the new one
+            if (_Firmware.EntryPoints.Shutdown)
+            {
+                _Firmware.EntryPoints.Shutdown();
+            }
+            _Draining = true;
+            _DrainStartTime = Now();
         }
 
-        // Wait for the current code completely
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        FreeLibrary(_DllInstance);
+        // Don't block here, Run() keeps executing the outgoing firmware until it drains
+        if (!IsDrained())
+        {
+            // Only the time limit ends a drain without IsQuiescent(), a stepped core sleeps until then
+            return _Firmware.EntryPoints.IsQuiescent || !WakeupAt(_DrainStartTime + DrainTimeLimit);
+        }
+
+        _Draining = false;
+        Free(_Firmware);
+    }
+
+    _Firmware = _NewFirmware;
+    _NewFirmware = LoadedFirmware{};
+    return true;
+}
+
+bool FirmwareCore::IsDrained()
+{
+    if (!_Firmware.EntryPoints.IsQuiescent)
+    {
+        return (Now() - _DrainStartTime) >= DrainTimeLimit;
     }
 
-    _Execute = _NewExecute;
-    _NewExecute = nullptr;
+    // The HALs pop a command only after its listener returned, so empty queues mean no thread is still in the old code
+    return _Firmware.EntryPoints.IsQuiescent()
+        && (_NandHal == nullptr || _NandHal->IsCommandQueueEmpty())
+        && (_CustomProtocolHal == nullptr || _CustomProtocolHal->IsTransferQueueEmpty());
+}
 
-    _DllInstance = _NewDllInstance;
-    _NewDllInstance = NULL;
+void FirmwareCore::SetInstanceId(U32 instanceId)
+{
+    _InstanceId = instanceId;
+}
+
+void FirmwareCore::SetShards(U32 shardCount, bool threaded, const ThreadPlacement &placement)
+{
+    _ShardCount = shardCount;
+    _ShardsThreaded = threaded;
+    _ShardPlacement = placement;
 }
 
 void FirmwareCore::SetHalComponents(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
@@ -109,4 +322,4 @@ void FirmwareCore::SetHalComponents(NandHal* nandHal, BufferHal* bufferHal, Cust
     _NandHal = nandHal;
     _BufferHal = bufferHal;
     _CustomProtocolHal = CustomProtocolHal;
-}
+}
\ No newline at end of file
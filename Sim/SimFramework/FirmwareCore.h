@@ -2,8 +2,12 @@
 #ifndef __FirmwareCore_h__
 #define __FirmwareCore_h__
 
+#include <chrono>
+#include <string>
+
 #include "BasicTypes.h"
 #include "SimFrameworkBase/FrameworkThread.h"
+#include "SimFrameworkBase/FirmwareRegistry.h"
 #include "Nand/Hal/NandHal.h"
 #include "Buffer/Hal/BufferHal.h"
 #include "HostComm/CustomProtocol/CustomProtocolHal.h"
@@ -11,7 +15,7 @@
 class FirmwareCore : public FrameworkThread
 {
 protected:
-	virtual void Run() override;
+	virtual bool Run() override;
 
 public:
     FirmwareCore();
@@ -19,12 +23,38 @@ public:
     void Unload();
     void SetHalComponents(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal);
 
+    //! Firmware keeps its state in globals, instances other than 0 load a private copy of the library
+    void SetInstanceId(U32 instanceId);
+
+    //! For firmware that can split its work over shards, each on a thread of its own unless not threaded
+    void SetShards(U32 shardCount, bool threaded, const ThreadPlacement &placement);
+
 private:
-    void SwapExecute();
+    struct LoadedFirmware
+    {
+        void *Module;                   //!< null for firmware linked in through the FirmwareRegistry
+        std::string ModuleCopy;         //!< per instance copy of the library in the temp directory, removed on unload
+        FirmwareEntryPoints EntryPoints;
+    };
+
+    bool Load(const std::string &filename, LoadedFirmware &firmware);
+    void Free(LoadedFirmware &firmware);
+    bool SwapExecute();         //!< returns false while waiting for nothing but the drain time limit
+    bool IsDrained();
 
 private:
-    std::function<void()> _Execute;
-    std::function<void()> _NewExecute;
+    LoadedFirmware _Firmware;
+    LoadedFirmware _NewFirmware;
+    U32 _InstanceId;
+
+    U32 _ShardCount;
+    bool _ShardsThreaded;
+    ThreadPlacement _ShardPlacement;
+
+    //! The outgoing firmware keeps running after Shutdown until it has nothing in flight
+    bool _Draining;
+    std::chrono::high_resolution_clock::time_point _DrainStartTime;
+
     NandHal* _NandHal;
     BufferHal* _BufferHal;
     CustomProtocolHal* _CustomProtocolHal;
@@ -1,5 +1,7 @@
 #include "Framework.h"
 
+#include <iostream>
+
 #include "SimFrameworkBase/JSONParser.h"
 #include "FirmwareCore.h"
 #include "HostComm/Ipc/Message.hpp"
@@ -8,7 +10,10 @@
 constexpr U32 MaxIpcServer = 10;
 
 Framework::Framework() :
-	_State(State::Start)
+	_State(State::Start),
+	_Idle(false),
+	_ForceSteppedMode(false),
+	_ReportThreadPlacement(false)
 {
     _NandHal = std::make_shared<NandHal>();
     _BufferHal = std::make_shared<BufferHal>();
@@ -32,14 +37,15 @@ void Framework::Init(const std::string& configFileName, std::string ipcNamesPref
 	SetupNandHal(parser);
 	GetFirmwareCoreInfo(parser);
 
+    U32 ipcSegmentSize = GetIpcSegmentSize(parser);
     std::string simServerIpcName;
     std::string customProtocolIpcName;
     if (ipcNamesPrefix.empty())
     {
         simServerIpcName = "SsdSimMainMessageServer";
         customProtocolIpcName = "SsdSimCustomProtocolServer";
-        _SimServer = std::make_shared<MessageServer<SimFrameworkCommand>>(simServerIpcName.c_str(), 8 * 1024 * 1024);
-        _ProtocolServer = std::make_shared<MessageServer<CustomProtocolCommand>>(customProtocolIpcName.c_str(), 8 * 1024 * 1024);
+        _SimServer = std::make_shared<MessageServer<SimFrameworkCommand>>(simServerIpcName.c_str(), ipcSegmentSize);
+        _ProtocolServer = std::make_shared<MessageServer<CustomProtocolCommand>>(customProtocolIpcName.c_str(), ipcSegmentSize);
     }
     else
     {
@@ -50,8 +56,8 @@ void Framework::Init(const std::string& configFileName, std::string ipcNamesPref
             {
                 simServerIpcName = ipcNamesPrefix + "MainMessageServer" + std::to_string(serverId);
                 customProtocolIpcName = ipcNamesPrefix + "CustomProtocolServer" + std::to_string(serverId);
-                _SimServer = std::make_shared<MessageServer<SimFrameworkCommand>>(simServerIpcName.c_str(), 8 * 1024 * 1024, false);
-                _ProtocolServer = std::make_shared<MessageServer<CustomProtocolCommand>>(customProtocolIpcName.c_str(), 8 * 1024 * 1024, false);
+                _SimServer = std::make_shared<MessageServer<SimFrameworkCommand>>(simServerIpcName.c_str(), ipcSegmentSize, false);
+                _ProtocolServer = std::make_shared<MessageServer<CustomProtocolCommand>>(customProtocolIpcName.c_str(), ipcSegmentSize, false);
             }
             catch (...)
             {
@@ -70,8 +76,32 @@ void Framework::Init(const std::string& configFileName, std::string ipcNamesPref
         }
     }
 
+    SetupControllerMemoryBuffer(parser, customProtocolIpcName);
+
     _CustomProtocolHal = std::make_shared<CustomProtocolHal>();
     _CustomProtocolHal->Init(customProtocolIpcName.c_str(), _BufferHal.get());
+    SetupCustomProtocolHal(parser);
+
+    SetupThreads(parser);
+
+    _SimServerName = simServerIpcName;
+    _CustomProtocolServerName = customProtocolIpcName;
+}
+
+void Framework::SetSteppedMode(U32 firmwareInstanceId)
+{
+	_ForceSteppedMode = true;
+	_FirmwareCore->SetInstanceId(firmwareInstanceId);
+}
+
+const std::string& Framework::GetSimServerName() const
+{
+	return _SimServerName;
+}
+
+const std::string& Framework::GetCustomProtocolServerName() const
+{
+	return _CustomProtocolServerName;
 }
 
 void Framework::SetupNandHal(JSONParser& parser)
@@ -170,6 +200,206 @@ void Framework::SetupBufferHal(JSONParser& parser)
     _BufferHal->PreInit(maxBufferSizeInKB);
 }
 
+void Framework::SetupControllerMemoryBuffer(JSONParser& parser, const std::string& customProtocolIpcName)
+{
+	// The controller memory buffer is optional, the host opens it by the protocol server name suffixed with "Cmb"
+	constexpr int maxControllerMemoryBufferSizeInKB = 1024 * 1024;
+	U32 sizeInKB = GetOptionalValueInt(parser, "BufferHalPreInit", "cmbKbs", 0, 0, maxControllerMemoryBufferSizeInKB);
+	if (sizeInKB == 0)
+	{
+		return;
+	}
+
+	try
+	{
+		_BufferHal->InitControllerMemoryBuffer(customProtocolIpcName + "Cmb", sizeInKB);
+	}
+	catch (...)
+	{
+		throw Exception("Failed to create the controller memory buffer");
+	}
+}
+
+void Framework::SetupCustomProtocolHal(JSONParser& parser)
+{
+	// Completion coalescing is optional, disabled by default
+	constexpr int maxCoalescingThreshold = 1024;
+	constexpr int maxCoalescingTimeInUs = 1000 * 1000;
+	U32 threshold = GetOptionalValueInt(parser, "CustomProtocolHalPreInit", "coalescingThreshold", 1, 1, maxCoalescingThreshold);
+	U32 timeInUs = GetOptionalValueInt(parser, "CustomProtocolHalPreInit", "coalescingTimeUs", 0, 0, maxCoalescingTimeInUs);
+
+	_CustomProtocolHal->SetResponseCoalescing(threshold, std::chrono::microseconds(timeInUs));
+
+	// Commands the firmware may have in flight, all of them unless limited
+	constexpr int maxQueueDepth = CustomProtocolHal::MaxInFlightCommands;
+	U32 queueDepth = GetOptionalValueInt(parser, "CustomProtocolHalPreInit", "queueDepth", maxQueueDepth, 1, maxQueueDepth);
+	_CustomProtocolHal->SetQueueDepth(queueDepth);
+}
+
+void Framework::SetupThreads(JSONParser& parser)
+{
+	// Threads busy spin by default, the other strategies trade wakeup latency for idle CPU time
+	constexpr int defaultSpinCount = 10000;
+	constexpr int maxSpinCount = 100 * 1000 * 1000;
+	constexpr int defaultParkTimeoutInUs = 100;
+	constexpr int maxParkTimeoutInUs = 1000 * 1000;
+	U32 spinCount = GetOptionalValueInt(parser, "Threads", "spinCount", defaultSpinCount, 0, maxSpinCount);
+	std::chrono::microseconds parkTimeout(GetOptionalValueInt(parser, "Threads", "parkTimeoutUs", defaultParkTimeoutInUs, 1, maxParkTimeoutInUs));
+
+	_NandHal->SetIdleStrategy(GetIdleStrategy(parser, "nandHalIdle"), spinCount, parkTimeout);
+	_CustomProtocolHal->SetIdleStrategy(GetIdleStrategy(parser, "customProtocolHalIdle"), spinCount, parkTimeout);
+	_FirmwareCore->SetIdleStrategy(GetIdleStrategy(parser, "firmwareCoreIdle"), spinCount, parkTimeout);
+
+	_NandHal->SetPlacement(GetThreadPlacement(parser, "nandHal"));
+	_CustomProtocolHal->SetPlacement(GetThreadPlacement(parser, "customProtocolHal"));
+	_FirmwareCore->SetPlacement(GetThreadPlacement(parser, "firmwareCore"));
+	_ReportThreadPlacement = parser.HasAttribute("Threads");
+
+	// Completions are consumed by the firmware, let the HALs wake it up
+	_NandHal->SetListenerThread(_FirmwareCore.get());
+	_CustomProtocolHal->SetListenerThread(_FirmwareCore.get());
+
+	SetupEventScheduler(parser);
+
+	// Firmware that supports it runs this many FTL shards, stepped from its own core in discrete event mode
+	constexpr int maxShardCount = ThreadPlacement::MaxCpus;
+	U32 shardCount = GetOptionalValueInt(parser, "Threads", "firmwareShards", 1, 1, maxShardCount);
+	_FirmwareCore->SetShards(shardCount, !_EventScheduler, GetThreadPlacement(parser, "firmwareShards"));
+}
+
+void Framework::SetupEventScheduler(JSONParser& parser)
+{
+	std::string mode = GetOptionalValueString(parser, "Threads", "mode", "threaded");
+	if (mode == "threaded")
+	{
+		if (!_ForceSteppedMode)
+		{
+			return;
+		}
+	}
+	else if (mode != "discreteEvent")
+	{
+		throw Exception("mode value of " + mode + " is invalid. Expected to be threaded or discreteEvent");
+	}
+
+	// Virtual time a component spends on each step that did work
+	constexpr int defaultStepInNs = 1;
+	constexpr int maxStepInNs = 1000 * 1000 * 1000;
+	U32 nandHalStep = GetOptionalValueInt(parser, "Threads", "nandHalStepNs", defaultStepInNs, 1, maxStepInNs);
+	U32 customProtocolHalStep = GetOptionalValueInt(parser, "Threads", "customProtocolHalStepNs", defaultStepInNs, 1, maxStepInNs);
+	U32 firmwareCoreStep = GetOptionalValueInt(parser, "Threads", "firmwareCoreStepNs", defaultStepInNs, 1, maxStepInNs);
+
+	// Keep this order, it breaks ties between components ready at the same virtual time
+	_EventScheduler = std::make_unique<EventScheduler>();
+	_EventScheduler->AddComponent(_NandHal.get(), nandHalStep);
+	_EventScheduler->AddComponent(_CustomProtocolHal.get(), customProtocolHalStep);
+	_EventScheduler->AddComponent(_FirmwareCore.get(), firmwareCoreStep);
+}
+
+FrameworkThread::IdleStrategy Framework::GetIdleStrategy(JSONParser& parser, const std::string& name)
+{
+	std::string value = GetOptionalValueString(parser, "Threads", name, "busySpin");
+	if (value == "busySpin")
+	{
+		return FrameworkThread::IdleStrategy::BusySpin;
+	}
+	else if (value == "spinThenYield")
+	{
+		return FrameworkThread::IdleStrategy::SpinThenYield;
+	}
+	else if (value == "spinThenPark")
+	{
+		return FrameworkThread::IdleStrategy::SpinThenPark;
+	}
+
+	throw Exception(name + " value of " + value + " is invalid. Expected to be busySpin, spinThenYield or spinThenPark");
+}
+
+ThreadPlacement Framework::GetThreadPlacement(JSONParser& parser, const std::string& threadName)
+{
+	// Placement is looked up by thread name, e.g. nandHalCpus and nandHalPolicy
+	ThreadPlacement placement;
+	std::string cpus = GetOptionalValueString(parser, "Threads", threadName + "Cpus", "");
+	if (!placement.ParseCpus(cpus))
+	{
+		std::ostringstream ss;
+		ss << threadName << "Cpus value of " << cpus << " is invalid. Expected a list of cpus or ranges below " << ThreadPlacement::MaxCpus << ", e.g. \"0,2-3\"";
+		throw Exception(ss.str());
+	}
+
+	std::string policy = GetOptionalValueString(parser, "Threads", threadName + "Policy", "default");
+	if (!placement.ParsePolicy(policy))
+	{
+		throw Exception(threadName + "Policy value of " + policy + " is invalid. Expected to be default, high or realtime");
+	}
+
+	return placement;
+}
+
+void Framework::ReportThreadPlacement()
+{
+	if (!_ReportThreadPlacement)
+	{
+		return;
+	}
+
+	std::cout << "nandHal: " << _NandHal->GetAppliedPlacement() << std::endl;
+	std::cout << "customProtocolHal: " << _CustomProtocolHal->GetAppliedPlacement() << std::endl;
+	std::cout << "firmwareCore: " << _FirmwareCore->GetAppliedPlacement() << std::endl;
+}
+
+U32 Framework::GetIpcSegmentSize(JSONParser& parser)
+{
+	constexpr int defaultSegmentSizeInKB = 8 * 1024;
+	constexpr int minSegmentSizeInKB = 64;
+	constexpr int maxSegmentSizeInKB = 1024 * 1024;
+	return GetOptionalValueInt(parser, "CustomProtocolHalPreInit", "ipcSegmentKbs",
+		defaultSegmentSizeInKB, minSegmentSizeInKB, maxSegmentSizeInKB) * 1024;
+}
+
+int Framework::GetOptionalValueInt(JSONParser& parser, const std::string& attribute, const std::string& name, int defaultValue, int min, int max)
+{
+	if (!parser.HasMemberForAttribute(attribute, name))
+	{
+		return defaultValue;
+	}
+
+	int value;
+	try
+	{
+		value = parser.GetValueIntForAttribute(attribute, name);
+	}
+	catch (JSONParser::Exception e)
+	{
+		throw Exception("Failed to parse \'" + name + "\' value. Expecting an \'int\'");
+	}
+
+	if ((value < min) || (max < value))
+	{
+		std::ostringstream ss;
+		ss << name << " value of " << value << " is out of range. Expected to be between [" << min << ", " << max << "]";
+		throw Exception(ss.str());
+	}
+	return value;
+}
+
+std::string Framework::GetOptionalValueString(JSONParser& parser, const std::string& attribute, const std::string& name, const std::string& defaultValue)
+{
+	if (!parser.HasMemberForAttribute(attribute, name))
+	{
+		return defaultValue;
+	}
+
+	try
+	{
+		return parser.GetValueStringForAttribute(attribute, name);
+	}
+	catch (JSONParser::Exception e)
+	{
+		throw Exception("Failed to parse \'" + name + "\' value. Expecting an \'string\'");
+	}
+}
+
 void Framework::GetFirmwareCoreInfo(JSONParser& parser)
 {
 	try
@@ -184,67 +414,90 @@ void Framework::GetFirmwareCoreInfo(JSONParser& parser)
 
 void Framework::operator()()
 {
-	std::future<void> nandHal;
-    std::future<void> CustomProtocolHal;
-	std::future<void> firmwareMain;
+	Start();
+	while (Step());
+	Stop();
+}
 
+void Framework::Start()
+{
     // Load ROM
 	_FirmwareCore->SetHalComponents(_NandHal.get(), _BufferHal.get(), _CustomProtocolHal.get());
 	_FirmwareCore->SetExecute(this->_RomCodePath);
 
-    while (State::Exit != _State)
+	if (!_EventScheduler)
 	{
-		switch (_State)
-		{
-			case State::Start:
-			{
-				nandHal = std::async(std::launch::async, &NandHal::operator(), _NandHal);
-                CustomProtocolHal = std::async(std::launch::async, &CustomProtocolHal::operator(), _CustomProtocolHal);
-				firmwareMain = std::async(std::launch::async, &FirmwareCore::operator(), _FirmwareCore);
-
-				_State = State::Run;
-			} break;
-
-			case State::Run:
-			{
-				if (true == _SimServer->HasMessage())
-				{
-                    Message<SimFrameworkCommand>* message = _SimServer->Pop();
-
-					switch (message->Data.Code)
-					{
-                        case SimFrameworkCommand::Code::Exit:
-                        {
-                            _State = State::Exit;
-							_SimServer->DeallocateMessage(message);
-                        } break;
-						case SimFrameworkCommand::Code::DataOutLoopback:
-						{
-							//Get data from host
-							auto buffer = std::make_unique<U8[]>(message->PayloadSize);
-							memcpy_s(buffer.get(), message->PayloadSize, message->Payload, message->PayloadSize);
-							_SimServer->PushResponse(message->Id());
-						} break;
-						case SimFrameworkCommand::Code::DataInLoopback:
-						{
-							//Send data to host
-							auto buffer = std::make_unique<U8[]>(message->PayloadSize);
-							memcpy_s(message->Payload, message->PayloadSize, buffer.get(), message->PayloadSize);
-							_SimServer->PushResponse(message->Id());
-						} break;
-					}
-				}
-			} break;
-		}
+		_NandHalFuture = std::async(std::launch::async, &NandHal::operator(), _NandHal);
+		_CustomProtocolHalFuture = std::async(std::launch::async, &CustomProtocolHal::operator(), _CustomProtocolHal);
+		_FirmwareCoreFuture = std::async(std::launch::async, &FirmwareCore::operator(), _FirmwareCore);
+		ReportThreadPlacement();
+	}
+
+	_State = State::Run;
+}
+
+bool Framework::Step()
+{
+	_Idle = true;
+	if (_EventScheduler)
+	{
+		_Idle = !_EventScheduler->Step();
+	}
+
+	if (true == _SimServer->HasMessage())
+	{
+		ProcessSimCommand();
+		_Idle = false;
 	}
 
-	_FirmwareCore->Stop();
-	_NandHal->Stop();
-    _CustomProtocolHal->Stop();
+	return (State::Exit != _State);
+}
 
-    firmwareMain.wait();
-    nandHal.wait();
-    CustomProtocolHal.wait();
+void Framework::Stop()
+{
+	if (!_EventScheduler)
+	{
+		_FirmwareCore->Stop();
+		_NandHal->Stop();
+		_CustomProtocolHal->Stop();
 
-    _FirmwareCore->Unload();
+		_FirmwareCoreFuture.wait();
+		_NandHalFuture.wait();
+		_CustomProtocolHalFuture.wait();
+	}
+
+	_FirmwareCore->Unload();
+}
+
+bool Framework::IsIdle() const
+{
+	return _Idle;
 }
+
+void Framework::ProcessSimCommand()
+{
+	Message<SimFrameworkCommand>* message = _SimServer->Pop();
+
+	switch (message->Data.Code)
+	{
+		case SimFrameworkCommand::Code::Exit:
+		{
+			_State = State::Exit;
+			_SimServer->DeallocateMessage(message);
+		} break;
+		case SimFrameworkCommand::Code::DataOutLoopback:
+		{
+			//Get data from host
+			auto buffer = std::make_unique<U8[]>(message->PayloadSize);
+			memcpy_s(buffer.get(), message->PayloadSize, message->Payload, message->PayloadSize);
+			_SimServer->PushResponse(message->Id());
+		} break;
+		case SimFrameworkCommand::Code::DataInLoopback:
+		{
+			//Send data to host
+			auto buffer = std::make_unique<U8[]>(message->PayloadSize);
+			memcpy_s(message->Payload, message->PayloadSize, buffer.get(), message->PayloadSize);
+			_SimServer->PushResponse(message->Id());
+		} break;
+	}
+}
\ No newline at end of file
@@ -3,8 +3,10 @@
 
 #include <queue>
 #include <exception>
+#include <future>
 #include <string>
 
+#include "SimFrameworkBase/EventScheduler.h"
 #include "Buffer/Hal/BufferHal.h"
 #include "Nand/Hal/NandHal.h"
 #include "FirmwareCore.h"
@@ -44,12 +46,35 @@ public:
 	Framework();
 	void Init(const std::string& nandConfigFilename, std::string ipcNamesPrefix = "");
 
+	//! Call before Init(), the HALs and firmware are then stepped by Step() whatever the configured mode
+	void SetSteppedMode(U32 firmwareInstanceId);
+
+	const std::string& GetSimServerName() const;
+	const std::string& GetCustomProtocolServerName() const;
+
 public:
 	void operator()();
 
+	//! operator() split in parts so that a caller can drive the framework itself
+	void Start();
+	bool Step();		//!< returns false once the exit command has been received
+	void Stop();
+	bool IsIdle() const;	//!< true when the last Step() had nothing to do
+
 private:
     void SetupNandHal(JSONParser& parser);
     void SetupBufferHal(JSONParser& parser);
+    void SetupCustomProtocolHal(JSONParser& parser);
+    void SetupControllerMemoryBuffer(JSONParser& parser, const std::string& customProtocolIpcName);
+    void SetupThreads(JSONParser& parser);
+    void SetupEventScheduler(JSONParser& parser);
+    FrameworkThread::IdleStrategy GetIdleStrategy(JSONParser& parser, const std::string& name);
+    ThreadPlacement GetThreadPlacement(JSONParser& parser, const std::string& threadName);
+    U32 GetIpcSegmentSize(JSONParser& parser);
+    int GetOptionalValueInt(JSONParser& parser, const std::string& attribute, const std::string& name, int defaultValue, int min, int max);
+    std::string GetOptionalValueString(JSONParser& parser, const std::string& attribute, const std::string& name, const std::string& defaultValue);
+    void ReportThreadPlacement();
+    void ProcessSimCommand();
     void GetFirmwareCoreInfo(JSONParser& parser);
 
 private:
@@ -61,6 +86,8 @@ private:
 	};
 
 	State _State;
+	bool _Idle;
+	bool _ForceSteppedMode;
 
 private:
     std::shared_ptr<MessageServer<SimFrameworkCommand>> _SimServer;
@@ -70,6 +97,16 @@ private:
     std::shared_ptr<CustomProtocolHal> _CustomProtocolHal;
     std::shared_ptr<FirmwareCore> _FirmwareCore;
 	std::string _RomCodePath;
+	std::string _SimServerName;
+	std::string _CustomProtocolServerName;
+	bool _ReportThreadPlacement;
+
+	//! Set in discrete event mode, the HALs and firmware are then stepped from the framework thread
+	std::unique_ptr<EventScheduler> _EventScheduler;
+
+	std::future<void> _NandHalFuture;
+	std::future<void> _CustomProtocolHalFuture;
+	std::future<void> _FirmwareCoreFuture;
 };
 
 #endif
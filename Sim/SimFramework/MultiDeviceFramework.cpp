@@ -0,0 +1,111 @@
+#include "MultiDeviceFramework.h"
+
+#include <algorithm>
+#include <future>
+#include <thread>
+
+MultiDeviceFramework::MultiDeviceFramework()
+{
+}
+
+void MultiDeviceFramework::Init(const std::vector<std::string>& configFileNames, U32 workerCount)
+{
+	if (configFileNames.empty())
+	{
+		throw Framework::Exception("At least one hardware spec is required");
+	}
+
+	for (U32 i = 0; i < configFileNames.size(); ++i)
+	{
+		// Instance 0 loads the firmware library in place, the others get their own copy of its globals
+		auto drive = std::make_unique<Framework>();
+		drive->SetSteppedMode(i);
+		drive->Init(configFileNames[i], "SsdSimDrive" + std::to_string(i));
+		_Drives.push_back(std::move(drive));
+	}
+
+	if (workerCount == 0)
+	{
+		workerCount = std::max(std::thread::hardware_concurrency(), 1U);
+	}
+	workerCount = std::min(workerCount, static_cast<U32>(_Drives.size()));
+
+	// Idle workers park, a pool serving quiet drives shouldn't hold the cores
+	constexpr U32 spinCount = 10000;
+	constexpr auto parkTimeout = std::chrono::microseconds(100);
+	for (U32 i = 0; i < workerCount; ++i)
+	{
+		auto worker = std::make_unique<DriveWorker>();
+		worker->SetIdleStrategy(FrameworkThread::IdleStrategy::SpinThenPark, spinCount, parkTimeout);
+		_Workers.push_back(std::move(worker));
+	}
+
+	for (U32 i = 0; i < _Drives.size(); ++i)
+	{
+		_Workers[i % workerCount]->AddDrive(_Drives[i].get());
+	}
+}
+
+void MultiDeviceFramework::operator()()
+{
+	std::vector<std::future<void>> futures;
+	for (auto &worker : _Workers)
+	{
+		futures.push_back(std::async(std::launch::async, &DriveWorker::operator(), worker.get()));
+	}
+
+	for (auto &future : futures)
+	{
+		future.wait();
+	}
+}
+
+U32 MultiDeviceFramework::GetDriveCount() const
+{
+	return static_cast<U32>(_Drives.size());
+}
+
+Framework& MultiDeviceFramework::GetDrive(U32 drive)
+{
+	return *_Drives.at(drive);
+}
+
+void MultiDeviceFramework::DriveWorker::AddDrive(Framework *drive)
+{
+	_Drives.push_back(Drive{ drive, false, true });
+	++_RunningDriveCount;
+}
+
+bool MultiDeviceFramework::DriveWorker::Run()
+{
+	bool busy = false;
+	for (auto &drive : _Drives)
+	{
+		if (!drive.Running)
+		{
+			continue;
+		}
+
+		// Started from the worker so the firmware is loaded on the thread that steps it
+		if (!drive.Started)
+		{
+			drive.Instance->Start();
+			drive.Started = true;
+		}
+
+		drive.Running = drive.Instance->Step();
+		busy |= !drive.Instance->IsIdle();
+		if (!drive.Running)
+		{
+			drive.Instance->Stop();
+			--_RunningDriveCount;
+		}
+	}
+
+	if (_RunningDriveCount == 0)
+	{
+		Stop();
+	}
+
+	return busy;
+}
\ No newline at end of file
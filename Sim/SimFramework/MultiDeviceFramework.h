@@ -0,0 +1,56 @@
+#ifndef __MultiDeviceFramework_h__
+#define __MultiDeviceFramework_h__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Framework.h"
+
+//! Hosts several independent drives in one process
+/*!
+    Each drive has its own hardware spec and IPC names, "SsdSimDrive<n>" followed by the usual server names.
+    Drives run in stepped mode and are shared out over a pool of worker threads,
+    so the thread count follows the machine rather than the number of drives.
+*/
+class MultiDeviceFramework
+{
+public:
+	MultiDeviceFramework();
+
+	//! workerCount of 0 uses one worker per hardware thread, never more than the number of drives
+	void Init(const std::vector<std::string>& configFileNames, U32 workerCount = 0);
+
+	//! Returns once every drive has received its exit command
+	void operator()();
+
+	U32 GetDriveCount() const;
+	Framework& GetDrive(U32 drive);
+
+private:
+	class DriveWorker : public FrameworkThread
+	{
+	public:
+		void AddDrive(Framework *drive);
+
+	protected:
+		bool Run() override;
+
+	private:
+		struct Drive
+		{
+			Framework *Instance;
+			bool Started;
+			bool Running;
+		};
+
+		std::vector<Drive> _Drives;
+		U32 _RunningDriveCount = 0;
+	};
+
+private:
+	std::vector<std::unique_ptr<Framework>> _Drives;
+	std::vector<std::unique_ptr<DriveWorker>> _Workers;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "EventScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "FrameworkThread.h"
+
+EventScheduler::EventScheduler() : _Now(0)
+{
+
+}
+
+void EventScheduler::AddComponent(FrameworkThread *component, VirtualTime stepCost)
+{
+	// A zero cost would let a busy component starve everything added after it
+	assert(stepCost > 0);
+
+	Component entry;
+	entry.Thread = component;
+	entry.StepCost = stepCost;
+	entry.BusyUntil = 0;
+	entry.ScheduledAt = 0;
+	entry.Scheduled = false;
+	_Components.push_back(entry);
+
+	component->SetScheduler(this, static_cast<U32>(_Components.size() - 1));
+}
+
+bool EventScheduler::Step()
+{
+	// Events replaced by an earlier one for the same component are left in the queue, drop them here
+	while (!_Events.empty() && !IsCurrent(_Events.top()))
+	{
+		_Events.pop();
+	}
+
+	if (_Events.empty())
+	{
+		// Nothing scheduled, poll for work that can't signal, e.g. host commands arriving through IPC
+		bool busy = false;
+		for (U32 i = 0; i < _Components.size(); ++i)
+		{
+			busy |= StepComponent(i);
+		}
+		return busy;
+	}
+
+	Event event = _Events.top();
+	_Events.pop();
+
+	_Now = std::max(_Now, event.Time);
+	_Components[event.Component].Scheduled = false;
+	StepComponent(event.Component);
+	return true;
+}
+
+EventScheduler::VirtualTime EventScheduler::Now() const
+{
+	return _Now;
+}
+
+void EventScheduler::Schedule(U32 component)
+{
+	ScheduleAt(component, 0);
+}
+
+void EventScheduler::ScheduleAt(U32 component, VirtualTime time)
+{
+	Component &entry = _Components[component];
+	time = std::max(time, std::max(_Now, entry.BusyUntil));
+	if (entry.Scheduled && entry.ScheduledAt <= time)
+	{
+		return;
+	}
+
+	entry.Scheduled = true;
+	entry.ScheduledAt = time;
+	_Events.push(Event{ time, component });
+}
+
+bool EventScheduler::IsCurrent(const Event &event) const
+{
+	const Component &entry = _Components[event.Component];
+	return entry.Scheduled && entry.ScheduledAt == event.Time;
+}
+
+bool EventScheduler::StepComponent(U32 component)
+{
+	Component &entry = _Components[component];
+	if (entry.Scheduled)
+	{
+		return false;
+	}
+
+	if (!entry.Thread->Run())
+	{
+		return false;
+	}
+
+	entry.BusyUntil = _Now + entry.StepCost;
+	Schedule(component);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef __EventScheduler_h__
+#define __EventScheduler_h__
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "BasicTypes.h"
+
+class FrameworkThread;
+
+//! Steps framework components from a single thread, ordered by virtual time
+/*!
+    A component that did work is stepped again once its step cost has elapsed.
+    An idle component only runs again after a Wakeup(), at the time it asked for with WakeupAt(),
+    or when nothing at all is scheduled, in which case every component is polled once in the order added.
+    Virtual time jumps straight to the next event, idle stretches cost nothing.
+    Ties in virtual time go to the component added first, so a run only depends on its inputs.
+*/
+class EventScheduler
+{
+public:
+	using VirtualTime = std::uint64_t;		//!< in nanoseconds
+
+public:
+	EventScheduler();
+
+	void AddComponent(FrameworkThread *component, VirtualTime stepCost);
+
+	//! Returns false when no component had any work
+	bool Step();
+
+	VirtualTime Now() const;
+
+private:
+	friend class FrameworkThread;
+	void Schedule(U32 component);
+	void ScheduleAt(U32 component, VirtualTime time);
+	bool StepComponent(U32 component);
+
+private:
+	struct Component
+	{
+		FrameworkThread *Thread;
+		VirtualTime StepCost;
+		VirtualTime BusyUntil;
+		VirtualTime ScheduledAt;	//!< an earlier event replaces a later one, which is then skipped
+		bool Scheduled;
+	};
+
+	struct Event
+	{
+		VirtualTime Time;
+		U32 Component;
+
+		bool operator>(const Event &rhs) const
+		{
+			return (Time != rhs.Time) ? (Time > rhs.Time) : (Component > rhs.Component);
+		}
+	};
+
+	bool IsCurrent(const Event &event) const;
+
+private:
+	std::vector<Component> _Components;
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _Events;
+	VirtualTime _Now;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "FirmwareRegistry.h"
+
+void FirmwareRegistry::Register(const std::string &fileName, const FirmwareEntryPoints &entryPoints)
+{
+	Entries()[fileName] = &entryPoints;
+}
+
+const FirmwareEntryPoints* FirmwareRegistry::Find(const std::string &path)
+{
+	auto separator = path.find_last_of("\\/");
+	std::string fileName = (separator == std::string::npos) ? path : path.substr(separator + 1);
+
+	auto it = Entries().find(fileName);
+	return (it != Entries().end()) ? it->second : nullptr;
+}
+
+std::map<std::string, const FirmwareEntryPoints*>& FirmwareRegistry::Entries()
+{
+	// Function local so registrars in other translation units can run during static initialization
+	static std::map<std::string, const FirmwareEntryPoints*> entries;
+	return entries;
+}
\ No newline at end of file
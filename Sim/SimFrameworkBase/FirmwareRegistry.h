@@ -0,0 +1,86 @@
+#ifndef __FirmwareRegistry_h__
+#define __FirmwareRegistry_h__
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "BasicTypes.h"
+#include "FrameworkThread.h"
+
+class NandHal;
+class BufferHal;
+class CustomProtocolHal;
+
+#ifdef _WIN32
+#define FIRMWARE_CALL __stdcall
+#define FIRMWARE_DLLEXPORT __declspec(dllexport)
+#else
+#define FIRMWARE_CALL
+#define FIRMWARE_DLLEXPORT __attribute__((visibility("default")))
+#endif
+
+//! Firmware sources declare their entry points between FIRMWARE_EXPORTS_BEGIN/END
+/*!
+	By default these are DLL exports looked up by name. With SSDSIM_STATIC_FIRMWARE
+	they become plain functions in a namespace named after the firmware, which
+	FIRMWARE_ENTRY_POINTS gathers so the firmware can be linked into the simulator.
+*/
+#ifdef SSDSIM_STATIC_FIRMWARE
+#define FIRMWARE_EXPORTS_BEGIN(firmware) namespace firmware {
+#define FIRMWARE_EXPORT(returnType) returnType FIRMWARE_CALL
+#define FIRMWARE_ENTRY_POINTS(firmware, ...) \
+	namespace firmware { extern const FirmwareEntryPoints EntryPoints; const FirmwareEntryPoints EntryPoints = { __VA_ARGS__ }; }
+#else
+#define FIRMWARE_EXPORTS_BEGIN(firmware) extern "C" {
+#define FIRMWARE_EXPORT(returnType) returnType FIRMWARE_DLLEXPORT FIRMWARE_CALL
+#define FIRMWARE_ENTRY_POINTS(firmware, ...)
+#endif
+#define FIRMWARE_EXPORTS_END }
+
+//! Registers a statically linked firmware under the file name it would otherwise be loaded from
+#define FIRMWARE_STATIC_REGISTER(firmware, fileName) \
+	namespace firmware { extern const FirmwareEntryPoints EntryPoints; } \
+	static FirmwareRegistry::Registrar firmware##Registrar(fileName, firmware::EntryPoints);
+
+struct FirmwareEntryPoints
+{
+	typedef void(FIRMWARE_CALL *fInitialize)(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* customProtocolHal);
+	typedef void(FIRMWARE_CALL *fExecute)();
+	typedef void(FIRMWARE_CALL *fShutdown)();
+	typedef bool(FIRMWARE_CALL *fIsQuiescent)();
+	typedef void(FIRMWARE_CALL *fSetExecuteCallback)(std::function<bool(std::string)> callback);
+	typedef void(FIRMWARE_CALL *fSetShards)(U32 shardCount, bool threaded, const ThreadPlacement &placement,
+		FrameworkThread::IdleStrategy idleStrategy, U32 spinCount, std::chrono::microseconds parkTimeout, FrameworkThread *firmwareCore);
+
+	fInitialize Initialize;
+	fExecute Execute;                           //!< the only required one
+	fShutdown Shutdown;
+	fIsQuiescent IsQuiescent;
+	fSetExecuteCallback SetExecuteCallback;
+	fSetShards SetShards;                       //!< before Initialize, only when more than one shard is asked for, the shards idle like the firmware core
+};
+
+class FirmwareRegistry
+{
+public:
+	class Registrar
+	{
+	public:
+		Registrar(const char *fileName, const FirmwareEntryPoints &entryPoints)
+		{
+			FirmwareRegistry::Register(fileName, entryPoints);
+		}
+	};
+
+public:
+	static void Register(const std::string &fileName, const FirmwareEntryPoints &entryPoints);
+
+	//! Matches on the file name only, "x64\\Release\\SimpleFtl.dll" finds what was registered as "SimpleFtl.dll"
+	static const FirmwareEntryPoints* Find(const std::string &path);
+
+private:
+	static std::map<std::string, const FirmwareEntryPoints*>& Entries();
+};
+
+#endif
\ No newline at end of file
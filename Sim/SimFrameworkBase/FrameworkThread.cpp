@@ -1,41 +1,162 @@
 #include "FrameworkThread.h"
 
-#include "BasicTypes.h"
+#include <thread>
+
+#include "EventScheduler.h"
 
 FrameworkThread::FrameworkThread() :
-	_StopFuture(_StopSignal.get_future())
+	_StopRequested{ false },
+	_WakeupPending{ false },
+	_ParkWakeup{ false },
+	_Parked{ false },
+	_IdleStrategy(IdleStrategy::BusySpin),
+	_SpinCount(0),
+	_ParkTimeout(0),
+	_Scheduler(nullptr),
+	_SchedulerComponent(0),
+	_PlacementResult(_PlacementApplied.get_future().share())
 {
 
 }
 
 void FrameworkThread::operator()()
 {
-    U32 counter = 0;
-    bool quit = false;
-	while (false == quit)
+	if (_PlacementResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
 	{
-        ++counter;
-        if (counter == 1000000)
-        {
-            quit = IsStopRequested();
-            counter = 0;
-        }
+		_PlacementApplied.set_value(_Placement.Apply());
+	}
 
-		Run();
+	U32 idleCount = 0;
+	while (false == _StopRequested.load(std::memory_order_relaxed))
+	{
+		if (Run() || Idle(++idleCount))
+		{
+			idleCount = 0;
+		}
 	}
 }
 
 void FrameworkThread::Stop()
 {
-	_StopSignal.set_value();
+	_StopRequested = true;
+	Wakeup();
 }
 
-bool FrameworkThread::IsStopRequested()
+void FrameworkThread::SetIdleStrategy(IdleStrategy strategy, U32 spinCount, std::chrono::microseconds parkTimeout)
+{
+	_IdleStrategy = strategy;
+	_SpinCount = spinCount;
+	_ParkTimeout = parkTimeout;
+}
+
+FrameworkThread::IdleStrategy FrameworkThread::GetIdleStrategy() const
+{
+	return _IdleStrategy;
+}
+
+U32 FrameworkThread::GetSpinCount() const
+{
+	return _SpinCount;
+}
+
+std::chrono::microseconds FrameworkThread::GetParkTimeout() const
+{
+	return _ParkTimeout;
+}
+
+void FrameworkThread::Wakeup()
 {
-	if (_StopFuture.wait_for(std::chrono::nanoseconds(0)) == std::future_status::timeout)
+	if (_Scheduler)
+	{
+		_Scheduler->Schedule(_SchedulerComponent);
+		return;
+	}
+
+	_WakeupPending = true;
+	_ParkWakeup = true;
+
+	// Park() publishes _Parked before checking _ParkWakeup so one side always sees the other
+	if (_Parked)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_ParkMutex);
+		}
+		_ParkCondition.notify_one();
+	}
+}
+
+std::chrono::high_resolution_clock::time_point FrameworkThread::Now() const
+{
+	if (_Scheduler)
+	{
+		return std::chrono::high_resolution_clock::time_point(std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+			std::chrono::nanoseconds(_Scheduler->Now())));
+	}
+	return std::chrono::high_resolution_clock::now();
+}
+
+bool FrameworkThread::WakeupAt(std::chrono::high_resolution_clock::time_point time)
+{
+	if (!_Scheduler)
 	{
 		return false;
 	}
-		
+
+	auto virtualTime = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+	_Scheduler->ScheduleAt(_SchedulerComponent, virtualTime > 0 ? static_cast<EventScheduler::VirtualTime>(virtualTime) : 0);
 	return true;
+}
+
+void FrameworkThread::SetPlacement(const ThreadPlacement &placement)
+{
+	_Placement = placement;
+}
+
+std::string FrameworkThread::GetAppliedPlacement()
+{
+	return _PlacementResult.get();
+}
+
+void FrameworkThread::SetScheduler(EventScheduler *scheduler, U32 component)
+{
+	_Scheduler = scheduler;
+	_SchedulerComponent = component;
+}
+
+bool FrameworkThread::IsStopRequested()
+{
+	return _StopRequested;
+}
+
+bool FrameworkThread::ConsumeWakeup()
+{
+	return (_WakeupPending.load(std::memory_order_relaxed) && _WakeupPending.exchange(false));
+}
+
+bool FrameworkThread::Idle(U32 idleCount)
+{
+	if ((_IdleStrategy == IdleStrategy::BusySpin) || (idleCount <= _SpinCount))
+	{
+		return false;
+	}
+
+	if (_IdleStrategy == IdleStrategy::SpinThenYield)
+	{
+		std::this_thread::yield();
+		return _ParkWakeup.exchange(false);
+	}
+	return Park();
+}
+
+bool FrameworkThread::Park()
+{
+	std::unique_lock<std::mutex> lock(_ParkMutex);
+	_Parked = true;
+	if (false == _ParkWakeup && false == _StopRequested)
+	{
+		//NOTE: the timeout is what picks up work nobody signals, e.g. host commands arriving through IPC
+		_ParkCondition.wait_for(lock, _ParkTimeout, [this]() { return _ParkWakeup || _StopRequested; });
+	}
+	_Parked = false;
+	return _ParkWakeup.exchange(false);
 }
\ No newline at end of file
@@ -1,21 +1,59 @@
 #ifndef __FrameworkThread_h__
 #define __FrameworkThread_h__
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <future>
+#include <mutex>
+#include <string>
+
+#include "BasicTypes.h"
+#include "ThreadPlacement.h"
+
+class EventScheduler;
 
 class FrameworkThread
 {
+public:
+	//! What the thread does when Run() found nothing to do
+	enum class IdleStrategy
+	{
+		BusySpin,		//!< keep polling, lowest latency
+		SpinThenYield,	//!< poll SpinCount times then yield the core between polls
+		SpinThenPark,	//!< poll SpinCount times then sleep until Wakeup() or the park timeout
+	};
+
 public:
 	FrameworkThread();
-	FrameworkThread(FrameworkThread && rhs) : _StopSignal(std::move(rhs._StopSignal)), _StopFuture(std::move(rhs._StopFuture))
+	FrameworkThread(FrameworkThread && rhs) :
+		_StopRequested{ rhs._StopRequested.load() },
+		_WakeupPending{ false },
+		_ParkWakeup{ false },
+		_Parked{ false },
+		_IdleStrategy(rhs._IdleStrategy),
+		_SpinCount(rhs._SpinCount),
+		_ParkTimeout(rhs._ParkTimeout),
+		_Scheduler(rhs._Scheduler),
+		_SchedulerComponent(rhs._SchedulerComponent),
+		_Placement(std::move(rhs._Placement)),
+		_PlacementApplied(std::move(rhs._PlacementApplied)),
+		_PlacementResult(std::move(rhs._PlacementResult))
 	{
-		
+
 	}
 
 	FrameworkThread & operator=(FrameworkThread && rhs)
 	{
-		_StopSignal = std::move(rhs._StopSignal);
-		_StopFuture = std::move(rhs._StopFuture);
+		_StopRequested = rhs._StopRequested.load();
+		_IdleStrategy = rhs._IdleStrategy;
+		_SpinCount = rhs._SpinCount;
+		_ParkTimeout = rhs._ParkTimeout;
+		_Scheduler = rhs._Scheduler;
+		_SchedulerComponent = rhs._SchedulerComponent;
+		_Placement = std::move(rhs._Placement);
+		_PlacementApplied = std::move(rhs._PlacementApplied);
+		_PlacementResult = std::move(rhs._PlacementResult);
 		return *this;
 	}
 
@@ -23,14 +61,63 @@ public:
 	void operator()();
 	void Stop();
 
+	void SetIdleStrategy(IdleStrategy strategy, U32 spinCount, std::chrono::microseconds parkTimeout);
+	IdleStrategy GetIdleStrategy() const;
+	U32 GetSpinCount() const;
+	std::chrono::microseconds GetParkTimeout() const;
+
+	//! Called by producers after queueing work for this thread, cheap unless the thread is parked
+	//! When stepped by an EventScheduler this schedules the next step instead
+	void Wakeup();
+
+	//! Wall clock time, or the virtual time of the EventScheduler stepping the thread
+	std::chrono::high_resolution_clock::time_point Now() const;
+
+	//! Must be set before the thread starts, it is applied on entering operator()
+	void SetPlacement(const ThreadPlacement &placement);
+
+	//! Blocks until the thread has started and returns the placement the OS accepted
+	std::string GetAppliedPlacement();
+
 protected:
-	virtual void Run() = 0;
-	
+	//! Returns true if any work was done, false lets the thread go idle
+	virtual bool Run() = 0;
+
 	bool IsStopRequested();
 
+	//! Returns true once for each batch of Wakeup() calls received since the previous check
+	bool ConsumeWakeup();
+
+	//! For work due at a given time, when stepped by an EventScheduler the thread runs again at that time
+	//! Returns false for a free running thread, which has to keep polling instead
+	bool WakeupAt(std::chrono::high_resolution_clock::time_point time);
+
+private:
+	friend class EventScheduler;
+	void SetScheduler(EventScheduler *scheduler, U32 component);
+
+	//! Both return true when a Wakeup() arrived, which restarts the spin phase
+	bool Idle(U32 idleCount);
+	bool Park();
+
 private:
-	std::promise<void> _StopSignal;
-	std::future<void> _StopFuture;
+	std::atomic<bool> _StopRequested;
+	std::atomic<bool> _WakeupPending;	//!< cleared by ConsumeWakeup() only
+	std::atomic<bool> _ParkWakeup;		//!< cleared by Park(), so parking never swallows a wakeup Run() still has to see
+	std::atomic<bool> _Parked;
+	std::mutex _ParkMutex;
+	std::condition_variable _ParkCondition;
+
+	IdleStrategy _IdleStrategy;
+	U32 _SpinCount;
+	std::chrono::microseconds _ParkTimeout;
+
+	EventScheduler *_Scheduler;
+	U32 _SchedulerComponent;
+
+	ThreadPlacement _Placement;
+	std::promise<std::string> _PlacementApplied;
+	std::shared_future<std::string> _PlacementResult;
 };
 
-#endif
+#endif
\ No newline at end of file
@@ -69,6 +69,23 @@ int JSONParser::GetValueInt(const std::string &memberValue)
 	return memberValueItr->value.GetInt();
 }
 
+bool JSONParser::HasAttribute(const std::string &attributes)
+{
+	return _Document.IsObject() && _Document.HasMember(attributes.c_str());
+}
+
+bool JSONParser::HasMemberForAttribute(const std::string &attributes, const std::string &memberValue)
+{
+	if (!HasAttribute(attributes))
+	{
+		return false;
+	}
+
+	Value::MemberIterator memberAttributeItr = _Document.FindMember(attributes.c_str());
+
+	return memberAttributeItr->value.IsObject() && memberAttributeItr->value.HasMember(memberValue.c_str());
+}
+
 int JSONParser::GetValueIntForAttribute(const std::string &attributes, const std::string &memberValue)
 {
 	if (!_Document.HasMember(attributes.c_str()))
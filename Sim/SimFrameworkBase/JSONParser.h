@@ -43,6 +43,9 @@ public:
 	const char* GetValueString(const std::string &memberValue);
 	int GetValueInt(const std::string &memberValue);
 
+	bool HasAttribute(const std::string &attributes);
+	bool HasMemberForAttribute(const std::string &attributes, const std::string &memberValue);
+
 	int GetValueIntForAttribute(const std::string &attributes, const std::string &memberValue);
 	const char* GetValueStringForAttribute(const std::string &attributes, const std::string &memberValue);
 
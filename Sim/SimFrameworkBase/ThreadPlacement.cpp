@@ -0,0 +1,176 @@
+#include "ThreadPlacement.h"
+
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+	std::string ToString(const std::vector<U32> &cpus)
+	{
+		if (cpus.empty())
+		{
+			return "any";
+		}
+
+		std::ostringstream ss;
+		for (size_t i = 0; i < cpus.size(); ++i)
+		{
+			ss << (i ? "," : "") << cpus[i];
+		}
+		return ss.str();
+	}
+
+	const char* ToString(ThreadPlacement::SchedulingPolicy policy)
+	{
+		switch (policy)
+		{
+		case ThreadPlacement::SchedulingPolicy::High: return "high";
+		case ThreadPlacement::SchedulingPolicy::Realtime: return "realtime";
+		default: return "default";
+		}
+	}
+}
+
+ThreadPlacement::ThreadPlacement() : Policy(SchedulingPolicy::Default)
+{
+
+}
+
+bool ThreadPlacement::ParseCpus(const std::string &cpus)
+{
+	std::vector<U32> result;
+	std::istringstream ss(cpus);
+	std::string range;
+	while (std::getline(ss, range, ','))
+	{
+		U32 first, last;
+		char dash;
+		std::istringstream rs(range);
+		if (!(rs >> first))
+		{
+			return false;
+		}
+		last = first;
+		if ((rs >> dash) && (dash != '-' || !(rs >> last)))
+		{
+			return false;
+		}
+
+		// Nothing but blanks may follow, "1-2x" isn't a range
+		if (!(rs >> std::ws).eof())
+		{
+			return false;
+		}
+		if (last < first || MaxCpus <= last)
+		{
+			return false;
+		}
+
+		for (U32 cpu = first; cpu <= last; ++cpu)
+		{
+			result.push_back(cpu);
+		}
+	}
+
+	Cpus = result;
+	return true;
+}
+
+bool ThreadPlacement::ParsePolicy(const std::string &policy)
+{
+	if (policy == "default")
+	{
+		Policy = SchedulingPolicy::Default;
+	}
+	else if (policy == "high")
+	{
+		Policy = SchedulingPolicy::High;
+	}
+	else if (policy == "realtime")
+	{
+		Policy = SchedulingPolicy::Realtime;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+std::string ThreadPlacement::Apply() const
+{
+	std::vector<U32> appliedCpus;
+	bool cpusApplied = true;
+	bool policyApplied = true;
+
+#ifdef _WIN32
+	HANDLE thread = GetCurrentThread();
+	if (!Cpus.empty())
+	{
+		// A mask has a bit per cpu, 32 of them only in a 32-bit build
+		DWORD_PTR mask = 0;
+		for (auto cpu : Cpus)
+		{
+			if (sizeof(DWORD_PTR) * 8 <= cpu)
+			{
+				cpusApplied = false;
+				break;
+			}
+			mask |= (DWORD_PTR(1) << cpu);
+		}
+		cpusApplied = cpusApplied && (SetThreadAffinityMask(thread, mask) != 0);
+		if (cpusApplied)
+		{
+			appliedCpus = Cpus;
+		}
+	}
+
+	if (Policy != SchedulingPolicy::Default)
+	{
+		int priority = (Policy == SchedulingPolicy::Realtime) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+		policyApplied = (SetThreadPriority(thread, priority) != 0);
+	}
+#else
+	pthread_t thread = pthread_self();
+	if (!Cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : Cpus)
+		{
+			CPU_SET(cpu, &set);
+		}
+		cpusApplied = (pthread_setaffinity_np(thread, sizeof(set), &set) == 0);
+		if (cpusApplied && pthread_getaffinity_np(thread, sizeof(set), &set) == 0)
+		{
+			for (U32 cpu = 0; cpu < MaxCpus; ++cpu)
+			{
+				if (CPU_ISSET(cpu, &set))
+				{
+					appliedCpus.push_back(cpu);
+				}
+			}
+		}
+	}
+
+	if (Policy != SchedulingPolicy::Default)
+	{
+		int policy = (Policy == SchedulingPolicy::Realtime) ? SCHED_FIFO : SCHED_RR;
+		sched_param param;
+		param.sched_priority = (Policy == SchedulingPolicy::Realtime) ? sched_get_priority_max(policy) : sched_get_priority_min(policy);
+		policyApplied = (pthread_setschedparam(thread, policy, &param) == 0);
+	}
+#endif
+
+	std::ostringstream ss;
+	ss << "cpus " << (cpusApplied ? ToString(appliedCpus) : "any (failed to set " + ToString(Cpus) + ")")
+		<< ", policy " << (policyApplied ? ToString(Policy) : std::string("default (failed to set ") + ToString(Policy) + ")");
+	return ss.str();
+}
\ No newline at end of file
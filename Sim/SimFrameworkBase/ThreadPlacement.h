@@ -0,0 +1,37 @@
+#ifndef __ThreadPlacement_h__
+#define __ThreadPlacement_h__
+
+#include <string>
+#include <vector>
+
+#include "BasicTypes.h"
+
+//! CPU set and scheduling policy of a framework thread, applied from within the thread itself
+class ThreadPlacement
+{
+public:
+	enum class SchedulingPolicy
+	{
+		Default,	//!< leave the OS defaults alone
+		High,		//!< raised priority, still time shared
+		Realtime,	//!< highest priority the OS allows, may need elevated rights
+	};
+
+	static constexpr U32 MaxCpus = 64;
+
+public:
+	ThreadPlacement();
+
+	//! Accepts a list of cpus and ranges such as "0,2-3", an empty string means any cpu
+	bool ParseCpus(const std::string &cpus);
+	bool ParsePolicy(const std::string &policy);
+
+	//! Applies to the calling thread, returns what the OS actually accepted
+	std::string Apply() const;
+
+public:
+	std::vector<U32> Cpus;
+	SchedulingPolicy Policy;
+};
+
+#endif
\ No newline at end of file
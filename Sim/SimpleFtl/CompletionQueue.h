@@ -0,0 +1,99 @@
+#ifndef __CompletionQueue_h__
+#define __CompletionQueue_h__
+
+#include <atomic>
+
+#include "BasicTypes.h"
+
+//! Completions handed from the HAL threads to the FTL thread, the nodes are the FTL's own preallocated slots
+/*!
+    Multi-producer single-consumer, intrusive: pushing links the node in with one exchange and one store
+    and never allocates, so any number of completions can be in flight at once.
+    A node pushed but not linked yet hides the ones after it until its producer is done, Pop returns null meanwhile.
+*/
+class CompletionQueue
+{
+public:
+    struct Node
+    {
+        std::atomic<Node*> Next;
+    };
+
+public:
+    CompletionQueue() : _Tail(&_Stub), _Head(&_Stub)
+    {
+        _Stub.Next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    //! Any thread
+    inline void Push(Node *node)
+    {
+        node->Next.store(nullptr, std::memory_order_relaxed);
+        Node *previous = _Tail.exchange(node, std::memory_order_acq_rel);
+        previous->Next.store(node, std::memory_order_release);
+    }
+
+    //! The consuming thread only. Null when there is nothing to take yet
+    inline Node* Pop()
+    {
+        Node *head = _Head;
+        Node *next = head->Next.load(std::memory_order_acquire);
+        if (head == &_Stub)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+            _Head = next;
+            head = next;
+            next = next->Next.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr)
+        {
+            _Head = next;
+            return head;
+        }
+
+        // The last node is only taken once something is linked after it, the stub when no producer is on its way
+        if (head != _Tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        Push(&_Stub);
+        next = head->Next.load(std::memory_order_acquire);
+        if (next != nullptr)
+        {
+            _Head = next;
+            return head;
+        }
+        return nullptr;
+    }
+
+    //! Up to maxCount nodes in push order, returns how many
+    inline U32 PopBatch(Node **nodes, const U32 &maxCount)
+    {
+        U32 count = 0;
+        while (count < maxCount && (nodes[count] = Pop()) != nullptr)
+        {
+            ++count;
+        }
+        return count;
+    }
+
+    //! The consuming thread only
+    inline bool IsEmpty() const
+    {
+        return _Head == &_Stub && _Tail.load(std::memory_order_acquire) == &_Stub;
+    }
+
+private:
+    std::atomic<Node*> _Tail;       //!< the producers' end
+    Node *_Head;                    //!< the consumer's end
+    Node _Stub;                     //!< keeps the list from ever being empty
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <algorithm>
+
+#include "ReadAhead.h"
+
+ReadAhead::ReadAhead() : _MaxWindow(0), _UseCount(0)
+{
+    Reset();
+}
+
+void ReadAhead::SetMaxWindow(const U32 &pageCount)
+{
+    _MaxWindow = pageCount;
+    for (auto &stream : _Streams)
+    {
+        stream.Window = std::min<U32>(stream.Window, _MaxWindow);
+    }
+}
+
+void ReadAhead::Reset()
+{
+    for (auto &stream : _Streams)
+    {
+        stream = Stream{ 0, 0, 0, 0, 0 };
+    }
+}
+
+bool ReadAhead::OnRead(const U32 &lba, const U32 &sectorCount, const U32 &sectorsPerPage, U32 &stream, U32 &firstPage, U32 &endPage)
+{
+    if (_MaxWindow == 0 || sectorCount == 0)
+    {
+        return false;
+    }
+
+    ++_UseCount;
+    auto match = std::find_if(_Streams.begin(), _Streams.end(),
+        [&lba](const Stream &candidate) { return candidate.ReadCount > 0 && candidate.NextLba == lba; });
+    if (match == _Streams.end())
+    {
+        match = std::min_element(_Streams.begin(), _Streams.end(),
+            [](const Stream &left, const Stream &right) { return left.LastUse < right.LastUse; });
+        *match = Stream{ lba + sectorCount, 1, 0, 0, _UseCount };
+        return false;
+    }
+
+    Stream &current = *match;
+    current.NextLba = lba + sectorCount;
+    current.LastUse = _UseCount;
+    current.Window = (++current.ReadCount == 2) ? std::min<U32>(InitialWindow, _MaxWindow) : std::min<U32>(current.Window * 2, _MaxWindow);
+
+    // From the page after this read, what's already read ahead isn't asked for again
+    U32 nextPage = (current.NextLba + sectorsPerPage - 1) / sectorsPerPage;
+    stream = static_cast<U32>(match - _Streams.begin());
+    firstPage = std::max<U32>(nextPage, current.ReadAheadEnd);
+    endPage = nextPage + current.Window;
+    current.ReadAheadEnd = std::max<U32>(current.ReadAheadEnd, endPage);
+    return firstPage < endPage;
+}
+
+void ReadAhead::SetReadAheadEnd(const U32 &stream, const U32 &endPage)
+{
+    _Streams[stream].ReadAheadEnd = endPage;
+}
\ No newline at end of file
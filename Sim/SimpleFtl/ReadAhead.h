@@ -0,0 +1,52 @@
+#ifndef __ReadAhead_h__
+#define __ReadAhead_h__
+
+#include <array>
+
+#include "BasicTypes.h"
+
+//! Detects sequential read streams from the recent host reads and tells which pages to read ahead
+/*!
+    A read starting where one of the tracked streams ended continues it. From the second read
+    of a stream on, the pages past its end are read ahead, the window doubling with each further
+    read up to the maximum. A read that continues no stream replaces the least recently used one.
+*/
+class ReadAhead
+{
+public:
+    ReadAhead();
+
+    //! 0 turns read ahead off
+    void SetMaxWindow(const U32 &pageCount);
+    inline U32 GetMaxWindow() const { return _MaxWindow; }
+    void Reset();
+
+    //! Records a host read, true with the pages to read ahead [firstPage, endPage) if it continues a stream
+    bool OnRead(const U32 &lba, const U32 &sectorCount, const U32 &sectorsPerPage, U32 &stream, U32 &firstPage, U32 &endPage);
+
+    //! Pages of the stream from endPage on weren't read ahead, they are asked for again with its next read
+    void SetReadAheadEnd(const U32 &stream, const U32 &endPage);
+
+private:
+    struct Stream
+    {
+        U32 NextLba;
+        U32 ReadCount;
+        U32 Window;
+        U32 ReadAheadEnd;       //!< page after the last one read ahead
+        U32 LastUse;
+    };
+
+    enum : U32
+    {
+        StreamCount = 4,
+        InitialWindow = 2,
+    };
+
+private:
+    std::array<Stream, StreamCount> _Streams;
+    U32 _MaxWindow;
+    U32 _UseCount;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "ReadCache.h"
+
+ReadCache::ReadCache() :
+    _BufferHal(nullptr),
+    _SectorsPerPage(0),
+    _Capacity(0),
+    _FrameCount(0),
+    _SlotMask(0),
+    _ClockHand(0),
+    _Statistics{}
+{
+}
+
+void ReadCache::Init(BufferHal *bufferHal, const U8 &sectorsPerPage, const U32 &shareCount)
+{
+    for (U32 i = 0; i < _Frames.size(); ++i)
+    {
+        if (_Frames[i].InUse)
+        {
+            assert(_Frames[i].PinCount == 0);
+            FreeFrame(i);
+        }
+    }
+
+    _BufferHal = bufferHal;
+    _SectorsPerPage = sectorsPerPage;
+
+    // Every frame holds a page buffer, the pool bounds how many there can be
+    U32 maxFrameCount = std::max<U32>(1, _BufferHal->GetMaxBufferSizeInSector() / _SectorsPerPage);
+    U32 slotCount = 1;
+    while (slotCount < 2 * maxFrameCount)
+    {
+        slotCount <<= 1;
+    }
+
+    _Frames.assign(maxFrameCount, Frame{});
+    _FreeFrames.clear();
+    for (U32 i = maxFrameCount; i > 0; --i)
+    {
+        _FreeFrames.push_back(i - 1);
+    }
+    _Slots.assign(slotCount, EmptySlot);
+    _SlotMask = slotCount - 1;
+    _ClockHand = 0;
+    _FrameCount = 0;
+    _DetachedFrames.clear();
+    _Capacity = maxFrameCount / 4 / shareCount;
+}
+
+void ReadCache::SetCapacity(const U32 &pageCount)
+{
+    _Capacity = std::min<U32>(pageCount, _Frames.size());
+    while (_FrameCount > _Capacity && EvictOne());
+}
+
+bool ReadCache::Lookup(const U32 &pageIndex, const std::uint64_t &sectorMask, Buffer &buffer)
+{
+    U32 slot = FindSlot(pageIndex);
+    if (slot != EmptySlot)
+    {
+        Frame &frame = _Frames[_Slots[slot]];
+        if ((frame.ValidSectors & sectorMask) == sectorMask)
+        {
+            frame.Referenced = true;
+            ++frame.PinCount;
+            buffer = frame.Buffer;
+            ++_Statistics.Hits;
+            return true;
+        }
+    }
+
+    ++_Statistics.Misses;
+    return false;
+}
+
+bool ReadCache::Insert(const U32 &pageIndex, const std::uint64_t &validSectors, const Buffer &buffer)
+{
+    if (_Capacity == 0 || FindSlot(pageIndex) != EmptySlot)
+    {
+        return false;
+    }
+    if (_FrameCount >= _Capacity && !EvictOne())
+    {
+        return false;
+    }
+    assert(!_FreeFrames.empty());
+
+    U32 frameIndex = _FreeFrames.back();
+    _FreeFrames.pop_back();
+    Frame &frame = _Frames[frameIndex];
+    frame.PageIndex = pageIndex;
+    frame.Buffer = buffer;
+    frame.ValidSectors = validSectors;
+    frame.PinCount = 1;
+    frame.InUse = true;
+    frame.InTable = true;
+    frame.Referenced = false;
+    ++_FrameCount;
+
+    U32 slot = Hash(pageIndex);
+    while (_Slots[slot] != EmptySlot)
+    {
+        slot = (slot + 1) & _SlotMask;
+    }
+    _Slots[slot] = frameIndex;
+
+    return true;
+}
+
+bool ReadCache::Unpin(const U32 &pageIndex, const Buffer &buffer)
+{
+    U32 frameIndex = EmptySlot;
+    U32 slot = FindSlot(pageIndex);
+    if (slot != EmptySlot && _Frames[_Slots[slot]].Buffer.Handle == buffer.Handle)
+    {
+        frameIndex = _Slots[slot];
+    }
+    else
+    {
+        // Invalidated meanwhile, it's no longer in the table
+        auto detached = _DetachedFrames.find(buffer.Handle);
+        if (detached == _DetachedFrames.end())
+        {
+            return false;
+        }
+        frameIndex = detached->second;
+    }
+
+    Frame &frame = _Frames[frameIndex];
+    assert(frame.PinCount > 0);
+    if (--frame.PinCount == 0 && (!frame.InTable || _FrameCount > _Capacity))
+    {
+        if (frame.InTable)
+        {
+            RemoveSlot(FindSlot(frame.PageIndex));
+        }
+        else
+        {
+            _DetachedFrames.erase(frame.Buffer.Handle);
+        }
+        FreeFrame(frameIndex);
+    }
+    return true;
+}
+
+void ReadCache::Invalidate(const U32 &pageIndex)
+{
+    U32 slot = FindSlot(pageIndex);
+    if (slot == EmptySlot)
+    {
+        return;
+    }
+
+    U32 frameIndex = _Slots[slot];
+    RemoveSlot(slot);
+    _Frames[frameIndex].InTable = false;
+    if (_Frames[frameIndex].PinCount == 0)
+    {
+        FreeFrame(frameIndex);
+    }
+    else
+    {
+        _DetachedFrames.emplace(_Frames[frameIndex].Buffer.Handle, frameIndex);
+    }
+}
+
+bool ReadCache::EvictOne()
+{
+    // Two turns at most, the first one may only clear reference bits
+    for (U32 step = 0; step < 2 * _Frames.size(); ++step)
+    {
+        U32 frameIndex = _ClockHand;
+        _ClockHand = (_ClockHand + 1) % _Frames.size();
+
+        Frame &frame = _Frames[frameIndex];
+        if (!frame.InUse || !frame.InTable || frame.PinCount > 0)
+        {
+            continue;
+        }
+        if (frame.Referenced)
+        {
+            frame.Referenced = false;
+            continue;
+        }
+
+        RemoveSlot(FindSlot(frame.PageIndex));
+        FreeFrame(frameIndex);
+        return true;
+    }
+
+    return false;
+}
+
+U32 ReadCache::FindSlot(const U32 &pageIndex) const
+{
+    if (_Slots.empty())
+    {
+        return EmptySlot;
+    }
+
+    for (U32 slot = Hash(pageIndex); _Slots[slot] != EmptySlot; slot = (slot + 1) & _SlotMask)
+    {
+        if (_Frames[_Slots[slot]].PageIndex == pageIndex)
+        {
+            return slot;
+        }
+    }
+    return EmptySlot;
+}
+
+void ReadCache::RemoveSlot(U32 slot)
+{
+    // Backward shift, an entry after the hole moves into it unless its home slot lies between the two
+    U32 next = (slot + 1) & _SlotMask;
+    while (_Slots[next] != EmptySlot)
+    {
+        U32 home = Hash(_Frames[_Slots[next]].PageIndex);
+        if (((next - home) & _SlotMask) >= ((next - slot) & _SlotMask))
+        {
+            _Slots[slot] = _Slots[next];
+            slot = next;
+        }
+        next = (next + 1) & _SlotMask;
+    }
+    _Slots[slot] = EmptySlot;
+}
+
+void ReadCache::FreeFrame(const U32 &frameIndex)
+{
+    Frame &frame = _Frames[frameIndex];
+    assert(frame.InUse);
+    _BufferHal->DeallocateBuffer(frame.Buffer);
+    frame.InUse = false;
+    frame.InTable = false;
+    _FreeFrames.push_back(frameIndex);
+    --_FrameCount;
+}
\ No newline at end of file
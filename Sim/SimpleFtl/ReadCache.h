@@ -0,0 +1,99 @@
+#ifndef __ReadCache_h__
+#define __ReadCache_h__
+
+#include <map>
+#include <vector>
+
+#include "Buffer/Hal/BufferHal.h"
+
+//! Pages read from NAND kept in their buffers, keyed by page index (lba / sectors per page)
+/*!
+    Frames are found through an open addressing table with linear probing, and evicted by CLOCK:
+    a hit sets the frame's reference bit, the hand skips and clears set bits and takes the first clear one.
+    The buffers come from the BufferHal pool, when it runs dry the FTL evicts frames to get them back.
+
+    A frame is pinned while a transfer to the host reads from it. Invalidating a pinned frame takes it out
+    of the table right away, its buffer is freed when the last transfer is done.
+*/
+class ReadCache
+{
+public:
+    struct Statistics
+    {
+        std::uint64_t Hits;
+        std::uint64_t Misses;
+    };
+
+public:
+    ReadCache();
+
+    //! Drops every frame. Capacity defaults to a quarter of the buffer pool, split among the caches sharing it
+    void Init(BufferHal *bufferHal, const U8 &sectorsPerPage, const U32 &shareCount);
+
+    //! Up to as many pages as the pool holds, 0 turns the cache off
+    void SetCapacity(const U32 &pageCount);
+    inline U32 GetCapacity() const { return _Capacity; }
+
+    //! Buffer of the page if it holds every sector in sectorMask, pinned. Counts a hit or a miss
+    bool Lookup(const U32 &pageIndex, const std::uint64_t &sectorMask, Buffer &buffer);
+
+    //! Neither pins nor counts
+    inline bool Contains(const U32 &pageIndex) const { return FindSlot(pageIndex) != EmptySlot; }
+
+    //! Takes the buffer over as a pinned frame, false if it's left to the caller
+    bool Insert(const U32 &pageIndex, const std::uint64_t &validSectors, const Buffer &buffer);
+
+    //! False if the buffer isn't a frame, the caller still owns it then
+    bool Unpin(const U32 &pageIndex, const Buffer &buffer);
+
+    //! For when the page is written
+    void Invalidate(const U32 &pageIndex);
+
+    //! Frees the buffer of the next frame CLOCK picks, false if every frame is pinned
+    bool EvictOne();
+
+    inline const Statistics& GetStatistics() const { return _Statistics; }
+
+private:
+    struct Frame
+    {
+        U32 PageIndex;
+        Buffer Buffer;
+        std::uint64_t ValidSectors;
+        U32 PinCount;
+        bool InUse;
+        bool InTable;
+        bool Referenced;
+    };
+
+    enum : U32
+    {
+        EmptySlot = 0xFFFFFFFF
+    };
+
+private:
+    U32 FindSlot(const U32 &pageIndex) const;
+    void RemoveSlot(U32 slot);
+    inline U32 Hash(const U32 &pageIndex) const
+    {
+        return static_cast<U32>((static_cast<std::uint64_t>(pageIndex) * 0x9E3779B97F4A7C15ull) >> 32) & _SlotMask;
+    }
+    void FreeFrame(const U32 &frameIndex);
+
+private:
+    BufferHal *_BufferHal;
+    U8 _SectorsPerPage;
+    U32 _Capacity;
+    U32 _FrameCount;                //!< in use, pinned invalidated ones included
+    std::map<U32, U32> _DetachedFrames;     //!< pinned invalidated ones by buffer handle, they're out of the table
+
+    std::vector<Frame> _Frames;
+    std::vector<U32> _FreeFrames;
+    std::vector<U32> _Slots;        //!< frame indexes, at least twice as many as frames
+    U32 _SlotMask;
+    U32 _ClockHand;
+
+    Statistics _Statistics;
+};
+
+#endif
\ No newline at end of file
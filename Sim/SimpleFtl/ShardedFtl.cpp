@@ -0,0 +1,449 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "ShardedFtl.h"
+
+ShardedFtl::Shard::Shard(ShardedFtl *owner, const U32 &index) :
+    Owner(owner),
+    Index(index),
+    Commands(CustomProtocolHal::MaxInFlightCommands)
+{
+}
+
+bool ShardedFtl::Shard::Step()
+{
+    bool busy = !Ftl.IsEventQueueEmpty();
+    CustomProtocolCommand *command;
+    while (Commands.pop(command))
+    {
+        Ftl.SubmitCustomProtocolCommand(command);
+        busy = true;
+    }
+    Ftl();
+    return busy;
+}
+
+void ShardedFtl::Shard::HandleResponse(CustomProtocolCommand *command)
+{
+    Owner->PushResponse(Index, command);
+}
+
+bool ShardedFtl::Shard::Run()
+{
+    return Step();
+}
+
+ShardedFtl::ShardedFtl() :
+    _CustomProtocolHal(nullptr),
+    _ShardCount(1),
+    _Threaded(false),
+    _FirmwareCore(nullptr),
+    _IdleStrategy(FrameworkThread::IdleStrategy::SpinThenYield),
+    _SpinCount(DefaultShardSpinCount),
+    _ParkTimeout(0),
+    _AllShards(0),
+    _ActiveCommandCount(0),
+    _DrainingCommand(nullptr),
+    _DrainingStarted(false)
+{
+}
+
+ShardedFtl::~ShardedFtl()
+{
+    StopThreads();
+}
+
+void ShardedFtl::SetShards(const U32 &shardCount, const bool &threaded, const ThreadPlacement &placement, FrameworkThread *firmwareCore)
+{
+    _ShardCount = std::max<U32>(1, std::min<U32>(shardCount, MaxShardCount));
+    _Threaded = threaded;
+    _Placement = placement;
+    _FirmwareCore = firmwareCore;
+}
+
+void ShardedFtl::SetIdleStrategy(const FrameworkThread::IdleStrategy &strategy, const U32 &spinCount, const std::chrono::microseconds &parkTimeout)
+{
+    _IdleStrategy = strategy;
+    _SpinCount = spinCount;
+    _ParkTimeout = parkTimeout;
+}
+
+void ShardedFtl::Initialize(NandHal *nandHal, BufferHal *bufferHal, CustomProtocolHal *customProtocolHal)
+{
+    assert(_Shards.empty());
+    _CustomProtocolHal = customProtocolHal;
+    _Translation.SetGeometry(nandHal->GetGeometry());
+    _Translation.SetSectorSize(DefaultSectorInfo.SectorSizeInBit);
+
+    // A shard owns one die at least
+    _ShardCount = std::min<U32>(_ShardCount, _Translation.GetDieCount());
+    _AllShards = (_ShardCount == MaxShardCount) ? ~std::uint64_t(0) : ((std::uint64_t(1) << _ShardCount) - 1);
+    for (U32 i = 0; i < _ShardCount; ++i)
+    {
+        _Shards.push_back(std::make_unique<Shard>(this, i));
+        SimpleFtl &ftl = _Shards.back()->Ftl;
+        ftl.SetNandHal(nandHal);
+        ftl.SetShard(i, _ShardCount);
+        ftl.SetBufferHal(bufferHal);
+        ftl.SetProtocol(customProtocolHal);
+        ftl.SetResponseListener(_Shards.back().get());
+        if (_Threaded)
+        {
+            ftl.SetEventThread(_Shards.back().get());
+        }
+    }
+
+    // NOTE: emplaced one by one, a command can't be moved
+    U32 queueDepth = _CustomProtocolHal->GetQueueDepth();
+    _HostCommands.assign(queueDepth, HostCommand{ nullptr, 0, 0 });
+    for (U32 i = 0; i < queueDepth * _ShardCount; ++i)
+    {
+        _ShardCommands.emplace_back();
+    }
+
+    if (!_Threaded)
+    {
+        return;
+    }
+
+    for (auto &shard : _Shards)
+    {
+        ThreadPlacement placement = _Placement;
+        if (!_Placement.Cpus.empty())
+        {
+            placement.Cpus.assign(1, _Placement.Cpus[shard->Index % _Placement.Cpus.size()]);
+        }
+        shard->SetPlacement(placement);
+        shard->SetIdleStrategy(_IdleStrategy, _SpinCount, _ParkTimeout);
+        shard->Thread = std::async(std::launch::async, &Shard::operator(), shard.get());
+    }
+}
+
+void ShardedFtl::operator()()
+{
+    if (!_Threaded)
+    {
+        for (auto &shard : _Shards)
+        {
+            shard->Step();
+        }
+    }
+
+    CompletionQueue::Node *responses[ResponseBatchSize];
+    for (U32 count = _Responses.PopBatch(responses, ResponseBatchSize); count > 0; count = _Responses.PopBatch(responses, ResponseBatchSize))
+    {
+        for (U32 i = 0; i < count; ++i)
+        {
+            OnShardResponse(static_cast<ShardCommand*>(responses[i])->Command);
+        }
+    }
+}
+
+bool ShardedFtl::CanAcceptCommand()
+{
+    return (nullptr == _DrainingCommand);
+}
+
+void ShardedFtl::SubmitCustomProtocolCommand(CustomProtocolCommand *command)
+{
+    assert(command->GetContextIndex() < _HostCommands.size());
+    HostCommand &hostCommand = _HostCommands[command->GetContextIndex()];
+    assert(hostCommand.Command == nullptr);
+    hostCommand.Command = command;
+    hostCommand.PendingShardCount = 0;
+    hostCommand.NextShard = 0;
+    command->CommandStatus = CustomProtocolCommand::Status::Success;
+    ++_ActiveCommandCount;
+
+    switch (command->Command)
+    {
+    case CustomProtocolCommand::Code::Write:
+    case CustomProtocolCommand::Code::Read:
+    case CustomProtocolCommand::Code::Compare:
+    case CustomProtocolCommand::Code::Verify:
+    {
+        if (CustomProtocolCommand::Code::Compare == command->Command)
+        {
+            command->Descriptor.ComparePayload.MismatchOffset = ComparePayload::NoMismatch;
+        }
+        const SimpleFtlPayload &payload = command->Descriptor.SimpleFtlPayload;
+        SendToShards(hostCommand, GetShardsOfRange(payload.Lba, payload.SectorCount), command->Command);
+    } break;
+
+    case CustomProtocolCommand::Code::WriteVectored:
+    case CustomProtocolCommand::Code::ReadVectored:
+    {
+        SendToShards(hostCommand, GetShardsOfRanges(command->Descriptor.RangeListPayload), command->Command);
+    } break;
+
+    case CustomProtocolCommand::Code::Flush:
+    {
+        SendToShards(hostCommand, _AllShards, command->Command);
+    } break;
+
+    case CustomProtocolCommand::Code::GetStatistics:
+    {
+        // Summed up from every shard
+        command->Descriptor.StatisticsPayload = StatisticsPayload{};
+        SendToShards(hostCommand, _AllShards, command->Command);
+    } break;
+
+    case CustomProtocolCommand::Code::SetReadCache:
+    {
+        // Every shard takes its share of the pages, what they applied is summed up
+        U32 pageCount = command->Descriptor.ReadCachePayload.PageCount;
+        for (U32 i = 0; i < _ShardCount; ++i)
+        {
+            command->Descriptor.ReadCachePayload.PageCount = pageCount / _ShardCount + ((i < pageCount % _ShardCount) ? 1 : 0);
+            SendToShard(hostCommand, i, command->Command);
+        }
+        command->Descriptor.ReadCachePayload.PageCount = 0;
+    } break;
+
+    case CustomProtocolCommand::Code::SetSectorSize:
+    {
+        _DrainingCommand = command;
+        ResumeDrainingCommand();
+    } break;
+
+    default:
+    {
+        SendToShard(hostCommand, 0, command->Command);
+    } break;
+    }
+}
+
+std::uint64_t ShardedFtl::GetShardsOfRange(const U32 &lba, const U32 &sectorCount) const
+{
+    // Consecutive pages are on consecutive dies, the loop ends once every shard has a page at the latest
+    std::uint64_t shards = 0;
+    std::uint64_t endLba = static_cast<std::uint64_t>(lba) + sectorCount;
+    U32 sectorsPerPage = _Translation.GetSectorsPerPage();
+    for (std::uint64_t page = lba / sectorsPerPage; page * sectorsPerPage < endLba && shards != _AllShards; ++page)
+    {
+        shards |= std::uint64_t(1) << (_Translation.PageIndexToDie(static_cast<U32>(page)) % _ShardCount);
+    }
+    return shards;
+}
+
+std::uint64_t ShardedFtl::GetShardsOfRanges(const RangeListPayload &payload) const
+{
+    // Left for shard 0 to fail
+    if (payload.RangeCount > RangeListPayload::MaxRangeCount)
+    {
+        return 0;
+    }
+
+    std::uint64_t shards = 0;
+    for (U32 i = 0; i < payload.RangeCount && shards != _AllShards; ++i)
+    {
+        shards |= GetShardsOfRange(payload.Ranges[i].Lba, payload.Ranges[i].SectorCount);
+    }
+    return shards;
+}
+
+void ShardedFtl::SendToShards(HostCommand &hostCommand, const std::uint64_t &shards, const CustomProtocolCommand::Code &code)
+{
+    // A command with no page on any die, or no valid one, is for shard 0 to answer
+    if (shards == 0)
+    {
+        SendToShard(hostCommand, 0, code);
+        return;
+    }
+
+    for (U32 i = 0; i < _ShardCount; ++i)
+    {
+        if (shards & (std::uint64_t(1) << i))
+        {
+            SendToShard(hostCommand, i, code);
+        }
+    }
+}
+
+void ShardedFtl::SendToShard(HostCommand &hostCommand, const U32 &shardIndex, const CustomProtocolCommand::Code &code)
+{
+    ShardCommand &shardCommand = _ShardCommands[hostCommand.Command->GetContextIndex() * _ShardCount + shardIndex];
+    shardCommand.Command = *hostCommand.Command;
+    shardCommand.Command.Command = code;
+    ++hostCommand.PendingShardCount;
+
+    // NOTE: can't be full, a shard has a command per context at most
+    Shard &shard = *_Shards[shardIndex];
+    bool pushed = shard.Commands.push(&shardCommand.Command);
+    assert(pushed);
+    shard.Wakeup();
+}
+
+void ShardedFtl::PushResponse(const U32 &shardIndex, CustomProtocolCommand *command)
+{
+    _Responses.Push(&_ShardCommands[command->GetContextIndex() * _ShardCount + shardIndex]);
+    if (_Threaded && _FirmwareCore != nullptr)
+    {
+        _FirmwareCore->Wakeup();
+    }
+}
+
+void ShardedFtl::OnShardResponse(const CustomProtocolCommand &response)
+{
+    HostCommand &hostCommand = _HostCommands[response.GetContextIndex()];
+    CustomProtocolCommand *command = hostCommand.Command;
+    assert(command != nullptr && hostCommand.PendingShardCount > 0);
+    --hostCommand.PendingShardCount;
+
+    if (CustomProtocolCommand::Code::SetSectorSize == command->Command)
+    {
+        OnSetSectorSizeResponse(hostCommand, response);
+        return;
+    }
+
+    switch (command->Command)
+    {
+    case CustomProtocolCommand::Code::Compare:
+    {
+        command->Descriptor.ComparePayload.MismatchOffset = std::min<std::uint64_t>(command->Descriptor.ComparePayload.MismatchOffset,
+            response.Descriptor.ComparePayload.MismatchOffset);
+    } break;
+
+    case CustomProtocolCommand::Code::GetStatistics:
+    {
+        StatisticsPayload &statistics = command->Descriptor.StatisticsPayload;
+        const StatisticsPayload &shardStatistics = response.Descriptor.StatisticsPayload;
+        statistics.HostSectorsWritten += shardStatistics.HostSectorsWritten;
+        statistics.NandSectorsWritten += shardStatistics.NandSectorsWritten;
+        statistics.RelocatedSectors += shardStatistics.RelocatedSectors;
+        statistics.ErasedBlocks += shardStatistics.ErasedBlocks;
+        statistics.FreeBlocks += shardStatistics.FreeBlocks;
+        statistics.ReadCacheHits += shardStatistics.ReadCacheHits;
+        statistics.ReadCacheMisses += shardStatistics.ReadCacheMisses;
+        statistics.ReadAheadPages += shardStatistics.ReadAheadPages;
+        statistics.CopybackPages += shardStatistics.CopybackPages;
+    } break;
+
+    case CustomProtocolCommand::Code::SetReadCache:
+    {
+        command->Descriptor.ReadCachePayload.PageCount += response.Descriptor.ReadCachePayload.PageCount;
+    } break;
+
+    case CustomProtocolCommand::Code::Write:
+    case CustomProtocolCommand::Code::Read:
+    case CustomProtocolCommand::Code::Verify:
+    case CustomProtocolCommand::Code::WriteVectored:
+    case CustomProtocolCommand::Code::ReadVectored:
+    case CustomProtocolCommand::Code::Flush:
+    {
+    } break;
+
+    default:
+    {
+        // Answered by shard 0 alone
+        command->Descriptor = response.Descriptor;
+    } break;
+    }
+
+    // The first error a shard reports is kept
+    if (CustomProtocolCommand::Status::Success == command->CommandStatus)
+    {
+        command->CommandStatus = response.CommandStatus;
+    }
+
+    if (hostCommand.PendingShardCount == 0)
+    {
+        SubmitResponse(hostCommand);
+    }
+}
+
+void ShardedFtl::OnSetSectorSizeResponse(HostCommand &hostCommand, const CustomProtocolCommand &response)
+{
+    CustomProtocolCommand *command = hostCommand.Command;
+    if (CustomProtocolCommand::Code::SetSectorSize == response.Command && CustomProtocolCommand::Status::Success != response.CommandStatus)
+    {
+        // Shard 0 refuses a sector size before any shard has taken it
+        command->CommandStatus = response.CommandStatus;
+    }
+    else if (hostCommand.PendingShardCount > 0)
+    {
+        return;
+    }
+    else if (hostCommand.NextShard < _ShardCount)
+    {
+        // Once every cache is flushed the shards take the sector size one at a time, they share the buffer HAL
+        SendToShard(hostCommand, hostCommand.NextShard++, CustomProtocolCommand::Code::SetSectorSize);
+        return;
+    }
+    else
+    {
+        _Translation.SetSectorSize(command->Descriptor.SectorInfoPayload.SectorInfo.SectorSizeInBit);
+    }
+
+    _DrainingCommand = nullptr;
+    _DrainingStarted = false;
+    SubmitResponse(hostCommand);
+}
+
+void ShardedFtl::SubmitResponse(HostCommand &hostCommand)
+{
+    assert(hostCommand.Command != nullptr && hostCommand.PendingShardCount == 0);
+    _CustomProtocolHal->SubmitResponse(hostCommand.Command);
+    hostCommand.Command = nullptr;
+    --_ActiveCommandCount;
+
+    ResumeDrainingCommand();
+}
+
+void ShardedFtl::ResumeDrainingCommand()
+{
+    // Started once the commands ahead of it are done, by flushing every shard
+    if (_DrainingCommand != nullptr && !_DrainingStarted && _ActiveCommandCount == 1)
+    {
+        _DrainingStarted = true;
+        SendToShards(_HostCommands[_DrainingCommand->GetContextIndex()], _AllShards, CustomProtocolCommand::Code::Flush);
+    }
+}
+
+void ShardedFtl::FlushAll()
+{
+    StopThreads();
+    for (auto &shard : _Shards)
+    {
+        shard->Ftl.FlushAll();
+    }
+}
+
+bool ShardedFtl::IsQuiescent()
+{
+    // NOTE: the shards are only looked into from this thread once theirs are stopped
+    if (_Threaded || _ActiveCommandCount > 0 || !_Responses.IsEmpty())
+    {
+        return false;
+    }
+
+    for (auto &shard : _Shards)
+    {
+        if (!shard->Commands.empty() || shard->Ftl.IsProcessingCommand() || !shard->Ftl.IsEventQueueEmpty() || !shard->Ftl.IsWriteCacheEmpty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShardedFtl::StopThreads()
+{
+    if (!_Threaded)
+    {
+        return;
+    }
+
+    for (auto &shard : _Shards)
+    {
+        shard->Stop();
+    }
+    for (auto &shard : _Shards)
+    {
+        if (shard->Thread.valid())
+        {
+            shard->Thread.wait();
+        }
+    }
+    _Threaded = false;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#ifndef __ShardedFtl_h__
+#define __ShardedFtl_h__
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "boost/lockfree/spsc_queue.hpp"
+
+#include "SimFrameworkBase/FrameworkThread.h"
+#include "SimFrameworkBase/ThreadPlacement.h"
+#include "CompletionQueue.h"
+#include "SimpleFtl.h"
+#include "Translation.h"
+
+//! Splits the LBA space over SimpleFtl shards by die, each shard running on a thread of its own
+/*!
+    Shard n owns the pages of dies n, n + shardCount and so on, so consecutive pages go to the shards
+    in turn. A host command goes to the shards that own some of its pages, each of them works on a copy
+    of it that keeps the offsets into the host payload, and the copies are merged back as they respond.
+    Commands about the whole device go to every shard, the others to shard 0.
+
+    Host commands and the shards' responses are only handled from operator(), on the firmware core.
+    Without threads the shards are stepped from there as well.
+
+    NOTE: a shard only sees the reads that have pages on its dies, short sequential reads don't make
+    a stream for its read ahead
+*/
+class ShardedFtl
+{
+public:
+    ShardedFtl();
+    ~ShardedFtl();
+
+    //! Before Initialize. The placement cpus are dealt out to the shard threads in turn, the firmware core is woken up by their responses
+    void SetShards(const U32 &shardCount, const bool &threaded, const ThreadPlacement &placement, FrameworkThread *firmwareCore);
+
+    //! Before Initialize, for the shard threads. They spin then yield unless set
+    void SetIdleStrategy(const FrameworkThread::IdleStrategy &strategy, const U32 &spinCount, const std::chrono::microseconds &parkTimeout);
+
+    //! Starts the shard threads, there are no more shards than dies
+    void Initialize(NandHal *nandHal, BufferHal *bufferHal, CustomProtocolHal *customProtocolHal);
+    void operator()();
+
+    bool CanAcceptCommand();
+    void SubmitCustomProtocolCommand(CustomProtocolCommand *command);
+
+    //! Stops the shard threads and has every shard flush its cache, they are stepped from operator() from then on
+    void FlushAll();
+
+    //! Only once FlushAll() stopped the threads
+    bool IsQuiescent();
+
+private:
+    //! The copy of a host command one shard works on, linked into the response queue once it's done
+    struct ShardCommand : public CompletionQueue::Node
+    {
+        CustomProtocolCommand Command;
+    };
+
+    class Shard : public FrameworkThread, public SimpleFtl::ResponseListener
+    {
+    public:
+        Shard(ShardedFtl *owner, const U32 &index);
+
+        //! Takes in the commands sent to the shard and processes its events, true if there were any
+        bool Step();
+        virtual void HandleResponse(CustomProtocolCommand *command);
+
+    protected:
+        virtual bool Run() override;
+
+    public:
+        ShardedFtl *Owner;
+        U32 Index;
+        SimpleFtl Ftl;
+        boost::lockfree::spsc_queue<CustomProtocolCommand*> Commands;   //!< from the firmware core
+        std::future<void> Thread;
+    };
+
+    //! State of a host command while shards work on it
+    struct HostCommand
+    {
+        CustomProtocolCommand *Command;
+        U32 PendingShardCount;
+        U32 NextShard;              //!< SetSectorSize is taken by one shard after the other
+    };
+
+    enum : U32
+    {
+        MaxShardCount = 64,         //!< bits of a shard mask
+        ResponseBatchSize = 32,
+        DefaultShardSpinCount = 10000,
+    };
+
+private:
+    std::uint64_t GetShardsOfRange(const U32 &lba, const U32 &sectorCount) const;
+    std::uint64_t GetShardsOfRanges(const RangeListPayload &payload) const;
+    void SendToShards(HostCommand &hostCommand, const std::uint64_t &shards, const CustomProtocolCommand::Code &code);
+    void SendToShard(HostCommand &hostCommand, const U32 &shardIndex, const CustomProtocolCommand::Code &code);
+    void PushResponse(const U32 &shardIndex, CustomProtocolCommand *command);
+    void OnShardResponse(const CustomProtocolCommand &response);
+    void OnSetSectorSizeResponse(HostCommand &hostCommand, const CustomProtocolCommand &response);
+    void SubmitResponse(HostCommand &hostCommand);
+    void ResumeDrainingCommand();
+    void StopThreads();
+
+private:
+    CustomProtocolHal *_CustomProtocolHal;
+    SimpleFtlTranslation _Translation;
+
+    U32 _ShardCount;
+    bool _Threaded;
+    ThreadPlacement _Placement;
+    FrameworkThread *_FirmwareCore;
+    FrameworkThread::IdleStrategy _IdleStrategy;
+    U32 _SpinCount;
+    std::chrono::microseconds _ParkTimeout;
+    std::vector<std::unique_ptr<Shard>> _Shards;
+    std::uint64_t _AllShards;
+
+    //! Indexed like the protocol HAL contexts, the shard commands by context then shard
+    std::vector<HostCommand> _HostCommands;
+    std::deque<ShardCommand> _ShardCommands;
+    U32 _ActiveCommandCount;
+    CompletionQueue _Responses;
+
+    //! Changing the sector size waits until it's the only command in flight, then every shard is flushed
+    CustomProtocolCommand *_DrainingCommand;
+    bool _DrainingStarted;
+};
+
+#endif
\ No newline at end of file
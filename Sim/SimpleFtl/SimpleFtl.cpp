@@ -1,13 +1,78 @@
+#include <algorithm>
+#include <cstring>
+
 #include "SimpleFtl.h"
 
-SimpleFtl::SimpleFtl() : _ProcessingCommand(nullptr)
+namespace
+{
+    //! Of the first byte that differs, size if none. memcmp is vectorized by the runtime, the byte is only looked for on a mismatch
+    U32 FindMismatch(const U8 *data, const U8 *expected, const U32 &size)
+    {
+        if (std::memcmp(data, expected, size) == 0)
+        {
+            return size;
+        }
+
+        U32 offset = 0;
+        while (data[offset] == expected[offset])
+        {
+            ++offset;
+        }
+        return offset;
+    }
+}
+
+void SimpleFtl::Event::HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command)
+{
+    Ftl->PushEvent(*this);
+}
+
+void SimpleFtl::Event::HandleCommandCompleted(const NandHal::CommandDesc &command)
 {
-    _EventQueue = std::unique_ptr<boost::lockfree::queue<Event>>(new boost::lockfree::queue<Event>{ 1024 });
+    EventParams.NandCommand.CommandStatus = command.CommandStatus;
+    Ftl->PushEvent(*this);
+}
+
+SimpleFtl::SimpleFtl() :
+    _ShardIndex(0),
+    _ShardCount(1),
+    _ResponseListener(nullptr),
+    _EventThread(nullptr),
+    _ActiveContextCount(0),
+    _QueuedTransferCount(0),
+    _DrainingCommand(nullptr),
+    _DrainingCommandParked(false),
+    _FlushDepth(1),
+    _WatermarkFlushing(false),
+    _FlushAll(false),
+    _FlushSequence(0),
+    _FlushFailed(false),
+    _HostSectorsWritten(0),
+    _NandSectorsWritten(0),
+    _PatternDataValue(0),
+    _ReadAheadPageCount(0)
+{
+    // NOTE: emplaced one by one, a slot can't be moved
+    for (U32 i = 0; i < InitialEventCount; ++i)
+    {
+        _Events.emplace_back();
+        _Events.back().Ftl = this;
+        _FreeEvents.push_back(&_Events.back());
+    }
 }
 
 void SimpleFtl::SetProtocol(CustomProtocolHal *customProtocolHal)
 {
     SimpleFtl::_CustomProtocolHal = customProtocolHal;
+
+    // Commands are taken in as long as the HAL has a context for them, the FTL mirrors its pool
+    _Contexts.resize(_CustomProtocolHal->GetQueueDepth());
+    for (U32 i = 0; i < _Contexts.size(); ++i)
+    {
+        _Contexts[i].Ftl = this;
+        _Contexts[i].Index = i;
+        _Contexts[i].Command = nullptr;
+    }
 }
 
 void SimpleFtl::SetNandHal(NandHal *nandHal)
@@ -15,7 +80,50 @@ void SimpleFtl::SetNandHal(NandHal *nandHal)
     _NandHal = nandHal;
     NandHal::Geometry geometry = _NandHal->GetGeometry();
 
-    SimpleFtlTranslation::SetGeometry(geometry);
+    _Translation.SetGeometry(geometry);
+    _FlushDepth = geometry.ChannelCount * geometry.DevicesPerChannel;
+    _OwnDies.assign(_FlushDepth, true);
+    _OwnDieDistances.assign(_FlushDepth, 1);
+
+    _PatternData = std::unique_ptr<U8[]>(new U8[geometry.BytesPerPage]);
+    std::memset(_PatternData.get(), 0, geometry.BytesPerPage);
+    _PatternDataValue = 0;
+}
+
+void SimpleFtl::SetShard(const U32 &shardIndex, const U32 &shardCount)
+{
+    assert(shardIndex < shardCount && shardCount <= _OwnDies.size());
+    _ShardIndex = shardIndex;
+    _ShardCount = shardCount;
+
+    // Flushes a page on each of its own dies at once
+    _FlushDepth = 0;
+    for (U32 die = 0; die < _OwnDies.size(); ++die)
+    {
+        _OwnDies[die] = (die % _ShardCount == _ShardIndex);
+        _FlushDepth += _OwnDies[die] ? 1 : 0;
+    }
+
+    // Commands are walked from one page of this shard to the next, the ones in between are skipped at once
+    for (U32 die = 0; die < _OwnDies.size(); ++die)
+    {
+        U32 distance = 1;
+        while (!_OwnDies[(die + distance) % _OwnDies.size()])
+        {
+            ++distance;
+        }
+        _OwnDieDistances[die] = distance;
+    }
+}
+
+void SimpleFtl::SetResponseListener(ResponseListener *listener)
+{
+    _ResponseListener = listener;
+}
+
+void SimpleFtl::SetEventThread(FrameworkThread *thread)
+{
+    _EventThread = thread;
 }
 
 void SimpleFtl::SetBufferHal(BufferHal *bufferHal)
@@ -35,42 +143,106 @@ bool SimpleFtl::SetSectorInfo(const SectorInfo &sectorInfo)
     _SectorsPerPage = geometry.BytesPerPage >> sectorInfo.SectorSizeInBit;
     _TotalSectors = geometry.ChannelCount * geometry.DevicesPerChannel
         * geometry.BlocksPerDevice * geometry.PagesPerBlock * _SectorsPerPage;
-    SimpleFtlTranslation::SetSectorSize(sectorInfo.SectorSizeInBit);
+    _Translation.SetSectorSize(sectorInfo.SectorSizeInBit);
 
     _SectorsPerSegment = _SectorsPerPage;
 
     _BufferHal->SetImplicitAllocationSectorCount(_SectorsPerSegment);
+    _WriteCache.Init(_BufferHal, &_Translation, _SectorsPerPage, _ShardCount);
+    _ReadCache.Init(_BufferHal, _SectorsPerPage, _ShardCount);
+    _ReadAhead.Reset();
+    _ReadAhead.SetMaxWindow(_ReadCache.GetCapacity() / 2);
 
     return true;
 }
 
+void SimpleFtl::GetStatistics(StatisticsPayload &payload)
+{
+    payload = StatisticsPayload{};
+    payload.HostSectorsWritten = _HostSectorsWritten;
+    payload.NandSectorsWritten = _NandSectorsWritten;
+    payload.ReadCacheHits = _ReadCache.GetStatistics().Hits;
+    payload.ReadCacheMisses = _ReadCache.GetStatistics().Misses;
+    payload.ReadAheadPages = _ReadAheadPageCount;
+}
+
 void SimpleFtl::operator()()
 {
-    while (_EventQueue->empty() == false)
+    CompletionQueue::Node *events[EventBatchSize];
+    for (U32 count = _EventQueue.PopBatch(events, EventBatchSize); count > 0; count = _EventQueue.PopBatch(events, EventBatchSize))
+    {
+        for (U32 i = 0; i < count; ++i)
+        {
+            ProcessEvent(*static_cast<Event*>(events[i]));
+        }
+    }
+
+    // Buffers freed by the other shards wake nothing up here, what waits for them is retried
+    if (_ShardCount > 1)
+    {
+        ResumeWaitingContexts();
+    }
+
+    if (_FlushAll || _ShardCount > 1)
+    {
+        FlushCache();
+    }
+}
+
+SimpleFtl::Event& SimpleFtl::AllocateEvent(const Event::Type &type, const U32 &contextIndex)
+{
+    // More slots are added when every one is in flight, existing ones never move
+    if (_FreeEvents.empty())
     {
-        ProcessEvent();
+        _Events.emplace_back();
+        _Events.back().Ftl = this;
+        _FreeEvents.push_back(&_Events.back());
     }
+
+    Event &event = *_FreeEvents.back();
+    _FreeEvents.pop_back();
+    event.EventType = type;
+    event.ContextIndex = contextIndex;
+    event.EntryPinned = false;
+    return event;
 }
 
-void SimpleFtl::ProcessEvent()
+void SimpleFtl::PushEvent(Event &event)
+{
+    _EventQueue.Push(&event);
+    if (_EventThread != nullptr)
+    {
+        _EventThread->Wakeup();
+    }
+}
+
+void SimpleFtl::ProcessEvent(Event &event)
 {
-    Event event;
-    _EventQueue->pop(event);
     switch (event.EventType)
     {
         case Event::Type::CustomProtocolCommand:
         {
-            OnNewCustomProtocolCommand(event.EventParams.CustomProtocolCommand);
+            OnNewCustomProtocolCommand(_Contexts[event.ContextIndex]);
         } break;
 
         case Event::Type::TransferCompleted:
         {
-            OnTransferCommandCompleted(event.EventParams.TransferCommand);
+            OnTransferCommandCompleted(_Contexts[event.ContextIndex], event.EventParams.TransferCommand);
         } break;
 
         case Event::Type::NandCommandCompleted:
         {
-            OnNandCommandCompleted(event.EventParams.NandCommand);
+            OnNandCommandCompleted(_Contexts[event.ContextIndex], event.EventParams.NandCommand, event.EntryPinned);
+        } break;
+
+        case Event::Type::CacheCommandCompleted:
+        {
+            OnCacheCommandCompleted(event.EventParams.NandCommand);
+        } break;
+
+        case Event::Type::ReadAheadCompleted:
+        {
+            OnReadAheadCompleted(event.EventParams.NandCommand);
         } break;
 
         default:
@@ -78,51 +250,71 @@ void SimpleFtl::ProcessEvent()
             assert(0);
         }
     }
+
+    _FreeEvents.push_back(&event);
 }
 
-void SimpleFtl::OnNewCustomProtocolCommand(CustomProtocolCommand *command)
+void SimpleFtl::OnNewCustomProtocolCommand(CommandContext &context)
 {
-    // NOTE: only support for handling single command at a time
-    assert(_ProcessingCommand == nullptr);
-
     // Set default command staus is Success
-    _ProcessingCommand = command;
+    CustomProtocolCommand *command = context.Command;
     command->CommandStatus = CustomProtocolCommand::Status::Success;
 
     switch (command->Command)
     {
     case CustomProtocolCommand::Code::Write:
-    {
-        // Write command to nand
-        _RemainingSectorCount = command->Descriptor.SimpleFtlPayload.SectorCount;
-        _CurrentLba = command->Descriptor.SimpleFtlPayload.Lba;
-        _ProcessedSectorCount = 0;
-        _PendingCommandCount = 0;
-
-        WriteNextLbas();
-    } break;
-
-    case CustomProtocolCommand::Code::LoopbackWrite:
-    {
-        command->CommandStatus = CustomProtocolCommand::Status::Success;
-        SubmitResponse();
-    } break;
-
     case CustomProtocolCommand::Code::Read:
+    case CustomProtocolCommand::Code::WriteVectored:
+    case CustomProtocolCommand::Code::ReadVectored:
+    case CustomProtocolCommand::Code::Compare:
+    case CustomProtocolCommand::Code::Verify:
     {
-        // Read command from nand
-        _RemainingSectorCount = command->Descriptor.SimpleFtlPayload.SectorCount;
-        _CurrentLba = command->Descriptor.SimpleFtlPayload.Lba;
-        _ProcessedSectorCount = 0;
-        _PendingCommandCount = 0;
+        context.RemainingSectorCount = command->Descriptor.SimpleFtlPayload.SectorCount;
+        context.CurrentLba = command->Descriptor.SimpleFtlPayload.Lba;
+        context.ProcessedSectorCount = 0;
+        context.PendingCommandCount = 0;
+        bool inRange = (context.CurrentLba < _TotalSectors && context.RemainingSectorCount <= _TotalSectors - context.CurrentLba);
+        if (CustomProtocolCommand::Code::Compare == command->Command)
+        {
+            command->Descriptor.ComparePayload.MismatchOffset = ComparePayload::NoMismatch;
+        }
+        if ((IsVectored(*command) && !SplitRanges(context))
+            || ((CustomProtocolCommand::Code::Compare == command->Command || CustomProtocolCommand::Code::Verify == command->Command) && !inRange))
+        {
+            command->CommandStatus = CustomProtocolCommand::Status::Failed;
+            SubmitResponse(context);
+            break;
+        }
+        // Commands already waiting for buffers go first, pages are then programmed in command order
+        if (_BufferWaitingContexts.empty())
+        {
+            ProcessNextLbas(context);
+        }
+
+        // Queued behind the command's own reads so that it doesn't wait on them
+        U32 stream;
+        U32 firstPage;
+        U32 endPage;
+        if (CustomProtocolCommand::Code::Read == command->Command
+            && _ReadAhead.OnRead(command->Descriptor.SimpleFtlPayload.Lba, command->Descriptor.SimpleFtlPayload.SectorCount, _SectorsPerPage, stream, firstPage, endPage))
+        {
+            ReadAheadPages(stream, firstPage, endPage);
+        }
 
-        ReadNextLbas();
+        if (context.RemainingSectorCount > 0)
+        {
+            _BufferWaitingContexts.push_back(context.Index);
+        }
+        else if (context.PendingCommandCount == 0)
+        {
+            SubmitResponse(context);
+        }
     } break;
 
+    case CustomProtocolCommand::Code::LoopbackWrite:
     case CustomProtocolCommand::Code::LoopbackRead:
     {
-        command->CommandStatus = CustomProtocolCommand::Status::Success;
-        SubmitResponse();
+        SubmitResponse(context);
     } break;
 
     case CustomProtocolCommand::Code::GetDeviceInfo:
@@ -130,219 +322,893 @@ void SimpleFtl::OnNewCustomProtocolCommand(CustomProtocolCommand *command)
         command->Descriptor.DeviceInfoPayload.TotalSector = _TotalSectors;
         command->Descriptor.DeviceInfoPayload.SectorInfo = _BufferHal->GetSectorInfo();
         command->Descriptor.DeviceInfoPayload.SectorsPerPage = _SectorsPerPage;
-        command->CommandStatus = CustomProtocolCommand::Status::Success;
-        SubmitResponse();
+        SubmitResponse(context);
     } break;
 
     case CustomProtocolCommand::Code::SetSectorSize:
     {
-        SectorInfo sectorInfo = command->Descriptor.SectorInfoPayload.SectorInfo;
-        if (SetSectorInfo(sectorInfo))
+        // NOTE: started again once the commands ahead of it are done, the cache is flushed and read ahead is over
+        if (_ActiveContextCount > 1 || !_WriteCache.IsEmpty() || !_ReadAheadInFlight.empty())
         {
-            command->CommandStatus = CustomProtocolCommand::Status::Success;
+            _DrainingCommandParked = true;
+            FlushCache();
+            break;
         }
-        else
+        _DrainingCommand = nullptr;
+        _DrainingCommandParked = false;
+
+        SectorInfo sectorInfo = command->Descriptor.SectorInfoPayload.SectorInfo;
+        if (!SetSectorInfo(sectorInfo))
         {
             command->CommandStatus = CustomProtocolCommand::Status::Failed;
         }
-        SubmitResponse();
+        SubmitResponse(context);
+    } break;
+
+    case CustomProtocolCommand::Code::SetReadCache:
+    {
+        _ReadCache.SetCapacity(command->Descriptor.ReadCachePayload.PageCount);
+        _ReadAhead.SetMaxWindow(_ReadCache.GetCapacity() / 2);
+        command->Descriptor.ReadCachePayload.PageCount = _ReadCache.GetCapacity();
+        SubmitResponse(context);
+    } break;
+
+    case CustomProtocolCommand::Code::GetStatistics:
+    {
+        GetStatistics(command->Descriptor.StatisticsPayload);
+        SubmitResponse(context);
+    } break;
+
+    case CustomProtocolCommand::Code::Flush:
+    {
+        // Done once every page cached before it is programmed
+        context.FlushSequence = _WriteCache.GetNextSequence();
+        _FlushSequence = context.FlushSequence;
+        _FlushWaitingContexts.push_back(context.Index);
+        CompleteFlushCommands();
+        FlushCache();
+    } break;
+
+    default:
+    {
+        command->CommandStatus = CustomProtocolCommand::Status::Failed;
+        SubmitResponse(context);
     } break;
     }
 }
 
-void SimpleFtl::ReadNextLbas()
+void SimpleFtl::ProcessNextLbas(CommandContext &context)
+{
+    if (IsRead(*context.Command))
+    {
+        ReadNextLbas(context);
+    }
+    else
+    {
+        WriteNextLbas(context);
+    }
+}
+
+void SimpleFtl::ResumeWaitingContexts()
+{
+    // In arrival order, a command still short of buffers keeps the ones behind it waiting
+    while (!_BufferWaitingContexts.empty())
+    {
+        CommandContext &context = _Contexts[_BufferWaitingContexts.front()];
+        ProcessNextLbas(context);
+        if (context.RemainingSectorCount > 0)
+        {
+            break;
+        }
+        _BufferWaitingContexts.pop_front();
+    }
+}
+
+bool SimpleFtl::SplitRanges(CommandContext &context)
+{
+    const RangeListPayload &payload = context.Command->Descriptor.RangeListPayload;
+    if (payload.RangeCount > RangeListPayload::MaxRangeCount)
+    {
+        return false;
+    }
+
+    // The pieces keep where their data is in the payload
+    context.Pieces.clear();
+    context.NextPiece = 0;
+    context.RemainingSectorCount = 0;
+    U32 commandOffset = 0;
+    for (U32 i = 0; i < payload.RangeCount; ++i)
+    {
+        const SimpleFtlPayload &range = payload.Ranges[i];
+        if (range.Lba >= _TotalSectors || range.SectorCount > _TotalSectors - range.Lba)
+        {
+            return false;
+        }
+
+        for (U32 lba = range.Lba, remainingSectorCount = range.SectorCount; remainingSectorCount > 0; )
+        {
+            U32 sectorCount = std::min<U32>(remainingSectorCount, _SectorsPerPage - lba % _SectorsPerPage);
+            if (IsOwnPage(lba / _SectorsPerPage))
+            {
+                context.Pieces.push_back(CommandContext::Piece{ lba, sectorCount, commandOffset, Buffer{} });
+                context.RemainingSectorCount += sectorCount;
+            }
+            lba += sectorCount;
+            remainingSectorCount -= sectorCount;
+            commandOffset += sectorCount;
+        }
+    }
+
+    // In LBA order the pages are issued die after die, like the pages of a sequential command
+    std::stable_sort(context.Pieces.begin(), context.Pieces.end(),
+        [](const CommandContext::Piece &left, const CommandContext::Piece &right) { return left.Lba < right.Lba; });
+    return true;
+}
+
+void SimpleFtl::GetNextPiece(const CommandContext &context, TranslatedPages &pages, NandHal::NandAddress &nandAddress, U32 &commandOffset) const
 {
-    Buffer buffer;
-    NandHal::NandAddress nandAddress;
     U32 nextLba;
     U32 remainingSectorCount;
-    while (_RemainingSectorCount > 0)
+    if (IsVectored(*context.Command))
+    {
+        const CommandContext::Piece &piece = context.Pieces[context.NextPiece];
+        _Translation.LbaToNandAddress(piece.Lba, piece.SectorCount, nandAddress, nextLba, remainingSectorCount);
+        commandOffset = piece.CommandOffset;
+    }
+    else
     {
-        SimpleFtlTranslation::LbaToNandAddress(_CurrentLba, _RemainingSectorCount, nandAddress, nextLba, remainingSectorCount);
-        if (_BufferHal->AllocateBuffer(BufferType::User, buffer))
+        // Every piece taken is either issued or skipped, so the batch stays in step with CurrentLba
+        if (pages.Next == pages.Count)
         {
-            ReadPage(nandAddress, buffer, tSectorOffset{ _ProcessedSectorCount });
-            _ProcessedSectorCount += nandAddress.SectorCount;
-            _CurrentLba = nextLba;
-            _RemainingSectorCount = remainingSectorCount;
-            ++_PendingCommandCount;
+            pages.Count = _Translation.LbaRangeToNandAddresses(context.CurrentLba, context.RemainingSectorCount, pages.Addresses, TranslatedPages::BatchSize,
+                nextLba, remainingSectorCount);
+            pages.Next = 0;
         }
-        else
+        nandAddress = pages.Addresses[pages.Next++];
+        commandOffset = context.ProcessedSectorCount;
+    }
+}
+
+void SimpleFtl::AdvancePiece(CommandContext &context, const U32 &sectorCount, const U32 &followerCount)
+{
+    if (IsVectored(*context.Command))
+    {
+        for (U32 i = 0; i <= followerCount; ++i)
+        {
+            context.RemainingSectorCount -= context.Pieces[context.NextPiece++].SectorCount;
+            ++context.PendingCommandCount;
+        }
+    }
+    else
+    {
+        context.ProcessedSectorCount += sectorCount;
+        context.CurrentLba += sectorCount;
+        context.RemainingSectorCount -= sectorCount;
+        ++context.PendingCommandCount;
+    }
+}
+
+void SimpleFtl::SkipForeignPages(CommandContext &context, TranslatedPages &pages, const U32 &pageIndex, const U32 &sectorCount)
+{
+    // Vectored commands only have pieces of this shard
+    assert(!IsVectored(*context.Command));
+
+    // Straight to the next page of this shard, the pages up to it are whole. The batch goes on from there if it has it
+    U32 pageCount = _OwnDieDistances[_Translation.PageIndexToDie(pageIndex)];
+    U32 skippedSectorCount = std::min<U32>(context.RemainingSectorCount, sectorCount + (pageCount - 1) * _SectorsPerPage);
+    context.ProcessedSectorCount += skippedSectorCount;
+    context.CurrentLba += skippedSectorCount;
+    context.RemainingSectorCount -= skippedSectorCount;
+    pages.Next = std::min<U32>(pages.Count, pages.Next + pageCount - 1);
+}
+
+void SimpleFtl::ReadNextLbas(CommandContext &context)
+{
+    Buffer buffer;
+    NandHal::NandAddress nandAddress;
+    U32 commandOffset;
+    TranslatedPages pages;
+    while (context.RemainingSectorCount > 0)
+    {
+        GetNextPiece(context, pages, nandAddress, commandOffset);
+        U32 pageIndex = ToPageIndex(nandAddress);
+        if (!IsOwnPage(pageIndex))
+        {
+            SkipForeignPages(context, pages, pageIndex, nandAddress.SectorCount);
+            continue;
+        }
+        if (!CanQueueTransfer())
         {
             break;
         }
+        WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+        std::uint64_t sectorMask = WriteCache::ToSectorMask(nandAddress.Sector, nandAddress.SectorCount);
+        if ((entry != nullptr && entry->Flushing) || _ReadAheadInFlight.count(pageIndex) > 0)
+        {
+            break;
+        }
+
+        // The expected data needs a buffer of its own whichever way the sectors are read
+        if (IsPayloadCompare(*context.Command))
+        {
+            Buffer expectedBuffer;
+            if (!AllocateBuffer(expectedBuffer))
+            {
+                break;
+            }
+            context.PendingCompares[commandOffset] = CommandContext::ComparedSectors{ expectedBuffer, Buffer{} };
+        }
+
+        U32 followerCount = 0;
+        if (entry == nullptr && _ReadCache.Lookup(pageIndex, sectorMask, buffer))
+        {
+            DeliverReadData(context, buffer, nandAddress, tSectorOffset{ commandOffset }, nandAddress.SectorCount);
+        }
+        else
+        {
+            if (entry != nullptr && (entry->ValidSectors & sectorMask) == sectorMask)
+            {
+                // Sent straight from the write cache
+                DeliverReadData(context, entry->Buffer, nandAddress, tSectorOffset{ commandOffset }, nandAddress.SectorCount);
+            }
+            else if (AllocateBuffer(buffer))
+            {
+                if (!AllocateFollowerBuffers(context, pageIndex, followerCount))
+                {
+                    _BufferHal->DeallocateBuffer(buffer);
+                    break;
+                }
+
+                // Write cached sectors are laid over the NAND data once it's read
+                ReadPage(context, nandAddress, buffer, tSectorOffset{ commandOffset }, followerCount > 0, entry != nullptr);
+            }
+            else
+            {
+                if (IsPayloadCompare(*context.Command))
+                {
+                    _BufferHal->DeallocateBuffer(context.PendingCompares[commandOffset].Expected);
+                    context.PendingCompares.erase(commandOffset);
+                }
+                break;
+            }
+
+            // NOTE: a page with no entry has nothing to pin. The NAND queue is served in order, an entry cached after the read
+            // is issued is only programmed after it, so it's still there when the read completes
+            for (U32 i = 0; entry != nullptr && i <= followerCount; ++i)
+            {
+                _WriteCache.Pin(*entry);
+            }
+        }
+
+        // Counted when issued, the NAND reads in flight would otherwise all pass the check and deliver past the limit
+        _QueuedTransferCount += 1 + followerCount;
+        AdvancePiece(context, nandAddress.SectorCount, followerCount);
+    }
+}
+
+bool SimpleFtl::AllocateFollowerBuffers(CommandContext &context, const U32 &pageIndex, U32 &followerCount)
+{
+    // The other pieces of the page in a vectored command share its read, each with a buffer of its own to transfer from
+    followerCount = 0;
+    if (!IsVectored(*context.Command))
+    {
+        return true;
+    }
+
+    for (U32 i = context.NextPiece + 1; i < context.Pieces.size() && context.Pieces[i].Lba / _SectorsPerPage == pageIndex; ++i)
+    {
+        if (!AllocateBuffer(context.Pieces[i].Buffer))
+        {
+            for (U32 j = context.NextPiece + 1; j < i; ++j)
+            {
+                _BufferHal->DeallocateBuffer(context.Pieces[j].Buffer);
+            }
+            followerCount = 0;
+            return false;
+        }
+        ++followerCount;
+    }
+    return true;
+}
+
+void SimpleFtl::TransferToFollowers(CommandContext &context, const NandHal::CommandDesc &command, WriteCache::Entry *entry, const bool &entryPinned)
+{
+    // The piece the page was read for is found by its LBA then its offset, pieces of the page that came before it were served on their own
+    U32 pageIndex = ToPageIndex(command.Address);
+    U32 lba = pageIndex * _SectorsPerPage + command.Address.Sector;
+    auto piece = std::lower_bound(context.Pieces.begin(), context.Pieces.end(), lba,
+        [](const CommandContext::Piece &candidate, const U32 &value) { return candidate.Lba < value; });
+    while (piece->CommandOffset != command.DescSectorIndex)
+    {
+        ++piece;
+    }
+
+    for (++piece; piece != context.Pieces.end() && piece->Lba / _SectorsPerPage == pageIndex; ++piece)
+    {
+        NandHal::NandAddress nandAddress;
+        U32 nextLba;
+        U32 remainingSectorCount;
+        _Translation.LbaToNandAddress(piece->Lba, piece->SectorCount, nandAddress, nextLba, remainingSectorCount);
+        std::uint64_t sectorMask = WriteCache::ToSectorMask(nandAddress.Sector, nandAddress.SectorCount);
+        _WriteCache.CopySectors(piece->Buffer, command.Buffer, sectorMask);
+        if (entry != nullptr)
+        {
+            _WriteCache.CopySectors(piece->Buffer, entry->Buffer, entry->ValidSectors & sectorMask);
+        }
+        if (entryPinned)
+        {
+            _WriteCache.Unpin(*entry);
+        }
+
+        DeliverReadData(context, piece->Buffer, nandAddress, tSectorOffset{ piece->CommandOffset }, nandAddress.SectorCount);
+    }
+}
+
+void SimpleFtl::DeliverReadData(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+{
+    if (CustomProtocolCommand::Code::Read == context.Command->Command || CustomProtocolCommand::Code::ReadVectored == context.Command->Command)
+    {
+        TransferOut(context, buffer, nandAddress, commandOffset, sectorCount);
+    }
+    else if (IsPayloadCompare(*context.Command))
+    {
+        // The expected data is taken in, the sectors are compared once it's there
+        CommandContext::ComparedSectors &comparedSectors = context.PendingCompares[commandOffset];
+        comparedSectors.Data = buffer;
+        TransferIn(context, comparedSectors.Expected, nandAddress, commandOffset, sectorCount);
+    }
+    else
+    {
+        // Nothing goes to the host, the sectors are done with as if their transfer completed
+        PushEvent(PrepareTransfer(context, buffer, nandAddress, commandOffset, sectorCount));
     }
 }
 
-void SimpleFtl::TransferOut(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+SimpleFtl::Event& SimpleFtl::PrepareTransfer(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
 {
-    CustomProtocolHal::TransferCommandDesc transferCommand;
+    Event &event = AllocateEvent(Event::Type::TransferCompleted, context.Index);
+    CustomProtocolHal::TransferCommandDesc &transferCommand = event.EventParams.TransferCommand;
     transferCommand.Buffer = buffer;
     transferCommand.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
-    transferCommand.Command = _ProcessingCommand;
+    transferCommand.Command = context.Command;
     transferCommand.Direction = CustomProtocolHal::TransferCommandDesc::Direction::Out;
     transferCommand.CommandOffset = commandOffset;
     transferCommand.SectorCount = sectorCount;
     transferCommand.NandAddress = nandAddress;
-    transferCommand.Listener = this;
-    _CustomProtocolHal->QueueCommand(transferCommand);
+    transferCommand.Listener = &event;
+    return event;
 }
 
-void SimpleFtl::ReadPage(const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex)
+void SimpleFtl::TransferOut(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+{
+    _CustomProtocolHal->QueueCommand(PrepareTransfer(context, buffer, nandAddress, commandOffset, sectorCount).EventParams.TransferCommand);
+}
+
+void SimpleFtl::ReadPage(CommandContext &context, const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex, const bool &wholePage,
+    const bool &entryPinned)
 {
     assert((nandAddress.Sector + nandAddress.SectorCount) <= _SectorsPerPage);
 
-    NandHal::CommandDesc commandDesc;
+    Event &event = AllocateEvent(Event::Type::NandCommandCompleted, context.Index);
+    event.EntryPinned = entryPinned;
+    NandHal::CommandDesc &commandDesc = event.EventParams.NandCommand;
+    // Whole pages are read for the read cache, the address keeps the sectors to transfer
     commandDesc.Address = nandAddress;
-    commandDesc.Operation = (nandAddress.SectorCount == _SectorsPerPage)
+    commandDesc.Operation = (wholePage || nandAddress.SectorCount == _SectorsPerPage || _ReadCache.GetCapacity() > 0)
         ? NandHal::CommandDesc::Op::Read : NandHal::CommandDesc::Op::ReadPartial;
     commandDesc.Buffer = outBuffer;
     commandDesc.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
     commandDesc.DescSectorIndex = descSectorIndex;
-    commandDesc.Listener = this;
+    commandDesc.Listener = &event;
 
     _NandHal->QueueCommand(commandDesc);
 }
 
-void SimpleFtl::WriteNextLbas()
+bool SimpleFtl::AllocateBuffer(Buffer &buffer)
+{
+    // The read cache gives buffers back when the pool runs dry
+    while (!_BufferHal->AllocateBuffer(BufferType::User, buffer))
+    {
+        if (!_ReadCache.EvictOne())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SimpleFtl::ReleaseReadBuffer(const U32 &pageIndex, const Buffer &buffer)
+{
+    WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+    if (entry != nullptr && entry->Buffer.Handle == buffer.Handle)
+    {
+        _WriteCache.Unpin(*entry);
+    }
+    else if (!_ReadCache.Unpin(pageIndex, buffer))
+    {
+        _BufferHal->DeallocateBuffer(buffer);
+    }
+}
+
+Buffer SimpleFtl::CompareSectors(CommandContext &context, const CustomProtocolHal::TransferCommandDesc &command)
+{
+    ComparePayload &payload = context.Command->Descriptor.ComparePayload;
+    U32 byteOffset = _BufferHal->ToByteIndexInTransfer(BufferType::User, command.BufferOffset);
+    U32 byteCount = _BufferHal->ToByteIndexInTransfer(BufferType::User, command.SectorCount);
+
+    // Returns the buffer the sectors were read in, for the caller to release
+    Buffer buffer = command.Buffer;
+    U32 mismatch;
+    if (ComparePayload::Expected::Pattern == payload.ExpectedData)
+    {
+        SetPatternData(payload.Pattern);
+        mismatch = FindMismatch(_BufferHal->ToPointer(buffer) + byteOffset, &_PatternData[byteOffset], byteCount);
+    }
+    else
+    {
+        auto comparedSectors = context.PendingCompares.find(command.CommandOffset);
+        assert(comparedSectors != context.PendingCompares.end());
+        buffer = comparedSectors->second.Data;
+        mismatch = FindMismatch(_BufferHal->ToPointer(buffer) + byteOffset, _BufferHal->ToPointer(command.Buffer) + byteOffset, byteCount);
+        _BufferHal->DeallocateBuffer(command.Buffer);
+        context.PendingCompares.erase(comparedSectors);
+    }
+
+    // Sectors are compared in whatever order they come, the lowest offset is kept
+    if (mismatch < byteCount)
+    {
+        std::uint64_t mismatchOffset = _BufferHal->ToByteIndexInTransfer(BufferType::User, command.CommandOffset) + mismatch;
+        payload.MismatchOffset = std::min<std::uint64_t>(payload.MismatchOffset, mismatchOffset);
+        if (CustomProtocolCommand::Status::Success == context.Command->CommandStatus)
+        {
+            context.Command->CommandStatus = CustomProtocolCommand::Status::Miscompare;
+        }
+    }
+    return buffer;
+}
+
+void SimpleFtl::SetPatternData(const U32 &pattern)
+{
+    if (pattern != _PatternDataValue)
+    {
+        // 32 bits whatever the width of U32
+        std::uint32_t value = static_cast<std::uint32_t>(pattern);
+        U32 byteCount = _NandHal->GetGeometry().BytesPerPage;
+        for (U32 offset = 0; offset < byteCount; offset += sizeof(value))
+        {
+            std::memcpy(&_PatternData[offset], &value, sizeof(value));
+        }
+        _PatternDataValue = pattern;
+    }
+}
+
+void SimpleFtl::WriteNextLbas(CommandContext &context)
 {
     Buffer buffer;
     NandHal::NandAddress nandAddress;
-    U32 nextLba;
-    U32 remainingSectorCount;
-    while (_RemainingSectorCount > 0)
+    U32 offset;
+    TranslatedPages pages;
+    while (context.RemainingSectorCount > 0)
     {
-        SimpleFtlTranslation::LbaToNandAddress(_CurrentLba, _RemainingSectorCount, nandAddress, nextLba, remainingSectorCount);
-        if (_BufferHal->AllocateBuffer(BufferType::User, buffer))
+        GetNextPiece(context, pages, nandAddress, offset);
+        U32 pageIndex = ToPageIndex(nandAddress);
+        if (!IsOwnPage(pageIndex))
         {
-            tSectorOffset commandOffset{ _ProcessedSectorCount };
-            TransferIn(buffer, nandAddress, commandOffset, nandAddress.SectorCount);
-            _ProcessedSectorCount += nandAddress.SectorCount;
-            _CurrentLba = nextLba;
-            _RemainingSectorCount = remainingSectorCount;
-            ++_PendingCommandCount;
+            SkipForeignPages(context, pages, pageIndex, nandAddress.SectorCount);
+            continue;
         }
-        else
+        if (!CanQueueTransfer())
         {
             break;
         }
+        tSectorOffset commandOffset{ offset };
+        WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+        _ReadCache.Invalidate(pageIndex);
+        if (entry == nullptr && nandAddress.SectorCount == _SectorsPerPage)
+        {
+            // A whole page has nothing to gather, it's programmed as soon as it's in
+            if (!AllocateWriteBuffer(context, nandAddress, offset, buffer))
+            {
+                break;
+            }
+            TransferIn(context, buffer, nandAddress, commandOffset, nandAddress.SectorCount);
+        }
+        else
+        {
+            // NOTE: a page being flushed takes new data once it's programmed
+            if (entry == nullptr)
+            {
+                entry = _WriteCache.Insert(pageIndex);
+                while (entry == nullptr && !_WriteCache.IsFull() && _ReadCache.EvictOne())
+                {
+                    entry = _WriteCache.Insert(pageIndex);
+                }
+            }
+            if (entry == nullptr || entry->Flushing)
+            {
+                FlushCache();
+                break;
+            }
+            _WriteCache.Pin(*entry);
+            TransferIn(context, entry->Buffer, nandAddress, commandOffset, nandAddress.SectorCount);
+        }
+        ++_QueuedTransferCount;
+        AdvancePiece(context, nandAddress.SectorCount, 0);
+        _HostSectorsWritten += nandAddress.SectorCount;
     }
 }
 
-void SimpleFtl::TransferIn(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+bool SimpleFtl::AllocateWriteBuffer(CommandContext &context, const NandHal::NandAddress &nandAddress, const U32 &commandOffset, Buffer &buffer)
 {
-    CustomProtocolHal::TransferCommandDesc transferCommand;
-    transferCommand.Buffer = buffer;
-    transferCommand.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
-    transferCommand.Command = _ProcessingCommand;
+    if (context.Command->PayloadMode == CustomProtocolCommand::TransferMode::ControllerMemoryBuffer)
+    {
+        // Map the buffer straight onto the host data so the transfer doesn't need to copy it
+        U32 dataOffset = context.Command->ControllerMemoryBufferOffset + _BufferHal->ToByteIndexInTransfer(BufferType::User, commandOffset);
+        U32 sectorOffset = _BufferHal->ToByteIndexInTransfer(BufferType::User, nandAddress.Sector);
+        if (dataOffset >= sectorOffset
+            && _BufferHal->MapControllerMemoryBuffer(BufferType::User, dataOffset - sectorOffset, _SectorsPerSegment, buffer))
+        {
+            return true;
+        }
+    }
+
+    return AllocateBuffer(buffer);
+}
+
+void SimpleFtl::TransferIn(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount)
+{
+    CustomProtocolHal::TransferCommandDesc &transferCommand = PrepareTransfer(context, buffer, nandAddress, commandOffset, sectorCount).EventParams.TransferCommand;
     transferCommand.Direction = CustomProtocolHal::TransferCommandDesc::Direction::In;
-    transferCommand.CommandOffset = commandOffset;
-    transferCommand.SectorCount = sectorCount;
-    transferCommand.NandAddress = nandAddress;
-    transferCommand.Listener = this;
     _CustomProtocolHal->QueueCommand(transferCommand);
 }
 
-void SimpleFtl::WritePage(const NandHal::NandAddress &nandAddress, const Buffer &inBuffer)
+void SimpleFtl::WritePage(CommandContext &context, const NandHal::NandAddress &nandAddress, const Buffer &inBuffer, const tSectorOffset& descSectorIndex)
 {
     assert((nandAddress.Sector + nandAddress.SectorCount) <= _SectorsPerPage);
 
-    NandHal::CommandDesc commandDesc;
+    Event &event = AllocateEvent(Event::Type::NandCommandCompleted, context.Index);
+    NandHal::CommandDesc &commandDesc = event.EventParams.NandCommand;
     commandDesc.Address = nandAddress;
     commandDesc.Operation = (nandAddress.SectorCount == _SectorsPerPage)
         ? NandHal::CommandDesc::Op::Write : NandHal::CommandDesc::Op::WritePartial;
     commandDesc.Buffer = inBuffer;
     commandDesc.BufferOffset = nandAddress.Sector;  //NOTE: if NAND sector and buffer sector ever differ, need a conversion
-    commandDesc.Listener = this;
+    commandDesc.DescSectorIndex = descSectorIndex;
+    commandDesc.Listener = &event;
 
     _NandHal->QueueCommand(commandDesc);
 }
 
-void SimpleFtl::OnTransferCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command)
+void SimpleFtl::OnTransferCommandCompleted(CommandContext &context, const CustomProtocolHal::TransferCommandDesc &command)
 {
-    if (CustomProtocolCommand::Code::Read == _ProcessingCommand->Command)
+    --_QueuedTransferCount;
+    U32 pageIndex = ToPageIndex(command.NandAddress);
+    WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+    bool cached = (entry != nullptr && entry->Buffer.Handle == command.Buffer.Handle);
+    if (IsRead(*context.Command))
     {
-        _BufferHal->DeallocateBuffer(command.Buffer);
-        --_PendingCommandCount;
-
-        if (_RemainingSectorCount == 0 && _PendingCommandCount == 0)
+        if (CustomProtocolCommand::Code::Compare == context.Command->Command)
         {
-            SubmitResponse();
+            ReleaseReadBuffer(pageIndex, CompareSectors(context, command));
         }
         else
         {
-            ReadNextLbas();
+            ReleaseReadBuffer(pageIndex, command.Buffer);
         }
+        --context.PendingCommandCount;
+        OnDataCommandCompleted(context);
+    }
+    else if (cached)
+    {
+        _WriteCache.AddValidSectors(*entry, WriteCache::ToSectorMask(command.NandAddress.Sector, command.NandAddress.SectorCount));
+        _WriteCache.Unpin(*entry);
+        --context.PendingCommandCount;
+        OnDataCommandCompleted(context);
     }
     else
     {
-        WritePage(command.NandAddress, command.Buffer);
+        WritePage(context, command.NandAddress, command.Buffer, command.CommandOffset);
     }
 }
 
-void SimpleFtl::OnNandCommandCompleted(const NandHal::CommandDesc &command)
+void SimpleFtl::OnNandCommandCompleted(CommandContext &context, const NandHal::CommandDesc &command, const bool &entryPinned)
 {
-    if (CustomProtocolCommand::Code::Read == _ProcessingCommand->Command)
+    if (IsRead(*context.Command))
     {
-        TransferOut(command.Buffer, command.Address, command.DescSectorIndex, command.Address.SectorCount);
+        // The write cache has the newest data of the sectors it holds
+        U32 pageIndex = ToPageIndex(command.Address);
+        WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+        std::uint64_t sectorMask = WriteCache::ToSectorMask(command.Address.Sector, command.Address.SectorCount);
+        if (entry != nullptr)
+        {
+            _WriteCache.CopySectors(command.Buffer, entry->Buffer, entry->ValidSectors & sectorMask);
+        }
+        else if (NandHal::CommandDesc::Status::Success == command.CommandStatus)
+        {
+            // The buffer goes to the read cache if it takes it, it's freed when the transfer is done otherwise
+            bool wholePage = (NandHal::CommandDesc::Op::Read == command.Operation);
+            _ReadCache.Insert(pageIndex, wholePage ? _WriteCache.GetFullPageMask() : sectorMask, command.Buffer);
+        }
+        if (IsVectored(*context.Command))
+        {
+            TransferToFollowers(context, command, entry, entryPinned);
+        }
+        if (entryPinned)
+        {
+            _WriteCache.Unpin(*entry);
+        }
+
+        DeliverReadData(context, command.Buffer, command.Address, command.DescSectorIndex, command.Address.SectorCount);
 
         if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
         {
-            _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::ReadError;
+            context.Command->CommandStatus = CustomProtocolCommand::Status::ReadError;
         }
     }
     else
     {
         if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
         {
-            _ProcessingCommand->CommandStatus = CustomProtocolCommand::Status::WriteError;
+            context.Command->CommandStatus = CustomProtocolCommand::Status::WriteError;
+        }
+        // A read that raced with the write may have cached the old data
+        _ReadCache.Invalidate(ToPageIndex(command.Address));
+        _NandSectorsWritten += _SectorsPerPage;
+        _BufferHal->DeallocateBuffer(command.Buffer);
+        --context.PendingCommandCount;
+        OnDataCommandCompleted(context);
+    }
+}
+
+void SimpleFtl::OnDataCommandCompleted(CommandContext &context)
+{
+    // The rest of a command short of buffers is issued from the waiting list
+    if (context.RemainingSectorCount == 0 && context.PendingCommandCount == 0)
+    {
+        SubmitResponse(context);
+    }
+    ResumeWaitingContexts();
+    FlushCache();
+}
+
+void SimpleFtl::FlushCache()
+{
+    if (_WriteCache.IsAboveHighWatermark())
+    {
+        _WatermarkFlushing = true;
+    }
+
+    while (_WriteCache.GetFlushingCount() < _FlushDepth)
+    {
+        if (_WatermarkFlushing && !_WriteCache.IsAboveLowWatermark())
+        {
+            _WatermarkFlushing = false;
+        }
+
+        // Everything goes for a drain and what the flush commands wait for. Down to the low watermark only whole pages go, the host
+        // may still write the rest of the others, unless the cache is full and nothing being flushed makes room for a write
+        std::uint64_t fullSequence = 0;
+        std::uint64_t partialSequence = 0;
+        if (_FlushAll || _DrainingCommand != nullptr || (_WriteCache.IsFull() && _WriteCache.GetFlushingCount() == 0))
+        {
+            fullSequence = _WriteCache.GetNextSequence();
+            partialSequence = fullSequence;
+        }
+        else if (!_FlushWaitingContexts.empty())
+        {
+            fullSequence = _FlushSequence;
+            partialSequence = _FlushSequence;
         }
+        if (_WatermarkFlushing)
+        {
+            fullSequence = _WriteCache.GetNextSequence();
+        }
+
+        U32 pageIndex;
+        if (!_WriteCache.GetFlushCandidate(fullSequence, partialSequence, pageIndex) || !FlushPage(pageIndex))
+        {
+            break;
+        }
+    }
+}
+
+bool SimpleFtl::FlushPage(const U32 &pageIndex)
+{
+    WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+    assert(entry != nullptr);
+
+    if (entry->ValidSectors == _WriteCache.GetFullPageMask())
+    {
+        _WriteCache.SetFlushing(*entry);
+        QueueCacheCommand(pageIndex, NandHal::CommandDesc::Op::Write, entry->Buffer, Event::Type::CacheCommandCompleted);
+        return true;
+    }
+
+    // The sectors the host didn't write are read first so that the page is still programmed whole
+    Buffer buffer;
+    if (!AllocateBuffer(buffer))
+    {
+        return false;
+    }
+    _WriteCache.SetFlushing(*entry);
+    QueueCacheCommand(pageIndex, NandHal::CommandDesc::Op::Read, buffer, Event::Type::CacheCommandCompleted);
+    return true;
+}
+
+void SimpleFtl::QueueCacheCommand(const U32 &pageIndex, const NandHal::CommandDesc::Op &operation, const Buffer &buffer, const Event::Type &eventType)
+{
+    U32 nextLba;
+    U32 remainingSectorCount;
+    Event &event = AllocateEvent(eventType, 0);
+    NandHal::CommandDesc &commandDesc = event.EventParams.NandCommand;
+    _Translation.LbaToNandAddress(pageIndex * _SectorsPerPage, _SectorsPerPage, commandDesc.Address, nextLba, remainingSectorCount);
+    commandDesc.Operation = operation;
+    commandDesc.Buffer = buffer;
+    commandDesc.BufferOffset = 0;
+    commandDesc.DescSectorIndex = pageIndex;
+    commandDesc.Listener = &event;
+
+    _NandHal->QueueCommand(commandDesc);
+}
+
+void SimpleFtl::OnCacheCommandCompleted(const NandHal::CommandDesc &command)
+{
+    U32 pageIndex = command.DescSectorIndex;
+    WriteCache::Entry *entry = _WriteCache.Find(pageIndex);
+    assert(entry != nullptr && entry->Flushing);
+
+    if (NandHal::CommandDesc::Op::Read == command.Operation)
+    {
+        // NOTE: an unreadable page leaves the sectors the host didn't write as they were read
+        _WriteCache.CopySectors(entry->Buffer, command.Buffer, ~entry->ValidSectors & _WriteCache.GetFullPageMask());
         _BufferHal->DeallocateBuffer(command.Buffer);
-        --_PendingCommandCount;
+        QueueCacheCommand(pageIndex, NandHal::CommandDesc::Op::Write, entry->Buffer, Event::Type::CacheCommandCompleted);
+    }
+    else
+    {
+        if (NandHal::CommandDesc::Status::Success != command.CommandStatus)
+        {
+            _FlushFailed = true;
+        }
+        _ReadCache.Invalidate(pageIndex);
+        _NandSectorsWritten += _SectorsPerPage;
+        _WriteCache.Remove(pageIndex);
+        CompleteFlushCommands();
+        ResumeDrainingCommand();
+    }
 
-        if (_RemainingSectorCount == 0 && _PendingCommandCount == 0)
+    ResumeWaitingContexts();
+    FlushCache();
+}
+
+void SimpleFtl::CompleteFlushCommands()
+{
+    std::uint64_t oldestSequence = _WriteCache.GetOldestSequence();
+    while (!_FlushWaitingContexts.empty() && _Contexts[_FlushWaitingContexts.front()].FlushSequence <= oldestSequence)
+    {
+        CommandContext &context = _Contexts[_FlushWaitingContexts.front()];
+        _FlushWaitingContexts.pop_front();
+        if (_FlushFailed)
         {
-            SubmitResponse();
+            context.Command->CommandStatus = CustomProtocolCommand::Status::WriteError;
+            _FlushFailed = false;
         }
-        else
+        SubmitResponse(context);
+    }
+}
+
+void SimpleFtl::ReadAheadPages(const U32 &stream, const U32 &firstPage, const U32 &endPage)
+{
+    // Pages already cached or on the dies of other shards are skipped, the rest are spread over the dies like any consecutive pages
+    U32 pageCount = _TotalSectors / _SectorsPerPage;
+    U32 pageIndex = firstPage;
+    for (; pageIndex < endPage && pageIndex < pageCount; ++pageIndex)
+    {
+        if (_ReadAheadInFlight.size() >= _ReadAhead.GetMaxWindow())
+        {
+            break;
+        }
+        if (!IsOwnPage(pageIndex) || _WriteCache.Find(pageIndex) != nullptr || _ReadCache.Contains(pageIndex) || _ReadAheadInFlight.count(pageIndex) > 0)
         {
-            WriteNextLbas();
+            continue;
         }
+
+        // NOTE: only free buffers are taken, reading ahead never evicts cached pages
+        Buffer buffer;
+        if (!_BufferHal->AllocateBuffer(BufferType::User, buffer))
+        {
+            break;
+        }
+        _ReadAheadInFlight.insert(pageIndex);
+        QueueCacheCommand(pageIndex, NandHal::CommandDesc::Op::Read, buffer, Event::Type::ReadAheadCompleted);
     }
+    _ReadAhead.SetReadAheadEnd(stream, pageIndex);
 }
 
-void SimpleFtl::SubmitCustomProtocolCommand(CustomProtocolCommand *command)
+void SimpleFtl::OnReadAheadCompleted(const NandHal::CommandDesc &command)
 {
-    Event event;
-    event.EventType = Event::Type::CustomProtocolCommand;
-    event.EventParams.CustomProtocolCommand = command;
-    _EventQueue->push(event);
+    U32 pageIndex = command.DescSectorIndex;
+    _ReadAheadInFlight.erase(pageIndex);
+
+    // A write since then has the page in the write cache, or invalidates it once it's programmed
+    if (NandHal::CommandDesc::Status::Success == command.CommandStatus
+        && _WriteCache.Find(pageIndex) == nullptr
+        && _ReadCache.Insert(pageIndex, _WriteCache.GetFullPageMask(), command.Buffer))
+    {
+        _ReadCache.Unpin(pageIndex, command.Buffer);
+        ++_ReadAheadPageCount;
+    }
+    else
+    {
+        _BufferHal->DeallocateBuffer(command.Buffer);
+    }
+
+    ResumeDrainingCommand();
+    ResumeWaitingContexts();
 }
 
-void SimpleFtl::HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command)
+bool SimpleFtl::CanAcceptCommand()
 {
-    Event event;
-    event.EventType = Event::Type::TransferCompleted;
-    event.EventParams.TransferCommand = command;
-    assert(_EventQueue->push(event) == true);
+    return (nullptr == _DrainingCommand);
 }
 
-void SimpleFtl::HandleCommandCompleted(const NandHal::CommandDesc &command)
+void SimpleFtl::SubmitCustomProtocolCommand(CustomProtocolCommand *command)
 {
-    Event event;
-    event.EventType = Event::Type::NandCommandCompleted;
-    event.EventParams.NandCommand = command;
-    assert(_EventQueue->push(event) == true);
+    assert(command->GetContextIndex() < _Contexts.size());
+    CommandContext &context = _Contexts[command->GetContextIndex()];
+    assert(context.Command == nullptr);
+    context.Command = command;
+    ++_ActiveContextCount;
+
+    if (CustomProtocolCommand::Code::SetSectorSize == command->Command)
+    {
+        _DrainingCommand = command;
+    }
+
+    PushEvent(AllocateEvent(Event::Type::CustomProtocolCommand, context.Index));
 }
 
 bool SimpleFtl::IsProcessingCommand()
 {
-    return (nullptr != _ProcessingCommand);
+    return (_ActiveContextCount > 0);
 }
 
-void SimpleFtl::SubmitResponse()
+bool SimpleFtl::IsEventQueueEmpty()
 {
-    assert(_ProcessingCommand != nullptr);
-    _CustomProtocolHal->SubmitResponse(_ProcessingCommand);
-    _ProcessingCommand = nullptr;
+    return _EventQueue.IsEmpty();
+}
+
+void SimpleFtl::FlushAll()
+{
+    _FlushAll = true;
+}
+
+bool SimpleFtl::IsWriteCacheEmpty()
+{
+    return _WriteCache.IsEmpty();
+}
+
+void SimpleFtl::SubmitResponse(CommandContext &context)
+{
+    assert(context.Command != nullptr);
+    if (_ResponseListener != nullptr)
+    {
+        _ResponseListener->HandleResponse(context.Command);
+    }
+    else
+    {
+        _CustomProtocolHal->SubmitResponse(context.Command);
+    }
+    context.Command = nullptr;
+    --_ActiveContextCount;
+
+    ResumeDrainingCommand();
+}
+
+void SimpleFtl::ResumeDrainingCommand()
+{
+    if (_DrainingCommandParked && _ActiveContextCount == 1 && _WriteCache.IsEmpty() && _ReadAheadInFlight.empty())
+    {
+        OnNewCustomProtocolCommand(_Contexts[_DrainingCommand->GetContextIndex()]);
+    }
 }
\ No newline at end of file
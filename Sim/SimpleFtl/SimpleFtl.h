@@ -1,42 +1,122 @@
 #ifndef __SimpleFtl_h__
 #define __SimpleFtl_h__
 
-#include "boost/lockfree/queue.hpp"
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "Buffer/Hal/BufferHal.h"
 #include "HostComm/CustomProtocol/CustomProtocolHal.h"
 #include "Nand/Hal/NandHal.h"
+#include "SimFrameworkBase/FrameworkThread.h"
+#include "CompletionQueue.h"
+#include "ReadAhead.h"
+#include "ReadCache.h"
 #include "Translation.h"
+#include "WriteCache.h"
 
-class SimpleFtl : public CustomProtocolHal::TransferCommandListener, public NandHal::CommandListener
+//! Maps every LBA to a fixed NAND page, the NAND is never erased and nothing is relocated
+/*!
+    NOTE: a page programmed once can't be programmed again. Writing it a second time programs it in place, the NAND simulation
+    marks it corrupted and reads of it then fail with ReadError. The write cache only flushes whole pages to make room, a page
+    the host wrote part of is programmed by a Flush or when the cache is full of such pages, writing the rest of it afterwards
+    is a second write. Overwrite workloads belong on PageMappingFtl.
+*/
+class SimpleFtl
 {
 private:
-    enum State
-    {
-        PROCESSING,
-        IDLE
-    };
-
-    struct Event
+    //! A slot per new host command and per transfer or NAND command in flight, the HALs complete commands through it
+    /*!
+        The descriptor is filled in when the command is issued, the completion only sets the status
+        and links the slot into the completion queue. Cache commands carry the page index in DescSectorIndex.
+    */
+    class Event : public CompletionQueue::Node, public CustomProtocolHal::TransferCommandListener, public NandHal::CommandListener
     {
+    public:
         enum class Type
         {
             CustomProtocolCommand,
             TransferCompleted,
-            NandCommandCompleted
+            NandCommandCompleted,
+            CacheCommandCompleted,
+            ReadAheadCompleted
         };
 
         union Params
         {
-            CustomProtocolCommand *CustomProtocolCommand;
             CustomProtocolHal::TransferCommandDesc TransferCommand;
             NandHal::CommandDesc NandCommand;
         };
 
+        virtual void HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command);
+        virtual void HandleCommandCompleted(const NandHal::CommandDesc &command);
+
+    public:
+        SimpleFtl *Ftl;
         Type EventType;
+        U32 ContextIndex;
+        bool EntryPinned;           //!< a host NAND read that pinned the write cache entry of its page
         Params EventParams;
     };
 
+    //! State of one host command
+    class CommandContext
+    {
+    public:
+        SimpleFtl *Ftl;
+        U32 Index;
+
+        CustomProtocolCommand *Command;
+        U32 RemainingSectorCount;
+        U32 ProcessedSectorCount;
+        U32 CurrentLba;
+        U32 PendingCommandCount;
+        std::uint64_t FlushSequence;
+
+        //! Vectored commands are cut into pieces of a page, sorted by LBA so that the pieces of a page are next to each other
+        struct Piece
+        {
+            U32 Lba;
+            U32 SectorCount;
+            U32 CommandOffset;
+            Buffer Buffer;      //!< of a piece that shares the read of the piece before it
+        };
+        std::vector<Piece> Pieces;
+        U32 NextPiece;
+
+        //! Compare with the expected data in the payload, it's taken in next to the data read, keyed by command offset
+        struct ComparedSectors
+        {
+            Buffer Expected;
+            Buffer Data;
+        };
+        std::map<U32, ComparedSectors> PendingCompares;
+    };
+
+    //! The next pages of a sequential command, translated a batch at a time. Only lives for one pass over the command
+    struct TranslatedPages
+    {
+        enum : U32
+        {
+            BatchSize = 16,
+        };
+
+        TranslatedPages() : Count(0), Next(0) {}
+
+        NandHal::NandAddress Addresses[BatchSize];
+        U32 Count;
+        U32 Next;
+    };
+
+public:
+    //! Takes the responses instead of the protocol HAL
+    class ResponseListener
+    {
+    public:
+        virtual void HandleResponse(CustomProtocolCommand *command) = 0;
+    };
+
 public:
     SimpleFtl();
 
@@ -45,29 +125,103 @@ public:
     void SetBufferHal(BufferHal *bufferHal);
     void operator()();
 
+    //! Serves only the pages on every shardCount-th die from shardIndex on and takes its share of the buffer pool. Between SetNandHal and SetBufferHal
+    void SetShard(const U32 &shardIndex, const U32 &shardCount);
+    void SetResponseListener(ResponseListener *listener);
+
+    //! Woken up by every event, for an FTL on a thread of its own that may park while it waits for the HALs
+    void SetEventThread(FrameworkThread *thread);
+
+    //! A context is free and no command waits for the others to drain
+    bool CanAcceptCommand();
     void SubmitCustomProtocolCommand(CustomProtocolCommand *command);
-    virtual void HandleCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command);
-    virtual void HandleCommandCompleted(const NandHal::CommandDesc &command);
 
     bool IsProcessingCommand();
+    bool IsEventQueueEmpty();
+
+    //! Programs every cached page, for when the firmware is about to be replaced
+    void FlushAll();
+    bool IsWriteCacheEmpty();
 
 private:
-    void ProcessEvent();
-    void ReadNextLbas();
-    void TransferOut(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
-    void ReadPage(const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex);
+    Event& AllocateEvent(const Event::Type &type, const U32 &contextIndex);
+    void PushEvent(Event &event);
+    void ProcessEvent(Event &event);
+    bool SplitRanges(CommandContext &context);
+    void GetNextPiece(const CommandContext &context, TranslatedPages &pages, NandHal::NandAddress &nandAddress, U32 &commandOffset) const;
+    void AdvancePiece(CommandContext &context, const U32 &sectorCount, const U32 &followerCount);
+    void SkipForeignPages(CommandContext &context, TranslatedPages &pages, const U32 &pageIndex, const U32 &sectorCount);
+
+    void ReadNextLbas(CommandContext &context);
+    void DeliverReadData(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+    //! Out to the host unless changed
+    Event& PrepareTransfer(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+    void TransferOut(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+    void ReadPage(CommandContext &context, const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex, const bool &wholePage,
+        const bool &entryPinned);
+    bool AllocateFollowerBuffers(CommandContext &context, const U32 &pageIndex, U32 &followerCount);
+    void TransferToFollowers(CommandContext &context, const NandHal::CommandDesc &command, WriteCache::Entry *entry, const bool &entryPinned);
 
-    void WriteNextLbas();
-    void TransferIn(const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
-	void WritePage(const NandHal::NandAddress &nandAddress, const Buffer &outBuffer);
+    bool AllocateBuffer(Buffer &buffer);
+    void ReleaseReadBuffer(const U32 &pageIndex, const Buffer &buffer);
+    Buffer CompareSectors(CommandContext &context, const CustomProtocolHal::TransferCommandDesc &command);
+    void SetPatternData(const U32 &pattern);
+
+    void WriteNextLbas(CommandContext &context);
+    bool AllocateWriteBuffer(CommandContext &context, const NandHal::NandAddress &nandAddress, const U32 &commandOffset, Buffer &buffer);
+    void TransferIn(CommandContext &context, const Buffer &buffer, const NandHal::NandAddress &nandAddress, const tSectorOffset& commandOffset, const tSectorCount& sectorCount);
+	void WritePage(CommandContext &context, const NandHal::NandAddress &nandAddress, const Buffer &outBuffer, const tSectorOffset& descSectorIndex);
 
     bool SetSectorInfo(const SectorInfo &sectorInfo);
+    void GetStatistics(StatisticsPayload &payload);
 
-    void OnNewCustomProtocolCommand(CustomProtocolCommand *command);
-    void OnTransferCommandCompleted(const CustomProtocolHal::TransferCommandDesc &command);
-    void OnNandCommandCompleted(const NandHal::CommandDesc &command);
+    void OnNewCustomProtocolCommand(CommandContext &context);
+    void OnTransferCommandCompleted(CommandContext &context, const CustomProtocolHal::TransferCommandDesc &command);
+    void OnNandCommandCompleted(CommandContext &context, const NandHal::CommandDesc &command, const bool &entryPinned);
+    void OnDataCommandCompleted(CommandContext &context);
+    void ProcessNextLbas(CommandContext &context);
+    void ResumeWaitingContexts();
 
-    void SubmitResponse();
+    void FlushCache();
+    bool FlushPage(const U32 &pageIndex);
+    void QueueCacheCommand(const U32 &pageIndex, const NandHal::CommandDesc::Op &operation, const Buffer &buffer, const Event::Type &eventType);
+    void OnCacheCommandCompleted(const NandHal::CommandDesc &command);
+    void CompleteFlushCommands();
+
+    void ReadAheadPages(const U32 &stream, const U32 &firstPage, const U32 &endPage);
+    void OnReadAheadCompleted(const NandHal::CommandDesc &command);
+    inline U32 ToPageIndex(const NandHal::NandAddress &nandAddress) const
+    {
+        return _Translation.NandAddressToPageIndex(nandAddress);
+    }
+    inline bool IsOwnPage(const U32 &pageIndex) const
+    {
+        return _ShardCount == 1 || _OwnDies[_Translation.PageIndexToDie(pageIndex)];
+    }
+
+    //! Cache hits take no buffer, so transfers are held below half the protocol HAL queue, shared among the shards
+    inline bool CanQueueTransfer() const
+    {
+        return _QueuedTransferCount < CustomProtocolHal::TransferQueueSize / 2 / _ShardCount;
+    }
+
+    inline static bool IsRead(const CustomProtocolCommand &command)
+    {
+        return CustomProtocolCommand::Code::Read == command.Command || CustomProtocolCommand::Code::ReadVectored == command.Command
+            || CustomProtocolCommand::Code::Compare == command.Command || CustomProtocolCommand::Code::Verify == command.Command;
+    }
+    inline static bool IsPayloadCompare(const CustomProtocolCommand &command)
+    {
+        return CustomProtocolCommand::Code::Compare == command.Command
+            && ComparePayload::Expected::Payload == command.Descriptor.ComparePayload.ExpectedData;
+    }
+    inline static bool IsVectored(const CustomProtocolCommand &command)
+    {
+        return CustomProtocolCommand::Code::ReadVectored == command.Command || CustomProtocolCommand::Code::WriteVectored == command.Command;
+    }
+
+    void SubmitResponse(CommandContext &context);
+    void ResumeDrainingCommand();
 
 private:
     NandHal *_NandHal;
@@ -75,18 +229,63 @@ private:
     CustomProtocolHal *_CustomProtocolHal;
     U32 _TotalSectors;
     U8 _SectorsPerPage;
+    SimpleFtlTranslation _Translation;
+
+    //! A shard leaves the pages of the dies it doesn't own to the other shards
+    U32 _ShardIndex;
+    U32 _ShardCount;
+    std::vector<bool> _OwnDies;
+    std::vector<U32> _OwnDieDistances;          //!< by die, pages from one on it to the next one on a die of this shard
+    ResponseListener *_ResponseListener;
+    FrameworkThread *_EventThread;
 
-    CustomProtocolCommand *_ProcessingCommand;
-    U32 _RemainingSectorCount;
-    U32 _ProcessedSectorCount;
-    U32 _CurrentLba;
-    U32 _PendingCommandCount;
+    //! One per command the protocol HAL hands out at once, indexed like its contexts
+    std::vector<CommandContext> _Contexts;
+    U32 _ActiveContextCount;
+    std::deque<U32> _BufferWaitingContexts;     //!< ran out of buffers, cache room or transfers, resumed in order as they are freed
+    U32 _QueuedTransferCount;                   //!< transfers of the pieces issued, counted from the issue until they complete
+
+    //! Changing the sector size waits until it's the only command in flight
+    CustomProtocolCommand *_DrainingCommand;
+    bool _DrainingCommandParked;
 
     U8 _SectorsPerSegment;
 
+    //! Sub-page writes are gathered here, pages are only programmed whole
+    WriteCache _WriteCache;
+    U32 _FlushDepth;                            //!< flushing pages at once, one per die
+    bool _WatermarkFlushing;                    //!< from the high watermark down to the low one
+    bool _FlushAll;
+    std::uint64_t _FlushSequence;               //!< pages cached before it are flushed for the waiting flush commands
+    std::deque<U32> _FlushWaitingContexts;
+    bool _FlushFailed;                          //!< reported by the next flush command
+
+    //! Holds pages read from NAND that have no write cache entry, writes invalidate them
+    ReadCache _ReadCache;
+
+    //! Sequential reads have the pages after them read into the read cache ahead of time
+    ReadAhead _ReadAhead;
+    std::set<U32> _ReadAheadInFlight;           //!< pages, host reads of them wait rather than read them again
+    std::uint64_t _ReadAheadPageCount;
+
+    std::uint64_t _HostSectorsWritten;
+    std::uint64_t _NandSectorsWritten;
+
+    std::unique_ptr<U8[]> _PatternData;         //!< a page of the pattern Compare last expected
+    U32 _PatternDataValue;
+
     bip::interprocess_mutex *_Mutex;
 
-    std::unique_ptr<boost::lockfree::queue<Event>> _EventQueue;
+    enum : U32
+    {
+        InitialEventCount = 1024,
+        EventBatchSize = 32,
+    };
+
+    //! Taken in batches, the slots are only reused once processed
+    CompletionQueue _EventQueue;
+    std::deque<Event> _Events;                  //!< never shrinks, the HALs keep pointers to the slots in flight
+    std::vector<Event*> _FreeEvents;
 };
 
 #endif
\ No newline at end of file
@@ -3,38 +3,97 @@
 
 #include "HostComm/CustomProtocol/CustomProtocolHal.h"
 #include "Nand/Hal/NandHal.h"
+#include "SimFrameworkBase/FirmwareRegistry.h"
 #include "SimpleFtl.h"
+#include "ShardedFtl.h"
 
-CustomProtocolHal* _CustomProtocolHal = nullptr;
-SimpleFtl _SimpleFtl;
-
-extern "C"
+namespace
 {
-    void __declspec(dllexport) __stdcall Initialize(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
+    CustomProtocolHal* _CustomProtocolHal = nullptr;
+    bool _ShutdownRequested = false;
+
+    //! Made by every Initialize, linked statically the firmware can be swapped out and back in without its globals going away
+    std::unique_ptr<SimpleFtl> _SimpleFtl;
+
+    //! Used instead of _SimpleFtl when SetShards was called before the Initialize that made it
+    std::unique_ptr<ShardedFtl> _ShardedFtl;
+    std::unique_ptr<ShardedFtl> _NextShardedFtl;
+}
+
+FIRMWARE_EXPORTS_BEGIN(SimpleFtlFirmware)
+    FIRMWARE_EXPORT(void) SetShards(U32 shardCount, bool threaded, const ThreadPlacement &placement,
+        FrameworkThread::IdleStrategy idleStrategy, U32 spinCount, std::chrono::microseconds parkTimeout, FrameworkThread *firmwareCore)
+    {
+        _NextShardedFtl = std::make_unique<ShardedFtl>();
+        _NextShardedFtl->SetShards(shardCount, threaded, placement, firmwareCore);
+        _NextShardedFtl->SetIdleStrategy(idleStrategy, spinCount, parkTimeout);
+    }
+
+    FIRMWARE_EXPORT(void) Initialize(NandHal* nandHal, BufferHal* bufferHal, CustomProtocolHal* CustomProtocolHal)
     {
-        _SimpleFtl.SetNandHal(nandHal);
-        _SimpleFtl.SetBufferHal(bufferHal);
-        _SimpleFtl.SetProtocol(CustomProtocolHal);
+        // Nothing is kept from the last time, whatever it left in flight was drained or went with the HALs it was on
+        _ShutdownRequested = false;
+        _SimpleFtl.reset();
+        _ShardedFtl = std::move(_NextShardedFtl);
+        if (_ShardedFtl)
+        {
+            _ShardedFtl->Initialize(nandHal, bufferHal, CustomProtocolHal);
+        }
+        else
+        {
+            _SimpleFtl = std::make_unique<SimpleFtl>();
+            _SimpleFtl->SetNandHal(nandHal);
+            _SimpleFtl->SetBufferHal(bufferHal);
+            _SimpleFtl->SetProtocol(CustomProtocolHal);
+        }
         _CustomProtocolHal = CustomProtocolHal;
     }
 
-    void __declspec(dllexport) __stdcall Execute()
+    FIRMWARE_EXPORT(void) Execute()
     {
         if (_CustomProtocolHal == nullptr)
         {
             return;
         }
 
-        if (_CustomProtocolHal->HasCommand() && !_SimpleFtl.IsProcessingCommand())
+        if (_ShardedFtl)
+        {
+            while (!_ShutdownRequested && _ShardedFtl->CanAcceptCommand() && _CustomProtocolHal->HasCommand())
+            {
+                _ShardedFtl->SubmitCustomProtocolCommand(_CustomProtocolHal->GetCommand());
+            }
+            (*_ShardedFtl)();
+            return;
+        }
+
+        // After Shutdown new commands are left queued for the next firmware
+        while (!_ShutdownRequested && _SimpleFtl->CanAcceptCommand() && _CustomProtocolHal->HasCommand())
         {
             CustomProtocolCommand *command = _CustomProtocolHal->GetCommand();
-            _SimpleFtl.SubmitCustomProtocolCommand(command);
+            _SimpleFtl->SubmitCustomProtocolCommand(command);
+        }
+        (*_SimpleFtl)();
+    }
+
+    FIRMWARE_EXPORT(void) Shutdown()
+    {
+        _ShutdownRequested = true;
+        if (_ShardedFtl)
+        {
+            _ShardedFtl->FlushAll();
+            return;
         }
-        _SimpleFtl();
+        _SimpleFtl->FlushAll();
     }
 
-    void __declspec(dllexport) __stdcall Shutdown()
+    FIRMWARE_EXPORT(bool) IsQuiescent()
     {
-        
+        if (_ShardedFtl)
+        {
+            return _ShardedFtl->IsQuiescent();
+        }
+        return !_SimpleFtl->IsProcessingCommand() && _SimpleFtl->IsEventQueueEmpty() && _SimpleFtl->IsWriteCacheEmpty();
     }
-};
+FIRMWARE_EXPORTS_END
+
+FIRMWARE_ENTRY_POINTS(SimpleFtlFirmware, &Initialize, &Execute, &Shutdown, &IsQuiescent, nullptr, &SetShards)
@@ -1,48 +1,204 @@
 #ifndef __Translation_h__
 #define __Translation_h__
 
+#include <assert.h>
+#include <algorithm>
+
 #include "Nand/Hal/NandHal.h"
 
-namespace SimpleFtlTranslation
+//! Maps LBAs onto pages laid out channel first, then device, page and block. Built once per geometry and sector size
+/*!
+    The divides by the geometry dimensions are shifts and masks when the dimension is a power of two,
+    a multiplication by its precomputed reciprocal otherwise, so none of them is an actual divide.
+*/
+class SimpleFtlTranslation
 {
-    static U8 _SectorSizeInBit;
-    static U8 _SectorsPerPage;
+public:
+    SimpleFtlTranslation() : _SectorsPerPage(0), _Geometry{}
+    {
+    }
+
+    SimpleFtlTranslation(const NandHal::Geometry &geometry, const U8 &sectorSizeInBit)
+    {
+        SetGeometry(geometry);
+        SetSectorSize(sectorSizeInBit);
+    }
+
+    inline void SetGeometry(const NandHal::Geometry &geometry)
+    {
+        _Geometry = geometry;
+        _Channels.Init(_Geometry.ChannelCount);
+        _Devices.Init(_Geometry.DevicesPerChannel);
+        _Dies.Init(_Geometry.ChannelCount * _Geometry.DevicesPerChannel);
+        _Pages.Init(_Geometry.PagesPerBlock);
+    }
 
-    static NandHal::Geometry _Geometry;
+    inline void SetSectorSize(const U8 &sectorSizeInBit)
+    {
+        _SectorsPerPage = _Geometry.BytesPerPage >> sectorSizeInBit;
+        _Sectors.Init(_SectorsPerPage);
+    }
 
-    static inline void LbaToNandAddress(const U32 &lba, const U32& sectorCount,
-        NandHal::NandAddress &nandAddress, U32 &nextLba, U32 &remainSectorCount)
+    inline void LbaToNandAddress(const U32 &lba, const U32& sectorCount,
+        NandHal::NandAddress &nandAddress, U32 &nextLba, U32 &remainSectorCount) const
     {
-        U32 pageIndex = lba / (_Geometry.BytesPerPage >> _SectorSizeInBit);
-        nandAddress.Channel._ = pageIndex % _Geometry.ChannelCount;
-        nandAddress.Device._ = (pageIndex / _Geometry.ChannelCount) % _Geometry.DevicesPerChannel;
-        nandAddress.Page._ = ((pageIndex / _Geometry.ChannelCount) / _Geometry.DevicesPerChannel) % _Geometry.PagesPerBlock;
-        nandAddress.Block._ = (((pageIndex / _Geometry.ChannelCount) / _Geometry.DevicesPerChannel) / _Geometry.PagesPerBlock);
-        nandAddress.Sector._ = lba % _SectorsPerPage;
+        std::uint32_t pageIndex;
+        std::uint32_t remainder;
+        _Sectors.DivMod(static_cast<std::uint32_t>(lba), pageIndex, remainder);
+        nandAddress.Sector._ = remainder;
+        _Channels.DivMod(pageIndex, pageIndex, remainder);
+        nandAddress.Channel._ = remainder;
+        _Devices.DivMod(pageIndex, pageIndex, remainder);
+        nandAddress.Device._ = remainder;
+        _Pages.DivMod(pageIndex, pageIndex, remainder);
+        nandAddress.Page._ = remainder;
+        nandAddress.Block._ = pageIndex;
+
+        nandAddress.SectorCount._ = std::min<U32>(sectorCount, _SectorsPerPage - nandAddress.Sector._);
+        nextLba = lba + nandAddress.SectorCount._;
+        remainSectorCount = sectorCount - nandAddress.SectorCount._;
+    }
 
-        if (nandAddress.Sector._ + sectorCount <= _SectorsPerPage)
+    //! The range cut at page boundaries into up to maxCount addresses, returns how many. Same contract as LbaToNandAddress otherwise
+    inline U32 LbaRangeToNandAddresses(const U32 &lba, const U32 &sectorCount, NandHal::NandAddress *nandAddresses, const U32 &maxCount,
+        U32 &nextLba, U32 &remainSectorCount) const
+    {
+        nextLba = lba;
+        remainSectorCount = sectorCount;
+        if (sectorCount == 0 || maxCount == 0)
         {
-            nandAddress.SectorCount._ = sectorCount;
+            return 0;
         }
-        else
+
+        // Only the first page is translated, the ones after it start at sector 0 of the next die in line
+        LbaToNandAddress(lba, sectorCount, nandAddresses[0], nextLba, remainSectorCount);
+        U32 channel = nandAddresses[0].Channel._;
+        U32 device = nandAddresses[0].Device._;
+        U32 page = nandAddresses[0].Page._;
+        U32 block = nandAddresses[0].Block._;
+        U32 count = 1;
+        for (; count < maxCount && remainSectorCount > 0; ++count)
         {
-            nandAddress.SectorCount._ = _SectorsPerPage - nandAddress.Sector._;
+            if (++channel == _Geometry.ChannelCount)
+            {
+                channel = 0;
+                if (++device == _Geometry.DevicesPerChannel)
+                {
+                    device = 0;
+                    if (++page == _Geometry.PagesPerBlock)
+                    {
+                        page = 0;
+                        ++block;
+                    }
+                }
+            }
+
+            NandHal::NandAddress &nandAddress = nandAddresses[count];
+            nandAddress.Channel._ = channel;
+            nandAddress.Device._ = device;
+            nandAddress.Page._ = page;
+            nandAddress.Block._ = block;
+            nandAddress.Sector._ = 0;
+            nandAddress.SectorCount._ = std::min<U32>(remainSectorCount, _SectorsPerPage);
+            nextLba += nandAddress.SectorCount._;
+            remainSectorCount -= nandAddress.SectorCount._;
         }
+        return count;
+    }
 
-        nextLba = lba + nandAddress.SectorCount._;
-        remainSectorCount = sectorCount - nandAddress.SectorCount._;
+    //! Inverse of LbaToNandAddress, lba / sectors per page
+    inline U32 NandAddressToPageIndex(const NandHal::NandAddress &nandAddress) const
+    {
+        return ((nandAddress.Block._ * _Geometry.PagesPerBlock + nandAddress.Page._) * _Geometry.DevicesPerChannel
+            + nandAddress.Device._) * _Geometry.ChannelCount + nandAddress.Channel._;
     }
 
-    static inline void SetGeometry(const NandHal::Geometry &geometry)
+    //! Consecutive pages go to consecutive dies, channel first
+    inline U32 PageIndexToDie(const U32 &pageIndex) const
     {
-        _Geometry = geometry;
+        std::uint32_t round;
+        std::uint32_t die;
+        _Dies.DivMod(static_cast<std::uint32_t>(pageIndex), round, die);
+        return die;
     }
 
-    static inline void SetSectorSize(const U8 &sectorSizeInBit)
+    //! Sorts pages block by block, die then block, and by page within the block
+    inline std::uint64_t PageIndexToBlockOrder(const U32 &pageIndex) const
     {
-        _SectorSizeInBit = sectorSizeInBit;
-        _SectorsPerPage = _Geometry.BytesPerPage >> _SectorSizeInBit;
+        std::uint32_t round;
+        std::uint32_t die;
+        std::uint32_t block;
+        std::uint32_t page;
+        _Dies.DivMod(static_cast<std::uint32_t>(pageIndex), round, die);
+        _Pages.DivMod(round, block, page);
+        return ((static_cast<std::uint64_t>(block) * GetDieCount() + die) << 32) | page;
     }
+
+    inline U32 GetSectorsPerPage() const { return _SectorsPerPage; }
+    inline U32 GetDieCount() const { return _Geometry.ChannelCount * _Geometry.DevicesPerChannel; }
+
+private:
+    //! Unsigned 32-bit divide by a constant, by the round-up method of Granlund and Montgomery when it isn't a power of two
+    class Divider
+    {
+    public:
+        Divider() : _Divisor(1), _Multiplier(0), _Shift(0)
+        {
+        }
+
+        inline void Init(const std::uint32_t &divisor)
+        {
+            assert(divisor > 0);
+            U8 log2 = 0;
+            while ((std::uint64_t(1) << log2) < divisor)
+            {
+                ++log2;
+            }
+
+            _Divisor = divisor;
+            if ((divisor & (divisor - 1)) == 0)
+            {
+                _Multiplier = 0;
+                _Shift = log2;
+            }
+            else
+            {
+                _Multiplier = static_cast<std::uint32_t>(((std::uint64_t(1) << 32) * ((std::uint64_t(1) << log2) - divisor)) / divisor + 1);
+                _Shift = log2 - 1;
+            }
+        }
+
+        inline void DivMod(const std::uint32_t value, std::uint32_t &quotient, std::uint32_t &remainder) const
+        {
+            if (_Multiplier == 0)
+            {
+                remainder = value & (_Divisor - 1);
+                quotient = value >> _Shift;
+            }
+            else
+            {
+                std::uint32_t high = static_cast<std::uint32_t>((static_cast<std::uint64_t>(value) * _Multiplier) >> 32);
+                std::uint32_t result = (high + ((value - high) >> 1)) >> _Shift;
+                remainder = value - result * _Divisor;
+                quotient = result;
+            }
+        }
+
+    private:
+        std::uint32_t _Divisor;
+        std::uint32_t _Multiplier;      //!< 0 for a power of two
+        U8 _Shift;
+    };
+
+private:
+    U32 _SectorsPerPage;
+    NandHal::Geometry _Geometry;
+
+    Divider _Sectors;
+    Divider _Channels;
+    Divider _Devices;
+    Divider _Dies;
+    Divider _Pages;
 };
 
 #endif
\ No newline at end of file
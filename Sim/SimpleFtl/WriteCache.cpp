@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include "WriteCache.h"
+
+WriteCache::WriteCache() :
+    _BufferHal(nullptr),
+    _Translation(nullptr),
+    _SectorsPerPage(0),
+    _Capacity(0),
+    _HighWatermark(0),
+    _LowWatermark(0),
+    _FlushingCount(0),
+    _NextSequence(0)
+{
+}
+
+void WriteCache::Init(BufferHal *bufferHal, const SimpleFtlTranslation *translation, const U8 &sectorsPerPage, const U32 &shareCount)
+{
+    assert(_Entries.empty());
+    assert(sectorsPerPage <= 64);
+
+    _BufferHal = bufferHal;
+    _Translation = translation;
+    _SectorsPerPage = sectorsPerPage;
+    _Capacity = std::max<U32>(1, _BufferHal->GetMaxBufferSizeInSector() / _SectorsPerPage / 2 / shareCount);
+    _HighWatermark = std::max<U32>(1, _Capacity * 3 / 4);
+    _LowWatermark = _Capacity / 2;
+}
+
+WriteCache::Entry* WriteCache::Find(const U32 &pageIndex)
+{
+    auto entry = _Entries.find(_Translation->PageIndexToBlockOrder(pageIndex));
+    return (entry == _Entries.end()) ? nullptr : &entry->second;
+}
+
+WriteCache::Entry* WriteCache::Insert(const U32 &pageIndex)
+{
+    Buffer buffer;
+    if (IsFull() || !_BufferHal->AllocateBuffer(BufferType::User, _SectorsPerPage, buffer))
+    {
+        return nullptr;
+    }
+
+    auto entry = _Entries.emplace(_Translation->PageIndexToBlockOrder(pageIndex), Entry{ buffer, pageIndex, 0, _NextSequence++, 0, false });
+    assert(entry.second);
+    _Sequences.insert(entry.first->second.Sequence);
+    UpdateCandidate(entry.first);
+
+    // The page after it in the block is no longer first
+    auto next = std::next(entry.first);
+    if (next != _Entries.end())
+    {
+        UpdateCandidate(next);
+    }
+    return &entry.first->second;
+}
+
+void WriteCache::Remove(const U32 &pageIndex)
+{
+    auto entry = _Entries.find(_Translation->PageIndexToBlockOrder(pageIndex));
+    assert(entry != _Entries.end());
+    assert(entry->second.PinCount == 0);
+
+    if (entry->second.Flushing)
+    {
+        --_FlushingCount;
+    }
+    _FullPages.erase(entry->second.Sequence);
+    _PartialPages.erase(entry->second.Sequence);
+    _Sequences.erase(entry->second.Sequence);
+    _BufferHal->DeallocateBuffer(entry->second.Buffer);
+
+    // The page after it in the block may be first now
+    auto next = _Entries.erase(entry);
+    if (next != _Entries.end())
+    {
+        UpdateCandidate(next);
+    }
+}
+
+void WriteCache::AddValidSectors(Entry &entry, const std::uint64_t &sectorMask)
+{
+    bool wasFull = (entry.ValidSectors == GetFullPageMask());
+    entry.ValidSectors |= sectorMask;
+    if (!wasFull && entry.ValidSectors == GetFullPageMask() && _PartialPages.erase(entry.Sequence) > 0)
+    {
+        _FullPages.emplace(entry.Sequence, &entry);
+    }
+}
+
+bool WriteCache::GetFlushCandidate(const std::uint64_t &fullSequence, const std::uint64_t &partialSequence, U32 &pageIndex) const
+{
+    return FindCandidate(_FullPages, fullSequence, pageIndex) || FindCandidate(_PartialPages, partialSequence, pageIndex);
+}
+
+bool WriteCache::FindCandidate(const std::map<std::uint64_t, Entry*> &candidates, const std::uint64_t &sequence, U32 &pageIndex) const
+{
+    // Only the pinned pages are stepped over
+    for (auto candidate = candidates.begin(); candidate != candidates.end() && candidate->first < sequence; ++candidate)
+    {
+        if (candidate->second->PinCount == 0)
+        {
+            pageIndex = candidate->second->PageIndex;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WriteCache::SetFlushing(Entry &entry)
+{
+    assert(!entry.Flushing);
+    entry.Flushing = true;
+    ++_FlushingCount;
+    _FullPages.erase(entry.Sequence);
+    _PartialPages.erase(entry.Sequence);
+}
+
+void WriteCache::UpdateCandidate(const EntryMap::iterator &entry)
+{
+    // Pages of a block share the upper half of the key, a page being flushed keeps the ones after it back too
+    bool first = (entry == _Entries.begin() || (std::prev(entry)->first >> 32) != (entry->first >> 32));
+    Entry &cached = entry->second;
+    _FullPages.erase(cached.Sequence);
+    _PartialPages.erase(cached.Sequence);
+    if (first && !cached.Flushing)
+    {
+        ((cached.ValidSectors == GetFullPageMask()) ? _FullPages : _PartialPages).emplace(cached.Sequence, &cached);
+    }
+}
+
+bool WriteCache::IsAboveHighWatermark() const
+{
+    return (_Entries.size() - _FlushingCount) >= _HighWatermark;
+}
+
+bool WriteCache::IsAboveLowWatermark() const
+{
+    return (_Entries.size() - _FlushingCount) > _LowWatermark;
+}
+
+std::uint64_t WriteCache::ToSectorMask(const U32 &sector, const U32 &sectorCount)
+{
+    std::uint64_t mask = (sectorCount >= 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << sectorCount) - 1);
+    return mask << sector;
+}
+
+void WriteCache::CopySectors(const Buffer &dest, const Buffer &src, const std::uint64_t &mask)
+{
+    U8 *destData = _BufferHal->ToPointer(dest);
+    U8 *srcData = _BufferHal->ToPointer(src);
+    U32 sectorSize = _BufferHal->ToByteIndexInTransfer(BufferType::User, 1);
+    for (U32 sector = 0; sector < _SectorsPerPage; ++sector)
+    {
+        if (mask & (std::uint64_t(1) << sector))
+        {
+            U32 byteIndex = _BufferHal->ToByteIndexInTransfer(BufferType::User, sector);
+            std::memcpy(destData + byteIndex, srcData + byteIndex, sectorSize);
+        }
+    }
+}
\ No newline at end of file
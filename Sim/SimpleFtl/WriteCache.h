@@ -0,0 +1,100 @@
+#ifndef __WriteCache_h__
+#define __WriteCache_h__
+
+#include <assert.h>
+#include <map>
+#include <set>
+
+#include "Buffer/Hal/BufferHal.h"
+#include "Translation.h"
+
+//! Pages of host data held in buffers until they are programmed, keyed by page index (lba / sectors per page)
+/*!
+    An entry is a whole page buffer with a bitmap of the sectors the host wrote to it,
+    it stays until the page is programmed. Entries are kept block by block, only the lowest
+    cached page of a block is offered for flushing so that each block is programmed front to back.
+
+    Those pages are indexed by sequence, the whole ones apart from the ones the host only partly wrote.
+    A partly written page is filled in from NAND when it's flushed, the host writing the rest of it
+    afterwards would program it a second time, so those are only taken when asked for.
+
+    An entry is pinned while host transfers use its buffer or host NAND reads of its page are in flight,
+    it isn't flushed meanwhile so those always see the cached sectors.
+*/
+class WriteCache
+{
+public:
+    struct Entry
+    {
+        Buffer Buffer;
+        U32 PageIndex;
+        std::uint64_t ValidSectors;     //!< bit n set once sector n of the page is in the buffer, see AddValidSectors
+        std::uint64_t Sequence;         //!< order the entries were created in, a flush covers the entries before a point
+        U32 PinCount;
+        bool Flushing;
+    };
+
+public:
+    WriteCache();
+
+    //! Capacity is half the buffer pool, the other half is left to NAND reads and uncached writes. Caches sharing the pool split it
+    void Init(BufferHal *bufferHal, const SimpleFtlTranslation *translation, const U8 &sectorsPerPage, const U32 &shareCount);
+
+    Entry* Find(const U32 &pageIndex);
+
+    //! Null when the cache is full or out of buffers
+    Entry* Insert(const U32 &pageIndex);
+    void Remove(const U32 &pageIndex);
+
+    inline void Pin(Entry &entry) { ++entry.PinCount; }
+    inline void Unpin(Entry &entry) { assert(entry.PinCount > 0); --entry.PinCount; }
+
+    void AddValidSectors(Entry &entry, const std::uint64_t &sectorMask);
+
+    //! Oldest whole page cached before fullSequence that can be flushed now, else the oldest partly written one cached before partialSequence. False if none
+    bool GetFlushCandidate(const std::uint64_t &fullSequence, const std::uint64_t &partialSequence, U32 &pageIndex) const;
+    void SetFlushing(Entry &entry);
+
+    inline bool IsEmpty() const { return _Entries.empty(); }
+    inline bool IsFull() const { return _Entries.size() >= _Capacity; }
+    inline U32 GetCapacity() const { return _Capacity; }
+    inline U32 GetFlushingCount() const { return _FlushingCount; }
+    inline std::uint64_t GetNextSequence() const { return _NextSequence; }
+
+    //! Of the oldest entry, GetNextSequence() when empty
+    inline std::uint64_t GetOldestSequence() const { return _Sequences.empty() ? _NextSequence : *_Sequences.begin(); }
+
+    //! Watermarks on the entries not already being flushed
+    bool IsAboveHighWatermark() const;
+    bool IsAboveLowWatermark() const;
+
+    inline std::uint64_t GetFullPageMask() const { return ToSectorMask(0, _SectorsPerPage); }
+    static std::uint64_t ToSectorMask(const U32 &sector, const U32 &sectorCount);
+
+    //! Copies the sectors in mask between two page buffers
+    void CopySectors(const Buffer &dest, const Buffer &src, const std::uint64_t &mask);
+
+private:
+    typedef std::map<std::uint64_t, Entry> EntryMap;
+
+    //! Has the entry offered for flushing, or not, as it stands
+    void UpdateCandidate(const EntryMap::iterator &entry);
+    bool FindCandidate(const std::map<std::uint64_t, Entry*> &candidates, const std::uint64_t &sequence, U32 &pageIndex) const;
+
+private:
+    BufferHal *_BufferHal;
+    const SimpleFtlTranslation *_Translation;
+    U8 _SectorsPerPage;
+    U32 _Capacity;
+    U32 _HighWatermark;
+    U32 _LowWatermark;
+
+    EntryMap _Entries;                          //!< by PageIndexToBlockOrder
+    std::set<std::uint64_t> _Sequences;         //!< of every entry
+    std::map<std::uint64_t, Entry*> _FullPages;     //!< whole pages that are first of their block and not flushing, by sequence
+    std::map<std::uint64_t, Entry*> _PartialPages;  //!< the same for partly written pages
+    U32 _FlushingCount;
+    std::uint64_t _NextSequence;
+};
+
+#endif
\ No newline at end of file
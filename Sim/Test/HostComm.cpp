@@ -1,7 +1,11 @@
 #include "pch.h"
 
+#include <atomic>
+#include <future>
 #include <memory>
 
+#include "Test/gtest-cout.h"
+
 #include "HostComm.hpp"
 
 using namespace HostCommTest;
@@ -43,4 +47,133 @@ TEST(HostComm, Messaging_Basic)
 	ASSERT_TRUE(client->HasResponse());                             // Should have response
 	auto responseMessage = client->PopResponse();
 	client->DeallocateMessage(responseMessage);
-}
\ No newline at end of file
+}
+
+TEST(HostComm, Messaging_ResponseCoalescing)
+{
+	constexpr char* messagingName = "HostCommTest_Coalescing";
+	constexpr U32 threshold = 4;
+
+	auto server = std::make_shared<SimpleCommandMessageServer>(messagingName, 64 * 1024);
+	ASSERT_NE(server, nullptr);
+	auto client = std::make_shared<SimpleCommandMessageClient>(messagingName);
+	ASSERT_NE(client, nullptr);
+
+	server->SetResponseCoalescing(threshold, std::chrono::milliseconds(100));
+
+	for (U32 i = 0; i < threshold; ++i)
+	{
+		auto message = AllocateMessage<SimpleCommand>(client, 0, true);
+		ASSERT_NE(message, nullptr);
+		client->Push(message);
+	}
+
+	// Responses are held back until the threshold is reached
+	for (U32 i = 0; i < threshold - 1; ++i)
+	{
+		auto receivedMessage = server->Pop();
+		ASSERT_NE(receivedMessage, nullptr);
+		ASSERT_NO_THROW(server->PushResponse(receivedMessage));
+		ASSERT_FALSE(client->HasResponse());
+	}
+	ASSERT_NO_THROW(server->PushResponse(server->Pop()));
+	for (U32 i = 0; i < threshold; ++i)
+	{
+		ASSERT_TRUE(client->HasResponse());
+		client->DeallocateMessage(client->PopResponse());
+	}
+	ASSERT_FALSE(client->HasResponse());
+
+	// A partial batch is published once the time limit expires
+	auto message = AllocateMessage<SimpleCommand>(client, 0, true);
+	client->Push(message);
+	ASSERT_NO_THROW(server->PushResponse(server->Pop()));
+	server->ProcessResponseCoalescing();
+	ASSERT_FALSE(client->HasResponse());
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	server->ProcessResponseCoalescing();
+	ASSERT_TRUE(client->HasResponse());
+	client->DeallocateMessage(client->PopResponse());
+}
+
+TEST(HostComm, Messaging_ResponseCoalescingBenchmark)
+{
+	using namespace std::chrono;
+
+	constexpr char* messagingName = "HostCommTest_CoalescingBenchmark";
+	constexpr U32 queueDepth = 64;
+	constexpr U32 commandCount = 64 * 1024;
+	constexpr U32 thresholds[] = { 1, 8, 32 };
+	constexpr auto timeLimit = microseconds(50);
+
+	for (auto threshold : thresholds)
+	{
+		auto server = std::make_shared<SimpleCommandMessageServer>(messagingName, 1024 * 1024);
+		auto client = std::make_shared<SimpleCommandMessageClient>(messagingName);
+		server->SetResponseCoalescing(threshold, timeLimit);
+
+		std::atomic<bool> stop(false);
+		auto device = std::async(std::launch::async, [&]()
+		{
+			while (!stop)
+			{
+				auto receivedMessage = server->Pop();
+				if (receivedMessage)
+				{
+					server->PushResponse(receivedMessage);
+				}
+				server->ProcessResponseCoalescing();
+			}
+		});
+
+		SimpleCommandMessage* messages[queueDepth];
+		for (U32 i = 0; i < queueDepth; ++i)
+		{
+			messages[i] = AllocateMessage<SimpleCommand>(client, 0, true);
+			ASSERT_NE(messages[i], nullptr);
+		}
+
+		duration<double> maxLatency = duration<double>::zero();
+		duration<double> totalLatency = duration<double>::zero();
+		auto t0 = high_resolution_clock::now();
+		for (U32 i = 0; i < queueDepth; ++i)
+		{
+			client->Push(messages[i]);
+		}
+
+		U32 submitted = queueDepth;
+		U32 completed = 0;
+		while (completed < commandCount)
+		{
+			auto response = client->PopResponse();
+			if (response == nullptr)
+			{
+				continue;
+			}
+
+			auto latency = response->GetLatency();
+			totalLatency += latency;
+			if (latency > maxLatency) { maxLatency = latency; }
+			++completed;
+
+			if (submitted < commandCount)
+			{
+				client->Push(response);
+				++submitted;
+			}
+			else
+			{
+				client->DeallocateMessage(response);
+			}
+		}
+		auto delta = duration<double>(high_resolution_clock::now() - t0);
+
+		stop = true;
+		device.wait();
+
+		GOUT("Response coalescing benchmark, threshold " << threshold << ", queue depth " << queueDepth);
+		GOUT("   Operations per second: " << (double)commandCount / delta.count());
+		GOUT("   Avg latency: " << duration_cast<microseconds>(totalLatency).count() / commandCount << "us");
+		GOUT("   Max latency: " << duration_cast<microseconds>(maxLatency).count() << "us");
+	}
+}
@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include <array>
+#include <future>
 
 #include "Buffer/Hal/BufferHal.h"
 #include "Nand/Sim/NandDevice.h"
@@ -14,7 +15,7 @@ protected:
         _BufferHal = std::make_shared<BufferHal>();
         _BufferHal->PreInit(maxBufferSizeInKB);
 
-        _NandDevice = std::make_unique<NandDevice>(_BufferHal.get(), blockCount, pagesPerBlock, bytesPerPage);
+        _NandDevice = std::make_unique<NandDevice>(_BufferHal.get(), blockCount, pagesPerBlock, bytesPerPage, spareBytesPerPage);
     }
 
     void TearDown() override
@@ -24,6 +25,7 @@ protected:
     static const U32 blockCount = 64;
     static const U32 pagesPerBlock = 256;
     static const U32 bytesPerPage = 8192;
+    static const U32 spareBytesPerPage = bytesPerPage / 32;
     static const U32 sectorsPerPage = bytesPerPage / 512;
     static const U32 maxBufferSizeInKB = sectorsPerPage;
 
@@ -72,6 +74,44 @@ TEST_F(NandDeviceTest, Basic)
     _BufferHal->DeallocateBuffer(readBuffer);
 }
 
+TEST_F(NandDeviceTest, SpareArea)
+{
+    Buffer writeBuffer;
+    _BufferHal->AllocateBuffer(BufferType::System, sectorsPerPage, writeBuffer);
+    std::memset(_BufferHal->ToPointer(writeBuffer), 0x5A, writeBuffer.SizeInByte);
+
+    U8 erasedSpare[spareBytesPerPage];
+    std::memset(erasedSpare, NandBlock::ERASED_PATTERN, sizeof(erasedSpare));
+    U8 writeSpare[spareBytesPerPage];
+    for (U32 i = 0; i < spareBytesPerPage; ++i)
+    {
+        writeSpare[i] = i % 255;
+    }
+    U8 readSpare[spareBytesPerPage];
+
+    tBlockInDevice block{ 0 };
+    tBlockInDevice copyBlock{ 1 };
+    tPageInBlock page{ 0 };
+    ASSERT_TRUE(_NandDevice->ReadSpare(block, page, readSpare));
+    ASSERT_EQ(0, std::memcmp(erasedSpare, readSpare, spareBytesPerPage));
+
+    // The spare area is programmed along with the page and goes with it on copyback
+    _NandDevice->WritePage(block, page, writeBuffer);
+    _NandDevice->WriteSpare(block, page, writeSpare);
+    ASSERT_TRUE(_NandDevice->ReadSpare(block, page, readSpare));
+    ASSERT_EQ(0, std::memcmp(writeSpare, readSpare, spareBytesPerPage));
+
+    ASSERT_TRUE(_NandDevice->CopybackPage(block, page, copyBlock, page));
+    ASSERT_TRUE(_NandDevice->ReadSpare(copyBlock, page, readSpare));
+    ASSERT_EQ(0, std::memcmp(writeSpare, readSpare, spareBytesPerPage));
+
+    _NandDevice->EraseBlock(block);
+    ASSERT_TRUE(_NandDevice->ReadSpare(block, page, readSpare));
+    ASSERT_EQ(0, std::memcmp(erasedSpare, readSpare, spareBytesPerPage));
+
+    _BufferHal->DeallocateBuffer(writeBuffer);
+}
+
 class NandHalTest : public ::testing::Test, public NandHal::CommandListener
 {
 public:
@@ -240,4 +280,43 @@ TEST_F(NandHalTest, Basic_CommandQueue)
         _BufferHal->DeallocateBuffer(writeBuffers[i]);
         _BufferHal->DeallocateBuffer(readBuffers[i]);
     }
+}
+
+TEST_F(NandHalTest, Idle_SpinThenPark)
+{
+    // Long park timeout, so progress below can only come from wakeups
+    _NandHal->SetIdleStrategy(FrameworkThread::IdleStrategy::SpinThenPark, 0, std::chrono::seconds(10));
+    std::future<void> nandHalFuture = std::async(std::launch::async, &NandHal::operator(), _NandHal);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    constexpr U32 commandCount = 64;
+    NandHal::CommandDesc commandDesc;
+    commandDesc.Operation = NandHal::CommandDesc::Op::Erase;
+    commandDesc.Address.Channel = 0;
+    commandDesc.Address.Device = 0;
+    commandDesc.Address.Page = 0;
+    commandDesc.Listener = this;
+    for (U32 i(0); i < commandCount; ++i)
+    {
+        commandDesc.Address.Block = i % blocks;
+        _NandHal->QueueCommand(commandDesc);
+
+        // Let the HAL park again between some of the commands
+        if (i % 8 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    while (false == _NandHal->IsCommandQueueEmpty() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    {
+    }
+    bool drained = _NandHal->IsCommandQueueEmpty();
+
+    // Stopped before anything is checked, a failed check would leave the HAL thread running and the test waiting on it
+    _NandHal->Stop();
+    ASSERT_EQ(std::future_status::ready, nandHalFuture.wait_for(std::chrono::seconds(5)));
+    ASSERT_TRUE(drained);
+    ASSERT_EQ(commandCount, _CompletedNandCount);
 }
\ No newline at end of file
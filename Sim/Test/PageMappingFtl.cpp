@@ -0,0 +1,695 @@
+#include "pch.h"
+
+#include <random>
+#include <vector>
+
+#include "Test/gtest-cout.h"
+
+#include "SimFramework/Framework.h"
+
+#include "HostComm.hpp"
+#include "PageMappingFtl/PageMapping.h"
+
+using namespace HostCommTest;
+
+// Defined with the SimpleFtl tests
+void SetReadWriteCommand(CustomProtocolCommand &command, CustomProtocolCommand::Code code, const U32 &lba, const U32 &sectorCount);
+U32 GetSectorSizeInTransfer(const DeviceInfoPayload &deviceInfo);
+
+class PageMappingFtlTest : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		ASSERT_NO_THROW(SimFramework.Init("Hardwareconfig/hardwaremin.json"));
+
+		FrameworkFuture = std::async(std::launch::async, &(Framework::operator()), &SimFramework);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+		CustomProtocolClient = std::make_shared<MessageClient<CustomProtocolCommand>>(SimFramework.GetCustomProtocolServerName().c_str());
+		ASSERT_NE(nullptr, CustomProtocolClient);
+
+		constexpr char* pageMappingFtlDll = "PageMappingFtl.dll";
+		auto downloadAndExecuteMsg = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, false);
+		ASSERT_NE(downloadAndExecuteMsg, nullptr);
+		downloadAndExecuteMsg->Data.Command = CustomProtocolCommand::Code::DownloadAndExecute;
+		memcpy(downloadAndExecuteMsg->Data.Descriptor.DownloadAndExecute.CodeName, pageMappingFtlDll,
+			sizeof(downloadAndExecuteMsg->Data.Descriptor.DownloadAndExecute.CodeName));
+		CustomProtocolClient->Push(downloadAndExecuteMsg);
+
+		auto getDeviceInfoMsg = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+		ASSERT_NE(getDeviceInfoMsg, nullptr);
+		getDeviceInfoMsg->Data.Command = CustomProtocolCommand::Code::GetDeviceInfo;
+		CustomProtocolClient->Push(getDeviceInfoMsg);
+		while (!CustomProtocolClient->HasResponse());
+		CustomProtocolMessage* deviceInfoResponse = CustomProtocolClient->PopResponse();
+		ASSERT_EQ(CustomProtocolCommand::Status::Success, deviceInfoResponse->Data.CommandStatus);
+		DeviceInfo = deviceInfoResponse->Data.Descriptor.DeviceInfoPayload;
+		CustomProtocolClient->DeallocateMessage(deviceInfoResponse);
+		SectorSizeInTransfer = GetSectorSizeInTransfer(DeviceInfo);
+	}
+
+	void TearDown() override
+	{
+		auto client = std::make_shared<SimFrameworkMessageClient>(SimFramework.GetSimServerName().c_str());
+		ASSERT_NE(nullptr, client);
+
+		auto message = AllocateMessage<SimFrameworkCommand>(client, 0, false);
+		ASSERT_NE(message, nullptr);
+		message->Data.Code = SimFrameworkCommand::Code::Exit;
+		client->Push(message);
+
+		//Give the Framework a chance to stop completely before next test
+		std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+	}
+
+	CustomProtocolCommand::Status Execute(CustomProtocolMessage *message, CustomProtocolCommand::Code code, const U32 &lba, const U32 &sectorCount)
+	{
+		SetReadWriteCommand(message->Data, code, lba, sectorCount);
+		CustomProtocolClient->Push(message);
+		while (!CustomProtocolClient->HasResponse());
+		return CustomProtocolClient->PopResponse()->Data.CommandStatus;
+	}
+
+	Framework SimFramework;
+	std::future<void> FrameworkFuture;
+	CustomProtocolMessageClientSharedPtr CustomProtocolClient;
+	DeviceInfoPayload DeviceInfo;
+	U32 SectorSizeInTransfer;
+};
+
+namespace
+{
+	constexpr U8 sectorsPerPage = 4;
+
+	NandHal::Geometry MakeGeometry(U32 channels, U32 devices, U32 blocks, U32 pages)
+	{
+		NandHal::Geometry geometry;
+		geometry.ChannelCount = channels;
+		geometry.DevicesPerChannel = devices;
+		geometry.BlocksPerDevice = blocks;
+		geometry.PagesPerBlock = pages;
+		geometry.BytesPerPage = 2048;
+		return geometry;
+	}
+
+	//! Formatted with 4 sectors per page
+	PageMapping MakeMapping(const NandHal::Geometry &geometry, U32 reservedBlocksPerDie)
+	{
+		PageMapping mapping;
+		mapping.Format(geometry, sectorsPerPage, reservedBlocksPerDie);
+		return mapping;
+	}
+
+	//! NAND pages programmed per host page, overwriting a full drive with 90% of the writes going to 10% of its pages
+	/*!
+		The GC is done in line, a victim's valid sectors are packed into new pages whenever the free blocks run low.
+	*/
+	double MeasureWriteAmplification(PageMapping::VictimPolicy policy)
+	{
+		NandHal::Geometry geometry = MakeGeometry(1, 1, 64, 16);
+		PageMapping mapping = MakeMapping(geometry, 8);
+		U32 pageCount = mapping.GetLbaCount() / sectorsPerPage;
+		U32 sectorsPerBlock = geometry.PagesPerBlock * sectorsPerPage;
+
+		NandHal::NandAddress address;
+		bool openedBlock;
+		std::uint64_t relocatedPages = 0;
+		auto collect = [&]()
+		{
+			U32 victim = mapping.SelectVictim(policy);
+			ASSERT_NE(PageMapping::NoBlock, victim);
+			std::vector<U32> lbas;
+			for (U32 sector = victim * sectorsPerBlock; sector < (victim + 1) * sectorsPerBlock; ++sector)
+			{
+				if (mapping.GetLogicalSector(sector) != PageMapping::Unmapped)
+				{
+					lbas.push_back(mapping.GetLogicalSector(sector));
+				}
+			}
+			for (U32 i = 0; i < lbas.size(); i += sectorsPerPage)
+			{
+				ASSERT_TRUE(mapping.AllocatePage(address, openedBlock));
+				for (U32 sector = 0; sector < sectorsPerPage && i + sector < lbas.size(); ++sector)
+				{
+					address.Sector._ = sector;
+					mapping.Update(lbas[i + sector], 1, address);
+				}
+				mapping.ProgramCompleted(address);
+				++relocatedPages;
+			}
+			mapping.ReleaseBlock(victim);
+		};
+		auto write = [&](U32 page)
+		{
+			while (mapping.GetFreeBlockCount() <= 2)
+			{
+				collect();
+			}
+			ASSERT_TRUE(mapping.AllocatePage(address, openedBlock));
+			mapping.Update(page * sectorsPerPage, sectorsPerPage, address);
+			mapping.ProgramCompleted(address);
+		};
+
+		for (U32 page = 0; page < pageCount; ++page)
+		{
+			write(page);
+		}
+		relocatedPages = 0;
+
+		std::mt19937 generator(1);
+		U32 hotPageCount = pageCount / 10;
+		U32 hostPageCount = 8 * pageCount;
+		for (U32 i = 0; i < hostPageCount; ++i)
+		{
+			U32 page = (generator() % 10 < 9) ? generator() % hotPageCount : hotPageCount + generator() % (pageCount - hotPageCount);
+			write(page);
+		}
+		return static_cast<double>(hostPageCount + relocatedPages) / hostPageCount;
+	}
+}
+
+TEST(PageMappingFtl, Mapping_StripedOutOfPlaceWrite)
+{
+	NandHal::Geometry geometry = MakeGeometry(2, 2, 8, 4);
+	constexpr U32 reservedBlocksPerDie = 2;
+
+	PageMapping mapping = MakeMapping(geometry, reservedBlocksPerDie);
+	ASSERT_EQ((8u - reservedBlocksPerDie) * 4 * 4 * sectorsPerPage, mapping.GetLbaCount());
+	ASSERT_EQ(PageMapping::Unmapped, mapping.GetPhysicalSector(0));
+
+	// Consecutive pages go to a different channel first, then a different device
+	NandHal::NandAddress pages[5];
+	bool openedBlock;
+	for (U32 i = 0; i < 5; ++i)
+	{
+		ASSERT_TRUE(mapping.AllocatePage(pages[i], openedBlock));
+		ASSERT_EQ(i < 4, openedBlock);
+		ASSERT_EQ(i % 2, pages[i].Channel);
+		ASSERT_EQ((i / 2) % 2, pages[i].Device);
+		ASSERT_EQ(i / 4, pages[i].Page);
+	}
+	ASSERT_EQ(pages[0].Block, pages[4].Block);
+	ASSERT_EQ(8u * 4 - 4, mapping.GetFreeBlockCount());
+
+	U32 firstPage = mapping.ToPhysicalSector(pages[0]);
+	U32 firstBlock = mapping.ToBlockIndex(firstPage);
+	mapping.Update(0, sectorsPerPage, pages[0]);
+	ASSERT_EQ(firstPage, mapping.GetPhysicalSector(0));
+	ASSERT_EQ(3u, mapping.GetLogicalSector(firstPage + 3));
+	ASSERT_EQ(sectorsPerPage, mapping.GetValidSectorCount(firstBlock));
+
+	// Rewriting LBAs 1 and 2 moves them and invalidates their old sectors
+	mapping.Update(1, 2, pages[1]);
+	U32 secondPage = mapping.ToPhysicalSector(pages[1]);
+	ASSERT_EQ(2u, mapping.GetValidSectorCount(firstBlock));
+	ASSERT_EQ(2u, mapping.GetValidSectorCount(mapping.ToBlockIndex(secondPage)));
+	ASSERT_EQ(PageMapping::Unmapped, mapping.GetLogicalSector(firstPage + 1));
+	ASSERT_EQ(secondPage, mapping.GetPhysicalSector(1));
+
+	// Lookups split where the next LBA isn't in the same physical page
+	NandHal::NandAddress address;
+	U32 nextLba, remainingSectorCount;
+	bool mapped;
+	U32 expectedCounts[] = { 1, 2, 1 };
+	U32 lba = 0;
+	U32 sectorCount = 4;
+	for (auto expectedCount : expectedCounts)
+	{
+		mapping.LbaToNandAddress(lba, sectorCount, address, nextLba, remainingSectorCount, mapped);
+		ASSERT_TRUE(mapped);
+		ASSERT_EQ(expectedCount, address.SectorCount);
+		ASSERT_EQ(mapping.GetPhysicalSector(lba), mapping.ToPhysicalSector(address));
+		lba = nextLba;
+		sectorCount = remainingSectorCount;
+	}
+	ASSERT_EQ(0u, sectorCount);
+
+	mapping.LbaToNandAddress(4, 10, address, nextLba, remainingSectorCount, mapped);
+	ASSERT_FALSE(mapped);
+	ASSERT_EQ(sectorsPerPage, address.SectorCount);
+	ASSERT_EQ(8u, nextLba);
+}
+
+TEST(PageMappingFtl, Mapping_AllocateUntilFull)
+{
+	NandHal::Geometry geometry = MakeGeometry(2, 1, 4, 8);
+	PageMapping mapping = MakeMapping(geometry, 1);
+
+	NandHal::NandAddress address;
+	bool openedBlock;
+	for (U32 i = 0; i < 2 * 4 * 8; ++i)
+	{
+		ASSERT_TRUE(mapping.AllocatePage(address, openedBlock));
+	}
+	ASSERT_FALSE(mapping.AllocatePage(address, openedBlock));
+	ASSERT_EQ(0u, mapping.GetFreeBlockCount());
+}
+
+TEST(PageMappingFtl, Mapping_VictimSelection)
+{
+	NandHal::Geometry geometry = MakeGeometry(1, 1, 8, 4);
+	PageMapping mapping = MakeMapping(geometry, 2);
+
+	auto write = [&mapping](U32 lba, U32 sectorCount)
+	{
+		while (sectorCount > 0)
+		{
+			NandHal::NandAddress address;
+			bool openedBlock;
+			ASSERT_TRUE(mapping.AllocatePage(address, openedBlock));
+			U32 count = std::min<U32>(sectorCount, sectorsPerPage);
+			mapping.Update(lba, count, address);
+			mapping.ProgramCompleted(address);
+			lba += count;
+			sectorCount -= count;
+		}
+	};
+
+	// Blocks 0, 1 and 2 in that order, then rewrites leave 7 valid sectors in block 0 and 6 in block 1
+	write(0, 48);
+	write(0, 9);
+	write(16, 10);
+	ASSERT_EQ(7u, mapping.GetValidSectorCount(0));
+	ASSERT_EQ(6u, mapping.GetValidSectorCount(1));
+	ASSERT_EQ(16u, mapping.GetValidSectorCount(2));
+
+	// The older block is worth more to cost benefit, greedy goes for the fewest valid sectors
+	ASSERT_EQ(0u, mapping.SelectVictim(PageMapping::VictimPolicy::CostBenefit));
+	ASSERT_EQ(1u, mapping.SelectVictim(PageMapping::VictimPolicy::Greedy));
+
+	U32 freeBlockCount = mapping.GetFreeBlockCount();
+	write(26, 6);
+	ASSERT_EQ(0u, mapping.GetValidSectorCount(1));
+	mapping.ReleaseBlock(1);
+	ASSERT_EQ(freeBlockCount + 1, mapping.GetFreeBlockCount());
+
+	// Block 4 took the last rewrites and has 12 valid sectors, block 3 13 and block 2 is fully valid
+	ASSERT_EQ(4u, mapping.SelectVictim(PageMapping::VictimPolicy::Greedy));
+	ASSERT_EQ(3u, mapping.SelectVictim(PageMapping::VictimPolicy::Greedy));
+	ASSERT_EQ(PageMapping::NoBlock, mapping.SelectVictim(PageMapping::VictimPolicy::Greedy));
+}
+
+TEST(PageMappingFtl, Mapping_WriteAmplification)
+{
+	double greedy = MeasureWriteAmplification(PageMapping::VictimPolicy::Greedy);
+	double costBenefit = MeasureWriteAmplification(PageMapping::VictimPolicy::CostBenefit);
+
+	GOUT("Write amplification, 90% of the overwrites to 10% of the drive");
+	GOUT("   Greedy: " << greedy);
+	GOUT("   CostBenefit: " << costBenefit);
+	ASSERT_GE(greedy, 1.0);
+
+	// Cost benefit waits for the hot blocks to empty rather than moving the same cold sectors over and over
+	ASSERT_LT(costBenefit, greedy);
+}
+
+TEST(PageMappingFtl, Mapping_Trim)
+{
+	NandHal::Geometry geometry = MakeGeometry(1, 1, 64, 64);
+	PageMapping mapping = MakeMapping(geometry, 2);
+
+	NandHal::NandAddress pages[2];
+	bool openedBlock;
+	U32 lbas[] = { 4, 5000 };
+	for (U32 i = 0; i < 2; ++i)
+	{
+		ASSERT_TRUE(mapping.AllocatePage(pages[i], openedBlock));
+		mapping.Update(lbas[i], sectorsPerPage, pages[i]);
+	}
+	U32 block = mapping.ToBlockIndex(mapping.ToPhysicalSector(pages[0]));
+	ASSERT_EQ(2u * sectorsPerPage, mapping.GetValidSectorCount(block));
+
+	// Across the whole drive, only the written sectors are invalidated
+	mapping.Trim(5, mapping.GetLbaCount() - 5);
+	ASSERT_EQ(1u, mapping.GetValidSectorCount(block));
+	ASSERT_NE(PageMapping::Unmapped, mapping.GetPhysicalSector(4));
+	ASSERT_EQ(PageMapping::Unmapped, mapping.GetPhysicalSector(5));
+	ASSERT_EQ(PageMapping::Unmapped, mapping.GetPhysicalSector(5000));
+	ASSERT_EQ(PageMapping::Unmapped, mapping.GetLogicalSector(mapping.ToPhysicalSector(pages[1])));
+
+	NandHal::NandAddress address;
+	U32 nextLba, remainingSectorCount;
+	bool mapped;
+	mapping.LbaToNandAddress(5000, sectorsPerPage, address, nextLba, remainingSectorCount, mapped);
+	ASSERT_FALSE(mapped);
+}
+
+TEST(PageMappingFtl, Mapping_Pattern)
+{
+	NandHal::Geometry geometry = MakeGeometry(1, 1, 32, 4);
+	PageMapping mapping = MakeMapping(geometry, 2);
+
+	NandHal::NandAddress page;
+	bool openedBlock;
+	ASSERT_TRUE(mapping.AllocatePage(page, openedBlock));
+	mapping.Update(0, sectorsPerPage, page);
+	U32 block = mapping.ToBlockIndex(mapping.ToPhysicalSector(page));
+
+	// The pattern replaces the data of LBAs 2 and 3 and takes no NAND sector
+	ASSERT_TRUE(mapping.SetPattern(2, 6, 0xa5a5a5a5));
+	ASSERT_EQ(2u, mapping.GetValidSectorCount(block));
+
+	NandHal::NandAddress address;
+	U32 nextLba, remainingSectorCount, pattern;
+	bool mapped;
+	mapping.LbaToNandAddress(2, 8, address, nextLba, remainingSectorCount, mapped, pattern);
+	ASSERT_FALSE(mapped);
+	ASSERT_EQ(0xa5a5a5a5u, pattern);
+	ASSERT_EQ(sectorsPerPage, address.SectorCount);
+	mapping.LbaToNandAddress(8, 4, address, nextLba, remainingSectorCount, mapped, pattern);
+	ASSERT_FALSE(mapped);
+	ASSERT_EQ(0u, pattern);
+
+	// Every entry of the table taken, a new pattern is refused until one is released
+	for (U32 i = 1; i < PageMapping::PatternCount; ++i)
+	{
+		ASSERT_TRUE(mapping.SetPattern(8 + i, 1, i));
+	}
+	ASSERT_FALSE(mapping.SetPattern(0, 1, 0x12345678));
+	ASSERT_TRUE(mapping.SetPattern(2, 6, 0));
+	ASSERT_TRUE(mapping.SetPattern(0, 1, 0x12345678));
+	ASSERT_EQ(1u, mapping.GetValidSectorCount(block));
+}
+
+TEST(PageMappingFtl, Mapping_RebuildFromSpare)
+{
+	NandHal::Geometry geometry = MakeGeometry(2, 1, 8, 4);
+	PageMapping mapping = MakeMapping(geometry, 2);
+
+	auto write = [&mapping](U32 lba, U32 sectorCount)
+	{
+		NandHal::NandAddress address;
+		bool openedBlock;
+		ASSERT_TRUE(mapping.AllocatePage(address, openedBlock));
+		mapping.SetSpare(address, lba, sectorCount);
+		mapping.Update(lba, sectorCount, address);
+		mapping.ProgramCompleted(address);
+	};
+
+	write(0, 4);
+	write(4, 4);
+	write(8, 4);
+	write(12, 4);
+	write(1, 2);
+
+	// LBAs 8 to 11 moved by the GC while the host rewrites LBA 9
+	std::vector<U32> sources;
+	for (U32 lba = 8; lba < 12; ++lba)
+	{
+		sources.push_back(mapping.GetPhysicalSector(lba));
+	}
+	NandHal::NandAddress relocated;
+	bool openedBlock;
+	ASSERT_TRUE(mapping.AllocatePage(relocated, openedBlock));
+	mapping.SetSpare(relocated, sources, sectorsPerPage);
+	write(9, 1);
+	for (U32 sector = 0; sector < sectorsPerPage; ++sector)
+	{
+		U32 lba = mapping.GetLogicalSector(sources[sector]);
+		if (lba != PageMapping::Unmapped)
+		{
+			relocated.Sector._ = sector;
+			mapping.Update(lba, 1, relocated);
+		}
+	}
+	mapping.ProgramCompleted(relocated);
+
+	// What a mount reads from NAND, pages are programmed in order until the first erased one
+	PageMapping mounted = MakeMapping(geometry, 2);
+	size_t spareBytes = static_cast<size_t>(mapping.GetBlockCount()) * geometry.PagesPerBlock * NandHal::GetSpareBytesPerPage(geometry);
+	std::memcpy(mounted.GetSpare(0, 0), mapping.GetSpare(0, 0), spareBytes);
+	std::vector<U32> programmedPages(mapping.GetBlockCount(), 0);
+	for (U32 block = 0; block < mapping.GetBlockCount(); ++block)
+	{
+		while (programmedPages[block] < geometry.PagesPerBlock && !mounted.IsSpareErased(block, programmedPages[block]))
+		{
+			++programmedPages[block];
+		}
+	}
+	ASSERT_EQ(sectorsPerPage, mounted.GetMountedSectorsPerPage(programmedPages));
+	ASSERT_EQ(16u, mounted.Rebuild(programmedPages));
+
+	// Every LBA is found at the same write, a GC copy and its source being the same one
+	auto spareEntry = [&geometry](PageMapping &pageMapping, const U32 &physicalSector)
+	{
+		U32 page = physicalSector / sectorsPerPage;
+		PageMapping::SpareEntry *entries = reinterpret_cast<PageMapping::SpareEntry*>(pageMapping.GetSpare(page / geometry.PagesPerBlock, page % geometry.PagesPerBlock));
+		return entries[1 + physicalSector % sectorsPerPage];
+	};
+	for (U32 lba = 0; lba < 16; ++lba)
+	{
+		PageMapping::SpareEntry expected = spareEntry(mapping, mapping.GetPhysicalSector(lba));
+		PageMapping::SpareEntry actual = spareEntry(mounted, mounted.GetPhysicalSector(lba));
+		ASSERT_EQ(lba, actual.Lba);
+		ASSERT_EQ(expected.Sequence, actual.Sequence);
+	}
+	ASSERT_EQ(mapping.GetPhysicalSector(9), mounted.GetPhysicalSector(9));
+	ASSERT_EQ(mapping.GetPhysicalSector(1), mounted.GetPhysicalSector(1));
+	ASSERT_EQ(PageMapping::Unmapped, mounted.GetPhysicalSector(16));
+	ASSERT_EQ(mapping.GetFreeBlockCount(), mounted.GetFreeBlockCount());
+
+	// Writes after the mount are newer than any before it
+	NandHal::NandAddress address;
+	ASSERT_TRUE(mounted.AllocatePage(address, openedBlock));
+	U8 *spare = mounted.SetSpare(address, 0, 1);
+	ASSERT_LT(spareEntry(mapping, mapping.GetPhysicalSector(9)).Sequence, reinterpret_cast<PageMapping::SpareEntry*>(spare)[1].Sequence);
+}
+
+TEST_F(PageMappingFtlTest, RandomOverwriteReadVerify)
+{
+	constexpr U32 lbaCount = 1024;
+	constexpr U32 maxSectorCount = 32;
+	constexpr U32 writeCount = 500;
+	ASSERT_EQ(DeviceInfo.TotalSector >= lbaCount, true);
+
+	U32 payloadSize = lbaCount * SectorSizeInTransfer;
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+	ASSERT_NE(message, nullptr);
+	U8 *payload = (U8*)message->Payload;
+
+	// Never written LBAs read back as zeroes
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	std::vector<U8> expected(payloadSize, 0);
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+
+	// Every rewrite lands on a new page, the same LBAs can be written any number of times
+	std::mt19937 generator(36);
+	std::uniform_int_distribution<U32> lbaDistribution(0, lbaCount - 1);
+	std::uniform_int_distribution<U32> sectorCountDistribution(1, maxSectorCount);
+	for (U32 write = 0; write < writeCount; ++write)
+	{
+		U32 lba = lbaDistribution(generator);
+		U32 sectorCount = std::min(sectorCountDistribution(generator), lbaCount - lba);
+		U8 pattern = (U8)(write + 1);
+		U32 size = sectorCount * SectorSizeInTransfer;
+		std::memset(payload, pattern, size);
+		std::memset(&expected[lba * SectorSizeInTransfer], pattern, size);
+		ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Write, lba, sectorCount));
+	}
+
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
+
+TEST_F(PageMappingFtlTest, GarbageCollectionOverwriteReadVerify)
+{
+	constexpr U32 sectorsPerWrite = 256;
+	U32 lbaCount = DeviceInfo.TotalSector - DeviceInfo.TotalSector % sectorsPerWrite;
+	U32 chunkCount = lbaCount / sectorsPerWrite;
+
+	auto gcMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+	ASSERT_NE(gcMessage, nullptr);
+	gcMessage->Data.Command = CustomProtocolCommand::Code::SetGarbageCollection;
+	gcMessage->Data.Descriptor.GarbageCollectionPayload = GarbageCollectionPayload{ GarbageCollectionPayload::Policy::Greedy, 4, 2, 2 };
+	CustomProtocolClient->Push(gcMessage);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+	CustomProtocolClient->DeallocateMessage(gcMessage);
+
+	U32 payloadSize = sectorsPerWrite * SectorSizeInTransfer;
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+	ASSERT_NE(message, nullptr);
+	U8 *payload = (U8*)message->Payload;
+
+	// Fill the drive then rewrite twice its capacity, only possible if blocks are collected
+	std::vector<U8> patterns(chunkCount);
+	std::mt19937 generator(37);
+	std::uniform_int_distribution<U32> chunkDistribution(0, chunkCount - 1);
+	for (U32 write = 0; write < 3 * chunkCount; ++write)
+	{
+		U32 chunk = (write < chunkCount) ? write : chunkDistribution(generator);
+		patterns[chunk] = (U8)(write + 1);
+		std::memset(payload, patterns[chunk], payloadSize);
+		ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Write, chunk * sectorsPerWrite, sectorsPerWrite));
+	}
+
+	std::vector<U8> expected(payloadSize);
+	for (U32 chunk = 0; chunk < chunkCount; ++chunk)
+	{
+		ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, chunk * sectorsPerWrite, sectorsPerWrite));
+		std::memset(expected.data(), patterns[chunk], payloadSize);
+		ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+	}
+
+	message->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+	const StatisticsPayload &statistics = message->Data.Descriptor.StatisticsPayload;
+	ASSERT_EQ(3ull * lbaCount, statistics.HostSectorsWritten);
+	ASSERT_GE(statistics.NandSectorsWritten, statistics.HostSectorsWritten);
+	ASSERT_GT(statistics.ErasedBlocks, 128u);   // hardwaremin.json has 128 blocks
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
+
+TEST_F(PageMappingFtlTest, TrimReadsBackUnmapped)
+{
+	constexpr U32 lbaCount = 256;
+	U32 payloadSize = lbaCount * SectorSizeInTransfer;
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+	ASSERT_NE(message, nullptr);
+	U8 *payload = (U8*)message->Payload;
+
+	std::memset(payload, 0x5a, payloadSize);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Write, 0, lbaCount));
+
+	// Two ranges dropped, the rest keeps its data
+	message->Data.Command = CustomProtocolCommand::Code::Trim;
+	message->Data.Descriptor.RangeListPayload.RangeCount = 2;
+	message->Data.Descriptor.RangeListPayload.Ranges[0] = SimpleFtlPayload{ 8, 16 };
+	message->Data.Descriptor.RangeListPayload.Ranges[1] = SimpleFtlPayload{ 100, DeviceInfo.TotalSector - 100 };
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+
+	std::vector<U8> expected(payloadSize, 0x5a);
+	std::memset(&expected[8 * SectorSizeInTransfer], 0, 16 * SectorSizeInTransfer);
+	std::memset(&expected[100 * SectorSizeInTransfer], 0, (lbaCount - 100) * SectorSizeInTransfer);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+
+	// A range past the end fails the whole command
+	message->Data.Command = CustomProtocolCommand::Code::Trim;
+	message->Data.Descriptor.RangeListPayload.RangeCount = 2;
+	message->Data.Descriptor.RangeListPayload.Ranges[0] = SimpleFtlPayload{ 0, 8 };
+	message->Data.Descriptor.RangeListPayload.Ranges[1] = SimpleFtlPayload{ DeviceInfo.TotalSector, 1 };
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Failed, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
+
+TEST_F(PageMappingFtlTest, WriteZeroesAndPatternReadBack)
+{
+	constexpr U32 lbaCount = 64;
+	U32 payloadSize = lbaCount * SectorSizeInTransfer;
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+	ASSERT_NE(message, nullptr);
+	U8 *payload = (U8*)message->Payload;
+
+	std::memset(payload, 0x5a, payloadSize);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Write, 0, lbaCount));
+
+	// The whole drive gets the pattern, then part of it is zeroed
+	message->Data.Command = CustomProtocolCommand::Code::WritePattern;
+	message->Data.Descriptor.WritePatternPayload = WritePatternPayload{ 0, DeviceInfo.TotalSector, 0xc3c3c3c3 };
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::WriteZeroes, 16, 8));
+
+	std::vector<U8> expected(payloadSize, 0xc3);
+	std::memset(&expected[16 * SectorSizeInTransfer], 0, 8 * SectorSizeInTransfer);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, payloadSize));
+
+	ASSERT_EQ(CustomProtocolCommand::Status::Failed, Execute(message, CustomProtocolCommand::Code::WriteZeroes, DeviceInfo.TotalSector, 1));
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
+
+TEST_F(PageMappingFtlTest, CopyReadsBackSources)
+{
+	constexpr U32 lbaCount = 64;
+	constexpr U32 destinationLba = 128;
+	U32 sectorsPerPage = DeviceInfo.SectorsPerPage;
+	U32 payloadSize = lbaCount * SectorSizeInTransfer;
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+	ASSERT_NE(message, nullptr);
+	U8 *payload = (U8*)message->Payload;
+
+	for (U32 lba = 0; lba < lbaCount; ++lba)
+	{
+		std::memset(&payload[lba * SectorSizeInTransfer], (U8)(0x10 + lba), SectorSizeInTransfer);
+	}
+	std::vector<U8> written(payload, payload + payloadSize);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Write, 0, lbaCount));
+
+	// A whole page, which goes by copyback, then ranges that don't line up with the pages
+	std::vector<SimpleFtlPayload> sources{ { 0, sectorsPerPage }, { 2 * sectorsPerPage + 3, 5 }, { 40, 4 } };
+	message->Data.Command = CustomProtocolCommand::Code::Copy;
+	message->Data.Descriptor.CopyPayload.DestinationLba = destinationLba;
+	message->Data.Descriptor.CopyPayload.SourceRanges.RangeCount = (U32)sources.size();
+	std::vector<U8> expected;
+	for (U32 i = 0; i < sources.size(); ++i)
+	{
+		message->Data.Descriptor.CopyPayload.SourceRanges.Ranges[i] = sources[i];
+		expected.insert(expected.end(), &written[sources[i].Lba * SectorSizeInTransfer],
+			&written[(sources[i].Lba + sources[i].SectorCount) * SectorSizeInTransfer]);
+	}
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+
+	U32 copiedCount = (U32)(expected.size() / SectorSizeInTransfer);
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, destinationLba, copiedCount));
+	ASSERT_EQ(0, std::memcmp(expected.data(), payload, expected.size()));
+
+	// The sources are left as they were
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, Execute(message, CustomProtocolCommand::Code::Read, 0, lbaCount));
+	ASSERT_EQ(0, std::memcmp(written.data(), payload, payloadSize));
+
+	message->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_GT(CustomProtocolClient->PopResponse()->Data.Descriptor.StatisticsPayload.CopybackPages, 0u);
+
+	// A source overlapping the destination fails the whole command
+	message->Data.Command = CustomProtocolCommand::Code::Copy;
+	message->Data.Descriptor.CopyPayload.DestinationLba = 4;
+	message->Data.Descriptor.CopyPayload.SourceRanges.RangeCount = 1;
+	message->Data.Descriptor.CopyPayload.SourceRanges.Ranges[0] = SimpleFtlPayload{ 0, sectorsPerPage };
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Failed, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
+
+TEST_F(PageMappingFtlTest, MountReadsSpareAreasOfBlankDrive)
+{
+	auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, false);
+	ASSERT_NE(message, nullptr);
+
+	// The drive came up blank, the scan of each block stops at its first page
+	message->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+	CustomProtocolClient->Push(message);
+	while (!CustomProtocolClient->HasResponse());
+	ASSERT_EQ(CustomProtocolCommand::Status::Success, CustomProtocolClient->PopResponse()->Data.CommandStatus);
+	const StatisticsPayload &statistics = message->Data.Descriptor.StatisticsPayload;
+	ASSERT_GE(statistics.MountSpareReads, 128u);    // hardwaremin.json has 128 blocks of 64 pages
+	ASSERT_LT(statistics.MountSpareReads, 128u * 64);
+	ASSERT_EQ(128u, statistics.FreeBlocks);
+
+	CustomProtocolClient->DeallocateMessage(message);
+}
\ No newline at end of file
@@ -2,15 +2,57 @@
 
 #include <ctime>
 #include <map>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
 
 #include "Test/gtest-cout.h"
 
 #include "SimFramework/Framework.h"
+#include "SimFramework/MultiDeviceFramework.h"
 
 #include "HostComm.hpp"
 
 using namespace HostCommTest;
 
+namespace
+{
+	//! The test may itself be restricted to some cpus, pin to one it is allowed on
+	U32 FirstAllowedCpu()
+	{
+#ifdef _WIN32
+		DWORD_PTR processMask, systemMask;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		{
+			for (U32 cpu = 0; cpu < ThreadPlacement::MaxCpus; ++cpu)
+			{
+				if (processMask & (DWORD_PTR(1) << cpu))
+				{
+					return cpu;
+				}
+			}
+		}
+#else
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		{
+			for (U32 cpu = 0; cpu < ThreadPlacement::MaxCpus; ++cpu)
+			{
+				if (CPU_ISSET(cpu, &set))
+				{
+					return cpu;
+				}
+			}
+		}
+#endif
+		return 0;
+	}
+}
+
 TEST(SimFramework, LoadConfigFile)
 {
 	Framework framework;
@@ -20,6 +62,139 @@ TEST(SimFramework, LoadConfigFile)
 	ASSERT_ANY_THROW(framework2.Init("Hardwareconfig/hardwarebadvalue.json"));
 }
 
+TEST(SimFramework, ThreadPlacement)
+{
+	ThreadPlacement placement;
+	ASSERT_TRUE(placement.ParseCpus("0,2-4"));
+	ASSERT_EQ(std::vector<U32>({ 0, 2, 3, 4 }), placement.Cpus);
+	ASSERT_TRUE(placement.ParseCpus(""));
+	ASSERT_TRUE(placement.Cpus.empty());
+	ASSERT_FALSE(placement.ParseCpus("3-1"));
+	ASSERT_FALSE(placement.ParseCpus("1;2"));
+	ASSERT_FALSE(placement.ParseCpus("1-2x"));
+	ASSERT_FALSE(placement.ParseCpus("0,3 4"));
+	ASSERT_TRUE(placement.ParseCpus("1-2 "));
+	ASSERT_EQ(std::vector<U32>({ 1, 2 }), placement.Cpus);
+	ASSERT_FALSE(placement.ParseCpus("64"));
+
+	ASSERT_TRUE(placement.ParsePolicy("high"));
+	ASSERT_EQ(ThreadPlacement::SchedulingPolicy::High, placement.Policy);
+	ASSERT_FALSE(placement.ParsePolicy("fast"));
+
+	// Pinning to a cpu the process may use should be accepted everywhere, applied on a thread of its own to leave the test runner unpinned
+	std::string cpu = std::to_string(FirstAllowedCpu());
+	ASSERT_TRUE(placement.ParseCpus(cpu));
+	ASSERT_TRUE(placement.ParsePolicy("default"));
+	std::string applied;
+	std::thread pinned([&]() { applied = placement.Apply(); });
+	pinned.join();
+	ASSERT_EQ("cpus " + cpu + ", policy default", applied);
+}
+
+class SchedulerTestComponent : public FrameworkThread
+{
+public:
+	SchedulerTestComponent(char name, std::string &trace) : Work(0), Next(nullptr), Name(name), _Trace(trace) {}
+
+	U32 Work;
+	SchedulerTestComponent *Next;
+	char Name;
+
+protected:
+	virtual bool Run() override
+	{
+		if (Work == 0)
+		{
+			return false;
+		}
+
+		--Work;
+		_Trace += Name;
+		if (Next)
+		{
+			++Next->Work;
+			Next->Wakeup();
+		}
+		return true;
+	}
+
+private:
+	std::string &_Trace;
+};
+
+TEST(SimFramework, EventScheduler_Deterministic)
+{
+	auto run = [](std::string &trace)
+	{
+		SchedulerTestComponent a('a', trace), b('b', trace), c('c', trace);
+		a.Next = &b;
+		b.Next = &c;
+		c.Next = nullptr;
+
+		EventScheduler scheduler;
+		scheduler.AddComponent(&a, 10);
+		scheduler.AddComponent(&b, 3);
+		scheduler.AddComponent(&c, 5);
+
+		a.Work = 4;
+		while (scheduler.Step());
+		return scheduler.Now();
+	};
+
+	std::string trace1, trace2;
+	auto time1 = run(trace1);
+	auto time2 = run(trace2);
+
+	ASSERT_EQ("abcabcabcabc", trace1);
+	ASSERT_EQ(trace1, trace2);
+	ASSERT_EQ(time1, time2);
+
+	// a is the bottleneck, the last a runs at 30 and finds nothing left at 40
+	ASSERT_EQ(40u, time1);
+}
+
+class TimerTestComponent : public FrameworkThread
+{
+public:
+	TimerTestComponent(std::chrono::high_resolution_clock::time_point due) : Runs(0), Fired(false), _Due(due) {}
+
+	U32 Runs;
+	bool Fired;
+
+protected:
+	virtual bool Run() override
+	{
+		++Runs;
+		if (Now() < _Due)
+		{
+			WakeupAt(_Due);
+		}
+		else
+		{
+			Fired = true;
+		}
+		return false;
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point _Due;
+};
+
+TEST(SimFramework, EventScheduler_WakeupAt)
+{
+	TimerTestComponent timer(std::chrono::high_resolution_clock::time_point(std::chrono::milliseconds(1)));
+
+	EventScheduler scheduler;
+	scheduler.AddComponent(&timer, 1);
+
+	// The first poll asks to run again in a millisecond, virtual time skips there in one step rather than a step per ns
+	ASSERT_FALSE(scheduler.Step());
+	ASSERT_TRUE(scheduler.Step());
+	ASSERT_EQ(2u, timer.Runs);
+	ASSERT_TRUE(timer.Fired);
+	ASSERT_EQ(1000u * 1000u, scheduler.Now());
+}
+
 TEST(SimFramework, Basic)
 {
 	constexpr char* messagingName = "SsdSimMainMessageServer";	//TODO: define a way to get name
@@ -44,6 +219,82 @@ TEST(SimFramework, Basic)
 	std::this_thread::sleep_for(std::chrono::milliseconds(3000));
 }
 
+//! Every thread parks when idle, Stop() has to wake them up for the framework to exit
+TEST(SimFramework, Basic_SpinThenPark)
+{
+	constexpr char* messagingName = "SsdSimMainMessageServer";	//TODO: define a way to get name
+
+	Framework framework;
+	ASSERT_NO_THROW(framework.Init("Hardwareconfig/hardwareidle.json"));
+
+	auto fwFuture = std::async(std::launch::async, &(Framework::operator()), &framework);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+	auto client = std::make_shared<MessageClient<SimFrameworkCommand>>(messagingName);
+	ASSERT_NE(nullptr, client);
+
+	auto message = AllocateMessage<SimFrameworkCommand>(client, 0, false);
+	ASSERT_NE(message, nullptr);
+	message->Data.Code = SimFrameworkCommand::Code::Exit;
+	client->Push(message);
+
+	ASSERT_EQ(std::future_status::ready, fwFuture.wait_for(std::chrono::seconds(10)));
+
+	//Give the Framework a chance to stop completely before next test
+	// This is a work around until multiple servers can be created without collision
+	std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+}
+
+TEST(SimFramework, Basic_DiscreteEvent)
+{
+	constexpr char* messagingName = "SsdSimMainMessageServer";	//TODO: define a way to get name
+
+	Framework framework;
+	ASSERT_NO_THROW(framework.Init("Hardwareconfig/hardwarediscreteevent.json"));
+
+	auto fwFuture = std::async(std::launch::async, &(Framework::operator()), &framework);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+	auto client = std::make_shared<MessageClient<SimFrameworkCommand>>(messagingName);
+	ASSERT_NE(nullptr, client);
+
+	auto message = AllocateMessage<SimFrameworkCommand>(client, 0, false);
+	ASSERT_NE(message, nullptr);
+	message->Data.Code = SimFrameworkCommand::Code::Exit;
+	client->Push(message);
+
+	//Give the Framework a chance to stop completely before next test
+	// This is a work around until multiple servers can be created without collision
+	std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+}
+
+TEST(SimFramework, Basic_MultiDevice)
+{
+	MultiDeviceFramework framework;
+	ASSERT_NO_THROW(framework.Init({ "Hardwareconfig/hardwarespec.json", "Hardwareconfig/hardwarespec.json", "Hardwareconfig/hardwarespec.json" }, 2));
+	ASSERT_EQ(3u, framework.GetDriveCount());
+
+	auto fwFuture = std::async(std::launch::async, &(MultiDeviceFramework::operator()), &framework);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+	// Every drive has its own server and keeps running until it gets its own exit command
+	for (U32 i = 0; i < framework.GetDriveCount(); ++i)
+	{
+		auto client = std::make_shared<MessageClient<SimFrameworkCommand>>(framework.GetDrive(i).GetSimServerName().c_str());
+		ASSERT_NE(nullptr, client);
+
+		auto message = AllocateMessage<SimFrameworkCommand>(client, 0, false);
+		ASSERT_NE(message, nullptr);
+		message->Data.Code = SimFrameworkCommand::Code::Exit;
+		client->Push(message);
+	}
+
+	ASSERT_EQ(std::future_status::ready, fwFuture.wait_for(std::chrono::seconds(10)));
+}
+
 TEST(SimFramework, Basic_Benchmark)
 {
 	constexpr char* messagingName = "SsdSimMainMessageServer";	//TODO: define a way to get name
@@ -6,13 +6,18 @@
 #include "Test/gtest-cout.h"
 
 #include "SimFramework/Framework.h"
+#include "SimFrameworkBase/FirmwareRegistry.h"
 
 #include "HostComm.hpp"
+#include "SimpleFtl/CompletionQueue.h"
 #include "SimpleFtl/Translation.h"
 #include "SsdSimApp.h"
 
 using namespace HostCommTest;
 
+// SimpleFtl is compiled into this test as well, linked statically under a name of its own so the other tests still load the DLL
+FIRMWARE_STATIC_REGISTER(SimpleFtlFirmware, "StaticSimpleFtl.dll")
+
 void SetReadWriteCommand(CustomProtocolCommand &command, CustomProtocolCommand::Code code, const U32 &lba, const U32 &sectorCount)
 {
     command.Command = code;
@@ -26,13 +31,13 @@ U32 GetSectorSizeInTransfer(const DeviceInfoPayload &deviceInfo)
         ? deviceInfo.SectorInfo.CompactSizeInByte : (1 << deviceInfo.SectorInfo.SectorSizeInBit);
 }
 
-void VerifyLbaToNand(const U32 &lba, const U32 &sectorCount,
+void VerifyLbaToNand(const SimpleFtlTranslation &translation, const U32 &lba, const U32 &sectorCount,
     const NandHal::NandAddress &expectedAddress, const U32 &expectedLba, const U32 &expectedSectorCount)
 {
     NandHal::NandAddress address;
     U32 nextLba;
     U32 remainingSector;
-    SimpleFtlTranslation::LbaToNandAddress(lba, sectorCount, address, nextLba, remainingSector);
+    translation.LbaToNandAddress(lba, sectorCount, address, nextLba, remainingSector);
 
     ASSERT_EQ(address.Channel, expectedAddress.Channel);
     ASSERT_EQ(address.Device, expectedAddress.Device);
@@ -47,11 +52,22 @@ void VerifyLbaToNand(const U32 &lba, const U32 &sectorCount,
 class SimpleFtlTest : public ::testing::Test
 {
 protected:
+	virtual const char* GetHardwareConfig() const
+	{
+		return "Hardwareconfig/hardwaremin.json";
+	}
+
+	virtual const char* GetFirmware() const
+	{
+		return "SimpleFtl.dll";
+	}
+
 	void SetUp() override 
 	{
-		ASSERT_NO_THROW(SimFramework.Init("Hardwareconfig/hardwaremin.json"));
+		SimFramework = std::make_unique<Framework>();
+		ASSERT_NO_THROW(SimFramework->Init(GetHardwareConfig()));
 
-		FrameworkFuture = std::async(std::launch::async, &(Framework::operator()), &SimFramework);
+		FrameworkFuture = std::async(std::launch::async, &(Framework::operator()), SimFramework.get());
 
 		std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 
@@ -61,11 +77,10 @@ protected:
 		ASSERT_NE(nullptr, CustomProtocolClient);
 
 		// Load dll SimpleFtl by sending command DownloadAndExecute
-		constexpr char* simpleFtlDll = "SimpleFtl.dll";
 		auto downloadAndExecuteMsg = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, false);
 		ASSERT_NE(downloadAndExecuteMsg, nullptr);
         downloadAndExecuteMsg->Data.Command = CustomProtocolCommand::Code::DownloadAndExecute;
-		memcpy(downloadAndExecuteMsg->Data.Descriptor.DownloadAndExecute.CodeName, simpleFtlDll,
+		memcpy(downloadAndExecuteMsg->Data.Descriptor.DownloadAndExecute.CodeName, GetFirmware(),
 			sizeof(downloadAndExecuteMsg->Data.Descriptor.DownloadAndExecute.CodeName));
 		CustomProtocolClient->Push(downloadAndExecuteMsg);
 
@@ -111,13 +126,41 @@ protected:
 		std::this_thread::sleep_for(std::chrono::milliseconds(3000));
 	}
 
-	Framework SimFramework;
+	//! Exits the framework and starts a new one, firmware linked in statically is swapped back in with the globals it had
+	void Restart()
+	{
+		TearDown();
+		FrameworkFuture.wait();
+		SetUp();
+	}
+
+	std::unique_ptr<Framework> SimFramework;
 	std::future<void> FrameworkFuture;
 	CustomProtocolMessageClientSharedPtr CustomProtocolClient;
     DeviceInfoPayload DeviceInfo;
     U32 SectorSizeInTransfer;
 };
 
+//! SimpleFtl split over 4 shards, the 8 dies of the geometry dealt out to them
+class ShardedSimpleFtlTest : public SimpleFtlTest
+{
+protected:
+	const char* GetHardwareConfig() const override
+	{
+		return "Hardwareconfig/hardwareshards.json";
+	}
+};
+
+//! SimpleFtl linked into the test instead of loaded from its DLL
+class StaticSimpleFtlTest : public SimpleFtlTest
+{
+protected:
+	const char* GetFirmware() const override
+	{
+		return "StaticSimpleFtl.dll";
+	}
+};
+
 TEST(SimpleFtl, Translation_LbaToNand)
 {
     constexpr U8 SectorSizeInBit = 9;
@@ -135,8 +178,7 @@ TEST(SimpleFtl, Translation_LbaToNand)
     U32 lba = 0;
     NandHal::NandAddress address;
 
-    SimpleFtlTranslation::SetGeometry(geometry);
-    SimpleFtlTranslation::SetSectorSize(SectorSizeInBit);
+    SimpleFtlTranslation translation(geometry, SectorSizeInBit);
     for (U32 block(0); block < geometry.BlocksPerDevice; ++block)
     {
         for (U32 page(0); page < geometry.PagesPerBlock; ++page)
@@ -145,7 +187,7 @@ TEST(SimpleFtl, Translation_LbaToNand)
             {
                 for (U32 channel(0); channel < geometry.ChannelCount; ++channel)
                 {
-                    SimpleFtlTranslation::LbaToNandAddress(lba, sectorsPerPage, address, nextLba, remainingSector);
+                    translation.LbaToNandAddress(lba, sectorsPerPage, address, nextLba, remainingSector);
                     ASSERT_EQ(address.Channel, channel);
                     ASSERT_EQ(address.Device, device);
                     ASSERT_EQ(address.Page, page);
@@ -171,23 +213,219 @@ TEST(SimpleFtl, Translation_LbaToNand)
 
     expectedAddress.Sector = 1;
     expectedAddress.SectorCount = sectorsPerPage - 2;
-    VerifyLbaToNand(1, sectorsPerPage - 2, expectedAddress, sectorsPerPage - 1, 0);
+    VerifyLbaToNand(translation, 1, sectorsPerPage - 2, expectedAddress, sectorsPerPage - 1, 0);
 
     expectedAddress.Sector = 1;
     expectedAddress.SectorCount = sectorsPerPage - 1;
-    VerifyLbaToNand(1, sectorsPerPage, expectedAddress, sectorsPerPage, 1);
+    VerifyLbaToNand(translation, 1, sectorsPerPage, expectedAddress, sectorsPerPage, 1);
 
     expectedAddress.Sector = 1;
     expectedAddress.SectorCount = sectorsPerPage - 1;
-    VerifyLbaToNand(1, 2 * sectorsPerPage - 2, expectedAddress, sectorsPerPage, sectorsPerPage - 1);
+    VerifyLbaToNand(translation, 1, 2 * sectorsPerPage - 2, expectedAddress, sectorsPerPage, sectorsPerPage - 1);
 
     expectedAddress.Sector = 0;
     expectedAddress.SectorCount = sectorsPerPage - 1;
-    VerifyLbaToNand(0, sectorsPerPage - 1, expectedAddress, sectorsPerPage - 1, 0);
+    VerifyLbaToNand(translation, 0, sectorsPerPage - 1, expectedAddress, sectorsPerPage - 1, 0);
 
     expectedAddress.Sector = 0;
     expectedAddress.SectorCount = sectorsPerPage;
-    VerifyLbaToNand(0, 2 * sectorsPerPage - 1, expectedAddress, sectorsPerPage, sectorsPerPage - 1);
+    VerifyLbaToNand(translation, 0, 2 * sectorsPerPage - 1, expectedAddress, sectorsPerPage, sectorsPerPage - 1);
+}
+
+//! Translation by plain divides, the precomputed one is checked and timed against it
+void DivideLbaToNandAddress(const NandHal::Geometry &geometry, const U32 &sectorsPerPage, const U32 &lba, const U32 &sectorCount,
+    NandHal::NandAddress &nandAddress, U32 &nextLba, U32 &remainSectorCount)
+{
+    U32 pageIndex = lba / sectorsPerPage;
+    nandAddress.Channel._ = pageIndex % geometry.ChannelCount;
+    nandAddress.Device._ = (pageIndex / geometry.ChannelCount) % geometry.DevicesPerChannel;
+    nandAddress.Page._ = ((pageIndex / geometry.ChannelCount) / geometry.DevicesPerChannel) % geometry.PagesPerBlock;
+    nandAddress.Block._ = (((pageIndex / geometry.ChannelCount) / geometry.DevicesPerChannel) / geometry.PagesPerBlock);
+    nandAddress.Sector._ = lba % sectorsPerPage;
+    nandAddress.SectorCount._ = std::min<U32>(sectorCount, sectorsPerPage - nandAddress.Sector._);
+    nextLba = lba + nandAddress.SectorCount._;
+    remainSectorCount = sectorCount - nandAddress.SectorCount._;
+}
+
+TEST(SimpleFtl, Translation_NonPowerOfTwoAndBatch)
+{
+    constexpr U8 SectorSizeInBit = 9;
+    NandHal::Geometry geometry;
+    geometry.ChannelCount = 3;
+    geometry.DevicesPerChannel = 5;
+    geometry.BlocksPerDevice = 7;
+    geometry.PagesPerBlock = 96;
+    geometry.BytesPerPage = 6144;
+    U32 sectorsPerPage = geometry.BytesPerPage >> SectorSizeInBit;
+    SimpleFtlTranslation translation(geometry, SectorSizeInBit);
+
+    // Every LBA of the drive, then LBAs spread over the whole 32 bits
+    std::vector<U32> lbas;
+    U32 totalSector = geometry.ChannelCount * geometry.DevicesPerChannel * geometry.BlocksPerDevice * geometry.PagesPerBlock * sectorsPerPage;
+    for (U32 lba = 0; lba < totalSector; ++lba)
+    {
+        lbas.push_back(lba);
+    }
+    for (std::uint64_t lba = totalSector; lba <= 0xFFFFFFFF; lba += 0x10001)
+    {
+        lbas.push_back(static_cast<U32>(lba));
+    }
+    lbas.push_back(0xFFFFFFFF);
+
+    for (const auto &lba : lbas)
+    {
+        NandHal::NandAddress address;
+        NandHal::NandAddress expectedAddress;
+        U32 nextLba, remainingSector, expectedLba, expectedRemainingSector;
+        translation.LbaToNandAddress(lba, 3 * sectorsPerPage, address, nextLba, remainingSector);
+        DivideLbaToNandAddress(geometry, sectorsPerPage, lba, 3 * sectorsPerPage, expectedAddress, expectedLba, expectedRemainingSector);
+        ASSERT_EQ(expectedAddress.Channel, address.Channel);
+        ASSERT_EQ(expectedAddress.Device, address.Device);
+        ASSERT_EQ(expectedAddress.Block, address.Block);
+        ASSERT_EQ(expectedAddress.Page, address.Page);
+        ASSERT_EQ(expectedAddress.Sector, address.Sector);
+        ASSERT_EQ(expectedAddress.SectorCount, address.SectorCount);
+        ASSERT_EQ(expectedLba, nextLba);
+        ASSERT_EQ(expectedRemainingSector, remainingSector);
+    }
+
+    // A range over several pages matches page by page translation, and stops at maxCount
+    constexpr U32 maxCount = 64;
+    NandHal::NandAddress addresses[maxCount];
+    for (U32 lba = 1; lba < totalSector - maxCount * sectorsPerPage; lba += 997)
+    {
+        U32 sectorCount = 1 + lba % ((maxCount - 1) * sectorsPerPage);
+        U32 nextLba, remainingSector;
+        U32 count = translation.LbaRangeToNandAddresses(lba, sectorCount, addresses, maxCount, nextLba, remainingSector);
+        ASSERT_EQ(lba + sectorCount, nextLba);
+        ASSERT_EQ(0, remainingSector);
+
+        U32 expectedLba = lba;
+        U32 expectedRemainingSector = sectorCount;
+        for (U32 i = 0; i < count; ++i)
+        {
+            NandHal::NandAddress expectedAddress;
+            translation.LbaToNandAddress(expectedLba, expectedRemainingSector, expectedAddress, expectedLba, expectedRemainingSector);
+            ASSERT_EQ(expectedAddress.Channel, addresses[i].Channel);
+            ASSERT_EQ(expectedAddress.Device, addresses[i].Device);
+            ASSERT_EQ(expectedAddress.Block, addresses[i].Block);
+            ASSERT_EQ(expectedAddress.Page, addresses[i].Page);
+            ASSERT_EQ(expectedAddress.Sector, addresses[i].Sector);
+            ASSERT_EQ(expectedAddress.SectorCount, addresses[i].SectorCount);
+        }
+        ASSERT_EQ(0, expectedRemainingSector);
+
+        U32 fullCount = count;
+        count = translation.LbaRangeToNandAddresses(lba, sectorCount, addresses, 2, nextLba, remainingSector);
+        ASSERT_EQ(std::min<U32>(fullCount, 2), count);
+        ASSERT_EQ(sectorCount, nextLba - lba + remainingSector);
+    }
+}
+
+TEST(SimpleFtl, Translation_Benchmark)
+{
+    constexpr U8 SectorSizeInBit = 9;
+    constexpr U32 sectorCount = 1 << 24;
+    using namespace std::chrono;
+
+    NandHal::Geometry powerOfTwoGeometry{ 4, 2, 128, 256, 8192 };
+    NandHal::Geometry otherGeometry{ 3, 5, 128, 192, 8192 };
+    for (const auto &geometry : { powerOfTwoGeometry, otherGeometry })
+    {
+        U32 sectorsPerPage = geometry.BytesPerPage >> SectorSizeInBit;
+        SimpleFtlTranslation translation(geometry, SectorSizeInBit);
+        NandHal::NandAddress address;
+
+        // What the FTL does for a sequential command, one page at a time
+        U32 checksum = 0;
+        auto t0 = high_resolution_clock::now();
+        for (U32 lba = 0, remaining = sectorCount; remaining > 0; )
+        {
+            DivideLbaToNandAddress(geometry, sectorsPerPage, lba, remaining, address, lba, remaining);
+            checksum += address.Channel + address.Device + address.Page + address.Block;
+        }
+        auto t1 = high_resolution_clock::now();
+        for (U32 lba = 0, remaining = sectorCount; remaining > 0; )
+        {
+            translation.LbaToNandAddress(lba, remaining, address, lba, remaining);
+            checksum -= address.Channel + address.Device + address.Page + address.Block;
+        }
+        auto t2 = high_resolution_clock::now();
+        NandHal::NandAddress addresses[64];
+        for (U32 lba = 0, remaining = sectorCount; remaining > 0; )
+        {
+            U32 count = translation.LbaRangeToNandAddresses(lba, remaining, addresses, 64, lba, remaining);
+            for (U32 i = 0; i < count; ++i)
+            {
+                checksum += addresses[i].Channel + addresses[i].Device + addresses[i].Page + addresses[i].Block;
+            }
+        }
+        auto t3 = high_resolution_clock::now();
+        ASSERT_NE(0u, checksum);
+
+        U32 pageCount = sectorCount / sectorsPerPage;
+        GOUT("LbaToNandAddress benchmark, " << (U32)geometry.ChannelCount << "x" << (U32)geometry.DevicesPerChannel << "x" << geometry.PagesPerBlock << " pages");
+        GOUT("   Divides: " << duration_cast<nanoseconds>(t1 - t0).count() / pageCount << "ns per page");
+        GOUT("   Precomputed: " << duration_cast<nanoseconds>(t2 - t1).count() / pageCount << "ns per page");
+        GOUT("   Batch: " << duration_cast<nanoseconds>(t3 - t2).count() / pageCount << "ns per page");
+    }
+}
+
+//! Each producer's nodes come out in the order it pushed them, however the producers interleave
+TEST(SimpleFtl, CompletionQueue_MultipleProducers)
+{
+    constexpr U32 producerCount = 4;
+    constexpr U32 nodesPerProducer = 100000;
+    struct TestNode : CompletionQueue::Node
+    {
+        U32 Producer;
+        U32 Sequence;
+    };
+
+    CompletionQueue queue;
+    ASSERT_TRUE(queue.IsEmpty());
+    std::vector<TestNode> nodes(producerCount * nodesPerProducer);
+    std::vector<std::thread> producers;
+    for (U32 producer = 0; producer < producerCount; ++producer)
+    {
+        producers.emplace_back([&queue, &nodes, producer]()
+        {
+            for (U32 sequence = 0; sequence < nodesPerProducer; ++sequence)
+            {
+                TestNode &node = nodes[producer * nodesPerProducer + sequence];
+                node.Producer = producer;
+                node.Sequence = sequence;
+                queue.Push(&node);
+            }
+        });
+    }
+
+    // Checked once the producers are joined
+    std::vector<U32> nextSequences(producerCount, 0);
+    U32 outOfOrderCount = 0;
+    CompletionQueue::Node *batch[32];
+    for (U32 popped = 0; popped < nodes.size(); )
+    {
+        U32 count = queue.PopBatch(batch, 32);
+        for (U32 i = 0; i < count; ++i)
+        {
+            const TestNode *node = static_cast<const TestNode*>(batch[i]);
+            if (node->Sequence != nextSequences[node->Producer])
+            {
+                ++outOfOrderCount;
+            }
+            nextSequences[node->Producer] = node->Sequence + 1;
+        }
+        popped += count;
+    }
+
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+    ASSERT_EQ(0u, outOfOrderCount);
+    ASSERT_EQ(nullptr, queue.Pop());
+    ASSERT_TRUE(queue.IsEmpty());
 }
 
 TEST(SimpleFtl, BasicWriteReadVerify_App)
@@ -624,4 +862,759 @@ TEST_F(SimpleFtlTest, BasicRepeatedWriteReadVerify)
 
 	CustomProtocolClient->DeallocateMessage(writeMessage);
 	CustomProtocolClient->DeallocateMessage(readMessage);
-}
\ No newline at end of file
+}
+
+TEST_F(SimpleFtlTest, StreamingWriteReadVerify)
+{
+    constexpr U32 lba = 0;
+    constexpr U32 sectorCount = 16 * 1024;
+    constexpr U32 windowCount = 4;
+    constexpr U32 windowSizeInSector = 64;
+    U32 windowSizeInByte = windowSizeInSector * SectorSizeInTransfer;
+    U32 payloadSize = StreamingTransfer::PayloadSize(windowCount, windowSizeInByte);
+
+    ASSERT_EQ(DeviceInfo.TotalSector >= sectorCount, true);
+
+    auto fillSector = [](U8 *sector, const U32 &lba, const U32 &size)
+    {
+        memset(sector, (U8)(lba * 7 + 1), size);
+    };
+
+    // Write through the window ring
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, sectorCount);
+    writeMessage->Data.PayloadMode = CustomProtocolCommand::TransferMode::Streaming;
+    auto header = StreamingTransfer::Init(writeMessage->Payload, windowCount, windowSizeInSector, sectorCount);
+    CustomProtocolClient->Push(writeMessage);
+
+    U32 windowTotal = StreamingTransfer::WindowTotal(header);
+    for (U32 window = 0; window < windowTotal; ++window)
+    {
+        while (!StreamingTransfer::CanProduce(header, window));
+        U8 *data = StreamingTransfer::GetWindow(header, window, windowSizeInByte);
+        for (U32 i = 0; i < StreamingTransfer::WindowSectorCount(header, window); ++i)
+        {
+            fillSector(&data[i * SectorSizeInTransfer], window * windowSizeInSector + i, SectorSizeInTransfer);
+        }
+        header->ProducedWindowCount = window + 1;
+    }
+
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(writeMessage, writeResponse);
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    // Read back through the window ring
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+    SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, lba, sectorCount);
+    readMessage->Data.PayloadMode = CustomProtocolCommand::TransferMode::Streaming;
+    header = StreamingTransfer::Init(readMessage->Payload, windowCount, windowSizeInSector, sectorCount);
+    CustomProtocolClient->Push(readMessage);
+
+    auto expected = std::make_unique<U8[]>(SectorSizeInTransfer);
+    for (U32 window = 0; window < windowTotal; ++window)
+    {
+        while (!StreamingTransfer::CanConsume(header, window));
+        U8 *data = StreamingTransfer::GetWindow(header, window, windowSizeInByte);
+        for (U32 i = 0; i < StreamingTransfer::WindowSectorCount(header, window); ++i)
+        {
+            fillSector(expected.get(), window * windowSizeInSector + i, SectorSizeInTransfer);
+            ASSERT_EQ(0, std::memcmp(expected.get(), &data[i * SectorSizeInTransfer], SectorSizeInTransfer));
+        }
+        header->ConsumedWindowCount = window + 1;
+    }
+
+    while (!CustomProtocolClient->HasResponse());
+    auto readResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(readMessage, readResponse);
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(readResponse);
+}
+
+TEST_F(SimpleFtlTest, ControllerMemoryBufferWriteReadVerify)
+{
+    using namespace boost::interprocess;
+
+    constexpr char* controllerMemoryBufferName = "SsdSimCustomProtocolServerCmb";
+    shared_memory_object cmbShm(open_only, controllerMemoryBufferName, read_write);
+    mapped_region cmbRegion(cmbShm, read_write);
+    U8 *cmb = static_cast<U8*>(cmbRegion.get_address());
+
+    constexpr U32 lba = 100;
+    constexpr U32 sectorCount = 200;
+    U32 dataSize = sectorCount * SectorSizeInTransfer;
+    U32 readOffset = dataSize;
+    ASSERT_EQ(cmbRegion.get_size() >= 2 * dataSize, true);
+
+    // Place the write data in the CMB, the message itself carries no payload
+    for (U32 i = 0; i < sectorCount; ++i)
+    {
+        memset(&cmb[i * SectorSizeInTransfer], (U8)(lba + i), SectorSizeInTransfer);
+    }
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(writeMessage, nullptr);
+    SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, sectorCount);
+    writeMessage->Data.PayloadMode = CustomProtocolCommand::TransferMode::ControllerMemoryBuffer;
+    writeMessage->Data.ControllerMemoryBufferOffset = 0;
+    CustomProtocolClient->Push(writeMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(readMessage, nullptr);
+    SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, lba, sectorCount);
+    readMessage->Data.PayloadMode = CustomProtocolCommand::TransferMode::ControllerMemoryBuffer;
+    readMessage->Data.ControllerMemoryBufferOffset = readOffset;
+    CustomProtocolClient->Push(readMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto readResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+
+    ASSERT_EQ(0, std::memcmp(cmb, &cmb[readOffset], dataSize));
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(readResponse);
+}
+
+TEST_F(SimpleFtlTest, QueuedWriteReadVerify)
+{
+    constexpr U32 commandCount = 8;
+    constexpr U32 sectorCount = 64;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    ASSERT_EQ(DeviceInfo.TotalSector >= commandCount * sectorCount, true);
+
+    CustomProtocolMessage* writeMessages[commandCount];
+    CustomProtocolMessage* readMessages[commandCount];
+    for (U32 i = 0; i < commandCount; ++i)
+    {
+        writeMessages[i] = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+        ASSERT_NE(writeMessages[i], nullptr);
+        SetReadWriteCommand(writeMessages[i]->Data, CustomProtocolCommand::Code::Write, i * sectorCount, sectorCount);
+        memset(writeMessages[i]->Payload, 0x10 + i, payloadSize);
+
+        readMessages[i] = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+        ASSERT_NE(readMessages[i], nullptr);
+        SetReadWriteCommand(readMessages[i]->Data, CustomProtocolCommand::Code::Read, i * sectorCount, sectorCount);
+    }
+
+    // All the commands are in flight together, responses may come back in any order
+    auto executeAll = [this](CustomProtocolMessage** messages)
+    {
+        for (U32 i = 0; i < commandCount; ++i)
+        {
+            CustomProtocolClient->Push(messages[i]);
+        }
+        for (U32 responseCount = 0; responseCount < commandCount; )
+        {
+            if (CustomProtocolClient->HasResponse())
+            {
+                auto response = CustomProtocolClient->PopResponse();
+                ASSERT_EQ(CustomProtocolCommand::Status::Success, response->Data.CommandStatus);
+                ++responseCount;
+            }
+        }
+    };
+    executeAll(writeMessages);
+    executeAll(readMessages);
+
+    for (U32 i = 0; i < commandCount; ++i)
+    {
+        ASSERT_EQ(0, std::memcmp(writeMessages[i]->Payload, readMessages[i]->Payload, payloadSize));
+        CustomProtocolClient->DeallocateMessage(writeMessages[i]);
+        CustomProtocolClient->DeallocateMessage(readMessages[i]);
+    }
+}
+
+//! One sector at a time, backwards, over a few pages. The write cache gathers them so each page is programmed once, whole
+TEST_F(SimpleFtlTest, WriteCacheSubPageWriteFlushReadVerify)
+{
+    constexpr U32 pageCount = 4;
+    U32 sectorCount = pageCount * DeviceInfo.SectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, SectorSizeInTransfer, true);
+    ASSERT_NE(writeMessage, nullptr);
+    std::unique_ptr<U8[]> expected(new U8[payloadSize]);
+    for (U32 lba = sectorCount; lba > 0; )
+    {
+        --lba;
+        memset(writeMessage->Payload, (U8)(0x40 + lba), SectorSizeInTransfer);
+        memset(&expected[lba * SectorSizeInTransfer], (U8)(0x40 + lba), SectorSizeInTransfer);
+        SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, 1);
+        CustomProtocolClient->Push(writeMessage);
+        while (!CustomProtocolClient->HasResponse());
+        auto writeResponse = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+    }
+
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+    auto readVerify = [&]()
+    {
+        memset(readMessage->Payload, 0, payloadSize);
+        SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, 0, sectorCount);
+        CustomProtocolClient->Push(readMessage);
+        while (!CustomProtocolClient->HasResponse());
+        auto readResponse = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+        ASSERT_EQ(0, std::memcmp(expected.get(), readResponse->Payload, payloadSize));
+    };
+
+    // From the cache, then from NAND once flushed
+    readVerify();
+
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+    CustomProtocolClient->Push(flushMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto flushResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, flushResponse->Data.CommandStatus);
+
+    readVerify();
+
+    CustomProtocolClient->DeallocateMessage(writeMessage);
+    CustomProtocolClient->DeallocateMessage(readMessage);
+    CustomProtocolClient->DeallocateMessage(flushResponse);
+}
+
+// Documents SimpleFtl's fixed mapping, a page flushed a second time is programmed in place and reads back as corrupted
+TEST_F(SimpleFtlTest, WriteCacheRepeatedFlushOfPage)
+{
+    U32 sectorCount = DeviceInfo.SectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, SectorSizeInTransfer, true);
+    ASSERT_NE(writeMessage, nullptr);
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+
+    auto writeAndFlush = [&](U32 lba)
+    {
+        memset(writeMessage->Payload, (U8)(0x40 + lba), SectorSizeInTransfer);
+        SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, 1);
+        CustomProtocolClient->Push(writeMessage);
+        while (!CustomProtocolClient->HasResponse());
+        writeMessage = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, writeMessage->Data.CommandStatus);
+
+        flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+        CustomProtocolClient->Push(flushMessage);
+        while (!CustomProtocolClient->HasResponse());
+        flushMessage = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, flushMessage->Data.CommandStatus);
+    };
+    auto readStatus = [&]()
+    {
+        SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, 0, sectorCount);
+        CustomProtocolClient->Push(readMessage);
+        while (!CustomProtocolClient->HasResponse());
+        readMessage = CustomProtocolClient->PopResponse();
+        return readMessage->Data.CommandStatus;
+    };
+
+    // The first flush reads the rest of the blank page and programs it whole
+    writeAndFlush(0);
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, readStatus());
+    ASSERT_EQ((U8)0x40, static_cast<U8*>(readMessage->Payload)[0]);
+
+    // The second one programs the same page again
+    writeAndFlush(1);
+    ASSERT_EQ(CustomProtocolCommand::Status::ReadError, readStatus());
+
+    CustomProtocolClient->DeallocateMessage(writeMessage);
+    CustomProtocolClient->DeallocateMessage(flushMessage);
+    CustomProtocolClient->DeallocateMessage(readMessage);
+}
+
+//! Half of each of the last pages of the drive is held in the write cache while the front of the drive is written a few
+//! sectors at a time, which keeps the cache at its watermarks. Only whole pages are flushed for room, the held ones are
+//! still blank when the host writes the rest of them
+TEST_F(SimpleFtlTest, WriteCacheHoldsPartialPages)
+{
+    U32 sectorsPerPage = DeviceInfo.SectorsPerPage;
+    constexpr U32 heldPageCount = 4;
+    U32 heldLba = DeviceInfo.TotalSector - heldPageCount * sectorsPerPage;
+    constexpr U32 frontPageCount = 32;
+    U32 frontSectorCount = frontPageCount * sectorsPerPage;
+    U32 payloadSize = frontSectorCount * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+
+    auto write = [&](U32 lba, U32 sectorCount)
+    {
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            memset(&static_cast<U8*>(writeMessage->Payload)[i * SectorSizeInTransfer], (U8)(lba + i), SectorSizeInTransfer);
+        }
+        SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, sectorCount);
+        CustomProtocolClient->Push(writeMessage);
+        while (!CustomProtocolClient->HasResponse());
+        writeMessage = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, writeMessage->Data.CommandStatus);
+    };
+    auto readVerify = [&](U32 lba, U32 sectorCount)
+    {
+        SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, lba, sectorCount);
+        CustomProtocolClient->Push(readMessage);
+        while (!CustomProtocolClient->HasResponse());
+        readMessage = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, readMessage->Data.CommandStatus);
+        for (U32 i = 0; i < sectorCount; ++i)
+        {
+            ASSERT_EQ((U8)(lba + i), static_cast<U8*>(readMessage->Payload)[i * SectorSizeInTransfer]);
+        }
+    };
+
+    for (U32 page = 0; page < heldPageCount; ++page)
+    {
+        write(heldLba + page * sectorsPerPage, sectorsPerPage / 2);
+    }
+    for (U32 lba = 0; lba < frontSectorCount; )
+    {
+        U32 sectorCount = std::min<U32>(frontSectorCount - lba, sectorsPerPage / 2 + 1);
+        write(lba, sectorCount);
+        lba += sectorCount;
+    }
+    for (U32 page = 0; page < heldPageCount; ++page)
+    {
+        write(heldLba + page * sectorsPerPage + sectorsPerPage / 2, sectorsPerPage / 2);
+    }
+
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+    CustomProtocolClient->Push(flushMessage);
+    while (!CustomProtocolClient->HasResponse());
+    flushMessage = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, flushMessage->Data.CommandStatus);
+
+    readVerify(0, frontSectorCount);
+    readVerify(heldLba, heldPageCount * sectorsPerPage);
+
+    CustomProtocolClient->DeallocateMessage(writeMessage);
+    CustomProtocolClient->DeallocateMessage(readMessage);
+    CustomProtocolClient->DeallocateMessage(flushMessage);
+}
+
+TEST_F(SimpleFtlTest, ReadCacheHitMissStatistics)
+{
+    U32 sectorCount = DeviceInfo.SectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    memset(writeMessage->Payload, 0x5a, payloadSize);
+    SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, 0, sectorCount);
+    CustomProtocolClient->Push(writeMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+    auto readVerify = [&]()
+    {
+        memset(readMessage->Payload, 0, payloadSize);
+        SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, 0, sectorCount);
+        CustomProtocolClient->Push(readMessage);
+        while (!CustomProtocolClient->HasResponse());
+        auto readResponse = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+        ASSERT_EQ(0, std::memcmp(writeMessage->Payload, readResponse->Payload, payloadSize));
+    };
+    auto getStatistics = [&](StatisticsPayload &statistics)
+    {
+        auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+        ASSERT_NE(message, nullptr);
+        message->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+        CustomProtocolClient->Push(message);
+        while (!CustomProtocolClient->HasResponse());
+        auto response = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, response->Data.CommandStatus);
+        statistics = response->Data.Descriptor.StatisticsPayload;
+        CustomProtocolClient->DeallocateMessage(response);
+    };
+
+    // The first read fills the cache, the others are served from it
+    StatisticsPayload statistics;
+    for (int i = 0; i < 3; ++i)
+    {
+        readVerify();
+    }
+    getStatistics(statistics);
+    ASSERT_EQ(2u, statistics.ReadCacheHits);
+    ASSERT_EQ(1u, statistics.ReadCacheMisses);
+
+    // Turned off, reads go to NAND again
+    auto setReadCacheMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(setReadCacheMessage, nullptr);
+    setReadCacheMessage->Data.Command = CustomProtocolCommand::Code::SetReadCache;
+    setReadCacheMessage->Data.Descriptor.ReadCachePayload.PageCount = 0;
+    CustomProtocolClient->Push(setReadCacheMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto setReadCacheResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, setReadCacheResponse->Data.CommandStatus);
+    ASSERT_EQ(0u, setReadCacheResponse->Data.Descriptor.ReadCachePayload.PageCount);
+
+    readVerify();
+    getStatistics(statistics);
+    ASSERT_EQ(2u, statistics.ReadCacheHits);
+    ASSERT_EQ(2u, statistics.ReadCacheMisses);
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(readMessage);
+    CustomProtocolClient->DeallocateMessage(setReadCacheResponse);
+}
+
+TEST_F(SimpleFtlTest, ReadAheadSequentialReads)
+{
+    constexpr U32 pageCount = 8;
+    U32 sectorsPerPage = DeviceInfo.SectorsPerPage;
+    U32 pageSize = sectorsPerPage * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, pageCount * pageSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    std::unique_ptr<U8[]> expected(new U8[pageCount * pageSize]);
+    for (U32 i = 0; i < pageCount * pageSize; ++i)
+    {
+        expected[i] = (U8)(i / SectorSizeInTransfer);
+    }
+    memcpy(writeMessage->Payload, expected.get(), pageCount * pageSize);
+    SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, 0, pageCount * sectorsPerPage);
+    CustomProtocolClient->Push(writeMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    // A page at a time, the pages after the first reads are read ahead into the cache
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, pageSize, true);
+    ASSERT_NE(readMessage, nullptr);
+    for (U32 page = 0; page < pageCount; ++page)
+    {
+        memset(readMessage->Payload, 0, pageSize);
+        SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, page * sectorsPerPage, sectorsPerPage);
+        CustomProtocolClient->Push(readMessage);
+        while (!CustomProtocolClient->HasResponse());
+        readMessage = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, readMessage->Data.CommandStatus);
+        ASSERT_EQ(0, std::memcmp(&expected[page * pageSize], readMessage->Payload, pageSize));
+    }
+
+    auto statisticsMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(statisticsMessage, nullptr);
+    statisticsMessage->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+    CustomProtocolClient->Push(statisticsMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto statisticsResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, statisticsResponse->Data.CommandStatus);
+    const StatisticsPayload &statistics = statisticsResponse->Data.Descriptor.StatisticsPayload;
+    ASSERT_GT(statistics.ReadAheadPages, 0u);
+    ASSERT_GT(statistics.ReadCacheHits, 0u);
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(readMessage);
+    CustomProtocolClient->DeallocateMessage(statisticsResponse);
+}
+
+//! Ranges out of order and several to a page, the data of each range follows the one before in the payload
+TEST_F(SimpleFtlTest, VectoredWriteReadVerify)
+{
+    constexpr U32 pageCount = 2;
+    U32 sectorsPerPage = DeviceInfo.SectorsPerPage;
+    U32 sectorCount = pageCount * sectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto setRanges = [](CustomProtocolCommand &command, CustomProtocolCommand::Code code, const std::vector<std::pair<U32, U32>> &ranges)
+    {
+        command.Command = code;
+        command.Descriptor.RangeListPayload.RangeCount = (U32)ranges.size();
+        for (U32 i = 0; i < ranges.size(); ++i)
+        {
+            command.Descriptor.RangeListPayload.Ranges[i].Lba = ranges[i].first;
+            command.Descriptor.RangeListPayload.Ranges[i].SectorCount = ranges[i].second;
+        }
+    };
+
+    // Covers both pages, the second one split in three
+    std::vector<std::pair<U32, U32>> writeRanges{ { sectorsPerPage + 5, sectorsPerPage - 5 }, { 0, sectorsPerPage }, { sectorsPerPage, 2 }, { sectorsPerPage + 2, 3 } };
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    std::unique_ptr<U8[]> expected(new U8[payloadSize]);
+    U8 *payload = (U8*)writeMessage->Payload;
+    for (const auto &range : writeRanges)
+    {
+        for (U32 lba = range.first; lba < range.first + range.second; ++lba)
+        {
+            memset(payload, (U8)(0x80 + lba), SectorSizeInTransfer);
+            memset(&expected[lba * SectorSizeInTransfer], (U8)(0x80 + lba), SectorSizeInTransfer);
+            payload += SectorSizeInTransfer;
+        }
+    }
+    setRanges(writeMessage->Data, CustomProtocolCommand::Code::WriteVectored, writeRanges);
+    CustomProtocolClient->Push(writeMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+    CustomProtocolClient->Push(flushMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto flushResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, flushResponse->Data.CommandStatus);
+
+    // Overlapping ranges are each given their own copy of the data
+    std::vector<std::pair<U32, U32>> readRanges{ { sectorsPerPage + 1, 4 }, { 3, sectorsPerPage }, { 1, 2 }, { sectorsPerPage + 3, 1 } };
+    U32 readSectorCount = 0;
+    for (const auto &range : readRanges)
+    {
+        readSectorCount += range.second;
+    }
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, readSectorCount * SectorSizeInTransfer, true);
+    ASSERT_NE(readMessage, nullptr);
+    setRanges(readMessage->Data, CustomProtocolCommand::Code::ReadVectored, readRanges);
+    CustomProtocolClient->Push(readMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto readResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+    payload = (U8*)readResponse->Payload;
+    for (const auto &range : readRanges)
+    {
+        ASSERT_EQ(0, std::memcmp(&expected[range.first * SectorSizeInTransfer], payload, range.second * SectorSizeInTransfer));
+        payload += range.second * SectorSizeInTransfer;
+    }
+
+    // One range past the end fails the whole command
+    setRanges(readResponse->Data, CustomProtocolCommand::Code::ReadVectored, { { 0, 1 }, { DeviceInfo.TotalSector, 1 } });
+    CustomProtocolClient->Push(readResponse);
+    while (!CustomProtocolClient->HasResponse());
+    readResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Failed, readResponse->Data.CommandStatus);
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(flushResponse);
+    CustomProtocolClient->DeallocateMessage(readResponse);
+}
+
+//! The data is checked in the drive, only the status and the offset of the first difference come back
+TEST_F(SimpleFtlTest, CompareAndVerify)
+{
+    constexpr U32 pageCount = 2;
+    constexpr std::uint32_t pattern = 0x5aa55aa5;
+    U32 sectorCount = pageCount * DeviceInfo.SectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(writeMessage, nullptr);
+    for (U32 offset = 0; offset < payloadSize; offset += sizeof(pattern))
+    {
+        std::memcpy((U8*)writeMessage->Payload + offset, &pattern, sizeof(pattern));
+    }
+    writeMessage->Data.Command = CustomProtocolCommand::Code::Write;
+    writeMessage->Data.Descriptor.SimpleFtlPayload.Lba = 0;
+    writeMessage->Data.Descriptor.SimpleFtlPayload.SectorCount = sectorCount;
+    CustomProtocolClient->Push(writeMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto writeResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+    CustomProtocolClient->Push(flushMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto flushResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, flushResponse->Data.CommandStatus);
+
+    // Against the pattern, no data is transferred
+    auto compareMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(compareMessage, nullptr);
+    compareMessage->Data.Command = CustomProtocolCommand::Code::Compare;
+    compareMessage->Data.Descriptor.ComparePayload = ComparePayload{ 0, sectorCount, ComparePayload::Expected::Pattern, pattern, 0 };
+    CustomProtocolClient->Push(compareMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto compareResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, compareResponse->Data.CommandStatus);
+    ASSERT_EQ(ComparePayload::NoMismatch, compareResponse->Data.Descriptor.ComparePayload.MismatchOffset);
+
+    // Against the payload, the earliest of two differences is reported
+    U32 mismatchOffset = payloadSize / 2 + 3;
+    std::memcpy(compareResponse->Payload, writeResponse->Payload, payloadSize);
+    ((U8*)compareResponse->Payload)[mismatchOffset] ^= 0x01;
+    ((U8*)compareResponse->Payload)[payloadSize - 1] ^= 0x01;
+    compareResponse->Data.Descriptor.ComparePayload = ComparePayload{ 0, sectorCount, ComparePayload::Expected::Payload, 0, 0 };
+    CustomProtocolClient->Push(compareResponse);
+    while (!CustomProtocolClient->HasResponse());
+    compareResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Miscompare, compareResponse->Data.CommandStatus);
+    ASSERT_EQ(mismatchOffset, compareResponse->Data.Descriptor.ComparePayload.MismatchOffset);
+
+    compareResponse->Data.Command = CustomProtocolCommand::Code::Verify;
+    compareResponse->Data.Descriptor.SimpleFtlPayload.Lba = 0;
+    compareResponse->Data.Descriptor.SimpleFtlPayload.SectorCount = sectorCount;
+    CustomProtocolClient->Push(compareResponse);
+    while (!CustomProtocolClient->HasResponse());
+    compareResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, compareResponse->Data.CommandStatus);
+
+    compareResponse->Data.Descriptor.SimpleFtlPayload.Lba = DeviceInfo.TotalSector - 1;
+    compareResponse->Data.Descriptor.SimpleFtlPayload.SectorCount = 2;
+    CustomProtocolClient->Push(compareResponse);
+    while (!CustomProtocolClient->HasResponse());
+    compareResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Failed, compareResponse->Data.CommandStatus);
+
+    CustomProtocolClient->DeallocateMessage(writeResponse);
+    CustomProtocolClient->DeallocateMessage(flushResponse);
+    CustomProtocolClient->DeallocateMessage(compareResponse);
+}
+
+
+//! Every command spans the dies of several shards, the pieces are put back together in the one response
+TEST_F(ShardedSimpleFtlTest, QueuedWriteReadVerify)
+{
+    constexpr U32 commandCount = 8;
+    U32 sectorCount = 5 * DeviceInfo.SectorsPerPage;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    ASSERT_EQ(DeviceInfo.TotalSector >= commandCount * sectorCount, true);
+
+    CustomProtocolMessage* writeMessages[commandCount];
+    CustomProtocolMessage* readMessages[commandCount];
+    for (U32 i = 0; i < commandCount; ++i)
+    {
+        writeMessages[i] = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+        ASSERT_NE(writeMessages[i], nullptr);
+        SetReadWriteCommand(writeMessages[i]->Data, CustomProtocolCommand::Code::Write, i * sectorCount, sectorCount);
+        for (U32 offset = 0; offset < payloadSize; ++offset)
+        {
+            ((U8*)writeMessages[i]->Payload)[offset] = (U8)(i * 31 + offset / SectorSizeInTransfer);
+        }
+
+        readMessages[i] = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+        ASSERT_NE(readMessages[i], nullptr);
+        SetReadWriteCommand(readMessages[i]->Data, CustomProtocolCommand::Code::Read, i * sectorCount, sectorCount);
+    }
+
+    auto executeAll = [this](CustomProtocolMessage** messages)
+    {
+        for (U32 i = 0; i < commandCount; ++i)
+        {
+            CustomProtocolClient->Push(messages[i]);
+        }
+        for (U32 responseCount = 0; responseCount < commandCount; )
+        {
+            if (CustomProtocolClient->HasResponse())
+            {
+                auto response = CustomProtocolClient->PopResponse();
+                ASSERT_EQ(CustomProtocolCommand::Status::Success, response->Data.CommandStatus);
+                ++responseCount;
+            }
+        }
+    };
+    executeAll(writeMessages);
+    executeAll(readMessages);
+
+    for (U32 i = 0; i < commandCount; ++i)
+    {
+        ASSERT_EQ(0, std::memcmp(writeMessages[i]->Payload, readMessages[i]->Payload, payloadSize));
+        CustomProtocolClient->DeallocateMessage(writeMessages[i]);
+        CustomProtocolClient->DeallocateMessage(readMessages[i]);
+    }
+
+    // The shards' counters add up to what the host wrote
+    auto statisticsMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(statisticsMessage, nullptr);
+    statisticsMessage->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+    CustomProtocolClient->Push(statisticsMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto statisticsResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, statisticsResponse->Data.CommandStatus);
+    ASSERT_EQ(commandCount * sectorCount, statisticsResponse->Data.Descriptor.StatisticsPayload.HostSectorsWritten);
+    CustomProtocolClient->DeallocateMessage(statisticsResponse);
+}
+
+//! The globals of a statically linked SimpleFtl outlive the framework, once swapped back in the write cache holds sub-page writes again
+TEST_F(StaticSimpleFtlTest, WriteCacheAfterSwap)
+{
+    U32 sectorCount = DeviceInfo.SectorsPerPage / 2;
+    U32 payloadSize = sectorCount * SectorSizeInTransfer;
+
+    auto write = [&](const U32 &lba)
+    {
+        auto writeMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+        ASSERT_NE(writeMessage, nullptr);
+        memset(writeMessage->Payload, (U8)(0x40 + lba), payloadSize);
+        SetReadWriteCommand(writeMessage->Data, CustomProtocolCommand::Code::Write, lba, sectorCount);
+        CustomProtocolClient->Push(writeMessage);
+        while (!CustomProtocolClient->HasResponse());
+        auto writeResponse = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, writeResponse->Data.CommandStatus);
+        CustomProtocolClient->DeallocateMessage(writeResponse);
+    };
+
+    auto getStatistics = [&](StatisticsPayload &statistics)
+    {
+        auto message = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+        ASSERT_NE(message, nullptr);
+        message->Data.Command = CustomProtocolCommand::Code::GetStatistics;
+        CustomProtocolClient->Push(message);
+        while (!CustomProtocolClient->HasResponse());
+        auto response = CustomProtocolClient->PopResponse();
+        ASSERT_EQ(CustomProtocolCommand::Status::Success, response->Data.CommandStatus);
+        statistics = response->Data.Descriptor.StatisticsPayload;
+        CustomProtocolClient->DeallocateMessage(response);
+    };
+
+    // Left in the cache, the exit has the firmware flush everything
+    write(0);
+    Restart();
+
+    // Time for a flush to complete if the write wasn't kept
+    constexpr U32 lba = 64;
+    write(lba);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    StatisticsPayload statistics;
+    getStatistics(statistics);
+    ASSERT_EQ(sectorCount, statistics.HostSectorsWritten);
+    ASSERT_EQ(0u, statistics.NandSectorsWritten);
+
+    auto flushMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, 0, true);
+    ASSERT_NE(flushMessage, nullptr);
+    flushMessage->Data.Command = CustomProtocolCommand::Code::Flush;
+    CustomProtocolClient->Push(flushMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto flushResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, flushResponse->Data.CommandStatus);
+    CustomProtocolClient->DeallocateMessage(flushResponse);
+
+    getStatistics(statistics);
+    ASSERT_GT(statistics.NandSectorsWritten, 0u);
+
+    auto readMessage = AllocateMessage<CustomProtocolCommand>(CustomProtocolClient, payloadSize, true);
+    ASSERT_NE(readMessage, nullptr);
+    SetReadWriteCommand(readMessage->Data, CustomProtocolCommand::Code::Read, lba, sectorCount);
+    CustomProtocolClient->Push(readMessage);
+    while (!CustomProtocolClient->HasResponse());
+    auto readResponse = CustomProtocolClient->PopResponse();
+    ASSERT_EQ(CustomProtocolCommand::Status::Success, readResponse->Data.CommandStatus);
+    for (U32 i = 0; i < payloadSize; ++i)
+    {
+        ASSERT_EQ((U8)(0x40 + lba), static_cast<U8*>(readResponse->Payload)[i]);
+    }
+    CustomProtocolClient->DeallocateMessage(readResponse);
+}